@@ -0,0 +1,797 @@
+#include "Image.h"
+#include "AsyncImageIO.h"
+#include "Atlas.h"
+#include "CaptureWriter.h"
+#include "ColorLUT.h"
+#include "ImageExpr.h"
+#include "IntegralImage.h"
+#include "Palette.h"
+#include "Rasterizer.h"
+#include "SIMDLevel.h"
+#include "Timer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+/* IMAGE BENCHMARK SOURCE FILE
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Micro and macro benchmarks for the Image library, meant to catch performance
+regressions. Every case runs some warmup iterations and then a number of
+timed repetitions, and reports the best, median and mean times together with
+the throughput in MB/s and the cost in ns per pixel.
+
+The output can be a readable table (default), CSV or JSON lines, so that the
+results can be stored and compared between versions:
+
+	benchmark [--format text|csv|json] [--reps N] [--warmup N] [--filter text] [--dir path] [--quick]
+
+On Linux it can be built with a single g++ command, check the README.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+#define MAX_BENCH_REPS_ 1000u // Maximum number of timed repetitions per case
+
+/*
+-------------------------------------------------------------------------------------------------------
+Benchmark settings and reporting
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Output formats for the results
+
+enum OutputFormat
+{
+    FORMAT_TEXT,
+    FORMAT_CSV,
+    FORMAT_JSON,
+};
+
+// Settings read from the command line
+
+struct Settings
+{
+    OutputFormat format = FORMAT_TEXT;
+    unsigned reps = 10u;
+    unsigned warmup = 2u;
+    const char* filter = nullptr;
+    const char* dir = ".";
+    bool quick = false;
+};
+
+static Settings settings;
+
+// Sink to stop the compiler from removing the measured work
+
+static volatile unsigned long long sink = 0ull;
+
+static void consume(unsigned long long value)
+{
+    sink = sink + value;
+}
+
+// Sorts the times for the median, the arrays are tiny
+
+static void sort_times(unsigned long long* times, unsigned n)
+{
+    for (unsigned i = 1; i < n; i++)
+    {
+        unsigned long long t = times[i];
+        unsigned j = i;
+        while (j && times[j - 1] > t)
+        {
+            times[j] = times[j - 1];
+            j--;
+        }
+        times[j] = t;
+    }
+}
+
+// Prints the header of the results in the selected format
+
+static void print_header()
+{
+    switch (settings.format)
+    {
+    case FORMAT_TEXT:
+        printf("SIMD level: %s (supported %s)\n\n", simd_level_name(simd_level()), simd_level_name(simd_supported_level()));
+        printf("%-40s %10s %12s %12s %12s %10s %10s\n", "case", "pixels", "best(us)", "median(us)", "mean(us)", "MB/s", "ns/pixel");
+        break;
+    case FORMAT_CSV:
+        printf("case,width,height,reps,best_ns,median_ns,mean_ns,mb_per_s,ns_per_pixel\n");
+        break;
+    case FORMAT_JSON:
+        break;
+    }
+}
+
+// Runs the warmup and the timed repetitions of a case and prints its results.
+// Bytes is the amount of memory or file data processed by one iteration.
+
+template<typename Body>
+static void run_case(const char* name, unsigned width, unsigned height, unsigned long long bytes, const Body& body)
+{
+    if (settings.filter && !strstr(name, settings.filter))
+        return;
+
+    for (unsigned i = 0; i < settings.warmup; i++)
+        body();
+
+    unsigned long long times[MAX_BENCH_REPS_];
+    unsigned long long total = 0ull;
+    for (unsigned i = 0; i < settings.reps; i++)
+    {
+        const unsigned long long start = Timer::get_system_time_ns();
+        body();
+        times[i] = Timer::get_system_time_ns() - start;
+        total += times[i];
+    }
+    sort_times(times, settings.reps);
+
+    const unsigned long long pixels = (unsigned long long)width * height;
+    const double best = (double)times[0];
+    const double median = (double)times[settings.reps / 2u];
+    const double mean = (double)total / settings.reps;
+    const double mb_per_s = median > 0.0 ? (double)bytes / (1024.0 * 1024.0) / (median * 1e-9) : 0.0;
+    const double ns_per_pixel = pixels ? median / (double)pixels : 0.0;
+
+    switch (settings.format)
+    {
+    case FORMAT_TEXT:
+        printf("%-40s %10llu %12.1f %12.1f %12.1f %10.1f %10.3f\n", name, pixels, best * 1e-3, median * 1e-3, mean * 1e-3, mb_per_s, ns_per_pixel);
+        break;
+    case FORMAT_CSV:
+        printf("%s,%u,%u,%u,%.0f,%.0f,%.0f,%.3f,%.5f\n", name, width, height, settings.reps, best, median, mean, mb_per_s, ns_per_pixel);
+        break;
+    case FORMAT_JSON:
+        printf("{\"case\":\"%s\",\"width\":%u,\"height\":%u,\"reps\":%u,\"best_ns\":%.0f,\"median_ns\":%.0f,\"mean_ns\":%.0f,\"mb_per_s\":%.3f,\"ns_per_pixel\":%.5f}\n",
+            name, width, height, settings.reps, best, median, mean, mb_per_s, ns_per_pixel);
+        break;
+    }
+    fflush(stdout);
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Test data helpers
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Fills the image with a deterministic pattern
+
+static void fill_pattern(Image& image)
+{
+    Color* pixels = image.pixels();
+    const unsigned long long size = (unsigned long long)image.width() * image.height();
+
+    unsigned state = 0x12345678u;
+    for (unsigned long long i = 0; i < size; i++)
+    {
+        state = state * 1664525u + 1013904223u;
+        pixels[i] = Color((unsigned char)(state >> 24), (unsigned char)(state >> 16), (unsigned char)(state >> 8), (unsigned char)state);
+    }
+}
+
+// Writes the image as a BMP with the specified bit depth and row order, since
+// Image::save() only writes 32-bit bottom-up files. Returns the file size.
+
+static unsigned long long write_bmp(const Image& image, const char* path, unsigned bpp, bool top_down)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return 0ull;
+
+    const unsigned w = image.width(), h = image.height();
+    const unsigned bytes_pp = bpp / 8u;
+    const unsigned stride = ((w * bytes_pp + 3u) / 4u) * 4u;
+    const unsigned data_size = stride * h;
+    const int height = top_down ? -(int)h : (int)h;
+
+    unsigned char header[54] = { 'B', 'M' };
+    auto put32 = [&](unsigned offset, unsigned value)
+    {
+        header[offset + 0] = (unsigned char)value;
+        header[offset + 1] = (unsigned char)(value >> 8);
+        header[offset + 2] = (unsigned char)(value >> 16);
+        header[offset + 3] = (unsigned char)(value >> 24);
+    };
+    put32(2, 54u + data_size);
+    put32(10, 54u);
+    put32(14, 40u);
+    put32(18, w);
+    put32(22, (unsigned)height);
+    header[26] = 1;
+    header[28] = (unsigned char)bpp;
+    put32(34, data_size);
+    fwrite(header, 1, 54, file);
+
+    unsigned char* row = (unsigned char*)calloc(stride, 1);
+    for (unsigned y = 0; y < h; y++)
+    {
+        const unsigned src_y = top_down ? y : h - 1u - y;
+        unsigned char* out = row;
+        for (unsigned x = 0; x < w; x++)
+        {
+            const Color& c = image(src_y, x);
+            *out++ = c.B;
+            *out++ = c.G;
+            *out++ = c.R;
+            if (bpp == 32u)
+                *out++ = c.A;
+        }
+        fwrite(row, 1, stride, file);
+    }
+    free(row);
+    fclose(file);
+
+    return 54ull + data_size;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Benchmark cases
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Image sizes used by the size dependent cases
+
+static const unsigned sizes[][2] = { { 256u, 256u }, { 1024u, 1024u }, { 3840u, 2160u } };
+
+// Number of sizes used, quick mode skips the largest
+
+static unsigned n_sizes()
+{
+    return settings.quick ? 2u : 3u;
+}
+
+// Load and save throughput for every supported layout
+
+static void bench_file_io()
+{
+    char name[128], path[512];
+
+    for (unsigned s = 0; s < n_sizes(); s++)
+    {
+        const unsigned w = sizes[s][0], h = sizes[s][1];
+
+        Image source(w, h);
+        fill_pattern(source);
+
+        for (unsigned bpp = 24u; bpp <= 32u; bpp += 8u)
+            for (unsigned td = 0; td < 2u; td++)
+            {
+                snprintf(path, sizeof(path), "%s/bench_%ux%u_%u_%s.bmp", settings.dir, w, h, bpp, td ? "td" : "bu");
+                const unsigned long long file_size = write_bmp(source, path, bpp, td != 0);
+                if (!file_size)
+                {
+                    fprintf(stderr, "Could not write %s\n", path);
+                    continue;
+                }
+
+                snprintf(name, sizeof(name), "load/%u/%s/%ux%u", bpp, td ? "top-down" : "bottom-up", w, h);
+                Image image;
+                run_case(name, w, h, file_size, [&]() { consume(image.load("%s", path)); });
+
+                remove(path);
+            }
+
+        // Indexed files, expanded through the palette
+        for (unsigned bpp = 4u; bpp <= 8u; bpp += 4u)
+        {
+            snprintf(path, sizeof(path), "%s/bench_%ux%u_%u.bmp", settings.dir, w, h, bpp);
+            if (!source.save_palettized(bpp, PALETTE_DITHER_NONE, "%s", path))
+            {
+                fprintf(stderr, "Could not write %s\n", path);
+                continue;
+            }
+
+            const unsigned long long stride = ((w * bpp + 31ull) / 32ull) * 4ull;
+            const unsigned long long file_size = 54ull + (4ull << bpp) + stride * h;
+
+            snprintf(name, sizeof(name), "load/%u/bottom-up/%ux%u", bpp, w, h);
+            Image image;
+            run_case(name, w, h, file_size, [&]() { consume(image.load("%s", path)); });
+
+            remove(path);
+        }
+
+        // Thumbnails averaged while the rows are read, against the full load above
+        snprintf(path, sizeof(path), "%s/bench_%ux%u_thumb.bmp", settings.dir, w, h);
+        if (source.save("%s", path))
+        {
+            Image image;
+            for (unsigned factor = 2u; factor <= 8u; factor *= 2u)
+            {
+                snprintf(name, sizeof(name), "load-scaled/1:%u/%ux%u", factor, w, h);
+                run_case(name, w, h, 54ull + 4ull * w * h, [&]() { consume(image.load_scaled(factor, "%s", path)); });
+            }
+
+            snprintf(name, sizeof(name), "load-thumbnail/160x160/%ux%u", w, h);
+            run_case(name, w, h, 54ull + 4ull * w * h, [&]() { consume(image.load_thumbnail(160u, 160u, "%s", path)); });
+            remove(path);
+        }
+
+        snprintf(path, sizeof(path), "%s/bench_%ux%u_save.bmp", settings.dir, w, h);
+        snprintf(name, sizeof(name), "save/32/bottom-up/%ux%u", w, h);
+        run_case(name, w, h, 54ull + 4ull * w * h, [&]() { consume(source.save("%s", path)); });
+
+        // Cost for the render thread of handing frames to a capture writer, dropping them when full
+        {
+            CaptureWriter writer(DEFAULT_CAPTURE_SLOTS_, CAPTURE_OVERFLOW_DROP);
+            Image frame = source;
+
+            snprintf(name, sizeof(name), "capture/exchange/%ux%u", w, h);
+            run_case(name, w, h, 4ull * w * h, [&]()
+                {
+                    if (frame.width() != w || frame.height() != h)
+                        frame = source;
+                    consume(writer.exchange(frame, "%s", path));
+                });
+        }
+        remove(path);
+
+        // Many files loaded one after the other against the read and decode pipeline
+        {
+            const unsigned files = 16u;
+            char paths[files][512];
+            const char* list[files];
+            Image images[files];
+            unsigned long long bytes = 0ull;
+
+            for (unsigned f = 0; f < files; f++)
+            {
+                snprintf(paths[f], sizeof(paths[f]), "%s/bench_%ux%u_batch_%u.bmp", settings.dir, w, h, f);
+                list[f] = paths[f];
+                bytes += write_bmp(source, paths[f], 24u, false);
+            }
+
+            snprintf(name, sizeof(name), "load-batch/serial/%ux%ux%u", files, w, h);
+            run_case(name, w, h * files, bytes, [&]()
+                {
+                    for (unsigned f = 0; f < files; f++)
+                        consume(images[f].load("%s", list[f]));
+                });
+
+            snprintf(name, sizeof(name), "load-batch/pipeline/%ux%ux%u", files, w, h);
+            run_case(name, w, h * files, bytes, [&]() { consume(Image::load_batch(images, list, files)); });
+
+            // Same files with every read in flight at once from this thread, decoded from memory
+            AsyncImageIO io(files);
+            const char* backend = io.backend() == ASYNC_IO_URING ? "uring" : "stdio";
+
+            snprintf(name, sizeof(name), "load-batch/async-%s/%ux%ux%u", backend, files, w, h);
+            run_case(name, w, h * files, bytes, [&]()
+                {
+                    for (unsigned f = 0; f < files; f++)
+                        io.load(images[f], "%s", list[f]);
+                    consume(io.wait_all());
+                });
+
+            // 32-bit files, written from and read straight into the pixels by the ring
+            const unsigned long long bytes_32 = files * (54ull + 4ull * w * h);
+
+            snprintf(name, sizeof(name), "save-batch/serial/%ux%ux%u", files, w, h);
+            run_case(name, w, h * files, bytes_32, [&]()
+                {
+                    for (unsigned f = 0; f < files; f++)
+                        consume(source.save("%s", list[f]));
+                });
+
+            snprintf(name, sizeof(name), "save-batch/async-%s/%ux%ux%u", backend, files, w, h);
+            run_case(name, w, h * files, bytes_32, [&]()
+                {
+                    for (unsigned f = 0; f < files; f++)
+                        io.save(source, "%s", list[f]);
+                    consume(io.wait_all());
+                });
+
+            snprintf(name, sizeof(name), "load-batch/async-%s/32/%ux%ux%u", backend, files, w, h);
+            run_case(name, w, h * files, bytes_32, [&]()
+                {
+                    for (unsigned f = 0; f < files; f++)
+                        io.load(images[f], "%s", list[f]);
+                    consume(io.wait_all());
+                });
+
+            for (unsigned f = 0; f < files; f++)
+                remove(paths[f]);
+        }
+    }
+}
+
+// Throughput of the Color operators over large arrays
+
+static void bench_color_ops()
+{
+    const unsigned w = 1024u, h = 1024u;
+    const unsigned n = w * h;
+
+    Image a(w, h), b(w, h), out(w, h);
+    fill_pattern(a);
+    fill_pattern(b);
+    b.pixels()[0] = Color::White;
+
+    const Color* pa = a.pixels();
+    const Color* pb = b.pixels();
+    Color* po = out.pixels();
+    const unsigned long long bytes = 3ull * n * sizeof(Color);
+
+    run_case("color/add", w, h, bytes, [&]() { for (unsigned i = 0; i < n; i++) po[i] = pa[i] + pb[i]; consume(po[n - 1].R); });
+    run_case("color/sub", w, h, bytes, [&]() { for (unsigned i = 0; i < n; i++) po[i] = pa[i] - pb[i]; consume(po[n - 1].R); });
+    run_case("color/mul", w, h, bytes, [&]() { for (unsigned i = 0; i < n; i++) po[i] = pa[i] * pb[i]; consume(po[n - 1].R); });
+    run_case("color/div", w, h, bytes, [&]() { for (unsigned i = 0; i < n; i++) po[i] = pa[i] / pb[i]; consume(po[n - 1].R); });
+    run_case("color/mul-float", w, h, 2ull * n * sizeof(Color), [&]() { for (unsigned i = 0; i < n; i++) po[i] = pa[i] * 0.75f; consume(po[n - 1].R); });
+    run_case("color/div-int", w, h, 2ull * n * sizeof(Color), [&]() { for (unsigned i = 0; i < n; i++) po[i] = pa[i] / 3; consume(po[n - 1].R); });
+    run_case("color/invert", w, h, 2ull * n * sizeof(Color), [&]() { for (unsigned i = 0; i < n; i++) po[i] = -pa[i]; consume(po[n - 1].R); });
+    run_case("color/compare", w, h, 2ull * n * sizeof(Color), [&]() { unsigned c = 0; for (unsigned i = 0; i < n; i++) c += pa[i] == pb[i]; consume(c); });
+
+    // Whole-image expression, as a loop per operation with temporaries and fused
+    Image t0(w, h), t1(w, h);
+    Color* p0 = t0.pixels();
+    Color* p1 = t1.pixels();
+    run_case("color/expr-chained", w, h, bytes, [&]()
+        {
+            for (unsigned i = 0; i < n; i++) p0[i] = pa[i] * 0.75f;
+            for (unsigned i = 0; i < n; i++) p1[i] = pa[i] * pb[i];
+            for (unsigned i = 0; i < n; i++) p0[i] = p0[i] + p1[i];
+            for (unsigned i = 0; i < n; i++) po[i] = p0[i] - Color::Gray;
+            consume(po[n - 1].R);
+        });
+    run_case("color/expr-fused", w, h, bytes, [&]() { out = a * 0.75f + a * b - Color::Gray; consume(out.pixels()[n - 1].R); });
+}
+
+// Cost of constructing and copying images
+
+static void bench_construct_copy()
+{
+    char name[128];
+    PoolAllocator pool;
+
+    for (unsigned s = 0; s < n_sizes(); s++)
+    {
+        const unsigned w = sizes[s][0], h = sizes[s][1];
+        const unsigned long long bytes = 4ull * w * h;
+
+        Image source(w, h);
+        fill_pattern(source);
+        Image target(w, h);
+
+        snprintf(name, sizeof(name), "construct/transparent/%ux%u", w, h);
+        run_case(name, w, h, bytes, [&]() { Image image(w, h); consume(image.pixels()[0].A); });
+
+        snprintf(name, sizeof(name), "construct/color/%ux%u", w, h);
+        run_case(name, w, h, bytes, [&]() { Image image(w, h, Color::Orange); consume(image.pixels()[0].A); });
+
+        snprintf(name, sizeof(name), "construct/pool/%ux%u", w, h);
+        run_case(name, w, h, bytes, [&]() { Image image(w, h, Color::Orange, &pool); consume(image.pixels()[0].A); });
+
+        snprintf(name, sizeof(name), "fill/image/%ux%u", w, h);
+        run_case(name, w, h, bytes, [&]() { target.fill(Color::Orange); consume(target.pixels()[0].A); });
+
+        snprintf(name, sizeof(name), "fill/clear/%ux%u", w, h);
+        run_case(name, w, h, bytes, [&]() { target.clear(); consume(target.pixels()[0].A); });
+
+        snprintf(name, sizeof(name), "fill/rect-half/%ux%u", w, h);
+        run_case(name, w, h, bytes / 4ull, [&]() { target.fill_rect(h / 4u, w / 4u, h / 2u, w / 2u, Color::Cyan); consume(target.pixels()[0].A); });
+
+        snprintf(name, sizeof(name), "copy/construct/%ux%u", w, h);
+        run_case(name, w, h, 2ull * bytes, [&]() { Image image(source); consume(image.pixels()[0].A); });
+
+        snprintf(name, sizeof(name), "copy/assign/%ux%u", w, h);
+        run_case(name, w, h, 2ull * bytes, [&]() { target = source; consume(target.pixels()[0].A); });
+
+        source.set_copy_on_write(true);
+        snprintf(name, sizeof(name), "copy/cow-share/%ux%u", w, h);
+        run_case(name, w, h, 0ull, [&]() { Image image(source); consume(image.width()); });
+
+        snprintf(name, sizeof(name), "copy/cow-detach/%ux%u", w, h);
+        run_case(name, w, h, 2ull * bytes, [&]() { Image image(source); consume(image(0, 0).A); });
+        source.set_copy_on_write(false);
+    }
+}
+
+// Pixel format conversions, both directions
+
+static void bench_pixel_formats()
+{
+    static const char* names[] = { "bgra8", "rgba8", "bgr8", "rgb8", "gray8", "r8", "rgb565" };
+
+    char name[128];
+    const unsigned w = 1024u, h = 1024u;
+
+    Image source(w, h);
+    fill_pattern(source);
+    Image target(w, h);
+    unsigned char* buffer = (unsigned char*)malloc(4ull * w * h);
+
+    for (unsigned f = 0; f < sizeof(names) / sizeof(names[0]); f++)
+    {
+        const PixelFormat format = (PixelFormat)f;
+        const unsigned long long bytes = (4ull + pixel_format_size(format)) * w * h;
+
+        snprintf(name, sizeof(name), "format/export-%s", names[f]);
+        run_case(name, w, h, bytes, [&]() { consume(source.export_pixels(buffer, format)); });
+
+        snprintf(name, sizeof(name), "format/import-%s", names[f]);
+        run_case(name, w, h, bytes, [&]() { consume(target.import_pixels(buffer, w, h, format)); });
+    }
+
+    // Incremental export of a 256x256 dirty rectangle, against the full export above
+    source.set_dirty_tracking(true);
+    source.clear_dirty();
+    source.mark_dirty(384u, 384u, 256u, 256u);
+    run_case("dirty/export-256x256-of-1024x1024", w, h, 8ull * 256u * 256u, [&]() { consume(source.export_dirty(buffer, PIXEL_FORMAT_BGRA8)); });
+
+    free(buffer);
+
+    // YUV frames for video, BT.709 limited range
+    static const char* layouts[] = { "i420", "nv12", "yuy2" };
+    static const unsigned frames[][2] = { { 1920u, 1080u }, { 3840u, 2160u } };
+
+    for (unsigned s = 0; s < 2u; s++)
+    {
+        const unsigned fw = frames[s][0], fh = frames[s][1];
+        Image frame(fw, fh);
+        fill_pattern(frame);
+        Image decoded;
+        unsigned char* planes = (unsigned char*)malloc(yuv_frame_size(YUV_LAYOUT_YUY2, fw, fh));
+
+        for (unsigned l = 0; l < 3u; l++)
+        {
+            YUVFrame yuv;
+            yuv_frame_wrap(&yuv, planes, (YUVLayout)l, fw, fh);
+            const unsigned long long bytes = 4ull * fw * fh + yuv_frame_size((YUVLayout)l, fw, fh);
+
+            snprintf(name, sizeof(name), "yuv/export-%s/%ux%u", layouts[l], fw, fh);
+            run_case(name, fw, fh, bytes, [&]() { consume(frame.export_yuv(yuv)); });
+
+            snprintf(name, sizeof(name), "yuv/import-%s/%ux%u", layouts[l], fw, fh);
+            run_case(name, fw, fh, bytes, [&]() { consume(decoded.import_yuv(yuv)); });
+        }
+
+        free(planes);
+    }
+}
+
+// Image kernels
+
+static void bench_kernels()
+{
+    // Atlas packing of many small sprites
+    const unsigned n_sprites = 1024u;
+    Image* sprites = new Image[n_sprites];
+    const Image* list[n_sprites];
+    unsigned long long sprite_bytes = 0ull;
+
+    for (unsigned i = 0; i < n_sprites; i++)
+    {
+        sprites[i] = Image(8u + (i * 7u) % 57u, 8u + (i * 13u) % 41u, Color::Cyan);
+        sprite_bytes += 4ull * sprites[i].width() * sprites[i].height();
+        list[i] = &sprites[i];
+    }
+
+    Atlas atlas;
+    run_case("atlas/pack-1024", 0u, 0u, sprite_bytes, [&]() { consume(atlas.pack(list, n_sprites, 1u, true)); });
+
+    delete[] sprites;
+
+    // Rasterization of a 128x128 quad grid covering the target, with depth
+    const unsigned grid = 128u;
+    RasterVertex* vertices = new RasterVertex[(grid + 1u) * (grid + 1u)];
+    unsigned* indices = new unsigned[6u * grid * grid];
+
+    for (unsigned j = 0; j <= grid; j++)
+        for (unsigned i = 0; i <= grid; i++)
+        {
+            RasterVertex& v = vertices[j * (grid + 1u) + i];
+            v.x = -1.f + 2.f * i / grid;
+            v.y = -1.f + 2.f * j / grid;
+            v.z = 0.5f;
+            v.color = Color((unsigned char)(2u * i), (unsigned char)(2u * j), 128u);
+        }
+
+    for (unsigned j = 0, n = 0; j < grid; j++)
+        for (unsigned i = 0; i < grid; i++)
+        {
+            const unsigned a = j * (grid + 1u) + i, b = a + 1u, c = a + grid + 1u, d = c + 1u;
+            indices[n++] = a; indices[n++] = b; indices[n++] = c;
+            indices[n++] = b; indices[n++] = d; indices[n++] = c;
+        }
+
+    Image frame(1024u, 1024u);
+    Rasterizer rasterizer(&frame);
+    run_case("raster/grid-32k/1024x1024", 1024u, 1024u, 4ull * 1024u * 1024u, [&]()
+        {
+            rasterizer.clear(Color::Black);
+            rasterizer.draw_indexed(vertices, indices, 6u * grid * grid);
+            consume(frame.pixels()[0].R);
+        });
+
+    delete[] vertices;
+    delete[] indices;
+
+    // Summed-area table construction
+    char name[128];
+    for (unsigned s = 0; s < n_sizes(); s++)
+    {
+        const unsigned w = sizes[s][0], h = sizes[s][1];
+
+        Image source(w, h);
+        fill_pattern(source);
+        IntegralImage table;
+
+        snprintf(name, sizeof(name), "integral/build/%ux%u", w, h);
+        run_case(name, w, h, 20ull * w * h, [&]() { consume(table.build(source)); });
+
+        // Transforms, out of place into a reused image
+        Image target;
+
+        snprintf(name, sizeof(name), "transform/transpose/%ux%u", w, h);
+        run_case(name, w, h, 8ull * w * h, [&]() { source.transpose(target); consume(target.width()); });
+
+        snprintf(name, sizeof(name), "transform/rotate-90/%ux%u", w, h);
+        run_case(name, w, h, 8ull * w * h, [&]() { source.rotate(IMAGE_ROTATION_90, target); consume(target.width()); });
+
+        snprintf(name, sizeof(name), "transform/rotate-180/%ux%u", w, h);
+        run_case(name, w, h, 8ull * w * h, [&]() { source.rotate(IMAGE_ROTATION_180, target); consume(target.width()); });
+
+        snprintf(name, sizeof(name), "transform/flip-vertical/%ux%u", w, h);
+        run_case(name, w, h, 8ull * w * h, [&]() { source.flip_vertical(target); consume(target.width()); });
+
+        snprintf(name, sizeof(name), "transform/flip-horizontal/%ux%u", w, h);
+        run_case(name, w, h, 8ull * w * h, [&]() { source.flip_horizontal(target); consume(target.width()); });
+
+        snprintf(name, sizeof(name), "transform/transpose-in-place/%ux%u", w, h);
+        run_case(name, w, h, 8ull * w * h, [&]() { source.transpose(); consume(source.width()); });
+
+        // Palette quantization, building 256 colors and mapping with every dithering
+        Palette palette;
+        snprintf(name, sizeof(name), "palette/build-256/%ux%u", w, h);
+        run_case(name, w, h, 4ull * w * h, [&]() { consume(palette.build(source)); });
+
+        static const char* dithers[] = { "none", "ordered", "floyd-steinberg" };
+        unsigned char* indices = (unsigned char*)malloc((size_t)w * h);
+        for (unsigned d = 0; d < 3u; d++)
+        {
+            snprintf(name, sizeof(name), "palette/map-%s/%ux%u", dithers[d], w, h);
+            run_case(name, w, h, 5ull * w * h, [&]() { consume(palette.map(source, indices, (PaletteDither)d)); });
+        }
+        free(indices);
+
+        // Content hashes, against the comparison of two copies they replace
+        snprintf(name, sizeof(name), "hash/exact/%ux%u", w, h);
+        run_case(name, w, h, 4ull * w * h, [&]() { consume(source.hash()); });
+
+        snprintf(name, sizeof(name), "hash/dhash/%ux%u", w, h);
+        run_case(name, w, h, 4ull * w * h, [&]() { consume(source.dhash()); });
+
+        snprintf(name, sizeof(name), "hash/phash/%ux%u", w, h);
+        run_case(name, w, h, 4ull * w * h, [&]() { consume(source.phash()); });
+
+        Image copy = source;
+        snprintf(name, sizeof(name), "hash/compare-copy/%ux%u", w, h);
+        run_case(name, w, h, 8ull * w * h, [&]() { consume(memcmp(copy.pixels(), source.pixels(), 4ull * w * h)); });
+    }
+
+    // Large render targets with regular and with huge pages
+    {
+        const unsigned w = 4096u, h = 4096u;
+        LargePageAllocator huge(HUGE_PAGES_TRANSPARENT, NUMA_PLACEMENT_FIRST_TOUCH);
+        static const char* pages[] = { "regular", "huge" };
+
+        for (unsigned p = 0; p < 2u; p++)
+        {
+            PixelAllocator* allocator = p ? &huge : PixelAllocator::standard();
+
+            // Fresh buffers fault in every page on the first write
+            snprintf(name, sizeof(name), "pages/construct-%s/%ux%u", pages[p], w, h);
+            run_case(name, w, h, 4ull * w * h, [&]() { Image image(w, h, Color::Gray, allocator); consume(image.width()); });
+
+            Image source(w, h, Color::Transparent, allocator), target(h, w, Color::Transparent, allocator);
+            fill_pattern(source);
+
+            snprintf(name, sizeof(name), "pages/transpose-%s/%ux%u", pages[p], w, h);
+            run_case(name, w, h, 8ull * w * h, [&]() { source.transpose(target); consume(target.width()); });
+
+            snprintf(name, sizeof(name), "pages/rotate-90-%s/%ux%u", pages[p], w, h);
+            run_case(name, w, h, 8ull * w * h, [&]() { source.rotate(IMAGE_ROTATION_90, target); consume(target.width()); });
+        }
+    }
+
+    // Color grading of a 1080p frame with a 33^3 table, and with a separable one
+    const unsigned lut_size = 33u;
+    float* table = (float*)malloc(3ull * lut_size * lut_size * lut_size * sizeof(float));
+    for (unsigned b = 0, n = 0; b < lut_size; b++)
+        for (unsigned g = 0; g < lut_size; g++)
+            for (unsigned r = 0; r < lut_size; r++, n++)
+            {
+                const float fr = (float)r / (lut_size - 1u), fg = (float)g / (lut_size - 1u), fb = (float)b / (lut_size - 1u);
+                table[3u * n + 0u] = 0.8f * fr + 0.2f * fg * fb;
+                table[3u * n + 1u] = fg * fg;
+                table[3u * n + 2u] = 0.6f * fb + 0.4f * fr * fg;
+            }
+
+    Image frame_lut(1920u, 1080u);
+    fill_pattern(frame_lut);
+    ColorLUT grade(table, lut_size);
+    run_case("lut/tetrahedral-33/1920x1080", 1920u, 1080u, 8ull * 1920u * 1080u, [&]() { consume(grade.apply(frame_lut, LUT_INTERPOLATION_TETRAHEDRAL)); });
+    run_case("lut/trilinear-33/1920x1080", 1920u, 1080u, 8ull * 1920u * 1080u, [&]() { consume(grade.apply(frame_lut, LUT_INTERPOLATION_TRILINEAR)); });
+
+    // Same green curve, the red and blue ones only depend on their own input
+    for (unsigned b = 0, n = 0; b < lut_size; b++)
+        for (unsigned g = 0; g < lut_size; g++)
+            for (unsigned r = 0; r < lut_size; r++, n++)
+            {
+                table[3u * n + 0u] = (float)r / (lut_size - 1u);
+                table[3u * n + 2u] = 1.f - (float)b / (lut_size - 1u);
+            }
+
+    ColorLUT curves(table, lut_size);
+    run_case("lut/separable-33/1920x1080", 1920u, 1080u, 8ull * 1920u * 1080u, [&]() { consume(curves.apply(frame_lut) && curves.separable()); });
+
+    free(table);
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Main function
+-------------------------------------------------------------------------------------------------------
+*/
+
+int main(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (!strcmp(arg, "--quick"))
+            settings.quick = true;
+
+        else if (!strcmp(arg, "--format") && value)
+        {
+            settings.format = !strcmp(value, "csv") ? FORMAT_CSV : !strcmp(value, "json") ? FORMAT_JSON : FORMAT_TEXT;
+            i++;
+        }
+        else if (!strcmp(arg, "--reps") && value)
+        {
+            settings.reps = (unsigned)atoi(value);
+            i++;
+        }
+        else if (!strcmp(arg, "--warmup") && value)
+        {
+            settings.warmup = (unsigned)atoi(value);
+            i++;
+        }
+        else if (!strcmp(arg, "--filter") && value)
+        {
+            settings.filter = value;
+            i++;
+        }
+        else if (!strcmp(arg, "--dir") && value)
+        {
+            settings.dir = value;
+            i++;
+        }
+        else
+        {
+            printf("usage: %s [--format text|csv|json] [--reps N] [--warmup N] [--filter text] [--dir path] [--quick]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (settings.reps < 1u) settings.reps = 1u;
+    if (settings.reps > MAX_BENCH_REPS_) settings.reps = MAX_BENCH_REPS_;
+
+    print_header();
+
+    bench_file_io();
+    bench_color_ops();
+    bench_construct_copy();
+    bench_pixel_formats();
+    bench_kernels();
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include "Image.h"
+
+/* ASYNC IMAGE IO HEADER
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Loads and saves bitmap files asynchronously from a single thread, so that
+a service importing or capturing many images keeps hundreds of reads and
+writes in flight without a thread for each of them.
+
+On Linux it uses io_uring. Loads and saves are queued and handed to the
+kernel together on the next call to complete(), which also collects the
+finished ones, so a whole batch costs a few system calls. The headers are
+read into buffers registered with the kernel once. 32-bit files are read
+straight into the pixels of the image and saves write straight from them,
+the rows are reordered by the vectors of every read or write, without any
+copy. Other formats are read whole and decoded like Image::load_memory().
+
+When io_uring is not available, on other systems, on kernels without it
+or when it is disabled, every request runs right away with Image::load()
+and Image::save() and completes on the next call to complete(). If the
+ring fails while in use, the requests in it are reported as failed once
+the kernel is done with them, and the later ones use stdio.
+
+The images must not be used or destroyed while their requests are in
+flight. The object itself is not thread safe, it is meant to be driven by
+a single thread.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+#define DEFAULT_ASYNC_IO_DEPTH_ 256u // Default maximum number of requests in flight
+
+// Way the requests are carried out
+enum AsyncIOBackend : unsigned char
+{
+	ASYNC_IO_STDIO	= 0,	// Blocking stdio calls when the request is made
+	ASYNC_IO_URING	= 1,	// Linux io_uring, requests run in the kernel
+};
+
+// Finished load or save
+struct AsyncIOCompletion
+{
+	unsigned long long id = 0ull;	// Identifier returned by load() or save()
+	bool save = false;				// Whether it was a save
+	bool ok = false;				// Whether the file was loaded or saved
+};
+
+// Statistics of an asynchronous IO object since it was created
+struct AsyncIOStats
+{
+	unsigned long long loads = 0ull;			// Loads requested
+	unsigned long long saves = 0ull;			// Saves requested
+	unsigned long long failed = 0ull;			// Requests that failed
+
+	unsigned long long direct_loads = 0ull;		// Loads read straight into the pixels
+	unsigned long long bytes_read = 0ull;		// File bytes read
+	unsigned long long bytes_written = 0ull;	// File bytes written
+	unsigned long long system_calls = 0ull;		// Calls to io_uring_enter, submitting and collecting
+
+	unsigned int in_flight = 0u;				// Requests currently in flight
+	unsigned int max_in_flight = 0u;			// Largest number of requests in flight at once
+};
+
+// Internal ring and requests
+struct AsyncIOState;
+
+// Asynchronous bitmap loader and saver, backed by io_uring on Linux
+class AsyncImageIO
+{
+private:
+	// Private variables
+
+	AsyncIOState* state_ = nullptr;	// Ring, requests and finished requests
+
+	// Starts loading into the image, or saving the source if not nullptr
+	unsigned long long request(Image* image, const Image* source, const char* filename);
+
+public:
+	// Constructors/Destructors
+
+	// Creates the object with room for depth requests in flight. It uses io_uring if
+	// allowed and available, otherwise stdio.
+	explicit AsyncImageIO(unsigned int depth = DEFAULT_ASYNC_IO_DEPTH_, bool allow_uring = true);
+
+	AsyncImageIO(const AsyncImageIO&) = delete;
+	AsyncImageIO& operator=(const AsyncImageIO&) = delete;
+
+	// Waits for every request in flight and releases the ring
+	~AsyncImageIO();
+
+	// Returns the way the requests are carried out
+	AsyncIOBackend backend() const;
+
+	// Requests
+
+	// Queues loading the bitmap file into the image, same formats as Image::load(). If it
+	// fails the image is left empty. With depth requests in flight it waits for one to finish.
+	// Returns the identifier of the request, reported by complete(), or zero if the name is empty.
+	unsigned long long load(Image& image, const char* fmt_filename, ...);
+
+	// Queues saving the image to the bitmap file, same as Image::save(). With depth requests
+	// in flight it waits for one to finish. Returns the identifier of the request, reported
+	// by complete(), or zero if the name is empty.
+	unsigned long long save(const Image& image, const char* fmt_filename, ...);
+
+	// Completions
+
+	// Submits the queued requests, waits until at least min_wait have finished, as long as
+	// there are enough in flight, and stores up to max_completions of them in the order
+	// they finished. Returns the number stored, the rest are kept for the next call.
+	unsigned complete(AsyncIOCompletion* completions, unsigned int max_completions, unsigned int min_wait = 0u);
+
+	// Waits for every request in flight and discards the completions not collected yet.
+	// Returns the number of them that failed.
+	unsigned wait_all();
+
+	// Returns the number of requests in flight
+	unsigned in_flight() const;
+
+	// Returns the statistics since the object was created
+	AsyncIOStats stats() const;
+};
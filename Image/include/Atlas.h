@@ -0,0 +1,89 @@
+#pragma once
+#include "Image.h"
+
+/* ATLAS CLASS HEADER
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Texture atlas packer for the image library. It takes a list of small images,
+like sprites or glyphs, and packs them all into a single image so that a
+renderer can bind one texture instead of many.
+
+The packing uses a skyline bottom-left heuristic, the images are sorted by
+height and each one is placed at the lowest available position of the skyline.
+The atlas size is the smallest power of two (square or twice as wide) that fits.
+
+For every packed image it stores the pixel rectangle and the UV rectangle.
+UVs follow the image row order, v = 0 is the first row of the atlas.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+#define DEFAULT_ATLAS_MAX_SIZE_ 8192u // Default maximum width and height of an atlas
+
+// Location of a packed image inside the atlas
+struct AtlasRect
+{
+	unsigned int col = 0u;		// First column of the image inside the atlas
+	unsigned int row = 0u;		// First row of the image inside the atlas
+	unsigned int width = 0u;	// Width of the packed image
+	unsigned int height = 0u;	// Height of the packed image
+
+	float u0 = 0.f;	// Left UV coordinate
+	float v0 = 0.f;	// Top UV coordinate
+	float u1 = 0.f;	// Right UV coordinate
+	float v1 = 0.f;	// Bottom UV coordinate
+};
+
+// Packs a list of images into a single image and stores the location of each one.
+// The rectangles are stored in the same order as the images were given.
+class Atlas
+{
+private:
+	// Private variables
+
+	Image image_;					// Atlas image containing all the packed images
+
+	AtlasRect* rects_ = nullptr;	// Array of rectangles, one per packed image
+	unsigned int count_ = 0u;		// Number of packed images
+
+public:
+	// Copy functions are deleted. Copies not allowed
+
+	Atlas(const Atlas&)				= delete;
+	Atlas& operator=(const Atlas&)	= delete;
+
+	// Constructor / Destructor
+
+	// Creates an empty atlas
+	Atlas() = default;
+
+	// Frees the rectangles array
+	~Atlas();
+
+	// Packs the images into a new atlas image, replacing any previous content.
+	// Padding adds empty pixels around each image, and extrude fills that padding
+	// with the image edge pixels to avoid bleeding when sampling with filtering.
+	// The images are copied to the atlas in parallel. Returns false if they do not
+	// fit inside max_size x max_size, in which case the atlas is left empty.
+	bool pack(const Image* const* images, unsigned int count, unsigned int padding = 0u, bool extrude = false, unsigned int max_size = DEFAULT_ATLAS_MAX_SIZE_);
+
+	// Frees the atlas image and the rectangles
+	void clear();
+
+	// Getters
+
+	// Returns the atlas image
+	Image& image();
+
+	// Returns the constant atlas image
+	const Image& image() const;
+
+	// Returns the number of packed images
+	unsigned size() const;
+
+	// Returns the rectangles array, one per packed image
+	const AtlasRect* rects() const;
+
+	// Returns the rectangle of the packed image at the specified index
+	const AtlasRect& operator[](unsigned int idx) const;
+};
@@ -0,0 +1,101 @@
+#pragma once
+#include "Image.h"
+
+/* CAPTURE WRITER HEADER
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Saves frames to bitmap files from a background thread, so that a render
+loop capturing its output never waits for the disk.
+
+Frames are queued in a ring of slots and written by a single thread in
+the order they were submitted. With the default two slots it works as a
+double buffer, one frame is written while the next one waits. When the
+queue is full the writer either blocks the caller until a slot is free
+or drops the frame, as chosen on creation.
+
+Frames can be handed over by move, copied, which is free for images
+with copy-on-write until the caller writes to them again, or exchanged
+for the buffer of an already written frame, so that a capture loop runs
+without allocating once every slot has been used.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+#define DEFAULT_CAPTURE_SLOTS_ 2u // Default number of queued frames, double buffering
+
+// What CaptureWriter::submit() does when every slot is taken
+enum CaptureOverflow : unsigned char
+{
+	CAPTURE_OVERFLOW_BLOCK	= 0,	// Waits until the writer frees a slot
+	CAPTURE_OVERFLOW_DROP	= 1,	// Drops the frame and returns false
+};
+
+// Statistics of a capture writer since it was created or reset
+struct CaptureStats
+{
+	unsigned long long submitted = 0ull;	// Frames accepted into the queue
+	unsigned long long written = 0ull;		// Frames saved to disk
+	unsigned long long failed = 0ull;		// Frames that could not be saved
+	unsigned long long dropped = 0ull;		// Frames dropped because the queue was full
+
+	unsigned int queued = 0u;				// Frames currently queued or being written
+	unsigned int max_queued = 0u;			// Largest number of frames queued at once
+
+	double mean_latency_ms = 0.0;			// Mean time from submit until the file is written
+	double max_latency_ms = 0.0;			// Longest time from submit until the file is written
+	double blocked_ms = 0.0;				// Total time submit() waited for a free slot
+};
+
+// Internal queue and thread of the writer
+struct CaptureState;
+
+// Asynchronous frame writer, saves the submitted images in order from a background thread
+class CaptureWriter
+{
+private:
+	// Private variables
+
+	CaptureState* state_ = nullptr;	// Queue, statistics and writer thread
+
+	// Queues a copy of the image if copy is not nullptr, otherwise takes the frame, giving 
+	// back the buffer of a written frame if exchange. Returns false if dropped.
+	bool enqueue(Image* frame, const Image* copy, bool exchange, const char* filename);
+
+public:
+	// Constructors/Destructors
+
+	// Starts the writer thread with the specified number of slots and overflow policy
+	explicit CaptureWriter(unsigned int slots = DEFAULT_CAPTURE_SLOTS_, CaptureOverflow overflow = CAPTURE_OVERFLOW_BLOCK);
+
+	CaptureWriter(const CaptureWriter&) = delete;
+	CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+	// Writes every queued frame and stops the writer thread
+	~CaptureWriter();
+
+	// Submitting
+
+	// Queues the frame to be saved at the specified path, taking its pixels and leaving it
+	// empty. Returns false if it was dropped because the queue is full, the frame is kept then.
+	bool submit(Image&& frame, const char* fmt_filename, ...);
+
+	// Queues a copy of the frame to be saved at the specified path. The copy shares the
+	// pixels if the frame is copy-on-write. Returns false if dropped because the queue is full.
+	bool submit(const Image& frame, const char* fmt_filename, ...);
+
+	// Queues the frame to be saved at the specified path and gives back in it the buffer
+	// of a written frame, or an empty image if there is none yet, its content is undefined.
+	// Returns false if dropped because the queue is full, the frame is kept then.
+	bool exchange(Image& frame, const char* fmt_filename, ...);
+
+	// Waits until every queued frame is written
+	void flush();
+
+	// Statistics
+
+	// Returns the statistics since the writer was created or reset
+	CaptureStats stats() const;
+
+	// Resets the counters and latencies, the queue state is kept
+	void reset_stats();
+};
@@ -40,10 +40,10 @@ struct Color
 
 	// Initializes through a float*
 	constexpr Color(const float* float4color)
-		:	R{ unsigned char(float4color[0] * 255) },
-			G{ unsigned char(float4color[1] * 255) },
-			B{ unsigned char(float4color[2] * 255) },
-			A{ unsigned char(float4color[3] * 255) } {}
+		:	R{ (unsigned char)(float4color[0] * 255) },
+			G{ (unsigned char)(float4color[1] * 255) },
+			B{ (unsigned char)(float4color[2] * 255) },
+			A{ (unsigned char)(float4color[3] * 255) } {}
 
 	// Default colors defined for convenience
 	static const Color Black;
@@ -0,0 +1,116 @@
+#pragma once
+#include "Image.h"
+
+/* COLOR LUT HEADER
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Color lookup tables for color grading, like the ones exported by video
+and photo editors as .cube files.
+
+A 3D table stores the output color of size x size x size input colors
+evenly spread over the color cube, and every other color is interpolated
+from the corners of the cell it falls in, eight of them with trilinear
+interpolation or four with tetrahedral interpolation.
+
+The table is stored in fixed point, and the cell and position of every
+8-bit value along each axis are computed once, so applying it only costs
+the corner reads and their blend, done with SSE2 over threads.
+
+When every output channel only depends on its own input channel, as with
+1D tables or simple curves, the grade is separable and it is fused into
+three 256-entry tables that are applied with a read per channel instead.
+
+The alpha channel is kept as it is.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+#define MAX_LUT_SIZE_ 256u // Maximum number of samples per axis, as in the .cube specification
+
+// Interpolation used between the samples of a 3D table
+enum LUTInterpolation : unsigned char
+{
+	LUT_INTERPOLATION_TRILINEAR		= 0,	// Blend of the 8 corners of the cell
+	LUT_INTERPOLATION_TETRAHEDRAL	= 1,	// Blend of 4 corners, faster and exact along the gray axis
+};
+
+// 3D or 1D color lookup table, with a fused per-channel lookup when separable
+class ColorLUT
+{
+private:
+	// Private variables
+
+	short* entries_ = nullptr;					// B, G, R, 0 of every sample at 128 times the 8-bit value, red index fastest
+	unsigned int size_ = 0u;					// Samples per axis, zero if empty
+	bool cube_ = false;							// Whether it is a 3D table, otherwise one curve per channel
+
+	unsigned int offsets_[3][256] = {};			// First sample of the cell of every B, G and R value
+	unsigned short fractions_[3][256] = {};		// Position of every value inside its cell, in fixed point
+	unsigned int curves_[3][256] = {};			// Fused B, G and R lookups, every value in its byte of a color
+	bool separable_ = false;					// Whether the fused lookups are used
+
+	// Stores the samples, red fastest, with the input domain of every channel.
+	// Returns false if the size or the domain are invalid or out of memory.
+	bool set_samples(const float* samples, unsigned int size, bool cube, const float* domain_min, const float* domain_max);
+
+public:
+	// Constructors/Destructors
+
+	// Creates an empty table
+	ColorLUT() = default;
+
+	// Creates a 3D table from size^3 RGB float triplets, see set_table()
+	ColorLUT(const float* table, unsigned int size);
+
+	// Copies the other table
+	ColorLUT(const ColorLUT& other);
+
+	// Copies the other table
+	ColorLUT& operator=(const ColorLUT& other);
+
+	// Takes the other table and leaves it empty
+	ColorLUT(ColorLUT&& other) noexcept;
+
+	// Takes the other table and leaves it empty
+	ColorLUT& operator=(ColorLUT&& other) noexcept;
+
+	// Frees the table
+	~ColorLUT();
+
+	// Building
+
+	// Sets a 3D table of size^3 RGB float triplets from 0 to 1, with the red input changing
+	// fastest, then green, then blue, as in .cube files. The input of every channel spans
+	// from domain_min to domain_max, 0 to 1 if nullptr. Returns false if the size is below
+	// 2 or above MAX_LUT_SIZE_, a domain is empty or out of memory.
+	bool set_table(const float* table, unsigned int size, const float* domain_min = nullptr, const float* domain_max = nullptr);
+
+	// Sets a 1D table of size RGB float triplets from 0 to 1, one curve per channel,
+	// with the same conventions and limits as set_table(). Always separable.
+	bool set_curves(const float* table, unsigned int size, const float* domain_min = nullptr, const float* domain_max = nullptr);
+
+	// Loads a 3D or 1D table from a .cube file. Returns false if the file can
+	// not be read or is not a valid .cube file.
+	bool load(const char* fmt_filename, ...);
+
+	// Queries
+
+	// Returns the number of samples per axis, zero if empty
+	unsigned size() const;
+
+	// Returns whether it is a 3D table, otherwise a 1D one
+	bool is_3d() const;
+
+	// Returns whether the grade is separable, in which case it is applied
+	// through the fused per-channel lookups whatever the interpolation
+	bool separable() const;
+
+	// Returns the graded color. The table must not be empty.
+	Color lookup(Color color, LUTInterpolation interpolation = LUT_INTERPOLATION_TETRAHEDRAL) const;
+
+	// Grading
+
+	// Grades every pixel of the image in place, keeping the alpha.
+	// Returns false if the table is empty.
+	bool apply(Image& image, LUTInterpolation interpolation = LUT_INTERPOLATION_TETRAHEDRAL) const;
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+/* DIRTY REGION HEADER
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Keeps track of which pixels of an image changed, so that frame loops can
+upload to the GPU or save to disk only the parts that need it.
+
+The region stores one span of columns per row, the smallest one covering
+every change made to that row, so marking a pixel or a rectangle costs a
+couple of comparisons per row and never allocates. Marking the whole image
+is constant time and is what resizes the region.
+
+The spans can be read directly, which is what the Image export and save
+functions do, or merged into a short list of rectangles for APIs that
+upload by rectangles.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Rectangle of pixels inside an image
+struct ImageRect
+{
+	unsigned int row = 0u;		// First row of the rectangle
+	unsigned int col = 0u;		// First column of the rectangle
+	unsigned int height = 0u;	// Number of rows
+	unsigned int width = 0u;	// Number of columns
+};
+
+// Set of changed pixels of an image, stored as a span of columns per row
+class DirtyRegion
+{
+private:
+	// Private variables
+
+	unsigned int* spans_ = nullptr;	// First and end column of every row, first > end if clean
+	unsigned int width_ = 0u;		// Width of the image tracked
+	unsigned int height_ = 0u;		// Height of the image tracked
+
+	unsigned int first_row_ = 0u;	// First dirty row
+	unsigned int end_row_ = 0u;		// Row after the last dirty row, zero if clean
+	bool all_ = false;				// Whether the whole image is dirty, spans are not used then
+
+	// Makes sure the spans exist and sets them all clean
+	void clear_spans();
+
+public:
+	// Constructors/Destructors
+
+	// Creates an empty region of an empty image
+	DirtyRegion() = default;
+
+	// Creates a region for an image of the specified size, all clean or all dirty
+	DirtyRegion(unsigned int width, unsigned int height, bool dirty = false);
+
+	// Copies the other region
+	DirtyRegion(const DirtyRegion& other);
+
+	// Copies the other region
+	DirtyRegion& operator=(const DirtyRegion& other);
+
+	// Takes the other region and leaves it empty
+	DirtyRegion(DirtyRegion&& other) noexcept;
+
+	// Takes the other region and leaves it empty
+	DirtyRegion& operator=(DirtyRegion&& other) noexcept;
+
+	// Frees the spans
+	~DirtyRegion();
+
+	// Marking
+
+	// Sets the size of the image tracked and marks it all clean or all dirty.
+	// Marking it dirty never allocates, so it is safe in noexcept functions.
+	void reset(unsigned int width, unsigned int height, bool dirty);
+
+	// Marks the pixel as dirty, ignored if outside the image
+	void add(unsigned int row, unsigned int col);
+
+	// Marks the rectangle starting at the specified pixel coordinates with
+	// the specified size as dirty, the parts outside the image are ignored
+	void add(unsigned int row, unsigned int col, unsigned int height, unsigned int width);
+
+	// Marks the whole image as dirty
+	void add_all();
+
+	// Adds the dirty pixels of the other region, which must track an image of
+	// the same size. Returns false and does nothing if the sizes differ.
+	bool merge(const DirtyRegion& other);
+
+	// Marks the whole image as clean
+	void clear();
+
+	// Queries
+
+	// Returns whether no pixel is dirty
+	bool empty() const;
+
+	// Returns whether the whole image is dirty, as after a reset or add_all()
+	bool all() const;
+
+	// Returns the width of the image tracked
+	unsigned width() const;
+
+	// Returns the height of the image tracked
+	unsigned height() const;
+
+	// Returns the first dirty row, or the height if clean
+	unsigned first_row() const;
+
+	// Returns the row after the last dirty row, or zero if clean
+	unsigned end_row() const;
+
+	// Stores in first and end the dirty columns [first, end) of the row.
+	// Returns false if the row is clean, in which case both are zero.
+	bool row_span(unsigned int row, unsigned int* first, unsigned int* end) const;
+
+	// Returns the smallest rectangle covering every dirty pixel, empty if clean
+	ImageRect bounds() const;
+
+	// Returns the number of pixels covered by the row spans, which is what an
+	// incremental export or save copies
+	unsigned long long area() const;
+
+	// Merges the row spans into rectangles, joining consecutive rows whose spans
+	// overlap. Fills up to max_rects entries and returns the number of rectangles,
+	// which can be larger than max_rects, so it can be called first with zero.
+	unsigned rects(ImageRect* rects, unsigned int max_rects) const;
+};
@@ -1,5 +1,10 @@
 #pragma once
 #include "Color.h"
+#include "PixelAllocator.h"
+#include "PixelFormat.h"
+#include "YUV.h"
+#include "DirtyRegion.h"
+#include "ImageBatch.h"
 
 /* IMAGE CLASS HEADER
 -------------------------------------------------------------------------------------------------------
@@ -10,10 +15,91 @@ stores images as bitmaps, enough for the needs of this project.
 
 Stores a color array and allows for basic functionalities, but mostly 
 relevant for image file handling.
+
+The pixel buffers are obtained from a PixelAllocator, by default the
+standard one, so that frame loops can recycle buffers through a pool.
+
+Images can opt in to copy-on-write, then copies share the pixel buffer
+and it is only duplicated on the first non-constant pixel access.
+
+The pixels can be imported from and exported to other pixel layouts,
+see PixelFormat.h for the supported ones, and to YUV video frames, see YUV.h.
+
+Images can also track which pixels change through their non-constant
+functions, so that only those are exported or saved, see DirtyRegion.h.
+
+Whole images can be combined with the Color operators, like a * 0.5f + b,
+evaluated in a single pass without temporary images, see ImageExpr.h.
+
+Exact and perceptual hashes of the pixels can be used as cache keys or
+to find duplicate and near duplicate images without comparing them.
+
+Many bitmap files can be loaded at once, reading the next files while
+the previous ones are decoded on other threads, see ImageBatch.h. On Linux
+they can also be loaded and saved through io_uring, with hundreds of reads
+and writes in flight from a single thread, see AsyncImageIO.h.
+
+The channel swizzle, RGB8/BGR8 conversion and expression kernels pick
+their SSE2, SSSE3, AVX2 or AVX-512 versions when they first run, from
+what the processor supports, see SIMDLevel.h. The rest stay on SSE2.
 -------------------------------------------------------------------------------------------------------
 -------------------------------------------------------------------------------------------------------
 */
 
+// File formats recognized by Image::probe()
+enum ImageFormat : unsigned char
+{
+	IMAGE_FORMAT_UNKNOWN	= 0,	// Not an image file the library recognizes
+	IMAGE_FORMAT_BMP		= 1,	// Windows bitmap file
+};
+
+// Clockwise rotations supported by Image::rotate()
+enum ImageRotation : unsigned char
+{
+	IMAGE_ROTATION_0	= 0,	// Keeps the image as is
+	IMAGE_ROTATION_90	= 1,	// Quarter turn clockwise, swaps width and height
+	IMAGE_ROTATION_180	= 2,	// Half turn
+	IMAGE_ROTATION_270	= 3,	// Quarter turn counterclockwise, swaps width and height
+};
+
+// Information about an image file read from its header, without decoding the pixels
+struct ImageInfo
+{
+	ImageFormat format = IMAGE_FORMAT_UNKNOWN;	// File format
+
+	unsigned int width = 0u;			// Width of the image in pixels
+	unsigned int height = 0u;			// Height of the image in pixels
+	unsigned short bit_depth = 0u;		// Bits per pixel as stored in the file
+	unsigned int compression = 0u;		// BMP compression code (0 for uncompressed)
+	bool top_down = false;				// Whether the rows are stored from top to bottom
+
+	unsigned long long file_size = 0ull;// File size in bytes as stated in the header
+	bool loadable = false;				// Whether Image::load() supports this file
+};
+
+// Result of probing one of the files inside a directory
+struct ImageProbe
+{
+	char path[512] = {};	// Path of the file, directory included
+	ImageInfo info;			// Information read from its header
+};
+
+// Color palette for indexed files, see Palette.h
+class Palette;
+
+// Dithering used when reducing an image to a palette, see Palette.h
+enum PaletteDither : unsigned char;
+
+// Whole-image arithmetic expression, see ImageExpr.h
+template<typename Expr> struct ImageExpr;
+
+// Expression compiled into operations, see ImageExpr.h
+struct ImageProgram;
+
+// Sets count colors starting at pixels to the color. Large spans are split across 
+// threads and use streaming stores that do not pollute the cache.
+void fill_colors(Color* pixels, unsigned long long count, Color color);
+
 // Simple class for handling images, and storing and loading them as BMP files
 class Image
 {
@@ -25,9 +111,43 @@ private:
 	unsigned int width_	 = 0u;	// Stores the width of the image
 	unsigned int height_ = 0u;	// Stores the height of the image
 
+	PixelAllocator* allocator_ = nullptr;	// Allocator of the pixels, default one if nullptr
+
+	bool copy_on_write_ = false;				// Whether copies share the pixel buffer
+	long long* refs_ = nullptr;					// Buffer reference count, only with copy-on-write
+
+	static PixelAllocator* default_allocator_;	// Allocator used by images without one
+
+	DirtyRegion* dirty_ = nullptr;				// Changed pixels, nullptr if not tracked
+
+	friend struct AsyncIOState;					// Reads files straight into the pixels
+
+	// Makes sure the pixel buffer holds width x height pixels, reusing the current
+	// buffer if the size matches. The content is only zeroed if requested.
+	bool allocate_pixels(unsigned int width, unsigned int height, bool zero);
+
+	// Releases the pixel buffer to the allocator, or drops the reference if shared
+	void free_pixels();
+
+	// Shares the pixel buffer of the other image, which must be copy-on-write
+	void share_pixels(const Image& other);
+
+	// Makes a private copy of the pixel buffer if it is shared with other images
+	void detach();
+
+	// Marks every pixel as dirty if tracked, resizing the region to the image
+	void mark_all_dirty();
+
+	// Resizes the image to the size of the images of the program and stores its result
+	// for every pixel. Returns false if they differ in size or could not be allocated.
+	bool evaluate(const ImageProgram& program);
+
 public:
 	// Constructors/Destructors
 
+	// Creates an empty image, with no pixels
+	Image() = default;
+
 	// Initializes the image as stored in the bitmap file
 	Image(const char* fmt_filename, ...);
 
@@ -37,39 +157,243 @@ public:
 	// Copies the other image
 	Image& operator=(const Image& other);
 
+	// Takes the other image pixels and leaves it empty
+	Image(Image&& other) noexcept;
+
+	// Takes the other image pixels and leaves it empty
+	Image& operator=(Image&& other) noexcept;
+
 	// Stores a copy of the color pointer
 	Image(Color* pixels, unsigned int width, unsigned int height);
 
-	// Creates an image with the specified size and color
-	Image(unsigned int width, unsigned int height, Color color = Color::Transparent);
+	// Creates an image with the specified size and color, using the specified
+	// allocator for the pixels or the default one if nullptr
+	Image(unsigned int width, unsigned int height, Color color = Color::Transparent, PixelAllocator* allocator = nullptr);
+
+	// Evaluates the whole-image expression into a new image, see ImageExpr.h
+	template<typename Expr>
+	Image(const ImageExpr<Expr>& expression);
+
+	// Evaluates the whole-image expression in a single pass over the pixels, resizing the
+	// image to the size of the images in it, which can include this one. Throws if they
+	// differ in size, see ImageExpr.h.
+	template<typename Expr>
+	Image& operator=(const ImageExpr<Expr>& expression);
 
 	// Frees the pixel pointer
 	~Image();
 
 	// Getters
 
-	// Returns the pointer to the image pixels as a color array
+	// Returns the pointer to the image pixels as a color array.
+	// With copy-on-write it makes a private copy first if they are shared.
 	Color* pixels();
 
+	// Returns the constant pointer to the image pixels as a color array
+	const Color* pixels() const;
+
 	// Returns the image width
 	unsigned width() const;
 
 	// Returns the image height
 	unsigned height() const;
 
+	// Returns the allocator used for the pixels
+	PixelAllocator* allocator() const;
+
+	// Sets the allocator used for the pixels, moving the current pixels to it
+	void set_allocator(PixelAllocator* allocator);
+
+	// Sets the allocator used by new images, nullptr restores the standard one
+	static void set_default_allocator(PixelAllocator* allocator);
+
+	// Returns the allocator used by new images
+	static PixelAllocator* default_allocator();
+
+	// Copy-on-write
+
+	// Enables or disables copy-on-write. When enabled, copies of this image share its 
+	// pixels until one of them calls the non-constant pixels() or operator().
+	// Disabling it makes a private copy of the pixels if they are shared.
+	void set_copy_on_write(bool enable);
+
+	// Returns whether copy-on-write is enabled
+	bool copy_on_write() const;
+
+	// Returns whether the pixels are currently shared with another image
+	bool is_shared() const;
+
 	// Accessors
 
-	// Returns a color reference to the specified pixel coordinates
+	// Returns a color reference to the specified pixel coordinates.
+	// With copy-on-write it makes a private copy first if they are shared.
 	Color& operator()(unsigned int row, unsigned int col);
 
 	// Returns a constant color reference to the specified pixel coordinates
 	const Color& operator()(unsigned int row, unsigned int col) const;
 
+	// Fill functions
+
+	// Sets every pixel to the color. If the pixels are shared with copy-on-write 
+	// it takes a new buffer without copying them.
+	void fill(Color color);
+
+	// Sets every pixel to transparent, same as fill(Color::Transparent)
+	void clear();
+
+	// Sets the pixels of the rectangle starting at the specified pixel coordinates
+	// with the specified size to the color, the parts outside the image are ignored
+	void fill_rect(unsigned int row, unsigned int col, unsigned int height, unsigned int width, Color color);
+
+	// Transforms
+
+	// Swaps rows and columns in place. Square images are transposed tile by tile, 
+	// the rest use a new buffer from the allocator.
+	void transpose();
+
+	// Stores the image with rows and columns swapped in dst
+	void transpose(Image& dst) const;
+
+	// Rotates the image in place, 90 and 270 degree turns of non-square 
+	// images use a new buffer from the allocator
+	void rotate(ImageRotation rotation);
+
+	// Stores the rotated image in dst
+	void rotate(ImageRotation rotation, Image& dst) const;
+
+	// Reverses the order of the rows in place
+	void flip_vertical();
+
+	// Stores the image with the order of the rows reversed in dst
+	void flip_vertical(Image& dst) const;
+
+	// Reverses the order of the columns in place
+	void flip_horizontal();
+
+	// Stores the image with the order of the columns reversed in dst
+	void flip_horizontal(Image& dst) const;
+
+	// Dirty regions
+
+	// Enables or disables tracking which pixels change. When enabled every 
+	// non-constant function marks the pixels it may write, the non-constant 
+	// pixels() marks the whole image. Tracking starts clean and is not copied.
+	void set_dirty_tracking(bool enable);
+
+	// Returns whether the changed pixels are tracked
+	bool dirty_tracking() const;
+
+	// Returns the changed pixels since the last clear_dirty(), nullptr if not tracked
+	const DirtyRegion* dirty_region() const;
+
+	// Marks the rectangle starting at the specified pixel coordinates with the specified
+	// size as dirty, for pixels written through pointers. Ignored if not tracked.
+	void mark_dirty(unsigned int row, unsigned int col, unsigned int height, unsigned int width);
+
+	// Marks every pixel as clean, usually after exporting or saving them
+	void clear_dirty();
+
+	// Converts only the dirty pixels into dst, laid out as export_pixels() does, so it
+	// keeps a full copy of the image up to date. Uses the specified region, or the tracked
+	// one if nullptr, or exports every pixel if neither. Returns false if the stride is
+	// too small or the region does not match the image size.
+	bool export_dirty(void* dst, PixelFormat format, unsigned long long stride = 0ull, const DirtyRegion* region = nullptr) const;
+
+	// Writes only the dirty pixels into the existing file saved from this image. If the
+	// file is missing, or is not a 32-bit bitmap of the same size, the whole image is saved.
+	bool save_dirty(const char* fmt_filename, ...) const;
+
+	// Hashing
+
+	// Returns a 64-bit hash of the size and pixels, equal images always get the same
+	// value and different ones collide with negligible probability. Fixed segments of the 
+	// pixels are hashed in parallel, so the value does not depend on the number of threads.
+	unsigned long long hash() const;
+
+	// Returns a 64-bit difference hash. The image is reduced to 9x8 gray averages and 
+	// every bit tells whether one is brighter than the one to its right. It survives
+	// scaling and small edits, compare them with hash_distance(). Zero if empty.
+	unsigned long long dhash() const;
+
+	// Returns a 64-bit perceptual hash. The image is reduced to 32x32 gray averages and
+	// every bit tells whether one of the 8x8 lowest frequencies of their DCT is above
+	// their median. More robust than dhash() to contrast and gamma changes. Zero if empty.
+	unsigned long long phash() const;
+
+	// Returns the number of different bits between two perceptual hashes, 
+	// near duplicates are usually within 10 bits
+	static unsigned hash_distance(unsigned long long a, unsigned long long b);
+
+	// Pixel formats
+
+	// Converts the pixels into the specified format at dst, rows are stride bytes
+	// apart, or tightly packed if zero. Returns false if the stride is too small.
+	bool export_pixels(void* dst, PixelFormat format, unsigned long long stride = 0ull) const;
+
+	// Resizes the image to width x height and converts into it the pixels in the specified
+	// format at src, rows are stride bytes apart, or tightly packed if zero. 
+	// Returns false if the stride is too small or the pixels could not be allocated.
+	bool import_pixels(const void* src, unsigned int width, unsigned int height, PixelFormat format, unsigned long long stride = 0ull);
+
+	// Converts the pixels into the YUV frame, which must have the same size, averaging
+	// the chroma of the pixels every sample covers. Returns false if the size differs,
+	// a plane is missing or a stride is too small.
+	bool export_yuv(const YUVFrame& frame) const;
+
+	// Resizes the image to the size of the YUV frame and converts it into the pixels,
+	// with full alpha. Returns false if a plane is missing, a stride is too small or
+	// the pixels could not be allocated.
+	bool import_yuv(const YUVFrame& frame, YUVUpsampling upsampling = YUV_UPSAMPLING_BILINEAR);
+
 	// File functions
 
-	// Loads an image from the specified file path
+	// Loads an image from the specified bitmap file. Supports 1, 4 and 8-bit indexed
+	// files, also run length encoded, and 16, 24 and 32-bit ones, also with bitfields.
 	bool load(const char* fmt_filename, ...);
 
+	// Loads an image from a whole bitmap file already in memory, same formats as load()
+	bool load_memory(const void* data, unsigned long long size);
+
+	// Loads the bitmap file downscaled by the factor, like 2, 4 or 8, rounding the size
+	// up. Every output pixel is the average of its block, edge blocks of the pixels they
+	// cover. Blocks are averaged while the rows are read, so only one file row is held
+	// besides the result. Returns false if the factor is zero or the load fails.
+	bool load_scaled(unsigned int factor, const char* fmt_filename, ...);
+
+	// Loads the bitmap file downscaled to fit in max_width x max_height keeping its aspect
+	// ratio, never upscaled. Every output pixel is the average of the pixels it covers,
+	// computed while the rows are read. Returns false if a maximum is zero or it fails.
+	bool load_thumbnail(unsigned int max_width, unsigned int max_height, const char* fmt_filename, ...);
+
 	// Saves the image to the specified file path
 	bool save(const char* fmt_filename, ...) const;
+
+	// Saves the image as an indexed bitmap of 4 or 8 bits per pixel, with a palette of
+	// up to 16 or 256 colors built for it. The file always has the requested bit depth,
+	// even if the image has fewer colors. Returns false for other bit depths or if it fails.
+	bool save_palettized(unsigned int bits, PaletteDither dither, const char* fmt_filename, ...) const;
+
+	// Saves the image as an indexed bitmap with the specified palette, 4 bits per pixel
+	// if it has 16 entries or less and 8 otherwise. Returns false if the palette is empty.
+	bool save_palettized(const Palette& palette, PaletteDither dither, const char* fmt_filename, ...) const;
+
+	// Reads only the header of the specified image file, with a single small read, 
+	// and stores its dimensions and format in info. Returns false if it is not a
+	// recognized image file, in which case info format is IMAGE_FORMAT_UNKNOWN.
+	static bool probe(ImageInfo* info, const char* fmt_filename, ...);
+
+	// Probes every BMP file inside the specified directory, not recursive.
+	// Fills up to max_probes entries and returns the number of BMP files found,
+	// which can be larger than max_probes, so it can be called first with zero.
+	static unsigned probe_directory(ImageProbe* probes, unsigned int max_probes, const char* fmt_directory, ...);
+
+	// Loads count bitmap files into the images, paths used as is. The calling thread reads
+	// the files while decoder threads decode them, see ImageBatch.h. Images of files that
+	// fail are left empty. Returns the number of images loaded, stats are optional.
+	static unsigned load_batch(Image* images, const char* const* paths, unsigned int count, const BatchLoadSettings& settings = BatchLoadSettings(), BatchLoadStats* stats = nullptr);
+
+	// Loads every BMP file inside the specified directory, not recursive, like load_batch().
+	// Fills up to max_images images and probes, so the path of every image is known, and
+	// returns the number of BMP files found, which can be larger than max_images.
+	static unsigned load_directory(Image* images, ImageProbe* probes, unsigned int max_images, const BatchLoadSettings& settings, BatchLoadStats* stats, const char* fmt_directory, ...);
 };
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+
+/* IMAGE BATCH HEADER
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Settings and statistics of Image::load_batch() and Image::load_directory(),
+which load many bitmap files at once through a pipeline.
+
+The calling thread reads the files whole, one after the other, while decoder
+threads turn the files already read into images. Reading and decoding overlap,
+so the time of a batch is close to the slowest of the two instead of their sum.
+At most max_in_flight files wait in memory to be decoded, the reader blocks
+while the decoders catch up.
+
+On Linux and the other systems with posix_fadvise the reader also asks the
+system to read ahead the next files, so their pages are fetched from the disk
+while the current one is read. Elsewhere they are read without hints.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Settings of a batch load
+struct BatchLoadSettings
+{
+	unsigned int decoders = 0u;			// Decoder threads, zero for one per logical processor
+	unsigned int max_in_flight = 0u;	// Files read and waiting to be decoded, zero for twice the decoders
+	unsigned int prefetch = 4u;			// Files after the one being read hinted to be read ahead, zero for none
+};
+
+// Statistics of a batch load, times are in nanoseconds
+struct BatchLoadStats
+{
+	unsigned int files = 0u;			// Files in the batch
+	unsigned int loaded = 0u;			// Files read and decoded into their images
+	unsigned int failed = 0u;			// Files that could not be read or decoded
+
+	unsigned long long bytes_read = 0ull;	// File bytes read
+	unsigned long long pixels = 0ull;		// Pixels decoded
+
+	unsigned long long read_ns = 0ull;		// Time the reader spent reading files
+	unsigned long long decode_ns = 0ull;	// Time spent decoding, added over the decoder threads
+	unsigned long long wall_ns = 0ull;		// Time from the start to the end of the batch
+	unsigned int decoders = 0u;				// Decoder threads used
+};
@@ -0,0 +1,98 @@
+#pragma once
+#include "Image.h"
+
+/* IMAGE CACHE HEADER
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Process-wide cache of images loaded from files, so that different parts
+of an application asking for the same texture share a single copy.
+
+Images are keyed on the resolved file path and its modification time, if
+the file changes on disk the next request loads the new version. When
+several threads ask for the same file at once only one of them loads it
+and the rest wait for the result.
+
+The cache hands out reference-counted read-only handles. When the total
+size of the cached images exceeds the budget, the least recently used
+images that are not held by any handle are evicted.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+#define DEFAULT_IMAGE_CACHE_BUDGET_ (256ull << 20) // Default cache budget in bytes (256MB)
+
+// Reference-counted read-only handle to an image stored in the ImageCache.
+// The image stays alive while any handle points to it, even if it gets evicted.
+class CachedImage
+{
+private:
+	void* entry_ = nullptr;	// Pointer to the internal cache entry
+
+	friend class ImageCache;
+	explicit CachedImage(void* entry);
+public:
+	// Constructors/Destructors
+
+	// Creates an empty handle
+	CachedImage() = default;
+
+	// Shares the other handle image
+	CachedImage(const CachedImage& other);
+
+	// Shares the other handle image
+	CachedImage& operator=(const CachedImage& other);
+
+	// Takes the other handle image and leaves it empty
+	CachedImage(CachedImage&& other) noexcept;
+
+	// Takes the other handle image and leaves it empty
+	CachedImage& operator=(CachedImage&& other) noexcept;
+
+	// Releases the image
+	~CachedImage();
+
+	// Accessors
+
+	// Returns whether the handle points to an image
+	bool valid() const;
+
+	// Returns whether the handle points to an image
+	explicit operator bool() const;
+
+	// Returns a pointer to the image, nullptr if empty
+	const Image* get() const;
+
+	// Returns a pointer to the image, nullptr if empty
+	const Image* operator->() const;
+
+	// Returns a reference to the image, the handle must be valid
+	const Image& operator*() const;
+};
+
+// Static class that manages the process-wide image cache. It is thread safe.
+class ImageCache
+{
+public:
+	// The cache can not be instantiated
+
+	ImageCache() = delete;
+
+	// Returns a handle to the image stored in the bitmap file, loading it if it is
+	// not cached or it changed on disk. Returns an empty handle if loading fails.
+	static CachedImage load(const char* fmt_filename, ...);
+
+	// Sets the maximum number of bytes of pixels stored, evicts images if needed
+	static void set_budget(unsigned long long bytes);
+
+	// Returns the maximum number of bytes of pixels stored
+	static unsigned long long budget();
+
+	// Returns the number of bytes of pixels currently stored
+	static unsigned long long usage();
+
+	// Returns the number of images currently stored
+	static unsigned count();
+
+	// Evicts every image that is not held by any handle
+	static void clear();
+};
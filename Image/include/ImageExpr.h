@@ -0,0 +1,323 @@
+#pragma once
+#include "Image.h"
+
+/* IMAGE EXPRESSION HEADER
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Whole-image arithmetic with the Color operators, like
+
+	out = a * 0.5f + b * c - Color::Gray;
+
+where a, b and c are images of the same size. The operators do not compute
+anything, they build a small expression object that is only evaluated when
+it is assigned to an image, pixel by pixel in a single pass over the images,
+without temporary images in between.
+
+Every pixel gets exactly what the Color operators would give, images and
+colors can be added, subtracted, multiplied and divided between them, and
+multiplied and divided by int, float or double numbers, and negation inverts
+the colors keeping the alpha, as in Color.
+
+The expression is turned into a short list of operations when assigned, and
+the pixels go through it in blocks small enough to stay in the cache, with
+SSE2 for every operation and the blocks split across threads.
+
+The assigned image is resized to the size of the images in the expression,
+and it can be one of them. It throws if they do not have the same size.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+#define MAX_EXPR_OPS_ 32u // Maximum number of images, colors and operations in an expression
+
+// Operations of a compiled expression
+enum ExprOp : unsigned char
+{
+	EXPR_OP_IMAGE		= 0,	// Pixels of an image
+	EXPR_OP_COLOR		= 1,	// Single color
+	EXPR_OP_ADD			= 2,	// Color + Color
+	EXPR_OP_SUB			= 3,	// Color - Color
+	EXPR_OP_MUL			= 4,	// Color * Color
+	EXPR_OP_DIV			= 5,	// Color / Color
+	EXPR_OP_MUL_INT		= 6,	// Color * int
+	EXPR_OP_DIV_INT		= 7,	// Color / int
+	EXPR_OP_MUL_FLOAT	= 8,	// Color * float
+	EXPR_OP_DIV_FLOAT	= 9,	// Color / float
+	EXPR_OP_MUL_DOUBLE	= 10,	// Color * double
+	EXPR_OP_DIV_DOUBLE	= 11,	// Color / double
+	EXPR_OP_INVERT		= 12,	// -Color
+};
+
+// Single operation of a compiled expression
+struct ExprInstruction
+{
+	ExprOp op = EXPR_OP_IMAGE;		// Operation
+	unsigned char left = 0u;		// Instruction of the left or only operand
+	unsigned char right = 0u;		// Instruction of the right operand
+
+	const Image* image = nullptr;	// Image read by EXPR_OP_IMAGE
+	Color color;					// Color of EXPR_OP_COLOR
+	int integer = 0;				// Number of the int operations
+	double number = 0.0;			// Number of the float and double operations
+};
+
+// Expression compiled into operations, every one after the ones it uses
+struct ImageProgram
+{
+	ExprInstruction code[MAX_EXPR_OPS_];	// Operations, the last one gives the result
+	unsigned int size = 0u;					// Number of operations
+
+	// Appends the operation and returns its index
+	unsigned char push(const ExprInstruction& instruction)
+	{
+		code[size] = instruction;
+		return (unsigned char)size++;
+	}
+};
+
+/*
+-------------------------------------------------------------------------------------------------------
+Expression nodes
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Whether both types are the same
+template<typename A, typename B> constexpr bool expr_same_type = false;
+template<typename A> constexpr bool expr_same_type<A, A> = true;
+
+// Base of every expression node, Expr is the node itself
+template<typename Expr>
+struct ImageExpr
+{
+	// Returns the node
+	const Expr& self() const { return static_cast<const Expr&>(*this); }
+};
+
+// Image operand, only holds a reference so the image must outlive the expression
+struct ExprImage : ImageExpr<ExprImage>
+{
+	static constexpr unsigned ops = 1u;	// Number of operations it compiles into
+
+	const Image& image;	// Referenced image
+
+	ExprImage(const Image& image) : image{ image } {}
+
+	// Appends its operations to the program and returns the index of the last one
+	unsigned char emit(ImageProgram& program) const
+	{
+		ExprInstruction instruction;
+		instruction.op = EXPR_OP_IMAGE;
+		instruction.image = &image;
+		return program.push(instruction);
+	}
+};
+
+// Color operand, used for every pixel
+struct ExprColor : ImageExpr<ExprColor>
+{
+	static constexpr unsigned ops = 1u;	// Number of operations it compiles into
+
+	Color color;	// Stored color
+
+	ExprColor(const Color& color) : color{ color } {}
+
+	// Appends its operations to the program and returns the index of the last one
+	unsigned char emit(ImageProgram& program) const
+	{
+		ExprInstruction instruction;
+		instruction.op = EXPR_OP_COLOR;
+		instruction.color = color;
+		return program.push(instruction);
+	}
+};
+
+// Operation between two operands, Color + - * / Color
+template<ExprOp Op, typename Left, typename Right>
+struct ExprBinary : ImageExpr<ExprBinary<Op, Left, Right>>
+{
+	static constexpr unsigned ops = Left::ops + Right::ops + 1u;	// Number of operations it compiles into
+
+	Left left;		// Left operand
+	Right right;	// Right operand
+
+	ExprBinary(const Left& left, const Right& right) : left{ left }, right{ right } {}
+
+	// Appends its operations to the program and returns the index of the last one
+	unsigned char emit(ImageProgram& program) const
+	{
+		ExprInstruction instruction;
+		instruction.op = Op;
+		instruction.left = left.emit(program);
+		instruction.right = right.emit(program);
+		return program.push(instruction);
+	}
+};
+
+// Operation with a number, Color * int, float or double, or Color / them
+template<bool Divide, typename Operand, typename Number>
+struct ExprScalar : ImageExpr<ExprScalar<Divide, Operand, Number>>
+{
+	static constexpr unsigned ops = Operand::ops + 1u;	// Number of operations it compiles into
+
+	Operand operand;	// Color operand
+	Number number;		// Number operand
+
+	ExprScalar(const Operand& operand, Number number) : operand{ operand }, number{ number } {}
+
+	// Appends its operations to the program and returns the index of the last one
+	unsigned char emit(ImageProgram& program) const
+	{
+		ExprInstruction instruction;
+		instruction.left = operand.emit(program);
+
+		if constexpr (expr_same_type<Number, int>)
+		{
+			instruction.op = Divide ? EXPR_OP_DIV_INT : EXPR_OP_MUL_INT;
+			instruction.integer = number;
+		}
+		else
+		{
+			if constexpr (expr_same_type<Number, float>)
+				instruction.op = Divide ? EXPR_OP_DIV_FLOAT : EXPR_OP_MUL_FLOAT;
+			else
+				instruction.op = Divide ? EXPR_OP_DIV_DOUBLE : EXPR_OP_MUL_DOUBLE;
+			instruction.number = number;
+		}
+		return program.push(instruction);
+	}
+};
+
+// Color inversion, -Color
+template<typename Operand>
+struct ExprInvert : ImageExpr<ExprInvert<Operand>>
+{
+	static constexpr unsigned ops = Operand::ops + 1u;	// Number of operations it compiles into
+
+	Operand operand;	// Inverted operand
+
+	ExprInvert(const Operand& operand) : operand{ operand } {}
+
+	// Appends its operations to the program and returns the index of the last one
+	unsigned char emit(ImageProgram& program) const
+	{
+		ExprInstruction instruction;
+		instruction.op = EXPR_OP_INVERT;
+		instruction.left = operand.emit(program);
+		return program.push(instruction);
+	}
+};
+
+/*
+-------------------------------------------------------------------------------------------------------
+Operators
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Node stored for every operand type, images and colors are wrapped
+template<typename T> struct ExprNode			{ typedef T type; };
+template<> struct ExprNode<Image>				{ typedef ExprImage type; };
+template<> struct ExprNode<Color>				{ typedef ExprColor type; };
+
+// Expression nodes, the classes deriving from ImageExpr of themselves
+template<typename T>
+concept ImageExprNode = requires(const T& node) { static_cast<const ImageExpr<T>&>(node); };
+
+// Operands that make the operators build an expression, images and expression nodes
+template<typename T>
+concept ImageOperand = ImageExprNode<T> || expr_same_type<T, Image>;
+
+// Operands of the Color operators, image operands and colors
+template<typename T>
+concept ColorOperand = ImageOperand<T> || expr_same_type<T, Color>;
+
+// Numbers the Color operators accept
+template<typename T>
+concept ColorNumber = expr_same_type<T, int> || expr_same_type<T, float> || expr_same_type<T, double>;
+
+// Pairs of operands of the Color operators with at least one image operand
+template<typename Left, typename Right>
+concept ImageOperands = ColorOperand<Left> && ColorOperand<Right> && (ImageOperand<Left> || ImageOperand<Right>);
+
+// Saturated addition of every channel
+template<typename Left, typename Right> requires ImageOperands<Left, Right>
+ExprBinary<EXPR_OP_ADD, typename ExprNode<Left>::type, typename ExprNode<Right>::type> operator+(const Left& left, const Right& right)
+{
+	return { left, right };
+}
+
+// Saturated subtraction of every channel
+template<typename Left, typename Right> requires ImageOperands<Left, Right>
+ExprBinary<EXPR_OP_SUB, typename ExprNode<Left>::type, typename ExprNode<Right>::type> operator-(const Left& left, const Right& right)
+{
+	return { left, right };
+}
+
+// Product of every channel over 255
+template<typename Left, typename Right> requires ImageOperands<Left, Right>
+ExprBinary<EXPR_OP_MUL, typename ExprNode<Left>::type, typename ExprNode<Right>::type> operator*(const Left& left, const Right& right)
+{
+	return { left, right };
+}
+
+// Quotient of every channel times 255
+template<typename Left, typename Right> requires ImageOperands<Left, Right>
+ExprBinary<EXPR_OP_DIV, typename ExprNode<Left>::type, typename ExprNode<Right>::type> operator/(const Left& left, const Right& right)
+{
+	return { left, right };
+}
+
+// Every channel times the number, saturated
+template<typename Operand, typename Number> requires ImageOperand<Operand> && ColorNumber<Number>
+ExprScalar<false, typename ExprNode<Operand>::type, Number> operator*(const Operand& operand, Number number)
+{
+	return { operand, number };
+}
+
+// Every channel times the number, saturated
+template<typename Number, typename Operand> requires ImageOperand<Operand> && ColorNumber<Number>
+ExprScalar<false, typename ExprNode<Operand>::type, Number> operator*(Number number, const Operand& operand)
+{
+	return { operand, number };
+}
+
+// Every channel over the number, white if it is zero
+template<typename Operand, typename Number> requires ImageOperand<Operand> && ColorNumber<Number>
+ExprScalar<true, typename ExprNode<Operand>::type, Number> operator/(const Operand& operand, Number number)
+{
+	return { operand, number };
+}
+
+// Color inversion, keeps the alpha
+template<typename Operand> requires ImageOperand<Operand>
+ExprInvert<typename ExprNode<Operand>::type> operator-(const Operand& operand)
+{
+	return { operand };
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Evaluation
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Evaluates the expression into a new image
+template<typename Expr>
+Image::Image(const ImageExpr<Expr>& expression)
+{
+	*this = expression;
+}
+
+// Evaluates the expression into the image
+template<typename Expr>
+Image& Image::operator=(const ImageExpr<Expr>& expression)
+{
+	static_assert(Expr::ops <= MAX_EXPR_OPS_, "Image expression with too many operations");
+
+	ImageProgram program;
+	expression.self().emit(program);
+
+	if (!evaluate(program))
+		throw "Could not evaluate image expression";
+
+	return *this;
+}
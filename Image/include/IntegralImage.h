@@ -0,0 +1,91 @@
+#pragma once
+#include "Image.h"
+
+/* INTEGRAL IMAGE HEADER
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Summed-area table of an image, every entry stores the per-channel sums
+of all the pixels above and to the left of it, so the sum of any
+rectangle is obtained with four reads, independently of its size.
+
+Useful for box filters and adaptive thresholding, where the same
+window sums would otherwise be recomputed for every pixel.
+
+The sums are 32-bit and wrap around, but the rectangle sums are still
+exact as long as the rectangle has less than 16843009 pixels.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Per-channel sums of a group of pixels
+struct ColorSum
+{
+	unsigned int B = 0u;	// Sum of the blue values
+	unsigned int G = 0u;	// Sum of the green values
+	unsigned int R = 0u;	// Sum of the red values
+	unsigned int A = 0u;	// Sum of the transparency values
+};
+
+// Summed-area table with one 32-bit sum per channel, built in parallel
+class IntegralImage
+{
+private:
+	// Private variables
+
+	unsigned int* sums_ = nullptr;	// (height + 1) x (width + 1) entries of 4 sums, first row and column are zero
+
+	unsigned int width_	 = 0u;	// Width of the source image
+	unsigned int height_ = 0u;	// Height of the source image
+
+	// Returns the 4 sums of the entry, row and col go up to height and width
+	const unsigned int* entry(unsigned int row, unsigned int col) const;
+
+public:
+	// Constructors/Destructors
+
+	// Creates an empty table
+	IntegralImage() = default;
+
+	// Builds the table of the image
+	explicit IntegralImage(const Image& image);
+
+	// Copies the other table
+	IntegralImage(const IntegralImage& other);
+
+	// Copies the other table
+	IntegralImage& operator=(const IntegralImage& other);
+
+	// Takes the other table and leaves it empty
+	IntegralImage(IntegralImage&& other) noexcept;
+
+	// Takes the other table and leaves it empty
+	IntegralImage& operator=(IntegralImage&& other) noexcept;
+
+	// Frees the table
+	~IntegralImage();
+
+	// Functions
+
+	// Builds the table of the image, replacing the current one.
+	// Returns false if the table could not be allocated.
+	bool build(const Image& image);
+
+	// Returns the sums of the rectangle starting at the specified pixel coordinates
+	// with the specified size, which must be inside the image
+	ColorSum sum(unsigned int row, unsigned int col, unsigned int height, unsigned int width) const;
+
+	// Returns the mean color of the rectangle, rounded, which must be inside the image and not empty
+	Color mean(unsigned int row, unsigned int col, unsigned int height, unsigned int width) const;
+
+	// Getters
+
+	// Returns the width of the source image
+	unsigned width() const;
+
+	// Returns the height of the source image
+	unsigned height() const;
+
+	// Returns the table entries, (height + 1) rows of (width + 1) entries with the
+	// B, G, R and A sums each, the first row and column are zero
+	const unsigned int* data() const;
+};
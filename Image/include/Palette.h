@@ -0,0 +1,114 @@
+#pragma once
+#include "Image.h"
+
+/* PALETTE HEADER
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Color palettes of up to 256 entries, used to reduce images to indexed
+colors and store them as 4-bit or 8-bit bitmaps, four to eight times
+smaller than the 32-bit ones.
+
+Palettes are built from an image with median cut over a 15-bit color
+histogram. Images that already have few enough colors get exactly those.
+
+Mapping a color to its nearest entry is exact and fast. On creation the
+palette splits the color cube in 32x32x32 cells and stores for each cell
+the few entries that can be the nearest to any color inside it, so every
+lookup only compares against those, four at a time.
+
+Indexed colors ignore the alpha channel, palette entries are opaque.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+#define MAX_PALETTE_COLORS_ 256u // Maximum number of entries of a palette
+
+// Dithering used when mapping an image to palette indices
+enum PaletteDither : unsigned char
+{
+	PALETTE_DITHER_NONE				= 0,	// Every pixel gets its nearest entry
+	PALETTE_DITHER_ORDERED			= 1,	// 8x8 Bayer threshold added before the lookup
+	PALETTE_DITHER_FLOYD_STEINBERG	= 2,	// Error diffusion in serpentine order, single threaded
+};
+
+// Color palette with an exact cached nearest-entry lookup
+class Palette
+{
+private:
+	// Private variables
+
+	Color colors_[MAX_PALETTE_COLORS_] = {};	// Palette entries
+	unsigned int size_ = 0u;					// Number of entries
+
+	unsigned int* cell_offsets_ = nullptr;		// First candidate of every lookup cell, plus the end
+	Color* candidates_ = nullptr;				// Entries that can be nearest to each cell, index in the alpha
+
+	// Builds the nearest-entry lookup for the current entries. Returns false if out of memory.
+	bool build_lookup();
+
+	// Frees the lookup
+	void free_lookup();
+
+public:
+	// Constructors/Destructors
+
+	// Creates an empty palette
+	Palette() = default;
+
+	// Creates a palette with the specified colors, at most MAX_PALETTE_COLORS_
+	Palette(const Color* colors, unsigned int count);
+
+	// Creates a palette of at most max_colors entries for the image
+	explicit Palette(const Image& image, unsigned int max_colors = MAX_PALETTE_COLORS_);
+
+	// Copies the other palette
+	Palette(const Palette& other);
+
+	// Copies the other palette
+	Palette& operator=(const Palette& other);
+
+	// Takes the other palette and leaves it empty
+	Palette(Palette&& other) noexcept;
+
+	// Takes the other palette and leaves it empty
+	Palette& operator=(Palette&& other) noexcept;
+
+	// Frees the lookup
+	~Palette();
+
+	// Building
+
+	// Sets the palette entries, the alpha is set opaque. Returns false if count is
+	// zero or larger than MAX_PALETTE_COLORS_, or if out of memory.
+	bool set_colors(const Color* colors, unsigned int count);
+
+	// Builds a palette of at most max_colors entries for the image. If the image has
+	// that many distinct colors or less they are used as they are, otherwise the entries
+	// come from median cut. Returns false if the image is empty or out of memory.
+	bool build(const Image& image, unsigned int max_colors = MAX_PALETTE_COLORS_);
+
+	// Queries
+
+	// Returns the number of entries
+	unsigned size() const;
+
+	// Returns the palette entries
+	const Color* colors() const;
+
+	// Returns the entry at the specified index
+	const Color& operator[](unsigned int index) const;
+
+	// Returns the index of the entry nearest to the color, ignoring alpha. Ties go
+	// to the lowest index. The palette must not be empty.
+	unsigned char nearest(Color color) const;
+
+	// Mapping
+
+	// Stores in indices the palette index of every pixel of the image, row after row.
+	// Returns false if the palette is empty.
+	bool map(const Image& image, unsigned char* indices, PaletteDither dither = PALETTE_DITHER_NONE) const;
+
+	// Replaces every pixel of the image by its palette color, keeping the alpha.
+	// Returns false if the palette is empty.
+	bool apply(Image& image, PaletteDither dither = PALETTE_DITHER_NONE) const;
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+/* PIXEL ALLOCATOR HEADER
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Allocator hook used by the Image class for its pixel buffers. By default
+images use calloc/malloc and free, but any image can be given a different
+allocator, or the default can be changed for every new image.
+
+The PoolAllocator keeps the released buffers in size classes and hands
+them back to the next allocation of the same class, which removes the
+cost of allocating and freeing identical frame buffers every frame.
+
+Buffers can be requested without zeroing when the caller is going to
+overwrite all of them, like when loading an image from a file.
+
+The LargePageAllocator maps large buffers directly from the system, backed
+by huge pages to cut TLB misses over big render targets and atlases, and
+places their pages on the NUMA nodes of the threads that process them, or
+interleaves them over every node. Small buffers still use malloc.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+#define DEFAULT_POOL_CACHE_ (1ull << 30)	// Default maximum bytes retained by a PoolAllocator (1GB)
+#define POOL_SIZE_CLASSES_ 256u				// Number of size classes of a PoolAllocator
+#define HUGE_PAGE_BYTES_ (2ull << 20)		// Size of the huge pages aligned to, 2MB as in x86-64
+
+// Interface for allocating pixel buffers. Implementations must be thread safe
+// if images using them are created or destroyed from different threads.
+class PixelAllocator
+{
+public:
+	virtual ~PixelAllocator() = default;
+
+	// Returns a buffer of at least the specified bytes, zeroed if requested.
+	// Returns nullptr if the allocation fails.
+	virtual void* allocate(unsigned long long bytes, bool zero) = 0;
+
+	// Releases a buffer returned by allocate with the same number of bytes.
+	virtual void release(void* buffer, unsigned long long bytes) = 0;
+
+	// Returns the standard allocator, it uses calloc/malloc and free.
+	static PixelAllocator* standard();
+};
+
+// Allocator that recycles released buffers by size class. Each power of two
+// is divided in four classes, so a buffer wastes at most 25% of its size.
+// It is thread safe.
+class PoolAllocator : public PixelAllocator
+{
+private:
+	// Private variables
+
+	void* mutex_ = nullptr;							// Pointer to the internal mutex
+
+	void* free_[POOL_SIZE_CLASSES_] = {};			// Linked list of released buffers per class
+
+	unsigned long long max_cached_ = 0ull;			// Maximum bytes retained in the lists
+	unsigned long long cached_ = 0ull;				// Bytes currently retained in the lists
+
+	unsigned long long hits_ = 0ull;				// Allocations served from the lists
+	unsigned long long misses_ = 0ull;				// Allocations that went to the system
+
+public:
+	// Copy functions are deleted. Copies not allowed
+
+	PoolAllocator(const PoolAllocator&)				= delete;
+	PoolAllocator& operator=(const PoolAllocator&)	= delete;
+
+	// Constructor / Destructor
+
+	// Creates an empty pool that retains up to max_cached bytes of released buffers.
+	PoolAllocator(unsigned long long max_cached = DEFAULT_POOL_CACHE_);
+
+	// Frees all the retained buffers. Every buffer must have been released before.
+	~PoolAllocator();
+
+	// Allocator functions
+
+	// Returns a buffer of the size class, reusing a released one if available.
+	void* allocate(unsigned long long bytes, bool zero) override;
+
+	// Retains the buffer for reuse, or frees it if the pool is full.
+	void release(void* buffer, unsigned long long bytes) override;
+
+	// Frees all the retained buffers.
+	void trim();
+
+	// Getters
+
+	// Returns the bytes currently retained by the pool
+	unsigned long long cached() const;
+
+	// Returns the number of allocations served from released buffers
+	unsigned long long hits() const;
+
+	// Returns the number of allocations that went to the system
+	unsigned long long misses() const;
+};
+
+// Huge page use of a LargePageAllocator
+enum HugePages : unsigned char
+{
+	HUGE_PAGES_NONE			= 0,	// Regular pages
+	HUGE_PAGES_TRANSPARENT	= 1,	// Aligned to huge pages and advised to the kernel, which backs them when it can
+	HUGE_PAGES_EXPLICIT		= 2,	// Reserved huge pages, MAP_HUGETLB or large pages on Windows, transparent if none are left
+};
+
+// NUMA placement of the pages of a LargePageAllocator
+enum NUMAPlacement : unsigned char
+{
+	NUMA_PLACEMENT_DEFAULT		= 0,	// System policy, usually the node of the thread that first writes each page
+	NUMA_PLACEMENT_INTERLEAVE	= 1,	// Pages spread round robin over every allowed node
+	NUMA_PLACEMENT_FIRST_TOUCH	= 2,	// Pages touched on allocation by parallel threads, in the bands of the parallel kernels
+};
+
+// Allocator that maps buffers of at least min_bytes directly from the system,
+// with huge pages and NUMA placement, smaller ones use malloc. Mapped buffers are 
+// always zeroed. It is thread safe.
+class LargePageAllocator : public PixelAllocator
+{
+private:
+	// Private variables
+
+	HugePages huge_pages_;						// Huge page use
+	NUMAPlacement placement_;					// NUMA placement
+	unsigned long long min_bytes_;				// Smallest buffer that is mapped
+
+	volatile long long mapped_ = 0;				// Bytes currently mapped
+	volatile long long huge_allocations_ = 0;	// Buffers mapped with explicit huge pages
+	volatile long long fallbacks_ = 0;			// Explicit requests served with transparent ones
+
+	// Returns the bytes mapped for a buffer, rounded up to the page size used
+	unsigned long long mapping_bytes(unsigned long long bytes) const;
+
+public:
+	// Copy functions are deleted. Copies not allowed
+
+	LargePageAllocator(const LargePageAllocator&)				= delete;
+	LargePageAllocator& operator=(const LargePageAllocator&)	= delete;
+
+	// Constructor
+
+	// Creates an allocator with the specified huge page use and NUMA placement
+	// for the buffers of at least min_bytes.
+	LargePageAllocator(HugePages huge_pages = HUGE_PAGES_TRANSPARENT, NUMAPlacement placement = NUMA_PLACEMENT_DEFAULT, unsigned long long min_bytes = HUGE_PAGE_BYTES_);
+
+	// Allocator functions
+
+	// Maps a new buffer, or uses malloc if it is smaller than min_bytes.
+	void* allocate(unsigned long long bytes, bool zero) override;
+
+	// Unmaps the buffer, or frees it if it is smaller than min_bytes.
+	void release(void* buffer, unsigned long long bytes) override;
+
+	// Getters
+
+	// Returns the huge page use
+	HugePages huge_pages() const;
+
+	// Returns the NUMA placement
+	NUMAPlacement placement() const;
+
+	// Returns the bytes currently mapped, rounded up to pages
+	unsigned long long mapped() const;
+
+	// Returns the number of buffers mapped with explicit huge pages
+	unsigned long long huge_allocations() const;
+
+	// Returns the number of explicit huge page requests that fell back to transparent ones
+	unsigned long long fallbacks() const;
+};
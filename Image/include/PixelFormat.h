@@ -0,0 +1,37 @@
+#pragma once
+#include "Color.h"
+
+/* PIXEL FORMAT HEADER
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Conversions between the BGRA Color storage used by the Image class and
+other common pixel layouts, like RGBA for GPU uploads, RGB565 for small
+displays or grayscale for vision passes.
+
+The converters work on spans of pixels and use SSE2 when available, so
+consumers do not need to write their own loops over the Color fields.
+Formats without alpha are read back with full opacity.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Pixel layouts supported by the converters, byte order as stored in memory
+enum PixelFormat : unsigned char
+{
+	PIXEL_FORMAT_BGRA8	= 0,	// 4 bytes B, G, R, A, same as Color
+	PIXEL_FORMAT_RGBA8	= 1,	// 4 bytes R, G, B, A
+	PIXEL_FORMAT_BGR8	= 2,	// 3 bytes B, G, R
+	PIXEL_FORMAT_RGB8	= 3,	// 3 bytes R, G, B
+	PIXEL_FORMAT_GRAY8	= 4,	// 1 byte luma, (77 R + 150 G + 29 B) / 256
+	PIXEL_FORMAT_R8		= 5,	// 1 byte red channel
+	PIXEL_FORMAT_RGB565	= 6,	// 16-bit little endian, red in the high bits
+};
+
+// Returns the number of bytes per pixel of the format
+unsigned pixel_format_size(PixelFormat format);
+
+// Converts count colors into the specified format at dst
+void convert_to_format(const Color* src, void* dst, unsigned long long count, PixelFormat format);
+
+// Converts count pixels in the specified format at src into colors
+void convert_from_format(const void* src, Color* dst, unsigned long long count, PixelFormat format);
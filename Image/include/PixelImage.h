@@ -0,0 +1,379 @@
+#pragma once
+#include "Image.h"
+
+#include <cstring>
+
+/* PIXEL IMAGE HEADER
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Image template for pixel types other than the 8-bit BGRA Color, like
+single channel masks that use a quarter of the memory, or HDR render
+targets that keep their precision with 16-bit and float channels.
+
+The pixel buffers come from the same PixelAllocator as the Image class,
+and the conversions to and from Color images are resolved at compile
+time through the overloads of convert_pixels() for every pixel type.
+
+PixelImage<Color> behaves like a plain BGRA image, the Image class is
+kept as is for its file and copy-on-write functionalities.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+// IEEE 754 half precision float, stored as its 16 bits
+struct Half
+{
+	unsigned short bits = 0u;	// Sign, 5 exponent bits and 10 mantissa bits
+
+	// Default constructor, positive zero
+	constexpr Half() = default;
+
+	// Converts the float, rounding to the nearest half
+	Half(float value);
+
+	// Converts back to float, exact
+	operator float() const;
+};
+
+// Single 8-bit channel, the red channel when converted from a Color
+struct PixelR8
+{
+	unsigned char R = 0u;
+};
+
+// Two 8-bit channels, red and green
+struct PixelRG8
+{
+	unsigned char R = 0u;
+	unsigned char G = 0u;
+};
+
+// Four 16-bit channels, 65535 is the full value
+struct PixelRGBA16
+{
+	unsigned short R = 0u;
+	unsigned short G = 0u;
+	unsigned short B = 0u;
+	unsigned short A = 0u;
+};
+
+// Four half float channels, 1 is the full value
+struct PixelRGBA16F
+{
+	Half R;
+	Half G;
+	Half B;
+	Half A;
+};
+
+// Four float channels, 1 is the full value
+struct PixelRGBA32F
+{
+	float R = 0.f;
+	float G = 0.f;
+	float B = 0.f;
+	float A = 0.f;
+};
+
+// Conversions between spans of colors and pixels of the other types. The 8-bit types keep
+// the values, the 16-bit ones scale them by 257 and the float ones map them to [0, 1].
+// Converting back rounds to the nearest value and clamps the float ones.
+
+void convert_pixels(const Color* src, Color* dst, unsigned long long count);
+void convert_pixels(const Color* src, PixelR8* dst, unsigned long long count);
+void convert_pixels(const PixelR8* src, Color* dst, unsigned long long count);
+void convert_pixels(const Color* src, PixelRG8* dst, unsigned long long count);
+void convert_pixels(const PixelRG8* src, Color* dst, unsigned long long count);
+void convert_pixels(const Color* src, PixelRGBA16* dst, unsigned long long count);
+void convert_pixels(const PixelRGBA16* src, Color* dst, unsigned long long count);
+void convert_pixels(const Color* src, PixelRGBA16F* dst, unsigned long long count);
+void convert_pixels(const PixelRGBA16F* src, Color* dst, unsigned long long count);
+void convert_pixels(const Color* src, PixelRGBA32F* dst, unsigned long long count);
+void convert_pixels(const PixelRGBA32F* src, Color* dst, unsigned long long count);
+
+// Image class templated on the pixel type, stores the pixels as a row major array
+template<typename Pixel>
+class PixelImage
+{
+private:
+	// Private variables
+
+	Pixel* pixels_ = nullptr;	// Pointer to the image pixels
+
+	unsigned int width_	 = 0u;	// Stores the width of the image
+	unsigned int height_ = 0u;	// Stores the height of the image
+
+	PixelAllocator* allocator_ = nullptr;	// Allocator of the pixels, default one if nullptr
+
+	// Makes sure the pixel buffer holds width x height pixels, reusing the current
+	// buffer if the size matches. The content is only zeroed if requested.
+	bool allocate_pixels(unsigned int width, unsigned int height, bool zero);
+
+	// Releases the pixel buffer to the allocator
+	void free_pixels();
+
+public:
+	// Constructors/Destructors
+
+	// Creates an empty image, with no pixels
+	PixelImage() = default;
+
+	// Creates an image with the specified size, zeroed, using the specified
+	// allocator for the pixels or the default one of the Image class if nullptr
+	PixelImage(unsigned int width, unsigned int height, PixelAllocator* allocator = nullptr);
+
+	// Creates an image with the specified size filled with the value
+	PixelImage(unsigned int width, unsigned int height, const Pixel& value, PixelAllocator* allocator = nullptr);
+
+	// Creates an image converting the pixels of the color image
+	explicit PixelImage(const Image& image, PixelAllocator* allocator = nullptr);
+
+	// Copies the other image
+	PixelImage(const PixelImage& other);
+
+	// Copies the other image
+	PixelImage& operator=(const PixelImage& other);
+
+	// Takes the other image pixels and leaves it empty
+	PixelImage(PixelImage&& other) noexcept;
+
+	// Takes the other image pixels and leaves it empty
+	PixelImage& operator=(PixelImage&& other) noexcept;
+
+	// Frees the pixel pointer
+	~PixelImage();
+
+	// Getters
+
+	// Returns the pointer to the image pixels
+	Pixel* pixels() { return pixels_; }
+
+	// Returns the constant pointer to the image pixels
+	const Pixel* pixels() const { return pixels_; }
+
+	// Returns the image width
+	unsigned width() const { return width_; }
+
+	// Returns the image height
+	unsigned height() const { return height_; }
+
+	// Returns the allocator used for the pixels
+	PixelAllocator* allocator() const { return allocator_ ? allocator_ : Image::default_allocator(); }
+
+	// Accessors
+
+	// Returns a pixel reference to the specified pixel coordinates
+	Pixel& operator()(unsigned int row, unsigned int col) { return pixels_[(unsigned long long)row * width_ + col]; }
+
+	// Returns a constant pixel reference to the specified pixel coordinates
+	const Pixel& operator()(unsigned int row, unsigned int col) const { return pixels_[(unsigned long long)row * width_ + col]; }
+
+	// Functions
+
+	// Resizes the image, the pixels are zeroed. Returns false if they could not be allocated.
+	bool resize(unsigned int width, unsigned int height);
+
+	// Sets every pixel to the value
+	void fill(const Pixel& value);
+
+	// Resizes the image to the size of the color image and converts its pixels
+	bool from_image(const Image& image);
+
+	// Resizes the color image to the size of this image and converts the pixels into it
+	bool to_image(Image& image) const;
+};
+
+/*
+-------------------------------------------------------------------------------------------------------
+PixelImage template definitions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Makes sure the pixel buffer holds width x height pixels, reusing the current
+// buffer if the size matches. The content is only zeroed if requested.
+
+template<typename Pixel>
+bool PixelImage<Pixel>::allocate_pixels(unsigned int width, unsigned int height, bool zero)
+{
+	const unsigned long long bytes = (unsigned long long)width * height * sizeof(Pixel);
+
+	if (pixels_ && (unsigned long long)width_ * height_ * sizeof(Pixel) == bytes)
+	{
+		width_ = width;
+		height_ = height;
+		if (zero)
+			memset((void*)pixels_, 0, (size_t)bytes);
+		return true;
+	}
+
+	free_pixels();
+
+	if (!allocator_)
+		allocator_ = Image::default_allocator();
+
+	width_ = width;
+	height_ = height;
+	if (!bytes)
+		return true;
+
+	pixels_ = (Pixel*)allocator_->allocate(bytes, zero);
+	if (pixels_)
+		return true;
+
+	width_ = height_ = 0u;
+	return false;
+}
+
+// Releases the pixel buffer to the allocator
+
+template<typename Pixel>
+void PixelImage<Pixel>::free_pixels()
+{
+	if (pixels_)
+		allocator_->release(pixels_, (unsigned long long)width_ * height_ * sizeof(Pixel));
+
+	pixels_ = nullptr;
+	width_ = height_ = 0u;
+}
+
+// Creates an image with the specified size, zeroed
+
+template<typename Pixel>
+PixelImage<Pixel>::PixelImage(unsigned int width, unsigned int height, PixelAllocator* allocator)
+	:allocator_{ allocator }
+{
+	if (!allocate_pixels(width, height, true))
+		throw "Could not allocate image pixels";
+}
+
+// Creates an image with the specified size filled with the value
+
+template<typename Pixel>
+PixelImage<Pixel>::PixelImage(unsigned int width, unsigned int height, const Pixel& value, PixelAllocator* allocator)
+	:allocator_{ allocator }
+{
+	if (!allocate_pixels(width, height, false))
+		throw "Could not allocate image pixels";
+
+	fill(value);
+}
+
+// Creates an image converting the pixels of the color image
+
+template<typename Pixel>
+PixelImage<Pixel>::PixelImage(const Image& image, PixelAllocator* allocator)
+	:allocator_{ allocator }
+{
+	if (!from_image(image))
+		throw "Could not allocate image pixels";
+}
+
+// Copies the other image, using its same allocator
+
+template<typename Pixel>
+PixelImage<Pixel>::PixelImage(const PixelImage& other)
+	:allocator_{ other.allocator_ }
+{
+	if (!allocate_pixels(other.width_, other.height_, false))
+		throw "Could not allocate image pixels";
+
+	if (pixels_)
+		memcpy((void*)pixels_, (const void*)other.pixels_, (size_t)width_ * height_ * sizeof(Pixel));
+}
+
+// Copies the other image, keeping the current allocator
+
+template<typename Pixel>
+PixelImage<Pixel>& PixelImage<Pixel>::operator=(const PixelImage& other)
+{
+	if (&other == this)
+		return *this;
+
+	if (!allocate_pixels(other.width_, other.height_, false))
+		throw "Could not allocate image pixels";
+
+	if (pixels_)
+		memcpy((void*)pixels_, (const void*)other.pixels_, (size_t)width_ * height_ * sizeof(Pixel));
+
+	return *this;
+}
+
+// Takes the other image pixels and leaves it empty
+
+template<typename Pixel>
+PixelImage<Pixel>::PixelImage(PixelImage&& other) noexcept
+	:pixels_{ other.pixels_ }, width_{ other.width_ }, height_{ other.height_ }, allocator_{ other.allocator_ }
+{
+	other.pixels_ = nullptr;
+	other.width_ = other.height_ = 0u;
+}
+
+// Takes the other image pixels and leaves it empty
+
+template<typename Pixel>
+PixelImage<Pixel>& PixelImage<Pixel>::operator=(PixelImage&& other) noexcept
+{
+	if (&other == this)
+		return *this;
+
+	free_pixels();
+
+	pixels_ = other.pixels_;
+	width_ = other.width_;
+	height_ = other.height_;
+	allocator_ = other.allocator_;
+
+	other.pixels_ = nullptr;
+	other.width_ = other.height_ = 0u;
+	return *this;
+}
+
+// Frees the pixel pointer
+
+template<typename Pixel>
+PixelImage<Pixel>::~PixelImage()
+{
+	free_pixels();
+}
+
+// Resizes the image, the pixels are zeroed. Returns false if they could not be allocated.
+
+template<typename Pixel>
+bool PixelImage<Pixel>::resize(unsigned int width, unsigned int height)
+{
+	return allocate_pixels(width, height, true);
+}
+
+// Sets every pixel to the value
+
+template<typename Pixel>
+void PixelImage<Pixel>::fill(const Pixel& value)
+{
+	const unsigned long long size = (unsigned long long)width_ * height_;
+	for (unsigned long long i = 0; i < size; i++)
+		pixels_[i] = value;
+}
+
+// Resizes the image to the size of the color image and converts its pixels
+
+template<typename Pixel>
+bool PixelImage<Pixel>::from_image(const Image& image)
+{
+	if (!allocate_pixels(image.width(), image.height(), false))
+		return false;
+
+	convert_pixels(image.pixels(), pixels_, (unsigned long long)width_ * height_);
+	return true;
+}
+
+// Resizes the color image to the size of this image and converts the pixels into it
+
+template<typename Pixel>
+bool PixelImage<Pixel>::to_image(Image& image) const
+{
+	if (image.width() != width_ || image.height() != height_)
+		image = Image(width_, height_, Color::Transparent, image.allocator());
+
+	convert_pixels(pixels_, image.pixels(), (unsigned long long)width_ * height_);
+	return true;
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include "Image.h"
+
+/* RASTERIZER HEADER
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Software triangle rasterizer that draws into an Image, meant as a headless
+fallback for the 3D renderer on machines without a GPU.
+
+It follows the Direct3D conventions: vertices come in clip space, depth
+goes from 0 to 1, and clockwise triangles on screen are front facing.
+Colors and texture coordinates are interpolated with perspective
+correction, and the texture, if any, modulates the vertex colors.
+
+Every draw call is processed in three passes: the triangles are set up
+and clipped in parallel, then binned into 64x64 screen tiles, and the
+worker threads take tiles one by one and rasterize them with half-space
+edge functions evaluated 4 pixels at a time.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+#define RASTER_TILE_SIZE_ 64u // Side in pixels of the screen tiles
+
+// Vertex of a triangle to be rasterized
+struct RasterVertex
+{
+	float x = 0.f;	// Clip space position, divided by w to get the screen position
+	float y = 0.f;
+	float z = 0.f;	// Clip space depth, visible from 0 to w
+	float w = 1.f;	// Clip space w, 1 for already projected vertices
+
+	Color color = Color::White;	// Vertex color
+
+	float u = 0.f;	// Texture coordinates, repeat outside [0, 1]
+	float v = 0.f;
+};
+
+// Triangles discarded by their orientation on screen
+enum RasterCull : unsigned char
+{
+	RASTER_CULL_NONE	= 0,	// Draws every triangle
+	RASTER_CULL_BACK	= 1,	// Discards counterclockwise triangles
+	RASTER_CULL_FRONT	= 2,	// Discards clockwise triangles
+};
+
+// Internal triangle data after setup
+struct RasterTriangle;
+
+// Tile-based multithreaded triangle rasterizer with an optional float depth buffer
+class Rasterizer
+{
+private:
+	// Private variables
+
+	Image* target_ = nullptr;		// Image drawn into
+	unsigned int width_ = 0u;		// Width of the target when it was set
+	unsigned int height_ = 0u;		// Height of the target when it was set
+
+	float* depth_ = nullptr;		// Depth buffer, nullptr if disabled
+	bool depth_test_ = true;		// Whether the depth buffer is tested and written
+
+	const Image* texture_ = nullptr;	// Texture sampled, nullptr if none
+	RasterCull cull_ = RASTER_CULL_NONE;// Triangles discarded by orientation
+
+	RasterTriangle* triangles_ = nullptr;	// Triangles set up by the current draw call
+	unsigned int triangle_capacity_ = 0u;	// Size of the triangle array
+
+	unsigned int* bin_offsets_ = nullptr;	// First bin entry of every tile, plus the end
+	unsigned int* bins_ = nullptr;			// Triangle indices of every tile, in draw order
+	unsigned int bin_capacity_ = 0u;		// Size of the bin entries array
+
+	// Sets up, bins and rasterizes the triangles given by the indices, or by consecutive vertices if nullptr
+	void draw_triangles(const RasterVertex* vertices, const unsigned int* indices, unsigned int triangle_count);
+
+public:
+	// Constructors/Destructors
+
+	// Creates a rasterizer without a target
+	Rasterizer() = default;
+
+	// Creates a rasterizer drawing into the target
+	explicit Rasterizer(Image* target, bool depth = true);
+
+	Rasterizer(const Rasterizer&) = delete;
+	Rasterizer& operator=(const Rasterizer&) = delete;
+
+	// Frees the depth buffer and the internal arrays
+	~Rasterizer();
+
+	// Settings
+
+	// Sets the image drawn into and allocates a depth buffer of its size if requested.
+	// It must be called again if the target is resized. Returns false if out of memory.
+	bool set_target(Image* target, bool depth = true);
+
+	// Enables or disables the depth test, only works if there is a depth buffer
+	void set_depth_test(bool enable);
+
+	// Sets the texture modulating the vertex colors, nullptr for none
+	void set_texture(const Image* texture);
+
+	// Sets which triangles are discarded by their orientation on screen
+	void set_cull(RasterCull cull);
+
+	// Returns the depth buffer, nullptr if there is none
+	const float* depth() const;
+
+	// Drawing
+
+	// Fills the target with the color and the depth buffer with the depth
+	void clear(Color color, float depth = 1.f);
+
+	// Draws a list of triangles, every 3 consecutive vertices form a triangle
+	void draw(const RasterVertex* vertices, unsigned int vertex_count);
+
+	// Draws a list of triangles, every 3 consecutive indices form a triangle
+	void draw_indexed(const RasterVertex* vertices, const unsigned int* indices, unsigned int index_count);
+};
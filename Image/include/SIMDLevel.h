@@ -0,0 +1,39 @@
+#pragma once
+
+/* SIMD LEVEL HEADER
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Vector instruction sets used by the pixel kernels of the library.
+
+The library is built for SSE2 on x86, but the kernels that gain from wider
+instructions also have SSSE3, AVX2 or AVX-512 versions. The processor is
+checked once, the first time one of them runs, and every kernel picks the
+best version it has for the supported level, so the same binary runs on old
+and new processors.
+
+The level can be lowered for testing or comparisons by setting the
+IMAGE_SIMD_LEVEL environment variable before starting the program, to
+scalar, sse2, ssse3, avx2 or avx512. A level above the supported one is
+ignored. Kernels without versions for other levels keep using SSE2.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Vector instruction sets, every one includes the ones below
+enum SIMDLevel : unsigned char
+{
+	SIMD_LEVEL_SCALAR	= 0,	// No vector instructions
+	SIMD_LEVEL_SSE2		= 1,	// 128-bit integer and float vectors, every x86-64 processor
+	SIMD_LEVEL_SSSE3	= 2,	// Adds byte shuffles
+	SIMD_LEVEL_AVX2		= 3,	// 256-bit integer vectors
+	SIMD_LEVEL_AVX512	= 4,	// 512-bit vectors with byte and word operations (F and BW)
+};
+
+// Returns the level used by the kernels, the supported one unless lowered by IMAGE_SIMD_LEVEL
+SIMDLevel simd_level();
+
+// Returns the highest level supported by both the processor and the build
+SIMDLevel simd_supported_level();
+
+// Returns the lowercase name of the level, as accepted by IMAGE_SIMD_LEVEL
+const char* simd_level_name(SIMDLevel level);
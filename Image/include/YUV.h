@@ -0,0 +1,73 @@
+#pragma once
+
+/* YUV HEADER
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Description of the YUV frames used by video encoders and decoders, so that
+images can be converted into them and back with Image::export_yuv() and
+Image::import_yuv().
+
+The planar I420 and semi-planar NV12 layouts store the chroma at half the
+width and height, the packed YUY2 layout only at half the width. Both the
+BT.601 and BT.709 matrices are supported, with limited (16 to 235) or full
+(0 to 255) range.
+
+Chroma samples are sited at the center of the pixels they cover. Exporting
+averages them, importing interpolates them bilinearly or replicates them.
+The conversions use fixed point arithmetic, SSE2 when available, and split
+the rows across threads. Alpha is dropped on export and full on import.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Memory layouts of the YUV frames
+enum YUVLayout : unsigned char
+{
+	YUV_LAYOUT_I420	= 0,	// Y plane, then U and V planes at half width and height
+	YUV_LAYOUT_NV12	= 1,	// Y plane, then a plane of U V pairs at half width and height
+	YUV_LAYOUT_YUY2	= 2,	// Single plane of Y0 U Y1 V for every two pixels
+};
+
+// Color matrices, from the ITU-R recommendations
+enum YUVMatrix : unsigned char
+{
+	YUV_MATRIX_BT601 = 0,	// Standard definition video, also JPEG
+	YUV_MATRIX_BT709 = 1,	// High definition video
+};
+
+// Value ranges of the samples
+enum YUVRange : unsigned char
+{
+	YUV_RANGE_LIMITED	= 0,	// Luma from 16 to 235 and chroma from 16 to 240, usual for video
+	YUV_RANGE_FULL		= 1,	// Every sample from 0 to 255
+};
+
+// Chroma upsampling used when importing subsampled frames
+enum YUVUpsampling : unsigned char
+{
+	YUV_UPSAMPLING_NEAREST	= 0,	// Every chroma sample is replicated over its pixels
+	YUV_UPSAMPLING_BILINEAR	= 1,	// Weighted 3:1 with the nearest neighbors, smoother edges
+};
+
+// YUV frame, it does not own the planes. Only the planes used by the
+// layout are read, a zero stride means the rows are tightly packed.
+struct YUVFrame
+{
+	unsigned char* planes[3] = {};				// Y, U and V planes, Y and UV for NV12, packed for YUY2
+	unsigned long long strides[3] = {};			// Bytes between rows of every plane
+
+	unsigned int width = 0u;					// Width in pixels
+	unsigned int height = 0u;					// Height in pixels
+
+	YUVLayout layout = YUV_LAYOUT_I420;			// Memory layout
+	YUVMatrix matrix = YUV_MATRIX_BT709;		// Color matrix
+	YUVRange range = YUV_RANGE_LIMITED;			// Range of the samples
+};
+
+// Returns the number of bytes of a tightly packed frame of the specified layout and size
+unsigned long long yuv_frame_size(YUVLayout layout, unsigned int width, unsigned int height);
+
+// Sets the frame up over a tightly packed buffer of yuv_frame_size() bytes,
+// with the planes one after the other, as most encoders expect them.
+void yuv_frame_wrap(YUVFrame* frame, void* buffer, YUVLayout layout, unsigned int width, unsigned int height,
+	YUVMatrix matrix = YUV_MATRIX_BT709, YUVRange range = YUV_RANGE_LIMITED);
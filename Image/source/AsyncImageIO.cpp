@@ -0,0 +1,825 @@
+#include "AsyncImageIO.h"
+#include "BMP.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef __NR_io_uring_setup
+#define IMAGE_IO_URING_
+#endif
+#endif
+
+#define HEADER_SLOT_BYTES_ 64u		// Registered bytes of every request, both headers fit
+#define MAX_TRANSFER_IOVS_ 1024u	// Vectors of a single read or write, IOV_MAX on Linux
+
+/*
+-------------------------------------------------------------------------------------------------------
+Internal state
+-------------------------------------------------------------------------------------------------------
+*/
+
+#ifdef IMAGE_IO_URING_
+// Step a request is waiting for
+enum AsyncStage : unsigned char
+{
+    ASYNC_STAGE_FREE    = 0,    // Slot not in use
+    ASYNC_STAGE_HEADER  = 1,    // Reading the headers into the registered slot
+    ASYNC_STAGE_PIXELS  = 2,    // Reading 32-bit rows straight into the pixels
+    ASYNC_STAGE_FILE    = 3,    // Reading the rest of the file to decode it from memory
+    ASYNC_STAGE_WRITE   = 4,    // Writing the headers and rows straight from the pixels
+};
+
+// Load or save in flight. Reads and writes are vectors of up to MAX_TRANSFER_IOVS_
+// segments, which are resubmitted from where they stopped after a short transfer.
+struct AsyncRequest
+{
+    unsigned long long id = 0ull;       // Identifier given to the caller
+    Image* image = nullptr;             // Image loaded into
+    const Image* source = nullptr;      // Image saved from
+    int fd = -1;                        // Open file
+    AsyncStage stage = ASYNC_STAGE_FREE;
+
+    unsigned long long file_size = 0ull;// Size of the file loaded
+    unsigned char* file = nullptr;      // Whole file, for the formats decoded from memory
+
+    unsigned long long offset = 0ull;   // File offset of the next transfer
+    iovec* iov = nullptr;               // Segments of the current transfer, allocated on first use
+    unsigned iov_first = 0u;            // First segment not transferred yet
+    unsigned iov_count = 0u;            // Segments of the current transfer
+
+    unsigned next_row = 0u;             // Next stored row added to a transfer
+    bool bottom_up = false;             // Whether the stored rows go from the bottom up
+};
+#endif
+
+struct AsyncIOState
+{
+    AsyncIOBackend backend = ASYNC_IO_STDIO;
+    unsigned depth = 0u;
+
+    AsyncIOCompletion* done = nullptr;  // Finished requests not collected yet, oldest first
+    unsigned done_count = 0u;
+    unsigned done_capacity = 0u;
+
+    unsigned long long next_id = 1ull;
+    AsyncIOStats stats;
+
+#ifdef IMAGE_IO_URING_
+    AsyncRequest* requests = nullptr;   // Slots of the requests, depth long
+    unsigned* free_slots = nullptr;     // Stack of the free slots
+    unsigned free_count = 0u;
+
+    unsigned char* headers = nullptr;   // Header slot of every request, registered if possible
+    bool registered = false;
+
+    int ring = -1;                      // io_uring file descriptor
+    void* sq_map = nullptr;             // Submission ring mapping
+    size_t sq_map_bytes = 0u;
+    void* cq_map = nullptr;             // Completion ring mapping, same as sq_map with a single mapping
+    size_t cq_map_bytes = 0u;
+    io_uring_sqe* sqes = nullptr;       // Submission entries
+    size_t sqes_bytes = 0u;
+
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    unsigned to_submit = 0u;            // Entries queued since the last io_uring_enter
+#endif
+
+    // Resizes the image without zeroing, a friend of Image
+    static bool allocate_pixels(Image* image, unsigned width, unsigned height)
+    {
+        return image->allocate_pixels(width, height, false);
+    }
+};
+
+// Stores a finished request for complete()
+
+static void push_completion(AsyncIOState* state, unsigned long long id, bool save, bool ok)
+{
+    if (state->done_count == state->done_capacity)
+    {
+        const unsigned capacity = state->done_capacity ? 2u * state->done_capacity : 64u;
+        AsyncIOCompletion* done = (AsyncIOCompletion*)realloc(state->done, capacity * sizeof(AsyncIOCompletion));
+        if (!done)
+            return;
+
+        state->done = done;
+        state->done_capacity = capacity;
+    }
+
+    AsyncIOCompletion& completion = state->done[state->done_count++];
+    completion.id = id;
+    completion.save = save;
+    completion.ok = ok;
+
+    if (!ok)
+        state->stats.failed++;
+}
+
+#ifdef IMAGE_IO_URING_
+/*
+-------------------------------------------------------------------------------------------------------
+Ring helpers
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Maps the rings of a new io_uring with room for depth entries in flight and
+// registers the header slots. Returns false if io_uring is not available.
+
+static bool ring_setup(AsyncIOState* state)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = 2u * state->depth;
+
+    state->ring = (int)syscall(__NR_io_uring_setup, state->depth, &params);
+    if (state->ring < 0)
+    {
+        // Kernels before 5.5 do not know the completion size flag, twice is their default
+        memset(&params, 0, sizeof(params));
+        state->ring = (int)syscall(__NR_io_uring_setup, state->depth, &params);
+        if (state->ring < 0)
+            return false;
+    }
+
+    state->sq_map_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    state->cq_map_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && state->cq_map_bytes > state->sq_map_bytes)
+        state->sq_map_bytes = state->cq_map_bytes;
+
+    state->sq_map = mmap(nullptr, state->sq_map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, state->ring, IORING_OFF_SQ_RING);
+    if (state->sq_map == MAP_FAILED)
+    {
+        state->sq_map = nullptr;
+        return false;
+    }
+
+    if (single)
+        state->cq_map = state->sq_map;
+    else
+    {
+        state->cq_map = mmap(nullptr, state->cq_map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, state->ring, IORING_OFF_CQ_RING);
+        if (state->cq_map == MAP_FAILED)
+        {
+            state->cq_map = nullptr;
+            return false;
+        }
+    }
+
+    state->sqes_bytes = params.sq_entries * sizeof(io_uring_sqe);
+    state->sqes = (io_uring_sqe*)mmap(nullptr, state->sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, state->ring, IORING_OFF_SQES);
+    if ((void*)state->sqes == MAP_FAILED)
+    {
+        state->sqes = nullptr;
+        return false;
+    }
+
+    char* sq = (char*)state->sq_map;
+    state->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    state->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    state->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+    char* cq = (char*)state->cq_map;
+    state->cq_head = (unsigned*)(cq + params.cq_off.head);
+    state->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    state->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    state->cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // Without registration, as when the locked memory limit is too low, headers use plain reads
+    iovec headers = { state->headers, (size_t)state->depth * HEADER_SLOT_BYTES_ };
+    state->registered = syscall(__NR_io_uring_register, state->ring, IORING_REGISTER_BUFFERS, &headers, 1) == 0;
+    return true;
+}
+
+// Unmaps the rings and closes the io_uring
+
+static void ring_teardown(AsyncIOState* state)
+{
+    if (state->sqes)
+        munmap(state->sqes, state->sqes_bytes);
+    if (state->cq_map && state->cq_map != state->sq_map)
+        munmap(state->cq_map, state->cq_map_bytes);
+    if (state->sq_map)
+        munmap(state->sq_map, state->sq_map_bytes);
+    if (state->ring >= 0)
+        close(state->ring);
+
+    state->sqes = nullptr;
+    state->sq_map = state->cq_map = nullptr;
+    state->ring = -1;
+}
+
+// Returns a cleared submission entry for the request. There is always room,
+// every request has at most one entry queued or in flight.
+
+static io_uring_sqe* next_sqe(AsyncIOState* state, unsigned slot)
+{
+    const unsigned tail = *state->sq_tail;
+    const unsigned index = tail & *state->sq_mask;
+
+    io_uring_sqe* sqe = &state->sqes[index];
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    sqe->user_data = slot;
+
+    state->sq_array[index] = index;
+    __atomic_store_n(state->sq_tail, tail + 1u, __ATOMIC_RELEASE);
+    state->to_submit++;
+    return sqe;
+}
+
+// Submits the queued entries and waits for min_complete completions.
+// Returns false if the ring failed.
+
+static bool ring_enter(AsyncIOState* state, unsigned min_complete)
+{
+    for (;;)
+    {
+        const unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0u;
+        const long submitted = syscall(__NR_io_uring_enter, state->ring, state->to_submit, min_complete, flags, nullptr, 0);
+        state->stats.system_calls++;
+
+        if (submitted >= 0)
+        {
+            state->to_submit -= (unsigned)submitted;
+            if (!state->to_submit || min_complete)
+                return true;
+        }
+        else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return false;
+    }
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Request steps
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Queues the rest of the current transfer, a read or a write of its segments
+
+static void queue_transfer(AsyncIOState* state, unsigned slot)
+{
+    AsyncRequest& request = state->requests[slot];
+
+    io_uring_sqe* sqe = next_sqe(state, slot);
+    sqe->opcode = request.stage == ASYNC_STAGE_WRITE ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = request.fd;
+    sqe->off = request.offset;
+    sqe->addr = (unsigned long long)(uintptr_t)(request.iov + request.iov_first);
+    sqe->len = request.iov_count - request.iov_first;
+}
+
+// Queues reading the headers of the file into the header slot of the request
+
+static void queue_header(AsyncIOState* state, unsigned slot)
+{
+    AsyncRequest& request = state->requests[slot];
+    unsigned char* header = state->headers + (size_t)slot * HEADER_SLOT_BYTES_;
+    const unsigned bytes = request.file_size < HEADER_SLOT_BYTES_ ? (unsigned)request.file_size : HEADER_SLOT_BYTES_;
+
+    if (!state->registered)
+    {
+        request.iov[0] = { header, bytes };
+        request.iov_first = 0u;
+        request.iov_count = 1u;
+        queue_transfer(state, slot);
+        return;
+    }
+
+    io_uring_sqe* sqe = next_sqe(state, slot);
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = request.fd;
+    sqe->off = 0ull;
+    sqe->addr = (unsigned long long)(uintptr_t)header;
+    sqe->len = bytes;
+    sqe->buf_index = 0;
+}
+
+// Fills the next segments with the stored rows of the image, in the order of the
+// file, and for the first write of a save the headers before them. Returns false
+// once every row is done.
+
+static bool next_rows(AsyncIOState* state, unsigned slot)
+{
+    AsyncRequest& request = state->requests[slot];
+    const Image& image = request.source ? *request.source : *request.image;
+    const unsigned width = image.width(), height = image.height();
+
+    request.iov_first = request.iov_count = 0u;
+    if (request.stage == ASYNC_STAGE_WRITE && request.offset == 0ull)
+        request.iov[request.iov_count++] = { state->headers + (size_t)slot * HEADER_SLOT_BYTES_, BMP_HEADER_SIZE_ };
+
+    const Color* pixels = image.pixels();
+    for (; request.next_row < height && request.iov_count < MAX_TRANSFER_IOVS_; request.next_row++)
+    {
+        const unsigned row = request.bottom_up ? height - 1u - request.next_row : request.next_row;
+        request.iov[request.iov_count++] = { (void*)(pixels + (size_t)row * width), (size_t)width * sizeof(Color) };
+    }
+    return request.iov_count != 0u;
+}
+
+// Closes the file of the request, frees its slot and reports it
+
+static void finish(AsyncIOState* state, unsigned slot, bool ok)
+{
+    AsyncRequest& request = state->requests[slot];
+
+    if (request.fd >= 0)
+        close(request.fd);
+    free(request.file);
+
+    if (!ok && request.image)
+        AsyncIOState::allocate_pixels(request.image, 0u, 0u);
+
+    push_completion(state, request.id, request.source != nullptr, ok);
+
+    request.fd = -1;
+    request.file = nullptr;
+    request.image = nullptr;
+    request.source = nullptr;
+    request.stage = ASYNC_STAGE_FREE;
+    state->free_slots[state->free_count++] = slot;
+    state->stats.in_flight--;
+}
+
+// Picks how to load the file once its headers are read. Plain 32-bit files are read
+// straight into the pixels, the rest whole into memory to be decoded from there.
+// Returns false if the file can not be loaded.
+
+static bool start_pixels(AsyncIOState* state, unsigned slot, unsigned header_bytes)
+{
+    AsyncRequest& request = state->requests[slot];
+    const unsigned char* data = state->headers + (size_t)slot * HEADER_SLOT_BYTES_;
+
+    BMPHeader header;
+    if (header_bytes < BMP_HEADER_SIZE_ || !bmp_parse_header(data, &header) || !bmp_loadable(header))
+        return false;
+
+    const unsigned width = (unsigned)header.width;
+    const unsigned height = (unsigned)(header.height < 0 ? -header.height : header.height);
+    const unsigned long long pixel_bytes = (unsigned long long)width * height * sizeof(Color);
+
+    if (header.bit_count == 32u && header.compression == BMP_RGB_ && header.pixel_offset + pixel_bytes <= request.file_size)
+    {
+        if (!AsyncIOState::allocate_pixels(request.image, width, height))
+            return false;
+
+        request.stage = ASYNC_STAGE_PIXELS;
+        request.offset = header.pixel_offset;
+        request.bottom_up = header.height > 0;
+        request.next_row = 0u;
+        state->stats.direct_loads++;
+
+        if (next_rows(state, slot))
+            queue_transfer(state, slot);
+        else
+            finish(state, slot, true);
+        return true;
+    }
+
+    request.file = (unsigned char*)malloc((size_t)request.file_size);
+    if (!request.file)
+        return false;
+
+    memcpy(request.file, data, header_bytes);
+    request.stage = ASYNC_STAGE_FILE;
+    request.offset = header_bytes;
+    request.iov[0] = { request.file + header_bytes, (size_t)(request.file_size - header_bytes) };
+    request.iov_first = 0u;
+    request.iov_count = 1u;
+
+    if (request.file_size > header_bytes)
+        queue_transfer(state, slot);
+    else
+        finish(state, slot, request.image->load_memory(request.file, request.file_size));
+    return true;
+}
+
+// Advances the request by a finished read or write of the specified bytes, or error,
+// and queues its next step
+
+static void advance(AsyncIOState* state, unsigned slot, int result)
+{
+    AsyncRequest& request = state->requests[slot];
+    if (request.stage == ASYNC_STAGE_FREE)
+        return;
+
+    // A read that returns nothing means the file is shorter than its headers say.
+    // After the ring failed the request is not continued, see abandon_ring().
+    if (result <= 0 || state->backend != ASYNC_IO_URING)
+    {
+        finish(state, slot, false);
+        return;
+    }
+
+    if (request.stage == ASYNC_STAGE_WRITE)
+        state->stats.bytes_written += (unsigned)result;
+    else
+        state->stats.bytes_read += (unsigned)result;
+
+    if (request.stage == ASYNC_STAGE_HEADER)
+    {
+        if (!start_pixels(state, slot, (unsigned)result))
+            finish(state, slot, false);
+        return;
+    }
+
+    // Skip the segments done, resubmitting from the middle of a segment if it was short
+    size_t bytes = (size_t)result;
+    request.offset += bytes;
+    while (request.iov_first < request.iov_count && bytes >= request.iov[request.iov_first].iov_len)
+        bytes -= request.iov[request.iov_first++].iov_len;
+
+    if (request.iov_first < request.iov_count)
+    {
+        iovec& segment = request.iov[request.iov_first];
+        segment.iov_base = (char*)segment.iov_base + bytes;
+        segment.iov_len -= bytes;
+        queue_transfer(state, slot);
+        return;
+    }
+
+    if (request.stage == ASYNC_STAGE_FILE)
+        finish(state, slot, request.image->load_memory(request.file, request.file_size));
+    else if (next_rows(state, slot))
+        queue_transfer(state, slot);
+    else
+        finish(state, slot, true);
+}
+
+// Advances every request with a completion waiting in the ring
+
+static void reap(AsyncIOState* state)
+{
+    unsigned head = *state->cq_head;
+    const unsigned tail = __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++)
+    {
+        const io_uring_cqe& cqe = state->cqes[head & *state->cq_mask];
+        advance(state, (unsigned)cqe.user_data, cqe.res);
+    }
+    __atomic_store_n(state->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Fails every request after io_uring_enter failed and switches to stdio. Entries not
+// submitted yet are taken back from the ring and their requests failed right away. The
+// ones already in the kernel are failed as their completions arrive, so no pixels or
+// slots are released while the kernel may still read or write them.
+
+static void abandon_ring(AsyncIOState* state)
+{
+    const unsigned tail = *state->sq_tail;
+    const unsigned first = tail - state->to_submit;
+
+    for (unsigned i = first; i != tail; i++)
+        finish(state, (unsigned)state->sqes[state->sq_array[i & *state->sq_mask]].user_data, false);
+
+    __atomic_store_n(state->sq_tail, first, __ATOMIC_RELEASE);
+    state->to_submit = 0u;
+    state->backend = ASYNC_IO_STDIO;
+
+    // Completions keep arriving in the mapped ring even if waiting for them fails
+    while (state->stats.in_flight)
+    {
+        if (syscall(__NR_io_uring_enter, state->ring, 0u, 1u, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+            usleep(1000u);
+        reap(state);
+    }
+}
+
+// Submits the queued entries and advances the requests until at least count more
+// completions are stored or nothing is in flight. If the ring fails every request
+// still in flight is reported as failed, see abandon_ring().
+
+static void drive(AsyncIOState* state, unsigned count)
+{
+    const unsigned target = state->done_count + count;
+
+    do
+    {
+        const bool wait = state->done_count < target && state->stats.in_flight;
+        if ((state->to_submit || wait) && !ring_enter(state, wait ? 1u : 0u))
+        {
+            abandon_ring(state);
+            return;
+        }
+        reap(state);
+    }
+    while (state->done_count < target && state->stats.in_flight);
+}
+
+// Opens the file and queues the first step of the request. Returns false if the
+// file can not be opened, it is then reported as failed.
+
+static bool start_request(AsyncIOState* state, unsigned slot, Image* image, const Image* source, const char* filename)
+{
+    AsyncRequest& request = state->requests[slot];
+
+    request.image = image;
+    request.source = source;
+    request.offset = 0ull;
+    request.next_row = 0u;
+    request.fd = source ? open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666) : open(filename, O_RDONLY | O_CLOEXEC);
+
+    if (!request.iov)
+        request.iov = (iovec*)malloc(MAX_TRANSFER_IOVS_ * sizeof(iovec));
+
+    if (request.fd < 0 || !request.iov)
+        return false;
+
+    if (source)
+    {
+        // Same file as Image::save(), bottom-up 32-bit BGRA straight from the pixels
+        const uint32_t width = source->width(), height = source->height();
+        const uint32_t pixel_bytes = width * height * (uint32_t)sizeof(Color);
+
+        uint8_t* header = state->headers + (size_t)slot * HEADER_SLOT_BYTES_;
+        memset(header, 0, BMP_HEADER_SIZE_);
+        header[0] = 'B';
+        header[1] = 'M';
+        put_le32(header + 2, BMP_HEADER_SIZE_ + pixel_bytes);
+        put_le32(header + 10, BMP_HEADER_SIZE_);
+        put_le32(header + 14, BMP_INFO_HEADER_SIZE_);
+        put_le32(header + 18, width);
+        put_le32(header + 22, height);
+        put_le16(header + 26, 1u);
+        put_le16(header + 28, 32u);
+        put_le32(header + 30, BMP_RGB_);
+        put_le32(header + 34, pixel_bytes);
+        put_le32(header + 38, 2835u);
+        put_le32(header + 42, 2835u);
+
+        request.stage = ASYNC_STAGE_WRITE;
+        request.bottom_up = true;
+        next_rows(state, slot);
+        queue_transfer(state, slot);
+        return true;
+    }
+
+    struct stat info;
+    if (fstat(request.fd, &info) != 0 || info.st_size < (off_t)BMP_HEADER_SIZE_)
+        return false;
+
+    request.file_size = (unsigned long long)info.st_size;
+    request.stage = ASYNC_STAGE_HEADER;
+    queue_header(state, slot);
+    return true;
+}
+#endif
+
+/*
+-------------------------------------------------------------------------------------------------------
+Constructors / Destructors
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Creates the object, setting up the io_uring if allowed and available
+
+AsyncImageIO::AsyncImageIO(unsigned int depth, bool allow_uring)
+{
+    state_ = new AsyncIOState;
+    state_->depth = depth ? depth : 1u;
+
+#ifdef IMAGE_IO_URING_
+    if (!allow_uring)
+        return;
+
+    AsyncIOState* state = state_;
+    state->requests = new AsyncRequest[state->depth];
+    state->free_slots = (unsigned*)malloc(state->depth * sizeof(unsigned));
+    state->headers = (unsigned char*)calloc(state->depth, HEADER_SLOT_BYTES_);
+
+    if (state->free_slots && state->headers && ring_setup(state))
+    {
+        for (unsigned i = 0u; i < state->depth; i++)
+            state->free_slots[i] = state->depth - 1u - i;
+        state->free_count = state->depth;
+        state->backend = ASYNC_IO_URING;
+        return;
+    }
+
+    ring_teardown(state);
+    delete[] state->requests;
+    free(state->free_slots);
+    free(state->headers);
+    state->requests = nullptr;
+    state->free_slots = nullptr;
+    state->headers = nullptr;
+#else
+    (void)allow_uring;
+#endif
+}
+
+// Waits for every request in flight and releases the ring
+
+AsyncImageIO::~AsyncImageIO()
+{
+    wait_all();
+
+#ifdef IMAGE_IO_URING_
+    // The ring is kept until here even if it failed and the requests switched to stdio
+    if (state_->requests)
+    {
+        ring_teardown(state_);
+        for (unsigned i = 0u; i < state_->depth; i++)
+            free(state_->requests[i].iov);
+        delete[] state_->requests;
+        free(state_->free_slots);
+        free(state_->headers);
+    }
+#endif
+
+    free(state_->done);
+    delete state_;
+}
+
+// Returns the way the requests are carried out
+
+AsyncIOBackend AsyncImageIO::backend() const
+{
+    return state_->backend;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Requests
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Starts loading into the image, or saving the source if not nullptr. With stdio it
+// runs right away, with io_uring it waits for a free slot and queues the first step.
+// Waiting can switch to stdio if the ring fails.
+
+unsigned long long AsyncImageIO::request(Image* image, const Image* source, const char* filename)
+{
+    AsyncIOState* state = state_;
+    const unsigned long long id = state->next_id++;
+
+    if (source)
+        state->stats.saves++;
+    else
+        state->stats.loads++;
+
+#ifdef IMAGE_IO_URING_
+    if (state->backend == ASYNC_IO_URING && !state->free_count)
+        drive(state, 1u);
+
+    if (state->backend == ASYNC_IO_URING)
+    {
+        const unsigned slot = state->free_slots[--state->free_count];
+        state->requests[slot].id = id;
+        if (++state->stats.in_flight > state->stats.max_in_flight)
+            state->stats.max_in_flight = state->stats.in_flight;
+
+        if (!start_request(state, slot, image, source, filename))
+            finish(state, slot, false);
+        return id;
+    }
+#endif
+
+    bool ok;
+    if (source)
+    {
+        ok = source->save("%s", filename);
+        if (ok)
+            state->stats.bytes_written += BMP_HEADER_SIZE_ + (unsigned long long)source->width() * source->height() * sizeof(Color);
+    }
+    else
+    {
+        ok = image->load("%s", filename);
+        if (!ok)
+            AsyncIOState::allocate_pixels(image, 0u, 0u);
+    }
+
+    push_completion(state, id, source != nullptr, ok);
+    return id;
+}
+
+// Queues loading the bitmap file into the image
+
+unsigned long long AsyncImageIO::load(Image& image, const char* fmt_filename, ...)
+{
+    if (!fmt_filename || !*fmt_filename)
+        return 0ull;
+
+    va_list ap;
+
+    // Unwrap the format
+    char filename[512];
+
+    va_start(ap, fmt_filename);
+    const bool valid = bmp_format_filename(filename, 512u, fmt_filename, ap);
+    va_end(ap);
+
+    if (!valid)
+        return 0ull;
+
+    return request(&image, nullptr, filename);
+}
+
+// Queues saving the image to the bitmap file
+
+unsigned long long AsyncImageIO::save(const Image& image, const char* fmt_filename, ...)
+{
+    if (!fmt_filename || !*fmt_filename)
+        return 0ull;
+
+    va_list ap;
+
+    // Unwrap the format
+    char filename[512];
+
+    va_start(ap, fmt_filename);
+    const bool valid = bmp_format_filename(filename, 512u, fmt_filename, ap);
+    va_end(ap);
+
+    if (!valid)
+        return 0ull;
+
+    return request(nullptr, &image, filename);
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Completions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Submits the queued requests and collects the finished ones, oldest first
+
+unsigned AsyncImageIO::complete(AsyncIOCompletion* completions, unsigned int max_completions, unsigned int min_wait)
+{
+    AsyncIOState* state = state_;
+
+#ifdef IMAGE_IO_URING_
+    if (state->backend == ASYNC_IO_URING && (state->to_submit || state->stats.in_flight))
+        drive(state, min_wait > state->done_count ? min_wait - state->done_count : 0u);
+#else
+    (void)min_wait;
+#endif
+
+    const unsigned count = completions && max_completions < state->done_count ? max_completions : completions ? state->done_count : 0u;
+    if (!count)
+        return 0u;
+
+    memcpy(completions, state->done, count * sizeof(AsyncIOCompletion));
+    state->done_count -= count;
+    memmove(state->done, state->done + count, state->done_count * sizeof(AsyncIOCompletion));
+    return count;
+}
+
+// Waits for every request in flight and discards the completions
+
+unsigned AsyncImageIO::wait_all()
+{
+    AsyncIOState* state = state_;
+
+#ifdef IMAGE_IO_URING_
+    if (state->backend == ASYNC_IO_URING)
+        while (state->to_submit || state->stats.in_flight)
+            drive(state, state->stats.in_flight);
+#endif
+
+    unsigned failed = 0u;
+    for (unsigned i = 0u; i < state->done_count; i++)
+        if (!state->done[i].ok)
+            failed++;
+
+    state->done_count = 0u;
+    return failed;
+}
+
+// Returns the number of requests in flight
+
+unsigned AsyncImageIO::in_flight() const
+{
+    return state_->stats.in_flight;
+}
+
+// Returns the statistics since the object was created
+
+AsyncIOStats AsyncImageIO::stats() const
+{
+    return state_->stats;
+}
@@ -0,0 +1,359 @@
+#include "Atlas.h"
+#include "Parallel.h"
+
+#include <cstdlib>
+#include <cstring>
+
+/*
+-------------------------------------------------------------------------------------------------------
+Skyline packer helpers
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Horizontal segment of the skyline, everything below (row < y) is used
+
+struct SkylineNode
+{
+    unsigned x;
+    unsigned y;
+    unsigned width;
+};
+
+// Cell to be packed, including padding on every side
+
+struct PackCell
+{
+    unsigned idx;
+    unsigned width;
+    unsigned height;
+};
+
+// Sorts cells by decreasing height and then by decreasing width
+
+static int compare_cells(const void* lhs, const void* rhs)
+{
+    const PackCell* a = (const PackCell*)lhs;
+    const PackCell* b = (const PackCell*)rhs;
+
+    if (a->height != b->height)
+        return a->height > b->height ? -1 : 1;
+    if (a->width != b->width)
+        return a->width > b->width ? -1 : 1;
+
+    return a->idx < b->idx ? -1 : 1;
+}
+
+// Returns the row where a cell would sit if its left edge is placed at node i,
+// or false if it does not fit inside the atlas size.
+
+static bool skyline_fit(const SkylineNode* nodes, unsigned n_nodes, unsigned i, unsigned w, unsigned h, unsigned W, unsigned H, unsigned* out_y)
+{
+    const unsigned x = nodes[i].x;
+    if (x + w > W)
+        return false;
+
+    unsigned y = 0u;
+    unsigned left = w;
+    while (left)
+    {
+        if (i >= n_nodes)
+            return false;
+
+        if (nodes[i].y > y)
+            y = nodes[i].y;
+        if (y + h > H)
+            return false;
+
+        left = nodes[i].width >= left ? 0u : left - nodes[i].width;
+        i++;
+    }
+
+    *out_y = y;
+    return true;
+}
+
+// Raises the skyline after placing a cell at (x, y) with size w x h.
+// The nodes array must have room for one more node.
+
+static void skyline_insert(SkylineNode* nodes, unsigned* n_nodes, unsigned i, unsigned x, unsigned y, unsigned w, unsigned h)
+{
+    memmove(&nodes[i + 1], &nodes[i], (*n_nodes - i) * sizeof(SkylineNode));
+    nodes[i] = { x, y + h, w };
+    (*n_nodes)++;
+
+    // Shrink or remove the nodes now covered by the new one
+    unsigned j = i + 1;
+    while (j < *n_nodes)
+    {
+        const unsigned end = nodes[i].x + nodes[i].width;
+        if (nodes[j].x >= end)
+            break;
+
+        const unsigned shrink = end - nodes[j].x;
+        if (shrink < nodes[j].width)
+        {
+            nodes[j].x += shrink;
+            nodes[j].width -= shrink;
+            break;
+        }
+
+        memmove(&nodes[j], &nodes[j + 1], (*n_nodes - j - 1) * sizeof(SkylineNode));
+        (*n_nodes)--;
+    }
+
+    // Merge neighbours at the same height
+    for (unsigned k = 0; k + 1 < *n_nodes;)
+    {
+        if (nodes[k].y == nodes[k + 1].y)
+        {
+            nodes[k].width += nodes[k + 1].width;
+            memmove(&nodes[k + 1], &nodes[k + 2], (*n_nodes - k - 2) * sizeof(SkylineNode));
+            (*n_nodes)--;
+        }
+        else k++;
+    }
+}
+
+// Tries to pack all cells in a W x H area, storing the cell positions in rects.
+
+static bool skyline_pack(const PackCell* cells, unsigned count, unsigned W, unsigned H, SkylineNode* nodes, AtlasRect* rects)
+{
+    unsigned n_nodes = 1u;
+    nodes[0] = { 0u, 0u, W };
+
+    for (unsigned c = 0; c < count; c++)
+    {
+        const unsigned w = cells[c].width;
+        const unsigned h = cells[c].height;
+
+        if (!w || !h)
+            continue;
+
+        unsigned best = n_nodes;
+        unsigned best_bottom = 0xFFFFFFFFu;
+        unsigned best_width = 0xFFFFFFFFu;
+        unsigned best_y = 0u;
+
+        for (unsigned i = 0; i < n_nodes; i++)
+        {
+            unsigned y;
+            if (!skyline_fit(nodes, n_nodes, i, w, h, W, H, &y))
+                continue;
+
+            if (y + h < best_bottom || (y + h == best_bottom && nodes[i].width < best_width))
+            {
+                best = i;
+                best_bottom = y + h;
+                best_width = nodes[i].width;
+                best_y = y;
+            }
+        }
+
+        if (best == n_nodes)
+            return false;
+
+        AtlasRect& rect = rects[cells[c].idx];
+        rect.col = nodes[best].x;
+        rect.row = best_y;
+
+        skyline_insert(nodes, &n_nodes, best, nodes[best].x, best_y, w, h);
+    }
+    return true;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Constructors / Destructors
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Frees the rectangles array
+
+Atlas::~Atlas()
+{
+    clear();
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+User end functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Packs the images into a new atlas image, replacing any previous content.
+
+bool Atlas::pack(const Image* const* images, unsigned int count, unsigned int padding, bool extrude, unsigned int max_size)
+{
+    clear();
+
+    if (!images || !count)
+        return false;
+
+    // Build and sort the cells, find the minimum area needed
+    PackCell* cells = (PackCell*)calloc(count, sizeof(PackCell));
+    unsigned long long area = 0ull;
+    unsigned min_side = 1u;
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        const Image* image = images[i];
+        cells[i].idx = i;
+        if (image && image->width() && image->height())
+        {
+            cells[i].width = image->width() + 2u * padding;
+            cells[i].height = image->height() + 2u * padding;
+        }
+        area += (unsigned long long)cells[i].width * cells[i].height;
+
+        if (cells[i].width > min_side) min_side = cells[i].width;
+        if (cells[i].height > min_side) min_side = cells[i].height;
+    }
+    qsort(cells, count, sizeof(PackCell), compare_cells);
+
+    // Start with the smallest power of two that could hold everything
+    unsigned W = 1u;
+    while (W < min_side || (unsigned long long)W * W < area)
+        W <<= 1;
+    unsigned H = W;
+
+    rects_ = (AtlasRect*)calloc(count, sizeof(AtlasRect));
+    SkylineNode* nodes = (SkylineNode*)calloc(count + 2u, sizeof(SkylineNode));
+
+    bool packed = false;
+    while (W <= max_size && H <= max_size)
+    {
+        if ((packed = skyline_pack(cells, count, W, H, nodes, rects_)))
+            break;
+
+        // Grow alternating width and height
+        if (H < W) H <<= 1;
+        else W <<= 1;
+    }
+
+    free(nodes);
+    free(cells);
+
+    if (!packed)
+    {
+        clear();
+        return false;
+    }
+
+    count_ = count;
+    image_ = Image(W, H, Color::Transparent);
+
+    // Fill the rectangles now that the atlas size is known
+    for (unsigned i = 0; i < count; i++)
+    {
+        AtlasRect& rect = rects_[i];
+        const Image* image = images[i];
+        if (!image || !image->width() || !image->height())
+        {
+            rect = AtlasRect();
+            continue;
+        }
+
+        rect.col += padding;
+        rect.row += padding;
+        rect.width = image->width();
+        rect.height = image->height();
+
+        rect.u0 = (float)rect.col / W;
+        rect.v0 = (float)rect.row / H;
+        rect.u1 = (float)(rect.col + rect.width) / W;
+        rect.v1 = (float)(rect.row + rect.height) / H;
+    }
+
+    // Copy every image to its place, each thread takes a band of images
+    Color* dst = image_.pixels();
+    const AtlasRect* rects = rects_;
+
+    parallel_for(count, 8u, [&](unsigned begin, unsigned end)
+    {
+        for (unsigned i = begin; i < end; i++)
+        {
+            const AtlasRect& rect = rects[i];
+            if (!rect.width)
+                continue;
+
+            const Color* src = images[i]->pixels();
+            for (unsigned r = 0; r < rect.height; r++)
+                memcpy(&dst[(size_t)(rect.row + r) * W + rect.col], &src[(size_t)r * rect.width], rect.width * sizeof(Color));
+
+            if (!extrude || !padding)
+                continue;
+
+            // Extrude the edge columns to the left and right padding
+            for (unsigned r = 0; r < rect.height; r++)
+            {
+                Color* line = &dst[(size_t)(rect.row + r) * W];
+                const Color left = line[rect.col];
+                const Color right = line[rect.col + rect.width - 1u];
+                for (unsigned p = 1; p <= padding; p++)
+                {
+                    line[rect.col - p] = left;
+                    line[rect.col + rect.width - 1u + p] = right;
+                }
+            }
+
+            // Extrude the edge rows, including the corners, to the top and bottom padding
+            const size_t span = (size_t)(rect.width + 2u * padding);
+            const Color* top = &dst[(size_t)rect.row * W + rect.col - padding];
+            const Color* bottom = &dst[(size_t)(rect.row + rect.height - 1u) * W + rect.col - padding];
+            for (unsigned p = 1; p <= padding; p++)
+            {
+                memcpy(&dst[(size_t)(rect.row - p) * W + rect.col - padding], top, span * sizeof(Color));
+                memcpy(&dst[(size_t)(rect.row + rect.height - 1u + p) * W + rect.col - padding], bottom, span * sizeof(Color));
+            }
+        }
+    });
+
+    return true;
+}
+
+// Frees the atlas image and the rectangles
+
+void Atlas::clear()
+{
+    if (rects_)
+        free(rects_);
+
+    rects_ = nullptr;
+    count_ = 0u;
+    image_ = Image();
+}
+
+// Returns the atlas image
+
+Image& Atlas::image()
+{
+    return image_;
+}
+
+// Returns the constant atlas image
+
+const Image& Atlas::image() const
+{
+    return image_;
+}
+
+// Returns the number of packed images
+
+unsigned Atlas::size() const
+{
+    return count_;
+}
+
+// Returns the rectangles array, one per packed image
+
+const AtlasRect* Atlas::rects() const
+{
+    return rects_;
+}
+
+// Returns the rectangle of the packed image at the specified index
+
+const AtlasRect& Atlas::operator[](unsigned int idx) const
+{
+    return rects_[idx];
+}
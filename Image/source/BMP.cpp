@@ -0,0 +1,686 @@
+#include "BMP.h"
+#include "PixelFormat.h"
+#include "SIMD.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+/*
+-------------------------------------------------------------------------------------------------------
+BMP helper functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Parses the first BMP_HEADER_SIZE_ bytes of a bitmap file.
+
+bool bmp_parse_header(const uint8_t* data, BMPHeader* header)
+{
+    if (data[0] != 'B' || data[1] != 'M')
+        return false;
+
+    header->file_size       = get_le32(data + 2);
+    header->pixel_offset    = get_le32(data + 10);
+    header->info_size       = get_le32(data + 14);
+    header->width           = (int32_t)get_le32(data + 18);
+    header->height          = (int32_t)get_le32(data + 22);
+    header->planes          = get_le16(data + 26);
+    header->bit_count       = get_le16(data + 28);
+    header->compression     = get_le32(data + 30);
+    header->image_size      = get_le32(data + 34);
+    header->colors_used     = get_le32(data + 46);
+
+    // we expect BITMAPINFOHEADER or larger
+    return header->info_size >= BMP_INFO_HEADER_SIZE_;
+}
+
+// Returns whether Image::load() can decode a file with this header. Indexed images 
+// may be run length encoded, bottom-up only, and 16/32-bit ones may have bitfields.
+
+bool bmp_loadable(const BMPHeader& header)
+{
+    if (header.planes != 1 || header.width <= 0 || header.height == 0)
+        return false;
+
+    const bool bitfields = header.compression == BMP_BITFIELDS_ || header.compression == BMP_ALPHABITFIELDS_;
+    switch (header.bit_count)
+    {
+    case 1:
+    case 24:
+        return header.compression == BMP_RGB_;
+    case 4:
+        return header.compression == BMP_RGB_ || (header.compression == BMP_RLE4_ && header.height > 0);
+    case 8:
+        return header.compression == BMP_RGB_ || (header.compression == BMP_RLE8_ && header.height > 0);
+    case 16:
+    case 32:
+        return header.compression == BMP_RGB_ || bitfields;
+    default:
+        return false;
+    }
+}
+
+// Formats the filename and replaces its extension by ".bmp".
+
+bool bmp_format_filename(char* filename, unsigned size, const char* fmt_filename, va_list ap)
+{
+    if (!fmt_filename || !*fmt_filename || size < 6u)
+        return false;
+
+    if (vsnprintf(filename, size, fmt_filename, ap) < 0)
+        return false;
+
+    unsigned c = 0;
+    while (filename[++c] && filename[c] != '.');
+    if (c + 5u > size)
+        return false;
+
+    filename[c++] = '.';
+    filename[c++] = 'b';
+    filename[c++] = 'm';
+    filename[c++] = 'p';
+    filename[c++] = '\0';
+    return true;
+}
+
+// Moves the file to the offset from its start with the 64-bit seek of the system
+
+bool bmp_seek(FILE* file, unsigned long long offset)
+{
+#ifdef _WIN32
+    return _fseeki64(file, (long long)offset, SEEK_SET) == 0;
+#else
+    const off_t position = (off_t)offset;
+    if (position < 0 || (unsigned long long)position != offset)
+        return false;
+    return fseeko(file, position, SEEK_SET) == 0;
+#endif
+}
+
+// Returns the size of the open file with the 64-bit seek and tell of the system
+
+bool bmp_file_size(FILE* file, unsigned long long* size)
+{
+#ifdef _WIN32
+    const long long position = _ftelli64(file);
+    if (position < 0 || _fseeki64(file, 0, SEEK_END) != 0)
+        return false;
+
+    const long long end = _ftelli64(file);
+#else
+    const off_t position = ftello(file);
+    if (position < 0 || fseeko(file, 0, SEEK_END) != 0)
+        return false;
+
+    const off_t end = ftello(file);
+#endif
+    if (!bmp_seek(file, (unsigned long long)position) || end < 0)
+        return false;
+
+    *size = (unsigned long long)end;
+    return true;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Palette and channel masks
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Widens a value of the specified bits to 8 by repeating its bits, so that the
+// largest value becomes 255. Zero bits give 0, the caller handles missing channels.
+
+static uint8_t replicate_bits(uint32_t value, unsigned bits)
+{
+    if (!bits)
+        return 0u;
+
+    uint32_t result = 0u;
+    for (int shift = 8 - (int)bits; shift > -(int)bits; shift -= (int)bits)
+        result |= shift >= 0 ? value << shift : value >> -shift;
+    return (uint8_t)result;
+}
+
+// Stores the position and width of the mask, masks wider than 8 bits keep only
+// their top 8. Returns false if the bits of the mask are not contiguous.
+
+static bool parse_mask(uint32_t mask, uint8_t* shift, uint8_t* bits)
+{
+    *shift = 0u;
+    *bits = 0u;
+    if (!mask)
+        return true;
+
+    unsigned low = 0u;
+    while (!(mask >> low & 1u))
+        low++;
+
+    const uint32_t value = mask >> low;
+    if (value & (value + 1u))
+        return false;
+
+    unsigned width = 0u;
+    while (width < 32u && (value >> width & 1u))
+        width++;
+
+    if (width > 8u)
+    {
+        low += width - 8u;
+        width = 8u;
+    }
+    *shift = (uint8_t)low;
+    *bits = (uint8_t)width;
+    return true;
+}
+
+// Reads bytes at the offset of the file, open or in memory, leaving it positioned
+// right after them. Returns false if the file ends before.
+
+static bool read_at(BMPReader* reader, size_t offset, void* out, size_t bytes)
+{
+    if (reader->data)
+    {
+        if (offset > reader->size || bytes > reader->size - offset)
+            return false;
+
+        memcpy(out, reader->data + offset, bytes);
+        reader->pos = offset + bytes;
+        return true;
+    }
+    return fseek(reader->file, (long)offset, SEEK_SET) == 0 && fread(out, 1, bytes, reader->file) == bytes;
+}
+
+// Reads the color table or the channel masks of the file, as needed by its bit count,
+// and builds the lookup tables. Returns false if they are missing or invalid.
+
+static bool read_tables(BMPReader* reader, BMPTables* tables)
+{
+    const BMPHeader& header = reader->header;
+    const unsigned bits = header.bit_count;
+
+    if (bits <= 8u)
+    {
+        // Entries are B, G, R and a reserved byte, stored right after the info header
+        const uint32_t max = 1u << bits;
+        const uint32_t count = header.colors_used && header.colors_used < max ? header.colors_used : max;
+
+        uint8_t data[1024];
+        if (!read_at(reader, BMP_FILE_HEADER_SIZE_ + header.info_size, data, 4u * count))
+            return false;
+
+        for (unsigned i = 0u; i < 256u; i++)
+            tables->palette[i] = i < count ? Color(data[4u * i + 2u], data[4u * i + 1u], data[4u * i]) : Color(0u, 0u, 0u);
+
+        if (bits == 4u)
+            for (unsigned byte = 0u; byte < 256u; byte++)
+            {
+                tables->pairs[byte][0] = tables->palette[byte >> 4];
+                tables->pairs[byte][1] = tables->palette[byte & 15u];
+            }
+
+        if (bits == 1u)
+            for (unsigned byte = 0u; byte < 256u; byte++)
+                for (unsigned k = 0u; k < 8u; k++)
+                    tables->octets[byte][k] = tables->palette[byte >> (7u - k) & 1u];
+
+        return true;
+    }
+
+    if (bits == 24u)
+        return true;
+
+    // Masks default to 5-5-5 for 16-bit and to the stored bytes for 32-bit
+    uint32_t* masks = tables->masks;
+    if (bits == 16u)
+    {
+        masks[0] = 0x001Fu;
+        masks[1] = 0x03E0u;
+        masks[2] = 0x7C00u;
+        masks[3] = 0u;
+    }
+    else
+    {
+        masks[0] = 0x000000FFu;
+        masks[1] = 0x0000FF00u;
+        masks[2] = 0x00FF0000u;
+        masks[3] = 0xFF000000u;
+    }
+
+    // Stored red, green, blue and alpha right after the info header, or inside newer ones
+    if (header.compression == BMP_BITFIELDS_ || header.compression == BMP_ALPHABITFIELDS_)
+    {
+        const bool alpha = header.compression == BMP_ALPHABITFIELDS_ || header.info_size >= 56u;
+        const unsigned size = alpha ? 16u : 12u;
+
+        uint8_t data[16];
+        if (!read_at(reader, BMP_HEADER_SIZE_, data, size))
+            return false;
+
+        masks[2] = get_le32(data);
+        masks[1] = get_le32(data + 4);
+        masks[0] = get_le32(data + 8);
+        masks[3] = alpha ? get_le32(data + 12) : 0u;
+    }
+
+    for (unsigned k = 0u; k < 4u; k++)
+    {
+        if ((bits == 16u && masks[k] > 0xFFFFu) || !parse_mask(masks[k], tables->shifts + k, tables->bits + k))
+            return false;
+
+        // Without an alpha mask the pixels are opaque
+        for (unsigned v = 0u; v < 256u; v++)
+            tables->expand[k][v] = k == 3u && !tables->bits[k] ? 255u : replicate_bits(v & ((1u << tables->bits[k]) - 1u), tables->bits[k]);
+    }
+    return true;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Pixel decoding
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Returns the size in bytes of a stored row of uncompressed pixels, 4-byte aligned
+
+size_t bmp_row_stride(const BMPHeader& header)
+{
+    return (((size_t)(uint32_t)header.width * header.bit_count + 31u) / 32u) * 4u;
+}
+
+// Expands 1-bit pixels eight at a time, every byte copies its 32-byte entry
+
+static void decode_1(const uint8_t* in, Color* out, uint32_t width, const BMPTables& tables)
+{
+    uint32_t i = 0u;
+    for (; i < width / 8u; i++)
+    {
+        const Color* octet = tables.octets[in[i]];
+#ifdef IMAGE_SSE2_
+        _mm_storeu_si128((__m128i*)(out + 8u * i), _mm_loadu_si128((const __m128i*)octet));
+        _mm_storeu_si128((__m128i*)(out + 8u * i + 4u), _mm_loadu_si128((const __m128i*)(octet + 4)));
+#else
+        memcpy(out + 8u * i, octet, 8u * sizeof(Color));
+#endif
+    }
+    for (uint32_t x = 8u * i; x < width; x++)
+        out[x] = tables.octets[in[i]][x - 8u * i];
+}
+
+// Expands 4-bit pixels two at a time, every byte copies its 8-byte entry
+
+static void decode_4(const uint8_t* in, Color* out, uint32_t width, const BMPTables& tables)
+{
+    uint32_t i = 0u;
+    for (; i < width / 2u; i++)
+        memcpy(out + 2u * i, tables.pairs[in[i]], 2u * sizeof(Color));
+
+    if (width & 1u)
+        out[width - 1u] = tables.pairs[in[i]][0];
+}
+
+// Expands 8-bit pixels through the palette. Without gathers there is nothing
+// to vectorize, entries are copied as whole words, which the compiler does not
+// do for a Color copy, four at a time so that their loads overlap.
+
+static void decode_8(const uint8_t* in, Color* out, uint32_t width, const BMPTables& tables)
+{
+    const Color* palette = tables.palette;
+
+    uint32_t x = 0u;
+    for (; x + 4u <= width; x += 4u)
+    {
+        memcpy(out + x, palette + in[x], sizeof(Color));
+        memcpy(out + x + 1u, palette + in[x + 1u], sizeof(Color));
+        memcpy(out + x + 2u, palette + in[x + 2u], sizeof(Color));
+        memcpy(out + x + 3u, palette + in[x + 3u], sizeof(Color));
+    }
+    for (; x < width; x++)
+        memcpy(out + x, palette + in[x], sizeof(Color));
+}
+
+// Expands a 16 or 32-bit pixel with arbitrary masks through the channel tables
+
+static inline Color decode_masked(uint32_t pixel, const BMPTables& tables)
+{
+    Color c;
+    c.B = tables.expand[0][(pixel >> tables.shifts[0]) & 255u];
+    c.G = tables.expand[1][(pixel >> tables.shifts[1]) & 255u];
+    c.R = tables.expand[2][(pixel >> tables.shifts[2]) & 255u];
+    c.A = tables.expand[3][(pixel >> tables.shifts[3]) & 255u];
+    return c;
+}
+
+// Expands 16-bit pixels. Channels of 4 to 8 bits, which covers 5-5-5, 5-6-5 and
+// 4-4-4-4, are widened eight at a time by repeating their top bits.
+
+static void decode_16(const uint8_t* in, Color* out, uint32_t width, const BMPTables& tables)
+{
+    uint32_t x = 0u;
+#ifdef IMAGE_SSE2_
+    bool vector = true;
+    for (unsigned k = 0u; k < 4u; k++)
+        vector &= (tables.bits[k] >= 4u) || (k == 3u && !tables.bits[k]);
+
+    if (vector)
+    {
+        __m128i shifts[4], masks[4], ups[4], downs[4], places[4];
+        for (unsigned k = 0u; k < 4u; k++)
+        {
+            const int bits = tables.bits[k];
+            shifts[k] = _mm_cvtsi32_si128(tables.shifts[k]);
+            masks[k] = _mm_set1_epi32((1 << bits) - 1);
+            ups[k] = _mm_cvtsi32_si128(8 - bits + 8 * (int)k);
+            downs[k] = _mm_cvtsi32_si128(2 * bits - 8);
+            places[k] = _mm_cvtsi32_si128(8 * (int)k);
+        }
+        const __m128i opaque = _mm_set1_epi32(tables.bits[3] ? 0 : (int)0xFF000000);
+        const unsigned channels = tables.bits[3] ? 4u : 3u;
+        const __m128i zero = _mm_setzero_si128();
+
+        for (; x + 8u <= width; x += 8u)
+        {
+            const __m128i v = _mm_loadu_si128((const __m128i*)(in + 2u * x));
+            const __m128i halves[2] = { _mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero) };
+
+            for (unsigned h = 0u; h < 2u; h++)
+            {
+                __m128i c = opaque;
+                for (unsigned k = 0u; k < channels; k++)
+                {
+                    // Value moved to the top of its byte, with its top bits below it
+                    const __m128i value = _mm_and_si128(_mm_srl_epi32(halves[h], shifts[k]), masks[k]);
+                    const __m128i low = _mm_sll_epi32(_mm_srl_epi32(value, downs[k]), places[k]);
+                    c = _mm_or_si128(c, _mm_or_si128(_mm_sll_epi32(value, ups[k]), low));
+                }
+                _mm_storeu_si128((__m128i*)(out + x + 4u * h), c);
+            }
+        }
+    }
+#endif
+    for (; x < width; x++)
+        out[x] = decode_masked(get_le16(in + 2u * x), tables);
+}
+
+// Expands 32-bit pixels. The usual masks are the Color layout, so the
+// rows are copied, forcing the alpha if the file has none.
+
+static void decode_32(const uint8_t* in, Color* out, uint32_t width, const BMPTables& tables)
+{
+    const uint32_t* masks = tables.masks;
+    if (masks[0] != 0x000000FFu || masks[1] != 0x0000FF00u || masks[2] != 0x00FF0000u || (masks[3] && masks[3] != 0xFF000000u))
+    {
+        for (uint32_t x = 0u; x < width; x++)
+            out[x] = decode_masked(get_le32(in + 4u * x), tables);
+        return;
+    }
+
+    convert_from_format(in, out, width, PIXEL_FORMAT_BGRA8);
+    if (masks[3])
+        return;
+
+    uint32_t x = 0u;
+#ifdef IMAGE_SSE2_
+    const __m128i opaque = _mm_set1_epi32((int)0xFF000000);
+    for (; x + 4u <= width; x += 4u)
+        _mm_storeu_si128((__m128i*)(out + x), _mm_or_si128(_mm_loadu_si128((const __m128i*)(out + x)), opaque));
+#endif
+    for (; x < width; x++)
+        out[x].A = 255u;
+}
+
+// Expands a stored row of uncompressed pixels into width colors
+
+void bmp_decode_row(const uint8_t* in, Color* out, uint32_t width, const BMPHeader& header, const BMPTables& tables)
+{
+    switch (header.bit_count)
+    {
+    case 1:
+        decode_1(in, out, width, tables);
+        break;
+    case 4:
+        decode_4(in, out, width, tables);
+        break;
+    case 8:
+        decode_8(in, out, width, tables);
+        break;
+    case 16:
+        decode_16(in, out, width, tables);
+        break;
+    case 24:
+        convert_from_format(in, out, width, PIXEL_FORMAT_BGR8);
+        break;
+    case 32:
+        decode_32(in, out, width, tables);
+        break;
+    }
+}
+
+// Decodes the next stored row of RLE4 or RLE8 data. Every pair of bytes is a run
+// of a repeated index, or after a zero an escape: end of line, end of bitmap, a jump,
+// or a word-aligned run of literal indices. Runs are clipped to the row.
+
+static void decode_rle_row(BMPReader* reader, Color* row)
+{
+    const uint8_t* data = reader->rle;
+    const size_t size = reader->rle_size;
+    const uint32_t width = reader->width;
+    const bool rle4 = reader->header.compression == BMP_RLE4_;
+    const Color* palette = reader->tables->palette;
+
+    for (uint32_t x = 0u; x < width; x++)
+        row[x] = palette[0];
+
+    // Rows jumped over or after the end keep the first entry
+    if (reader->rle_end || reader->rle_y > reader->rows_read)
+        return;
+
+    uint32_t x = reader->rle_x;
+    reader->rle_x = 0u;
+
+    size_t i = reader->rle_pos;
+    while (i + 2u <= size)
+    {
+        const uint8_t count = data[i], value = data[i + 1u];
+        i += 2u;
+
+        // Repeated index, or alternating pair of indices for RLE4
+        if (count)
+        {
+            const uint32_t end = x >= width ? x : count > width - x ? width : x + count;
+            if (rle4)
+                for (uint32_t k = x; k < end; k++)
+                    row[k] = palette[(k - x) & 1u ? value & 15u : value >> 4];
+            else
+                for (uint32_t k = x; k < end; k++)
+                    row[k] = palette[value];
+            x += count;
+            continue;
+        }
+
+        switch (value)
+        {
+        case 0: // End of line
+            reader->rle_pos = i;
+            reader->rle_y++;
+            return;
+
+        case 1: // End of bitmap
+            reader->rle_end = true;
+            return;
+
+        case 2: // Jump right and up, the row ends if it moves up
+            if (i + 2u > size)
+                break;
+            x += data[i];
+            i += 2u;
+            if (data[i - 1u])
+            {
+                reader->rle_pos = i;
+                reader->rle_x = x;
+                reader->rle_y += data[i - 1u];
+                return;
+            }
+            continue;
+
+        default: // Literal indices, padded to an even number of bytes
+        {
+            const size_t bytes = rle4 ? (value + 1u) / 2u : value;
+            const size_t available = size - i < bytes ? size - i : bytes;
+            const uint32_t literals = (uint32_t)(rle4 ? (available * 2u < value ? available * 2u : value) : available);
+
+            for (uint32_t k = 0u; k < literals; k++, x++)
+                if (x < width)
+                    row[x] = palette[rle4 ? (k & 1u ? data[i + k / 2u] & 15u : data[i + k / 2u] >> 4) : data[i + k]];
+
+            i += (bytes + 1u) & ~(size_t)1u;
+            continue;
+        }
+        }
+        break;
+    }
+
+    // The data ended without an end of bitmap
+    reader->rle_end = true;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Row reader
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Reads and checks the headers and tables of the file, open or in memory, and
+// prepares the reader for the first row. Run length encoded data is read whole,
+// its stored size is only known by decoding it. In memory it is used in place.
+
+static bool start_reading(BMPReader* reader)
+{
+    // Read and check both headers at once
+    uint8_t data[BMP_HEADER_SIZE_];
+    BMPHeader& header = reader->header;
+    bool valid = read_at(reader, 0u, data, BMP_HEADER_SIZE_) && bmp_parse_header(data, &header) && bmp_loadable(header);
+
+    // Color table for indexed images, channel masks for 16 and 32-bit ones
+    if (valid)
+    {
+        reader->tables = (BMPTables*)malloc(sizeof(BMPTables));
+        valid = reader->tables && read_tables(reader, reader->tables);
+    }
+
+    if (!valid)
+        return false;
+
+    reader->width = (uint32_t)header.width;
+    reader->height = (uint32_t)(header.height < 0 ? -header.height : header.height);
+    const bool rle = header.compression == BMP_RLE8_ || header.compression == BMP_RLE4_;
+
+    if (reader->data)
+    {
+        if (header.pixel_offset >= reader->size)
+            return false;
+
+        reader->pos = header.pixel_offset;
+        if (rle)
+        {
+            reader->rle = reader->data + header.pixel_offset;
+            reader->rle_size = reader->size - header.pixel_offset;
+        }
+        else
+            reader->row_stride = bmp_row_stride(header);
+        return true;
+    }
+
+    if (rle)
+    {
+        long size = -1;
+        if (fseek(reader->file, 0, SEEK_END) == 0)
+            size = ftell(reader->file) - (long)header.pixel_offset;
+
+        uint8_t* buffer = size > 0 ? (uint8_t*)malloc((size_t)size) : nullptr;
+        reader->rle = buffer;
+        reader->rle_size = buffer ? (size_t)size : 0u;
+        return buffer && read_at(reader, header.pixel_offset, buffer, reader->rle_size);
+    }
+
+    // Some BMPs have extra header bytes; seek to pixel array
+    reader->row_stride = bmp_row_stride(header);
+    reader->row = (uint8_t*)malloc(reader->row_stride);
+    return reader->row && fseek(reader->file, (long)header.pixel_offset, SEEK_SET) == 0;
+}
+
+// Opens the bitmap file and reads its headers and tables
+
+bool bmp_open(BMPReader* reader, const char* filename)
+{
+    *reader = BMPReader();
+
+    reader->file = fopen(filename, "rb");
+    if (!reader->file)
+        return false;
+
+    if (start_reading(reader))
+        return true;
+
+    bmp_close(reader);
+    return false;
+}
+
+// Reads the headers and tables of a whole bitmap file in memory
+
+bool bmp_open_memory(BMPReader* reader, const void* data, size_t size)
+{
+    *reader = BMPReader();
+
+    reader->data = (const uint8_t*)data;
+    reader->size = size;
+
+    if (data && start_reading(reader))
+        return true;
+
+    bmp_close(reader);
+    return false;
+}
+
+// Decodes the next stored row into width colors. In memory uncompressed
+// rows are decoded in place, without copying them.
+
+bool bmp_read_row(BMPReader* reader, Color* out)
+{
+    if (reader->rows_read >= reader->height)
+        return false;
+
+    if (reader->rle)
+        decode_rle_row(reader, out);
+    else if (reader->data)
+    {
+        if (reader->row_stride > reader->size - reader->pos)
+            return false;
+
+        bmp_decode_row(reader->data + reader->pos, out, reader->width, reader->header, *reader->tables);
+        reader->pos += reader->row_stride;
+    }
+    else
+    {
+        if (fread(reader->row, 1, reader->row_stride, reader->file) != reader->row_stride)
+            return false;
+
+        bmp_decode_row(reader->row, out, reader->width, reader->header, *reader->tables);
+    }
+
+    reader->rows_read++;
+    return true;
+}
+
+// Closes the file and frees the buffers of the reader, the data in memory is not its own
+
+void bmp_close(BMPReader* reader)
+{
+    if (reader->file)
+        fclose(reader->file);
+
+    free(reader->tables);
+    free(reader->row);
+    if (!reader->data)
+        free((void*)reader->rle);
+    *reader = BMPReader();
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+/* BMP HELPERS HEADER (PRIVATE)
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Internal helpers shared by the different parts of the library that read
+bitmap files, so that they all parse the headers the same way.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+#include "Color.h"
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#define BMP_FILE_HEADER_SIZE_ 14u	// Size of the BITMAPFILEHEADER
+#define BMP_INFO_HEADER_SIZE_ 40u	// Size of the BITMAPINFOHEADER
+#define BMP_HEADER_SIZE_ 54u		// Size of both headers, enough to describe the image
+
+#define BMP_RGB_ 0u					// BI_RGB, uncompressed
+#define BMP_RLE8_ 1u				// BI_RLE8, run length encoded 8-bit indices
+#define BMP_RLE4_ 2u				// BI_RLE4, run length encoded 4-bit indices
+#define BMP_BITFIELDS_ 3u			// BI_BITFIELDS, 16 or 32-bit pixels with channel masks
+#define BMP_ALPHABITFIELDS_ 6u		// BI_ALPHABITFIELDS, same with an alpha mask
+
+// Fields of the bitmap file and info headers
+struct BMPHeader
+{
+	uint32_t file_size;		// bfSize
+	uint32_t pixel_offset;	// bfOffBits
+	uint32_t info_size;		// biSize
+	int32_t  width;			// biWidth
+	int32_t  height;		// biHeight, negative for top-down images
+	uint16_t planes;		// biPlanes
+	uint16_t bit_count;		// biBitCount
+	uint32_t compression;	// biCompression
+	uint32_t image_size;	// biSizeImage
+	uint32_t colors_used;	// biClrUsed
+};
+
+// Palette and channel masks of a bitmap file, with the lookup tables used to
+// expand its pixels into colors
+struct BMPTables
+{
+	Color palette[256];		// Color table, opaque, missing entries are black
+	Color pairs[256][2];	// Both pixels of every byte of a 4-bit image
+	Color octets[256][8];	// All eight pixels of every byte of a 1-bit image
+
+	uint32_t masks[4];		// Blue, green, red and alpha masks of 16 and 32-bit pixels
+	uint8_t shifts[4];		// Position of the lowest bit of every mask
+	uint8_t bits[4];		// Number of bits of every mask, contiguous
+	uint8_t expand[4][256];	// Channel value to 8 bits, masks of up to 8 bits only
+};
+
+// Reads little endian values from a byte buffer
+inline uint16_t get_le16(const uint8_t* b) { return (uint16_t)(b[0] | (b[1] << 8)); }
+inline uint32_t get_le32(const uint8_t* b) { return (uint32_t)(b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24)); }
+
+// Writes little endian values to a byte buffer
+inline void put_le16(uint8_t* b, uint16_t v) { b[0] = (uint8_t)v; b[1] = (uint8_t)(v >> 8); }
+inline void put_le32(uint8_t* b, uint32_t v) { b[0] = (uint8_t)v; b[1] = (uint8_t)(v >> 8); b[2] = (uint8_t)(v >> 16); b[3] = (uint8_t)(v >> 24); }
+
+// Parses the first BMP_HEADER_SIZE_ bytes of a bitmap file. Returns false if the
+// signature is not "BM" or the info header is smaller than a BITMAPINFOHEADER.
+bool bmp_parse_header(const uint8_t* data, BMPHeader* header);
+
+// Returns whether Image::load() can decode a file with this header
+bool bmp_loadable(const BMPHeader& header);
+
+// Returns the size in bytes of a stored row of uncompressed pixels, 4-byte aligned
+size_t bmp_row_stride(const BMPHeader& header);
+
+// Expands a stored row of uncompressed pixels into width colors
+void bmp_decode_row(const uint8_t* in, Color* out, uint32_t width, const BMPHeader& header, const BMPTables& tables);
+
+// Bitmap file being decoded one row at a time, in the order the rows are stored,
+// so that the whole pixel data is never held unless it is run length encoded.
+// It reads from an open file or from the whole file already in memory.
+struct BMPReader
+{
+	FILE* file = nullptr;		// Open file, positioned at the next stored row
+	const uint8_t* data = nullptr;	// Whole file in memory, if not reading from a file
+	size_t size = 0u;			// Size of the file in memory
+	size_t pos = 0u;			// Next byte to read from memory
+
+	BMPHeader header = {};		// Headers of the file
+	BMPTables* tables = nullptr;// Palette and masks of the file
+
+	uint32_t width = 0u;		// Width of the image
+	uint32_t height = 0u;		// Height of the image
+	uint32_t rows_read = 0u;	// Stored rows decoded so far
+
+	uint8_t* row = nullptr;		// Buffer for a stored row of uncompressed files, not used in memory
+	size_t row_stride = 0u;		// Size of a stored row
+
+	const uint8_t* rle = nullptr;	// Whole run length encoded data, inside the file in memory
+	size_t rle_size = 0u;		// Size of the encoded data
+	size_t rle_pos = 0u;		// Next byte to decode
+	uint32_t rle_x = 0u;		// Column where the next stored row starts
+	uint32_t rle_y = 0u;		// Stored row the data is at, rows before it are skipped
+	bool rle_end = false;		// Whether the end of the bitmap or of the data was reached
+};
+
+// Opens the bitmap file and reads its headers and tables. Returns false if it can not
+// be opened or Image::load() does not support it, the reader is left closed then.
+bool bmp_open(BMPReader* reader, const char* filename);
+
+// Same as bmp_open() for a whole bitmap file in memory, which must outlive the reader
+bool bmp_open_memory(BMPReader* reader, const void* data, size_t size);
+
+// Returns the top-down image row that the next bmp_read_row() call decodes
+inline uint32_t bmp_next_row(const BMPReader& reader)
+{
+	return reader.header.height < 0 ? reader.rows_read : reader.height - 1u - reader.rows_read;
+}
+
+// Decodes the next stored row into width colors. Run length encoded rows skipped by
+// the encoding get palette entry zero. Returns false if the file ends before the row.
+bool bmp_read_row(BMPReader* reader, Color* out);
+
+// Closes the file and frees the buffers of the reader
+void bmp_close(BMPReader* reader);
+
+// Formats the filename and replaces its extension by ".bmp", for every function
+// taking a file name. Returns false if it does not fit in the buffer.
+bool bmp_format_filename(char* filename, unsigned size, const char* fmt_filename, va_list ap);
+
+// Moves the file to the offset from its start, also past 2GB where long is 32-bit.
+// Returns false if it fails.
+bool bmp_seek(FILE* file, unsigned long long offset);
+
+// Returns the size of the open file, also past 2GB where long is 32-bit, leaving it at
+// the same position. Returns false if it fails.
+bool bmp_file_size(FILE* file, unsigned long long* size);
@@ -0,0 +1,290 @@
+#include "CaptureWriter.h"
+#include "Parallel.h"
+
+#include <cstdarg>
+#include <cstdio>
+
+/*
+-------------------------------------------------------------------------------------------------------
+Internal state
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Queued frame and the path it is saved to
+
+struct CaptureSlot
+{
+    Image image;
+    char filename[512];
+    unsigned long long submit_ns;
+    bool ready = false;     // Filled by its submitter, waiting for the slots before it
+};
+
+// Ring of slots shared by the submitting threads and the writer thread.
+// The slots from head to head + count are queued, the one at head being written.
+// The reserved ones after them are being filled by their submitters, outside the lock.
+
+struct CaptureState
+{
+    ParallelMutex mutex;
+    ParallelCondition queued;   // Signaled when a frame is queued or the writer must stop
+    ParallelCondition freed;    // Signaled when the writer frees a slot
+
+    CaptureSlot* slots = nullptr;
+    unsigned capacity = 0u;
+    unsigned head = 0u;
+    unsigned count = 0u;
+    unsigned reserved = 0u;
+    CaptureOverflow overflow = CAPTURE_OVERFLOW_BLOCK;
+    bool stop = false;
+
+    CaptureStats stats;
+    unsigned long long latency_sum_ns = 0ull;
+    unsigned long long finished = 0ull;     // Frames written or failed since the stats reset
+
+    ParallelThread thread;
+};
+
+// Writer thread loop, saves the frame at head until told to stop with an empty queue
+
+static void writer_entry(void* pstate)
+{
+    CaptureState* state = (CaptureState*)pstate;
+
+    state->mutex.lock();
+    for (;;)
+    {
+        while (!state->count && !state->stop)
+            state->queued.wait(state->mutex);
+
+        if (!state->count)
+            break;
+
+        // The slot stays counted while written so nobody reuses it
+        CaptureSlot& slot = state->slots[state->head];
+        state->mutex.unlock();
+
+        const bool saved = slot.filename[0] && slot.image.save("%s", slot.filename);
+        const unsigned long long latency = monotonic_ns() - slot.submit_ns;
+
+        state->mutex.lock();
+        state->head = (state->head + 1u) % state->capacity;
+        state->count--;
+
+        CaptureStats& stats = state->stats;
+        if (saved) stats.written++;
+        else stats.failed++;
+
+        state->finished++;
+        state->latency_sum_ns += latency;
+        stats.mean_latency_ms = state->latency_sum_ns / 1e6 / state->finished;
+        if (latency / 1e6 > stats.max_latency_ms)
+            stats.max_latency_ms = latency / 1e6;
+
+        state->freed.wake_all();
+    }
+    state->mutex.unlock();
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Constructors / Destructors
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Starts the writer thread with the specified number of slots and overflow policy
+
+CaptureWriter::CaptureWriter(unsigned int slots, CaptureOverflow overflow)
+{
+    if (!slots)
+        slots = 1u;
+
+    state_ = new CaptureState;
+    state_->slots = new CaptureSlot[slots];
+    state_->capacity = slots;
+    state_->overflow = overflow;
+
+    if (!state_->thread.start(writer_entry, state_))
+    {
+        delete[] state_->slots;
+        delete state_;
+        throw "Could not start capture writer thread";
+    }
+}
+
+// Writes every queued frame and stops the writer thread
+
+CaptureWriter::~CaptureWriter()
+{
+    state_->mutex.lock();
+    state_->stop = true;
+    state_->queued.wake_one();
+    state_->mutex.unlock();
+
+    state_->thread.join();
+
+    delete[] state_->slots;
+    delete state_;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Submitting
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Waits for a free slot or drops the frame, then stores the frame in it. Only the
+// pixel copy or move happens under the lock, the writer only holds it between frames.
+
+bool CaptureWriter::enqueue(Image* frame, const Image* copy, bool exchange, const char* filename)
+{
+    CaptureState& state = *state_;
+    const unsigned long long start = monotonic_ns();
+
+    state.mutex.lock();
+    if (state.count + state.reserved == state.capacity)
+    {
+        if (state.overflow == CAPTURE_OVERFLOW_DROP)
+        {
+            state.stats.dropped++;
+            state.mutex.unlock();
+            return false;
+        }
+
+        while (state.count + state.reserved == state.capacity)
+            state.freed.wait(state.mutex);
+
+        state.stats.blocked_ms += (monotonic_ns() - start) / 1e6;
+    }
+
+    // Reserve the slot and fill it without the lock, the copy of a whole frame
+    // must not stop the writer from taking and freeing the slots before it
+    CaptureSlot& slot = state.slots[(state.head + state.count + state.reserved) % state.capacity];
+    state.reserved++;
+    state.mutex.unlock();
+
+    // Reserved slots are never touched by the writer
+    if (copy)
+        slot.image = *copy;
+    else if (exchange)
+    {
+        Image written = static_cast<Image&&>(slot.image);
+        slot.image = static_cast<Image&&>(*frame);
+        *frame = static_cast<Image&&>(written);
+    }
+    else
+        slot.image = static_cast<Image&&>(*frame);
+
+    unsigned c = 0u;
+    while (c + 1u < sizeof(slot.filename) && filename[c])
+    {
+        slot.filename[c] = filename[c];
+        c++;
+    }
+    slot.filename[c] = '\0';
+    slot.submit_ns = start;
+
+    // Queue every filled slot in order, later ones may have been filled first
+    state.mutex.lock();
+    slot.ready = true;
+    state.stats.submitted++;
+
+    while (state.reserved && state.slots[(state.head + state.count) % state.capacity].ready)
+    {
+        state.slots[(state.head + state.count) % state.capacity].ready = false;
+        state.count++;
+        state.reserved--;
+    }
+    if (state.count > state.stats.max_queued)
+        state.stats.max_queued = state.count;
+
+    state.queued.wake_one();
+    state.mutex.unlock();
+    return true;
+}
+
+// Formats the filename of a submitted frame, an invalid one is stored
+// empty so that the frame is counted as failed when written.
+
+static void format_filename(char* filename, unsigned size, const char* fmt_filename, va_list ap)
+{
+    if (!fmt_filename || vsnprintf(filename, size, fmt_filename, ap) < 0)
+        filename[0] = '\0';
+}
+
+// Queues the frame taking its pixels and leaving it empty
+
+bool CaptureWriter::submit(Image&& frame, const char* fmt_filename, ...)
+{
+    char filename[512];
+    va_list ap;
+    va_start(ap, fmt_filename);
+    format_filename(filename, 512u, fmt_filename, ap);
+    va_end(ap);
+
+    return enqueue(&frame, nullptr, false, filename);
+}
+
+// Queues a copy of the frame
+
+bool CaptureWriter::submit(const Image& frame, const char* fmt_filename, ...)
+{
+    char filename[512];
+    va_list ap;
+    va_start(ap, fmt_filename);
+    format_filename(filename, 512u, fmt_filename, ap);
+    va_end(ap);
+
+    return enqueue(nullptr, &frame, false, filename);
+}
+
+// Queues the frame and gives back in it the buffer of a written frame
+
+bool CaptureWriter::exchange(Image& frame, const char* fmt_filename, ...)
+{
+    char filename[512];
+    va_list ap;
+    va_start(ap, fmt_filename);
+    format_filename(filename, 512u, fmt_filename, ap);
+    va_end(ap);
+
+    return enqueue(&frame, nullptr, true, filename);
+}
+
+// Waits until every queued frame is written
+
+void CaptureWriter::flush()
+{
+    state_->mutex.lock();
+    while (state_->count || state_->reserved)
+        state_->freed.wait(state_->mutex);
+    state_->mutex.unlock();
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Statistics
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Returns the statistics since the writer was created or reset
+
+CaptureStats CaptureWriter::stats() const
+{
+    state_->mutex.lock();
+    CaptureStats stats = state_->stats;
+    stats.queued = state_->count;
+    state_->mutex.unlock();
+    return stats;
+}
+
+// Resets the counters and latencies, the queue state is kept
+
+void CaptureWriter::reset_stats()
+{
+    state_->mutex.lock();
+    state_->stats = CaptureStats();
+    state_->latency_sum_ns = 0ull;
+    state_->finished = 0ull;
+    state_->mutex.unlock();
+}
@@ -0,0 +1,617 @@
+#include "ColorLUT.h"
+#include "Parallel.h"
+#include "SIMD.h"
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define LUT_ONE_ 32640						// Fixed point value of a full channel, 128 times 255
+#define LUT_FRACTION_BITS_ 12			// Bits of the position inside a cell
+#define LUT_SEPARABLE_TOLERANCE_ 2			// Largest fixed point difference still considered separable
+#define LUT_BLOCK_ 16384u					// Pixels per block of a parallel grade
+#define LUT_MIN_BLOCKS_ 4u					// Minimum blocks graded by each thread
+
+/*
+-------------------------------------------------------------------------------------------------------
+Interpolation kernels
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Read-only view of the tables used by the kernels, axes in B, G, R order
+
+struct LUTView
+{
+    const short* entries;
+    const unsigned* offsets[3];
+    const unsigned short* fractions[3];
+    unsigned strides[3];
+};
+
+// Axes sorted by position for every outcome of the comparisons R >= G, G >= B and R >= B,
+// B is 0, G is 1 and R is 2. Outcomes 1 and 6 are impossible.
+
+static const unsigned char tetrahedral_orders[8][3] = {
+    { 0u, 1u, 2u }, { 1u, 2u, 0u }, { 1u, 0u, 2u }, { 1u, 2u, 0u },
+    { 0u, 2u, 1u }, { 2u, 0u, 1u }, { 2u, 1u, 0u }, { 2u, 1u, 0u },
+};
+
+// Finds the four corners of the tetrahedron of the cell that contains the color,
+// and their weights. The cell is split along the axes sorted by their position,
+// picked from a table so that random colors do not cost branch mispredictions.
+
+static inline void tetrahedral_corners(const LUTView& lut, const Color& color, unsigned* corners, int* weights)
+{
+    const unsigned base = lut.offsets[0][color.B] + lut.offsets[1][color.G] + lut.offsets[2][color.R];
+    const int f[3] = { lut.fractions[0][color.B], lut.fractions[1][color.G], lut.fractions[2][color.R] };
+
+    const unsigned outcome = (unsigned)(f[2] >= f[1]) << 2 | (unsigned)(f[1] >= f[0]) << 1 | (unsigned)(f[2] >= f[0]);
+    const unsigned char* order = tetrahedral_orders[outcome];
+
+    corners[0] = base;
+    corners[1] = base + lut.strides[order[0]];
+    corners[2] = corners[1] + lut.strides[order[1]];
+    corners[3] = base + lut.strides[0] + lut.strides[1] + lut.strides[2];
+    weights[0] = (1 << LUT_FRACTION_BITS_) - f[order[0]];
+    weights[1] = f[order[0]] - f[order[1]];
+    weights[2] = f[order[1]] - f[order[2]];
+    weights[3] = f[order[2]];
+}
+
+// Returns the color with tetrahedral interpolation and the specified alpha
+
+static inline Color tetrahedral(const LUTView& lut, const Color& color, unsigned char alpha)
+{
+    unsigned corners[4];
+    int weights[4];
+    tetrahedral_corners(lut, color, corners, weights);
+
+    int sum[3] = {};
+    for (unsigned k = 0u; k < 4u; k++)
+        for (unsigned c = 0u; c < 3u; c++)
+            sum[c] += weights[k] * lut.entries[4u * corners[k] + c];
+
+    const int shift = 7 + LUT_FRACTION_BITS_;
+    return Color(
+        (unsigned char)((sum[2] + (1 << (shift - 1))) >> shift),
+        (unsigned char)((sum[1] + (1 << (shift - 1))) >> shift),
+        (unsigned char)((sum[0] + (1 << (shift - 1))) >> shift),
+        alpha
+    );
+}
+
+// Returns the color with trilinear interpolation and the specified alpha. It blends
+// along red, then green, then blue, rounding every step like the vector version.
+
+static inline Color trilinear(const LUTView& lut, const Color& color, unsigned char alpha)
+{
+    const unsigned base = lut.offsets[0][color.B] + lut.offsets[1][color.G] + lut.offsets[2][color.R];
+    const int fb = lut.fractions[0][color.B];
+    const int fg = lut.fractions[1][color.G];
+    const int fr = lut.fractions[2][color.R];
+    const int one = 1 << LUT_FRACTION_BITS_, half = one / 2;
+    const unsigned sb = lut.strides[0], sg = lut.strides[1], sr = lut.strides[2];
+
+    unsigned char result[3];
+    for (unsigned c = 0u; c < 3u; c++)
+    {
+        int edges[4];
+        for (unsigned k = 0u; k < 4u; k++)
+        {
+            const short* e = lut.entries + 4u * (base + (k & 1u) * sg + (k >> 1) * sb) + c;
+            edges[k] = ((one - fr) * e[0] + fr * e[4u * sr] + half) >> LUT_FRACTION_BITS_;
+        }
+
+        const int near = ((one - fg) * edges[0] + fg * edges[1] + half) >> LUT_FRACTION_BITS_;
+        const int far = ((one - fg) * edges[2] + fg * edges[3] + half) >> LUT_FRACTION_BITS_;
+        const int shift = 7 + LUT_FRACTION_BITS_;
+        result[c] = (unsigned char)(((one - fb) * near + fb * far + (1 << (shift - 1))) >> shift);
+    }
+    return Color(result[2], result[1], result[0], alpha);
+}
+
+// Grades the colors with tetrahedral interpolation, src and dst can be the same.
+// The vector version blends the corners of every pixel two at a time with madd.
+
+static void grade_tetrahedral(const LUTView& lut, const Color* src, Color* dst, unsigned long long count)
+{
+    unsigned long long i = 0ull;
+#ifdef IMAGE_SSE2_
+    const __m128i rounding = _mm_set1_epi32(1 << (6 + LUT_FRACTION_BITS_));
+    const __m128i alpha_mask = _mm_set1_epi32((int)0xFF000000);
+    for (; i + 4ull <= count; i += 4ull)
+    {
+        __m128i rgb[4];
+        for (unsigned q = 0u; q < 4u; q++)
+        {
+            unsigned corners[4];
+            int weights[4];
+            tetrahedral_corners(lut, src[i + q], corners, weights);
+
+            const __m128i e0 = _mm_loadl_epi64((const __m128i*)(lut.entries + 4u * corners[0]));
+            const __m128i e1 = _mm_loadl_epi64((const __m128i*)(lut.entries + 4u * corners[1]));
+            const __m128i e2 = _mm_loadl_epi64((const __m128i*)(lut.entries + 4u * corners[2]));
+            const __m128i e3 = _mm_loadl_epi64((const __m128i*)(lut.entries + 4u * corners[3]));
+
+            const __m128i s01 = _mm_madd_epi16(_mm_unpacklo_epi16(e0, e1), _mm_set1_epi32(weights[0] | weights[1] << 16));
+            const __m128i s23 = _mm_madd_epi16(_mm_unpacklo_epi16(e2, e3), _mm_set1_epi32(weights[2] | weights[3] << 16));
+            rgb[q] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(s01, s23), rounding), 7 + LUT_FRACTION_BITS_);
+        }
+
+        const __m128i alpha = _mm_and_si128(_mm_loadu_si128((const __m128i*)(src + i)), alpha_mask);
+        const __m128i colors = _mm_packus_epi16(_mm_packs_epi32(rgb[0], rgb[1]), _mm_packs_epi32(rgb[2], rgb[3]));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(colors, alpha));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = tetrahedral(lut, src[i], src[i].A);
+}
+
+// Grades the colors with trilinear interpolation, src and dst can be the same.
+// The vector version blends the four red edges, then the two green ones, then blue.
+
+static void grade_trilinear(const LUTView& lut, const Color* src, Color* dst, unsigned long long count)
+{
+    unsigned long long i = 0ull;
+#ifdef IMAGE_SSE2_
+    const int one = 1 << LUT_FRACTION_BITS_;
+    const __m128i half = _mm_set1_epi32(one / 2);
+    const __m128i rounding = _mm_set1_epi32(1 << (6 + LUT_FRACTION_BITS_));
+    const __m128i alpha_mask = _mm_set1_epi32((int)0xFF000000);
+    const unsigned sb = lut.strides[0], sg = lut.strides[1], sr = lut.strides[2];
+    for (; i + 4ull <= count; i += 4ull)
+    {
+        __m128i rgb[4];
+        for (unsigned q = 0u; q < 4u; q++)
+        {
+            const Color& c = src[i + q];
+            const unsigned base = lut.offsets[0][c.B] + lut.offsets[1][c.G] + lut.offsets[2][c.R];
+            const int fb = lut.fractions[0][c.B];
+            const int fg = lut.fractions[1][c.G];
+            const int fr = lut.fractions[2][c.R];
+
+            // Red edges of the four green and blue corners
+            const __m128i wr = _mm_set1_epi32((one - fr) | fr << 16);
+            __m128i edges[4];
+            for (unsigned k = 0u; k < 4u; k++)
+            {
+                const short* e = lut.entries + 4u * (base + (k & 1u) * sg + (k >> 1) * sb);
+                const __m128i pair = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)e), _mm_loadl_epi64((const __m128i*)(e + 4u * sr)));
+                edges[k] = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(pair, wr), half), LUT_FRACTION_BITS_);
+            }
+
+            // Pairs the edges of every blue side channel by channel
+            const __m128i wg = _mm_set1_epi32((one - fg) | fg << 16);
+            const __m128i x0 = _mm_packs_epi32(edges[0], edges[1]);
+            const __m128i x1 = _mm_packs_epi32(edges[2], edges[3]);
+            const __m128i near = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(x0, _mm_srli_si128(x0, 8)), wg), half), LUT_FRACTION_BITS_);
+            const __m128i far = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(x1, _mm_srli_si128(x1, 8)), wg), half), LUT_FRACTION_BITS_);
+
+            const __m128i wb = _mm_set1_epi32((one - fb) | fb << 16);
+            const __m128i y = _mm_packs_epi32(near, far);
+            rgb[q] = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(y, _mm_srli_si128(y, 8)), wb), rounding), 7 + LUT_FRACTION_BITS_);
+        }
+
+        const __m128i alpha = _mm_and_si128(_mm_loadu_si128((const __m128i*)(src + i)), alpha_mask);
+        const __m128i colors = _mm_packus_epi16(_mm_packs_epi32(rgb[0], rgb[1]), _mm_packs_epi32(rgb[2], rgb[3]));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(colors, alpha));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = trilinear(lut, src[i], src[i].A);
+}
+
+// Grades the colors through the fused per-channel lookups, src and dst can be the same
+
+static void grade_separable(const unsigned (*curves)[256], const Color* src, Color* dst, unsigned long long count)
+{
+    for (unsigned long long i = 0ull; i < count; i++)
+    {
+        uint32_t p;
+        memcpy(&p, (const void*)(src + i), sizeof(p));
+        p = curves[0][p & 0xFFu] | curves[1][p >> 8 & 0xFFu] | curves[2][p >> 16 & 0xFFu] | (p & 0xFF000000u);
+        memcpy((void*)(dst + i), &p, sizeof(p));
+    }
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Constructors / Destructors
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Creates a 3D table from size^3 RGB float triplets
+
+ColorLUT::ColorLUT(const float* table, unsigned int size)
+{
+    if (!set_table(table, size))
+        throw "Could not create color LUT";
+}
+
+// Copies the other table
+
+ColorLUT::ColorLUT(const ColorLUT& other)
+{
+    *this = other;
+}
+
+// Copies the other table
+
+ColorLUT& ColorLUT::operator=(const ColorLUT& other)
+{
+    if (&other == this)
+        return *this;
+
+    short* entries = nullptr;
+    if (other.entries_)
+    {
+        const size_t samples = other.cube_ ? (size_t)other.size_ * other.size_ * other.size_ : (size_t)other.size_;
+        entries = (short*)malloc(samples * 4u * sizeof(short));
+        if (!entries)
+            throw "Could not allocate color LUT";
+        memcpy(entries, other.entries_, samples * 4u * sizeof(short));
+    }
+
+    free(entries_);
+    entries_ = entries;
+    size_ = other.size_;
+    cube_ = other.cube_;
+    separable_ = other.separable_;
+    memcpy(offsets_, other.offsets_, sizeof(offsets_));
+    memcpy(fractions_, other.fractions_, sizeof(fractions_));
+    memcpy(curves_, other.curves_, sizeof(curves_));
+    return *this;
+}
+
+// Takes the other table and leaves it empty
+
+ColorLUT::ColorLUT(ColorLUT&& other) noexcept
+{
+    *this = static_cast<ColorLUT&&>(other);
+}
+
+// Takes the other table and leaves it empty
+
+ColorLUT& ColorLUT::operator=(ColorLUT&& other) noexcept
+{
+    if (&other == this)
+        return *this;
+
+    free(entries_);
+    entries_ = other.entries_;
+    size_ = other.size_;
+    cube_ = other.cube_;
+    separable_ = other.separable_;
+    memcpy(offsets_, other.offsets_, sizeof(offsets_));
+    memcpy(fractions_, other.fractions_, sizeof(fractions_));
+    memcpy(curves_, other.curves_, sizeof(curves_));
+
+    other.entries_ = nullptr;
+    other.size_ = 0u;
+    other.cube_ = false;
+    other.separable_ = false;
+    return *this;
+}
+
+// Frees the table
+
+ColorLUT::~ColorLUT()
+{
+    free(entries_);
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Building
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Converts a sample from 0 to 1 to fixed point, clamping it, NaN to zero
+
+static inline short fixed_sample(float value)
+{
+    const float v = value > 1.f ? 1.f : value > 0.f ? value : 0.f;
+    return (short)(v * (float)LUT_ONE_ + 0.5f);
+}
+
+// Stores the samples, red fastest, with the input domain of every channel. Then computes
+// the cell of every 8-bit value along each axis, and the fused lookups if separable.
+
+bool ColorLUT::set_samples(const float* samples, unsigned int size, bool cube, const float* domain_min, const float* domain_max)
+{
+    static const float zeros[3] = { 0.f, 0.f, 0.f };
+    static const float ones[3] = { 1.f, 1.f, 1.f };
+    if (!domain_min) domain_min = zeros;
+    if (!domain_max) domain_max = ones;
+
+    if (!samples || size < 2u || size > MAX_LUT_SIZE_)
+        return false;
+
+    for (unsigned c = 0u; c < 3u; c++)
+        if (!(domain_max[c] > domain_min[c]))
+            return false;
+
+    const size_t count = cube ? (size_t)size * size * size : (size_t)size;
+    short* entries = (short*)malloc(count * 4u * sizeof(short));
+    if (!entries)
+        return false;
+
+    // Samples come as R, G, B, stored as B, G, R, 0 like the colors
+    for (size_t s = 0u; s < count; s++)
+    {
+        entries[4u * s + 0u] = fixed_sample(samples[3u * s + 2u]);
+        entries[4u * s + 1u] = fixed_sample(samples[3u * s + 1u]);
+        entries[4u * s + 2u] = fixed_sample(samples[3u * s + 0u]);
+        entries[4u * s + 3u] = 0;
+    }
+
+    free(entries_);
+    entries_ = entries;
+    size_ = size;
+    cube_ = cube;
+
+    // Cells along every axis, B, G, R, with domains given in R, G, B order
+    const unsigned strides[3] = { cube ? size * size : 1u, cube ? size : 1u, 1u };
+    for (unsigned a = 0u; a < 3u; a++)
+    {
+        const float lo = domain_min[2u - a], range = domain_max[2u - a] - lo;
+        for (unsigned v = 0u; v < 256u; v++)
+        {
+            float position = ((float)v / 255.f - lo) / range * (float)(size - 1u);
+            position = position < 0.f ? 0.f : position > (float)(size - 1u) ? (float)(size - 1u) : position;
+
+            unsigned cell = (unsigned)position;
+            if (cell > size - 2u)
+                cell = size - 2u;
+
+            offsets_[a][v] = cell * strides[a];
+            fractions_[a][v] = (unsigned short)((position - (float)cell) * (float)(1 << LUT_FRACTION_BITS_) + 0.5f);
+        }
+    }
+
+    // A 3D table is separable if every channel matches the one of its axis
+    separable_ = true;
+    for (unsigned b = 0u; cube && separable_ && b < size; b++)
+        for (unsigned g = 0u; separable_ && g < size; g++)
+            for (unsigned r = 0u; r < size; r++)
+            {
+                const short* e = entries + 4u * (r + (size_t)g * size + (size_t)b * size * size);
+                const int db = e[0] - entries[4u * b * strides[0] + 0u];
+                const int dg = e[1] - entries[4u * g * strides[1] + 1u];
+                const int dr = e[2] - entries[4u * r * strides[2] + 2u];
+                if (db * db > LUT_SEPARABLE_TOLERANCE_ * LUT_SEPARABLE_TOLERANCE_ ||
+                    dg * dg > LUT_SEPARABLE_TOLERANCE_ * LUT_SEPARABLE_TOLERANCE_ ||
+                    dr * dr > LUT_SEPARABLE_TOLERANCE_ * LUT_SEPARABLE_TOLERANCE_)
+                {
+                    separable_ = false;
+                    break;
+                }
+            }
+
+    // Fused lookups, interpolated along the axis of every channel
+    if (separable_)
+    {
+        const int one = 1 << LUT_FRACTION_BITS_, shift = 7 + LUT_FRACTION_BITS_;
+        for (unsigned a = 0u; a < 3u; a++)
+            for (unsigned v = 0u; v < 256u; v++)
+            {
+                const short* e = entries + 4u * offsets_[a][v] + a;
+                const int f = fractions_[a][v];
+                const int value = ((one - f) * e[0] + f * e[4u * strides[a]] + (1 << (shift - 1))) >> shift;
+                curves_[a][v] = (unsigned)value << 8u * a;
+            }
+    }
+    return true;
+}
+
+// Sets a 3D table of size^3 RGB float triplets from 0 to 1, with the red input changing fastest
+
+bool ColorLUT::set_table(const float* table, unsigned int size, const float* domain_min, const float* domain_max)
+{
+    return set_samples(table, size, true, domain_min, domain_max);
+}
+
+// Sets a 1D table of size RGB float triplets from 0 to 1, one curve per channel
+
+bool ColorLUT::set_curves(const float* table, unsigned int size, const float* domain_min, const float* domain_max)
+{
+    return set_samples(table, size, false, domain_min, domain_max);
+}
+
+// Returns the text after the keyword if the line starts with it, nullptr otherwise
+
+static const char* cube_keyword(const char* line, const char* keyword)
+{
+    const size_t length = strlen(keyword);
+    if (strncmp(line, keyword, length) || (line[length] != ' ' && line[length] != '\t'))
+        return nullptr;
+    return line + length;
+}
+
+// Parses count floats from the text, returns false if there are less
+
+static bool cube_floats(const char* text, float* values, unsigned count)
+{
+    for (unsigned k = 0u; k < count; k++)
+    {
+        char* end;
+        values[k] = strtof(text, &end);
+        if (end == text)
+            return false;
+        text = end;
+    }
+    return true;
+}
+
+// Loads a 3D or 1D table from a .cube file. Keywords it does not know, like
+// TITLE, are skipped, and so are comments starting with '#'.
+
+bool ColorLUT::load(const char* fmt_filename, ...)
+{
+    va_list ap;
+    char filename[512];
+
+    va_start(ap, fmt_filename);
+    const bool formatted = fmt_filename && vsnprintf(filename, 512u, fmt_filename, ap) >= 0;
+    va_end(ap);
+
+    FILE* file = formatted ? fopen(filename, "rb") : nullptr;
+    if (!file)
+        return false;
+
+    float domain_min[3] = { 0.f, 0.f, 0.f };
+    float domain_max[3] = { 1.f, 1.f, 1.f };
+    float* samples = nullptr;
+    unsigned size = 0u;
+    bool cube = false;
+    size_t expected = 0u, read = 0u;
+
+    bool valid = true, line_start = true;
+    char line[512];
+    while (valid && fgets(line, sizeof(line), file))
+    {
+        // Long lines come in pieces, only the first one counts
+        const bool start = line_start;
+        line_start = strchr(line, '\n') != nullptr;
+        if (!start)
+            continue;
+
+        const char* p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+
+        if (!*p || *p == '#' || *p == '\r' || *p == '\n')
+            continue;
+
+        const char* args;
+        if ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.')
+        {
+            valid = samples && read < expected && cube_floats(p, samples + 3u * read, 3u);
+            read++;
+        }
+        else if ((args = cube_keyword(p, "LUT_3D_SIZE")) || (args = cube_keyword(p, "LUT_1D_SIZE")))
+        {
+            cube = p[4] == '3';
+            size = (unsigned)strtoul(args, nullptr, 10);
+            valid = !samples && size >= 2u && size <= MAX_LUT_SIZE_;
+            if (valid)
+            {
+                expected = cube ? (size_t)size * size * size : (size_t)size;
+                samples = (float*)malloc(expected * 3u * sizeof(float));
+                valid = samples != nullptr;
+            }
+        }
+        else if ((args = cube_keyword(p, "DOMAIN_MIN")))
+            valid = cube_floats(args, domain_min, 3u);
+        else if ((args = cube_keyword(p, "DOMAIN_MAX")))
+            valid = cube_floats(args, domain_max, 3u);
+        else if ((args = cube_keyword(p, "LUT_3D_INPUT_RANGE")) || (args = cube_keyword(p, "LUT_1D_INPUT_RANGE")))
+        {
+            float range[2];
+            valid = cube_floats(args, range, 2u);
+            for (unsigned c = 0u; c < 3u; c++)
+            {
+                domain_min[c] = range[0];
+                domain_max[c] = range[1];
+            }
+        }
+    }
+    fclose(file);
+
+    const bool loaded = valid && samples && read == expected && set_samples(samples, size, cube, domain_min, domain_max);
+    free(samples);
+    return loaded;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Queries
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Returns the number of samples per axis, zero if empty
+
+unsigned ColorLUT::size() const
+{
+    return size_;
+}
+
+// Returns whether it is a 3D table, otherwise a 1D one
+
+bool ColorLUT::is_3d() const
+{
+    return cube_;
+}
+
+// Returns whether the grade is separable
+
+bool ColorLUT::separable() const
+{
+    return separable_;
+}
+
+// Returns the graded color
+
+Color ColorLUT::lookup(Color color, LUTInterpolation interpolation) const
+{
+    if (separable_)
+    {
+        Color graded;
+        grade_separable(curves_, &color, &graded, 1ull);
+        return graded;
+    }
+
+    const LUTView lut = {
+        entries_,
+        { offsets_[0], offsets_[1], offsets_[2] },
+        { fractions_[0], fractions_[1], fractions_[2] },
+        { size_ * size_, size_, 1u }
+    };
+    return interpolation == LUT_INTERPOLATION_TRILINEAR ? trilinear(lut, color, color.A) : tetrahedral(lut, color, color.A);
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Grading
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Grades every pixel of the image in place, in blocks spread over the threads
+
+bool ColorLUT::apply(Image& image, LUTInterpolation interpolation) const
+{
+    if (!size_)
+        return false;
+
+    const unsigned long long count = (unsigned long long)image.width() * image.height();
+    if (!count)
+        return true;
+
+    Color* pixels = image.pixels();
+    const unsigned blocks = (unsigned)((count + LUT_BLOCK_ - 1u) / LUT_BLOCK_);
+
+    const LUTView lut = {
+        entries_,
+        { offsets_[0], offsets_[1], offsets_[2] },
+        { fractions_[0], fractions_[1], fractions_[2] },
+        { size_ * size_, size_, 1u }
+    };
+
+    parallel_for(blocks, LUT_MIN_BLOCKS_, [&](unsigned begin, unsigned end)
+        {
+            Color* first = pixels + (unsigned long long)begin * LUT_BLOCK_;
+            const unsigned long long last = (unsigned long long)end * LUT_BLOCK_;
+            const unsigned long long span = (last < count ? last : count) - (unsigned long long)begin * LUT_BLOCK_;
+
+            if (separable_)
+                grade_separable(curves_, first, first, span);
+            else if (interpolation == LUT_INTERPOLATION_TRILINEAR)
+                grade_trilinear(lut, first, first, span);
+            else
+                grade_tetrahedral(lut, first, first, span);
+        });
+
+    return true;
+}
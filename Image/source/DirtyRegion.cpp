@@ -0,0 +1,420 @@
+#include "DirtyRegion.h"
+
+#include <cstdlib>
+#include <cstring>
+
+/*
+-------------------------------------------------------------------------------------------------------
+Constructors / Destructors
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Creates a region for an image of the specified size, all clean or all dirty
+
+DirtyRegion::DirtyRegion(unsigned int width, unsigned int height, bool dirty)
+{
+    reset(width, height, dirty);
+}
+
+// Copies the other region
+
+DirtyRegion::DirtyRegion(const DirtyRegion& other)
+{
+    *this = other;
+}
+
+// Copies the other region, reusing the spans if the height matches
+
+DirtyRegion& DirtyRegion::operator=(const DirtyRegion& other)
+{
+    if (&other == this)
+        return *this;
+
+    if (other.all_ || !other.spans_)
+    {
+        reset(other.width_, other.height_, other.all_);
+        return *this;
+    }
+
+    if (!spans_ || height_ != other.height_)
+    {
+        free(spans_);
+        spans_ = (unsigned int*)malloc((size_t)other.height_ * 2u * sizeof(unsigned int));
+        if (!spans_)
+        {
+            width_ = height_ = first_row_ = end_row_ = 0u;
+            all_ = false;
+            throw "Could not allocate dirty region";
+        }
+    }
+
+    memcpy(spans_, other.spans_, (size_t)other.height_ * 2u * sizeof(unsigned int));
+    width_ = other.width_;
+    height_ = other.height_;
+    first_row_ = other.first_row_;
+    end_row_ = other.end_row_;
+    all_ = false;
+    return *this;
+}
+
+// Takes the other region and leaves it empty
+
+DirtyRegion::DirtyRegion(DirtyRegion&& other) noexcept
+    :spans_{ other.spans_ }, width_{ other.width_ }, height_{ other.height_ },
+    first_row_{ other.first_row_ }, end_row_{ other.end_row_ }, all_{ other.all_ }
+{
+    other.spans_ = nullptr;
+    other.width_ = other.height_ = other.first_row_ = other.end_row_ = 0u;
+    other.all_ = false;
+}
+
+// Takes the other region and leaves it empty
+
+DirtyRegion& DirtyRegion::operator=(DirtyRegion&& other) noexcept
+{
+    if (&other == this)
+        return *this;
+
+    free(spans_);
+    spans_ = other.spans_;
+    width_ = other.width_;
+    height_ = other.height_;
+    first_row_ = other.first_row_;
+    end_row_ = other.end_row_;
+    all_ = other.all_;
+
+    other.spans_ = nullptr;
+    other.width_ = other.height_ = other.first_row_ = other.end_row_ = 0u;
+    other.all_ = false;
+    return *this;
+}
+
+// Frees the spans
+
+DirtyRegion::~DirtyRegion()
+{
+    free(spans_);
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Marking
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Makes sure the spans exist and sets them all clean. Only the rows
+// between the first and end dirty rows can be dirty, the rest already are clean.
+
+void DirtyRegion::clear_spans()
+{
+    unsigned first = first_row_, end = end_row_;
+    if (!spans_ && height_)
+    {
+        spans_ = (unsigned int*)malloc((size_t)height_ * 2u * sizeof(unsigned int));
+        if (!spans_)
+            throw "Could not allocate dirty region";
+
+        first = 0u;
+        end = height_;
+    }
+
+    for (unsigned row = first; row < end; row++)
+    {
+        spans_[2u * row + 0u] = ~0u;
+        spans_[2u * row + 1u] = 0u;
+    }
+
+    first_row_ = height_;
+    end_row_ = 0u;
+    all_ = false;
+}
+
+// Sets the size of the image tracked and marks it all clean or all dirty.
+// Marking it dirty never allocates, the spans are dropped if the height changes.
+
+void DirtyRegion::reset(unsigned int width, unsigned int height, bool dirty)
+{
+    if (height != height_)
+    {
+        free(spans_);
+        spans_ = nullptr;
+        first_row_ = end_row_ = 0u;
+    }
+
+    width_ = width;
+    height_ = height;
+
+    if (dirty)
+        add_all();
+    else
+        clear_spans();
+}
+
+// Marks the pixel as dirty, ignored if outside the image
+
+void DirtyRegion::add(unsigned int row, unsigned int col)
+{
+    if (all_ || row >= height_ || col >= width_)
+        return;
+
+    unsigned int* span = spans_ + 2u * row;
+    if (col < span[0]) span[0] = col;
+    if (col >= span[1]) span[1] = col + 1u;
+
+    if (row < first_row_) first_row_ = row;
+    if (row >= end_row_) end_row_ = row + 1u;
+}
+
+// Marks the rectangle starting at the specified pixel coordinates with
+// the specified size as dirty, the parts outside the image are ignored
+
+void DirtyRegion::add(unsigned int row, unsigned int col, unsigned int height, unsigned int width)
+{
+    if (all_ || row >= height_ || col >= width_ || !height || !width)
+        return;
+
+    if (height > height_ - row) height = height_ - row;
+    if (width > width_ - col) width = width_ - col;
+
+    if (row == 0u && col == 0u && height == height_ && width == width_)
+    {
+        add_all();
+        return;
+    }
+
+    const unsigned end = col + width;
+    for (unsigned r = row; r < row + height; r++)
+    {
+        unsigned int* span = spans_ + 2u * r;
+        if (col < span[0]) span[0] = col;
+        if (end > span[1]) span[1] = end;
+    }
+
+    if (row < first_row_) first_row_ = row;
+    if (row + height > end_row_) end_row_ = row + height;
+}
+
+// Marks the whole image as dirty, the spans are left as they are and
+// ignored until the region is cleared. Empty images have no dirty pixels.
+
+void DirtyRegion::add_all()
+{
+    if (!width_ || !height_)
+    {
+        free(spans_);
+        spans_ = nullptr;
+        first_row_ = end_row_ = 0u;
+        all_ = false;
+        return;
+    }
+
+    all_ = true;
+    first_row_ = 0u;
+    end_row_ = height_;
+}
+
+// Adds the dirty pixels of the other region, which must track an image of the same size
+
+bool DirtyRegion::merge(const DirtyRegion& other)
+{
+    if (other.width_ != width_ || other.height_ != height_)
+        return false;
+
+    if (all_ || &other == this || other.empty())
+        return true;
+
+    if (other.all_)
+    {
+        add_all();
+        return true;
+    }
+
+    for (unsigned row = other.first_row_; row < other.end_row_; row++)
+    {
+        const unsigned int* src = other.spans_ + 2u * row;
+        unsigned int* span = spans_ + 2u * row;
+        if (src[0] < span[0]) span[0] = src[0];
+        if (src[1] > span[1]) span[1] = src[1];
+    }
+
+    if (other.first_row_ < first_row_) first_row_ = other.first_row_;
+    if (other.end_row_ > end_row_) end_row_ = other.end_row_;
+    return true;
+}
+
+// Marks the whole image as clean
+
+void DirtyRegion::clear()
+{
+    if (all_)
+    {
+        // The spans were left as they were when everything got dirty
+        first_row_ = 0u;
+        end_row_ = height_;
+    }
+    clear_spans();
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Queries
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Returns whether no pixel is dirty
+
+bool DirtyRegion::empty() const
+{
+    return end_row_ <= first_row_;
+}
+
+// Returns whether the whole image is dirty
+
+bool DirtyRegion::all() const
+{
+    return all_;
+}
+
+// Returns the width of the image tracked
+
+unsigned DirtyRegion::width() const
+{
+    return width_;
+}
+
+// Returns the height of the image tracked
+
+unsigned DirtyRegion::height() const
+{
+    return height_;
+}
+
+// Returns the first dirty row, or the height if clean
+
+unsigned DirtyRegion::first_row() const
+{
+    return empty() ? height_ : first_row_;
+}
+
+// Returns the row after the last dirty row, or zero if clean
+
+unsigned DirtyRegion::end_row() const
+{
+    return empty() ? 0u : end_row_;
+}
+
+// Stores in first and end the dirty columns [first, end) of the row
+
+bool DirtyRegion::row_span(unsigned int row, unsigned int* first, unsigned int* end) const
+{
+    *first = *end = 0u;
+    if (row < first_row_ || row >= end_row_)
+        return false;
+
+    if (all_)
+    {
+        *end = width_;
+        return true;
+    }
+
+    const unsigned int* span = spans_ + 2u * row;
+    if (span[0] >= span[1])
+        return false;
+
+    *first = span[0];
+    *end = span[1];
+    return true;
+}
+
+// Returns the smallest rectangle covering every dirty pixel, empty if clean
+
+ImageRect DirtyRegion::bounds() const
+{
+    ImageRect rect;
+    if (empty())
+        return rect;
+
+    unsigned first = ~0u, end = 0u;
+    for (unsigned row = first_row_; row < end_row_; row++)
+    {
+        unsigned a, b;
+        if (!row_span(row, &a, &b))
+            continue;
+
+        if (a < first) first = a;
+        if (b > end) end = b;
+    }
+
+    rect.row = first_row_;
+    rect.col = first;
+    rect.height = end_row_ - first_row_;
+    rect.width = end - first;
+    return rect;
+}
+
+// Returns the number of pixels covered by the row spans
+
+unsigned long long DirtyRegion::area() const
+{
+    if (all_)
+        return (unsigned long long)width_ * height_;
+
+    unsigned long long area = 0ull;
+    for (unsigned row = first_row_; row < end_row_; row++)
+    {
+        const unsigned int* span = spans_ + 2u * row;
+        if (span[0] < span[1])
+            area += span[1] - span[0];
+    }
+    return area;
+}
+
+// Merges the row spans into rectangles, joining consecutive rows whose spans overlap.
+// Fills up to max_rects entries and returns the number of rectangles.
+
+unsigned DirtyRegion::rects(ImageRect* rects, unsigned int max_rects) const
+{
+    unsigned count = 0u;
+    ImageRect current;
+    bool open = false;
+
+    for (unsigned row = first_row_; row < end_row_; row++)
+    {
+        unsigned first, end;
+        const bool dirty = row_span(row, &first, &end);
+
+        // Joins the rectangle if the span touches its columns
+        if (dirty && open && first <= current.col + current.width && end >= current.col)
+        {
+            const unsigned current_end = current.col + current.width;
+            if (first < current.col) current.col = first;
+            current.width = (end > current_end ? end : current_end) - current.col;
+            current.height++;
+            continue;
+        }
+
+        if (open)
+        {
+            if (count < max_rects)
+                rects[count] = current;
+            count++;
+        }
+
+        open = dirty;
+        if (dirty)
+        {
+            current.row = row;
+            current.col = first;
+            current.height = 1u;
+            current.width = end - first;
+        }
+    }
+
+    if (open)
+    {
+        if (count < max_rects)
+            rects[count] = current;
+        count++;
+    }
+    return count;
+}
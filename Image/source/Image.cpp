@@ -1,4 +1,6 @@
 #include "Image.h"
+#include "Parallel.h"
+#include "BMP.h"
 
 #include <cstdint>
 #include <cstdarg>
@@ -47,22 +49,6 @@ static inline void write_le32(FILE* f, uint32_t v)
     };
     if (fwrite(b, 1, 4, f) != 4) throw "Failed to write in file, possible corruption";
 }
-static inline uint16_t read_le16(FILE* f) 
-{
-    uint8_t b[2]; 
-    if (fread(b, 1, 2, f) != 2) 
-        throw "Failed to read from file, possible corruption";
-
-    return (uint16_t)(b[0] | (b[1] << 8));
-}
-static inline uint32_t read_le32(FILE* f) 
-{
-    uint8_t b[4]; 
-    if (fread(b, 1, 4, f) != 4) 
-        throw "Failed to read from file, possible corruption";
-
-    return (uint32_t)(b[0] | (b[1] << 8) | (b[2] << 16) | (b[3] << 24));
-}
 
 /*
 -------------------------------------------------------------------------------------------------------
@@ -91,62 +77,338 @@ Image::Image(const char* fmt_filename, ...)
         throw "Could not create image from file";
 }
 
-// Copies the other image
+// Copies the other image, using its same allocator. 
+// If the other is copy-on-write it shares its pixels instead.
 
 Image::Image(const Image& other)
-	:width_(other.width_), height_(other.height_)
+    :allocator_{ other.allocator_ }, copy_on_write_{ other.copy_on_write_ }
 {
-	pixels_ = (Color*)calloc(width_ * height_, sizeof(Color));
-	memcpy(pixels_, other.pixels_, width_ * height_ * sizeof(Color));
+    if (copy_on_write_)
+    {
+        share_pixels(other);
+        return;
+    }
+
+    if (!allocate_pixels(other.width_, other.height_, false))
+        throw "Could not allocate image pixels";
+
+    if (pixels_)
+        memcpy(pixels_, other.pixels_, (size_t)width_ * height_ * sizeof(Color));
 }
 
-// Copies the other image
+// Copies the other image, reuses the pixel buffer if the size matches.
+// If the other is copy-on-write it shares its pixels instead.
 
 Image& Image::operator=(const Image& other)
 {
     if (&other == this) 
         return *this;
 
+    if (other.copy_on_write_)
+    {
+        free_pixels();
+        allocator_ = other.allocator_;
+        copy_on_write_ = true;
+        share_pixels(other);
+        mark_all_dirty();
+        return *this;
+    }
+
+    if (!allocate_pixels(other.width_, other.height_, false))
+        throw "Could not allocate image pixels";
+
     if (pixels_)
-        free(pixels_);
+        memcpy(pixels_, other.pixels_, (size_t)width_ * height_ * sizeof(Color));
+
+    return *this;
+}
+
+// Takes the other image pixels and leaves it empty
+
+Image::Image(Image&& other) noexcept
+    :pixels_{ other.pixels_ }, width_{ other.width_ }, height_{ other.height_ }, allocator_{ other.allocator_ },
+    copy_on_write_{ other.copy_on_write_ }, refs_{ other.refs_ }, dirty_{ other.dirty_ }
+{
+    other.dirty_ = nullptr;
+    other.refs_ = nullptr;
+    other.pixels_ = nullptr;
+    other.width_ = 0u;
+    other.height_ = 0u;
+}
+
+// Takes the other image pixels and leaves it empty, keeps tracking
+// the dirty pixels if it did, now all of them.
+
+Image& Image::operator=(Image&& other) noexcept
+{
+    if (&other == this)
+        return *this;
+
+    free_pixels();
 
+    pixels_ = other.pixels_;
     width_ = other.width_;
     height_ = other.height_;
-    pixels_ = (Color*)calloc(width_ * height_, sizeof(Color));
-    memcpy(pixels_, other.pixels_, width_ * height_ * sizeof(Color));
+    allocator_ = other.allocator_;
+    copy_on_write_ = other.copy_on_write_;
+    refs_ = other.refs_;
 
+    other.refs_ = nullptr;
+    other.pixels_ = nullptr;
+    other.width_ = 0u;
+    other.height_ = 0u;
+
+    mark_all_dirty();
     return *this;
 }
 
 // Stores a copy of the color pointer
 
 Image::Image(Color* pixels, unsigned int width, unsigned int height)
-    :width_{ width }, height_{ height }, pixels_{ (Color*)calloc(width * height, sizeof(Color)) }
 {
-    memcpy(pixels_, pixels, width * height * sizeof(Color));
+    if (!allocate_pixels(width, height, false))
+        throw "Could not allocate image pixels";
+
+    memcpy(pixels_, pixels, (size_t)width * height * sizeof(Color));
 }
 
-// Creates an image with the specified size and color
+// Creates an image with the specified size and color, only transparent 
+// images ask the allocator for zeroed memory, the rest are filled directly.
 
-Image::Image(unsigned int w, unsigned int h, Color color)
+Image::Image(unsigned int w, unsigned int h, Color color, PixelAllocator* allocator)
+    :allocator_{ allocator }
 {
-    width_ = w;
-    height_ = h;
-
-    pixels_ = (Color*)calloc(width_ * height_, sizeof(Color));
+    const bool zero = color == Color::Transparent;
+    if (!allocate_pixels(w, h, zero))
+        throw "Could not allocate image pixels";
     
-    if (color != Color::Transparent)
-    {
-        for (unsigned int i = 0; i < width_ * height_; i++)
-            pixels_[i] = color;
-    }
+    if (!zero)
+        fill_colors(pixels_, (unsigned long long)width_ * height_, color);
 }
 
 // Frees the pixel pointer
 
 Image::~Image()
 {
-	free(pixels_);
+    free_pixels();
+    delete dirty_;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Pixel allocation
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Allocator used by images without one
+
+PixelAllocator* Image::default_allocator_ = nullptr;
+
+// Creates a reference count for a copy-on-write buffer
+
+static long long* new_refs()
+{
+    long long* refs = (long long*)calloc(1, sizeof(long long));
+    *refs = 1;
+    return refs;
+}
+
+// Makes sure the pixel buffer holds width x height pixels, reusing the current
+// buffer if the size matches. The content is only zeroed if requested.
+// Callers overwrite every pixel, so all are marked dirty if tracked.
+
+bool Image::allocate_pixels(unsigned int width, unsigned int height, bool zero)
+{
+    const unsigned long long bytes = (unsigned long long)width * height * sizeof(Color);
+
+    if (is_shared())
+        free_pixels();
+
+    if (pixels_ && (unsigned long long)width_ * height_ * sizeof(Color) == bytes)
+    {
+        width_ = width;
+        height_ = height;
+        if (zero)
+            memset((void*)pixels_, 0, (size_t)bytes);
+        mark_all_dirty();
+        return true;
+    }
+
+    free_pixels();
+
+    if (!allocator_)
+        allocator_ = default_allocator();
+
+    width_ = width;
+    height_ = height;
+    mark_all_dirty();
+    if (!bytes)
+        return true;
+
+    pixels_ = (Color*)allocator_->allocate(bytes, zero);
+    if (pixels_)
+    {
+        if (copy_on_write_)
+            refs_ = new_refs();
+        return true;
+    }
+
+    width_ = height_ = 0u;
+    mark_all_dirty();
+    return false;
+}
+
+// Releases the pixel buffer to the allocator, or drops the reference if shared
+
+void Image::free_pixels()
+{
+    if (refs_)
+    {
+        if (atomic_add(refs_, -1) == 0)
+        {
+            free(refs_);
+            refs_ = nullptr;
+        }
+        else
+        {
+            refs_ = nullptr;
+            pixels_ = nullptr;
+        }
+    }
+
+    if (pixels_)
+        allocator_->release(pixels_, (unsigned long long)width_ * height_ * sizeof(Color));
+
+    pixels_ = nullptr;
+    width_ = height_ = 0u;
+}
+
+// Shares the pixel buffer of the other image, which must be copy-on-write.
+
+void Image::share_pixels(const Image& other)
+{
+    pixels_ = other.pixels_;
+    width_ = other.width_;
+    height_ = other.height_;
+    refs_ = other.refs_;
+
+    if (refs_)
+        atomic_add(refs_, 1);
+}
+
+// Makes a private copy of the pixel buffer if it is shared with other images
+
+void Image::detach()
+{
+    if (!refs_ || atomic_load(refs_) == 1)
+        return;
+
+    const unsigned long long bytes = (unsigned long long)width_ * height_ * sizeof(Color);
+    Color* pixels = (Color*)allocator_->allocate(bytes, false);
+    if (!pixels)
+        throw "Could not allocate image pixels";
+
+    memcpy(pixels, pixels_, (size_t)bytes);
+
+    if (atomic_add(refs_, -1) == 0)
+    {
+        // The other images released it meanwhile
+        allocator_->release(pixels_, bytes);
+        free(refs_);
+    }
+
+    refs_ = new_refs();
+    pixels_ = pixels;
+}
+
+// Returns the allocator used for the pixels
+
+PixelAllocator* Image::allocator() const
+{
+    return allocator_ ? allocator_ : default_allocator();
+}
+
+// Sets the allocator used for the pixels, moving the current pixels to it
+
+void Image::set_allocator(PixelAllocator* allocator)
+{
+    if (!allocator)
+        allocator = default_allocator();
+
+    if (allocator == allocator_)
+        return;
+
+    detach();
+
+    if (!pixels_)
+    {
+        allocator_ = allocator;
+        return;
+    }
+
+    const unsigned long long bytes = (unsigned long long)width_ * height_ * sizeof(Color);
+    Color* pixels = (Color*)allocator->allocate(bytes, false);
+    if (!pixels)
+        throw "Could not allocate image pixels";
+
+    memcpy(pixels, pixels_, (size_t)bytes);
+    allocator_->release(pixels_, bytes);
+
+    pixels_ = pixels;
+    allocator_ = allocator;
+}
+
+// Sets the allocator used by new images, nullptr restores the standard one
+
+void Image::set_default_allocator(PixelAllocator* allocator)
+{
+    default_allocator_ = allocator;
+}
+
+// Returns the allocator used by new images
+
+PixelAllocator* Image::default_allocator()
+{
+    return default_allocator_ ? default_allocator_ : PixelAllocator::standard();
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Copy-on-write
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Enables or disables copy-on-write, disabling it makes a private copy if shared.
+
+void Image::set_copy_on_write(bool enable)
+{
+    if (enable == copy_on_write_)
+        return;
+
+    if (!enable)
+    {
+        detach();
+        free(refs_);
+        refs_ = nullptr;
+    }
+    else if (pixels_)
+        refs_ = new_refs();
+
+    copy_on_write_ = enable;
+}
+
+// Returns whether copy-on-write is enabled
+
+bool Image::copy_on_write() const
+{
+    return copy_on_write_;
+}
+
+// Returns whether the pixels are currently shared with another image
+
+bool Image::is_shared() const
+{
+    return refs_ && atomic_load(refs_) > 1;
 }
 
 /*
@@ -155,9 +417,22 @@ User end functions
 -------------------------------------------------------------------------------------------------------
 */
 
-// Returns the pointer to the image pixels as a color array
+// Returns the pointer to the image pixels as a color array, if the dirty
+// pixels are tracked all are marked since any of them can be written
 
 Color* Image::pixels()
+{
+    if (refs_)
+        detach();
+
+    mark_all_dirty();
+
+    return pixels_;
+}
+
+// Returns the constant pointer to the image pixels as a color array
+
+const Color* Image::pixels() const
 {
     return pixels_;
 }
@@ -180,6 +455,12 @@ unsigned Image::height() const
 
 Color& Image::operator()(unsigned int row, unsigned int col)
 {
+    if (refs_)
+        detach();
+
+    if (dirty_)
+        dirty_->add(row, col);
+
     return pixels_[row * width_ + col];
 }
 
@@ -209,16 +490,11 @@ bool Image::save(const char* fmt_filename, ...) const
     char filename[512];
 
     va_start(ap, fmt_filename);
-    if (vsnprintf(filename, 512, fmt_filename, ap) < 0) return false;
+    const bool formatted = bmp_format_filename(filename, 512u, fmt_filename, ap);
     va_end(ap);
 
-    unsigned c = 0;
-    while (filename[++c] && filename[c] != '.');
-    filename[c++] = '.';
-    filename[c++] = 'b';
-    filename[c++] = 'm';
-    filename[c++] = 'p';
-    filename[c++] = '\0';
+    if (!formatted)
+        return false;
 
     FILE* file = fopen(filename, "wb");
     if (!file) 
@@ -302,112 +578,58 @@ bool Image::load(const char* fmt_filename, ...)
     char filename[512];
 
     va_start(ap, fmt_filename);
-    if (vsnprintf(filename, 512, fmt_filename, ap) < 0) return false;
+    const bool formatted = bmp_format_filename(filename, 512u, fmt_filename, ap);
     va_end(ap);
 
-    unsigned c = 0;
-    while (filename[++c] && filename[c] != '.');
-    filename[c++] = '.';
-    filename[c++] = 'b';
-    filename[c++] = 'm';
-    filename[c++] = 'p';
-    filename[c++] = '\0';
-
-    FILE* file = fopen(filename, "rb");
-    if (!file) return false;
+    if (!formatted)
+        return false;
 
-    // Check signature
-    char sig[2];
-    if (fread(sig, 1, 2, file) != 2 || sig[0] != 'B' || sig[1] != 'M')
-    {
-        fclose(file);
+    // see bmp_loadable() for the supported formats
+    BMPReader reader;
+    if (!bmp_open(&reader, filename))
         return false;
-    }
 
-    (void)read_le32(file); // bfSize
-    (void)read_le16(file); // bfReserved1
-    (void)read_le16(file); // bfReserved2
-    uint32_t bfOffBits = read_le32(file);
-
-    uint32_t biSize = read_le32(file);
-    if (biSize < 40u) 
-    { 
-        fclose(file); 
-        return false; 
-    } // we expect BITMAPINFOHEADER or larger
-
-    int32_t biWidth = (int32_t)read_le32(file);
-    int32_t biHeight = (int32_t)read_le32(file);
-    uint16_t biPlanes = read_le16(file);
-    uint16_t biBitCount = read_le16(file);
-    uint32_t biCompression = read_le32(file);
-    (void)read_le32(file); // biSizeImage
-    (void)read_le32(file); // biXPelsPerMeter
-    (void)read_le32(file); // biYPelsPerMeter
-    (void)read_le32(file); // biClrUsed
-    (void)read_le32(file); // biClrImportant
-
-    if (biPlanes != 1 || (biBitCount != 24 && biBitCount != 32) || (biCompression != 0 && biCompression != 3))
+    // allocate, every pixel is written below so no need to zero
+    if (!allocate_pixels(reader.width, reader.height, false))
     {
-        fclose(file);
-        return false; // only uncompressed 24/32-bit
+        bmp_close(&reader);
+        return false;
     }
 
-    // Some BMPs have extra header bytes; seek to pixel array
-    if (fseek(file, (long)bfOffBits, SEEK_SET) != 0) 
-    { 
-        fclose(file); 
-        return false; 
-    }
+    for (uint32_t y = 0; y < reader.height; ++y)
+        if (!bmp_read_row(&reader, &pixels_[(size_t)bmp_next_row(reader) * reader.width]))
+        {
+            bmp_close(&reader);
+            return false;
+        }
 
-    const bool top_down = (biHeight < 0);
-    const uint32_t w = (uint32_t)biWidth;
-    const uint32_t h = (uint32_t)(top_down ? -biHeight : biHeight);
-    const uint32_t bytes_per_pixel = (biBitCount == 32) ? 4u : 3u;
-    const uint32_t row_stride = ((w * bytes_per_pixel + 3u) / 4u) * 4u;
+    bmp_close(&reader);
+    return true;
+}
 
-    // allocate
-    if (pixels_)
-        free(pixels_);
+// Loads an image from a whole bitmap file already in memory
 
-    width_ = w; height_ = h;
-    pixels_ = (Color*)calloc((size_t)w * h, sizeof(Color));
+bool Image::load_memory(const void* data, unsigned long long size)
+{
+    BMPReader reader;
+    if (!bmp_open_memory(&reader, data, (size_t)size))
+        return false;
 
-    uint8_t* row = (uint8_t*)calloc(row_stride, sizeof(uint8_t));
-    for (uint32_t y = 0; y < h; ++y)
+    // allocate, every pixel is written below so no need to zero
+    if (!allocate_pixels(reader.width, reader.height, false))
     {
-        uint8_t* in = row;
-        if (fread(in, sizeof(uint8_t), row_stride, file) != row_stride) 
-        { 
-            free(row); 
-            fclose(file); 
-            return false; 
-        }
-
-        uint32_t dst_y = top_down ? y : (h - 1 - y);
-        Color* out = &pixels_[(size_t)dst_y * w];
-
-        if (biBitCount == 32)
-            for (uint32_t x = 0; x < w; ++x)
-            {
-                out[x].B = *(in++);
-                out[x].G = *(in++);
-                out[x].R = *(in++);
-                out[x].A = *(in++);
-            }
-
-        else
-            for (uint32_t x = 0; x < w; ++x)
-            {
-                out[x].B = *(in++);
-                out[x].G = *(in++);
-                out[x].R = *(in++);
-                out[x].A = 255;
-            }
+        bmp_close(&reader);
+        return false;
     }
 
-    free(row);
-    fclose(file);
+    for (uint32_t y = 0; y < reader.height; ++y)
+        if (!bmp_read_row(&reader, &pixels_[(size_t)bmp_next_row(reader) * reader.width]))
+        {
+            bmp_close(&reader);
+            return false;
+        }
+
+    bmp_close(&reader);
     return true;
 }
 
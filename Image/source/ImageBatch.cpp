@@ -0,0 +1,297 @@
+#include "Image.h"
+#include "Parallel.h"
+#include "BMP.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+-------------------------------------------------------------------------------------------------------
+Internal helpers
+-------------------------------------------------------------------------------------------------------
+*/
+
+// File read whole and waiting to be decoded
+struct BatchFile
+{
+    unsigned index;         // Index of the file and its image
+    unsigned char* data;    // Contents of the file
+    size_t size;            // Size of the file
+};
+
+// Bounded queue between the reader and the decoder threads
+struct BatchQueue
+{
+    Image* images = nullptr;        // Images of the batch
+    bool* loaded = nullptr;         // Whether every image was loaded
+
+    BatchFile* files = nullptr;     // Ring of files waiting, capacity long
+    unsigned capacity = 0u;         // Maximum files waiting
+    unsigned head = 0u;             // Position of the oldest file waiting
+    unsigned count = 0u;            // Files waiting
+    bool done = false;              // Whether the reader pushed every file
+
+    ParallelMutex mutex;            // Protects the ring and done
+    ParallelCondition readable;     // Signaled when a file is pushed or the reader is done
+    ParallelCondition writable;     // Signaled when a file is popped
+
+    volatile long long pixels = 0;      // Pixels decoded
+    volatile long long decode_ns = 0;   // Time spent decoding, added over the threads
+};
+
+// Asks the system to start reading the file into its cache, without waiting.
+// Does nothing on systems without posix_fadvise.
+
+static void hint_read_ahead(const char* path)
+{
+#ifdef POSIX_FADV_WILLNEED
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+#else
+    (void)path;
+#endif
+}
+
+// Reads the whole file into a new buffer. Returns nullptr if it fails.
+
+static unsigned char* read_file(const char* path, size_t* size)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return nullptr;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    // Files too large for the address space are reported as failed, not truncated
+    unsigned long long length = 0ull;
+    const bool fits = bmp_file_size(file, &length) && length && length <= (unsigned long long)(size_t)-1;
+
+    unsigned char* data = fits ? (unsigned char*)malloc((size_t)length) : nullptr;
+    if (data && fread(data, 1, (size_t)length, file) != (size_t)length)
+    {
+        free(data);
+        data = nullptr;
+    }
+
+    fclose(file);
+    *size = data ? (size_t)length : 0u;
+    return data;
+}
+
+// Decodes the file into its image and frees its contents
+
+static void decode_file(BatchQueue& queue, const BatchFile& file)
+{
+    const unsigned long long start = monotonic_ns();
+
+    Image& image = queue.images[file.index];
+    if (image.load_memory(file.data, file.size))
+    {
+        queue.loaded[file.index] = true;
+        atomic_add(&queue.pixels, (long long)image.width() * image.height());
+    }
+    free(file.data);
+
+    atomic_add(&queue.decode_ns, (long long)(monotonic_ns() - start));
+}
+
+// Entry of the decoder threads, decodes files until the queue is empty and done
+
+static void decode_files(void* data)
+{
+    BatchQueue& queue = *(BatchQueue*)data;
+
+    for (;;)
+    {
+        queue.mutex.lock();
+        while (!queue.count && !queue.done)
+            queue.readable.wait(queue.mutex);
+
+        if (!queue.count)
+        {
+            queue.mutex.unlock();
+            return;
+        }
+
+        const BatchFile file = queue.files[queue.head];
+        queue.head = (queue.head + 1u) % queue.capacity;
+        queue.count--;
+        queue.writable.wake_one();
+        queue.mutex.unlock();
+
+        decode_file(queue, file);
+    }
+}
+
+// Waits for room in the queue and pushes the file for the decoders
+
+static void push_file(BatchQueue& queue, const BatchFile& file)
+{
+    queue.mutex.lock();
+    while (queue.count == queue.capacity)
+        queue.writable.wait(queue.mutex);
+
+    queue.files[(queue.head + queue.count) % queue.capacity] = file;
+    queue.count++;
+    queue.readable.wake_one();
+    queue.mutex.unlock();
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Batch loading functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Loads the bitmap files into the images, reading them in this thread and decoding
+// them in the decoder threads. If no thread can be started they are decoded here.
+
+unsigned Image::load_batch(Image* images, const char* const* paths, unsigned int count, const BatchLoadSettings& settings, BatchLoadStats* stats)
+{
+    const unsigned long long start = monotonic_ns();
+
+    if (stats)
+        *stats = BatchLoadStats();
+
+    if (!images || !paths || !count)
+        return 0u;
+
+    unsigned decoders = settings.decoders ? settings.decoders : parallel_threads();
+    if (decoders > MAX_PARALLEL_THREADS_) decoders = MAX_PARALLEL_THREADS_;
+    if (decoders > count) decoders = count;
+
+    BatchQueue queue;
+    queue.images = images;
+    queue.capacity = settings.max_in_flight ? settings.max_in_flight : 2u * decoders;
+    queue.loaded = (bool*)calloc(count, sizeof(bool));
+    queue.files = (BatchFile*)malloc(queue.capacity * sizeof(BatchFile));
+
+    if (!queue.loaded || !queue.files)
+    {
+        free(queue.loaded);
+        free(queue.files);
+        return 0u;
+    }
+
+    ParallelThread threads[MAX_PARALLEL_THREADS_];
+    unsigned started = 0u;
+    for (unsigned i = 0u; i < decoders; i++)
+        if (threads[started].start(decode_files, &queue))
+            started++;
+
+    // Read stage, hinting the files ahead before every read
+    unsigned long long read_ns = 0ull, bytes_read = 0ull;
+    unsigned hinted = 0u;
+
+    for (unsigned i = 0u; i < count; i++)
+    {
+        const unsigned ahead = count - i - 1u < settings.prefetch ? count - i - 1u : settings.prefetch;
+        if (hinted < i + 1u)
+            hinted = i + 1u;
+        for (; hinted <= i + ahead; hinted++)
+            hint_read_ahead(paths[hinted]);
+
+        const unsigned long long read_start = monotonic_ns();
+        BatchFile file = { i, nullptr, 0u };
+        file.data = paths[i] ? read_file(paths[i], &file.size) : nullptr;
+        read_ns += monotonic_ns() - read_start;
+
+        if (!file.data)
+            continue;
+
+        bytes_read += file.size;
+        if (started)
+            push_file(queue, file);
+        else
+            decode_file(queue, file);
+    }
+
+    queue.mutex.lock();
+    queue.done = true;
+    queue.readable.wake_all();
+    queue.mutex.unlock();
+
+    for (unsigned i = 0u; i < started; i++)
+        threads[i].join();
+
+    // Failed files leave their images empty
+    unsigned loaded = 0u;
+    for (unsigned i = 0u; i < count; i++)
+    {
+        if (queue.loaded[i])
+            loaded++;
+        else
+            images[i].allocate_pixels(0u, 0u, false);
+    }
+
+    free(queue.loaded);
+    free(queue.files);
+
+    if (stats)
+    {
+        stats->files = count;
+        stats->loaded = loaded;
+        stats->failed = count - loaded;
+        stats->bytes_read = bytes_read;
+        stats->pixels = (unsigned long long)atomic_load(&queue.pixels);
+        stats->read_ns = read_ns;
+        stats->decode_ns = (unsigned long long)atomic_load(&queue.decode_ns);
+        stats->wall_ns = monotonic_ns() - start;
+        stats->decoders = started;
+    }
+    return loaded;
+}
+
+// Probes the BMP files inside the directory and loads the ones that fit as a batch
+
+unsigned Image::load_directory(Image* images, ImageProbe* probes, unsigned int max_images, const BatchLoadSettings& settings, BatchLoadStats* stats, const char* fmt_directory, ...)
+{
+    if (stats)
+        *stats = BatchLoadStats();
+
+    if (!fmt_directory || !*fmt_directory)
+        return 0u;
+
+    if (!images || !probes)
+        max_images = 0u;
+
+    va_list ap;
+
+    // Unwrap the format
+    char directory[512];
+
+    va_start(ap, fmt_directory);
+    const int written = vsnprintf(directory, 512, fmt_directory, ap);
+    va_end(ap);
+
+    if (written < 0 || written >= 512)
+        return 0u;
+
+    const unsigned found = probe_directory(probes, max_images, "%s", directory);
+    const unsigned count = found < max_images ? found : max_images;
+    if (!count)
+        return found;
+
+    const char** paths = (const char**)malloc(count * sizeof(const char*));
+    if (!paths)
+        return found;
+
+    for (unsigned i = 0u; i < count; i++)
+        paths[i] = probes[i].path;
+
+    load_batch(images, paths, count, settings, stats);
+    free(paths);
+    return found;
+}
@@ -0,0 +1,479 @@
+#include "ImageCache.h"
+#include "Parallel.h"
+#include "BMP.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <limits.h>
+#endif
+
+#define CACHE_PATH_SIZE_ 4096u // Maximum length of a resolved path
+
+/*
+-------------------------------------------------------------------------------------------------------
+Internal cache state
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Cached image together with its key and bookkeeping
+
+struct CacheEntry
+{
+    volatile long long refs = 0;    // Handles plus one if it is stored in the cache
+
+    char* path = nullptr;           // Resolved file path
+    unsigned long long hash = 0ull; // Hash of the resolved path
+    long long mtime = 0ll;          // File modification time when loaded
+    long long size = 0ll;           // File size when loaded
+
+    Image image;                    // Loaded image
+    unsigned long long bytes = 0ull;// Pixel bytes accounted in the cache usage
+
+    bool loading = false;           // Whether a thread is still loading the image
+    bool stored = false;            // Whether it is still stored in the cache
+
+    CacheEntry* next = nullptr;     // Next entry in the same bucket
+    CacheEntry* newer = nullptr;    // More recently used entry
+    CacheEntry* older = nullptr;    // Less recently used entry
+};
+
+// Process-wide cache, hash table plus a least recently used list
+
+struct CacheState
+{
+    ParallelMutex mutex;
+    ParallelCondition loaded;
+
+    CacheEntry** buckets = nullptr;
+    unsigned n_buckets = 0u;
+    unsigned count = 0u;
+
+    CacheEntry* newest = nullptr;
+    CacheEntry* oldest = nullptr;
+
+    unsigned long long usage = 0ull;
+    unsigned long long budget = DEFAULT_IMAGE_CACHE_BUDGET_;
+};
+
+static CacheState& cache()
+{
+    static CacheState state;
+    return state;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Internal helpers
+-------------------------------------------------------------------------------------------------------
+*/
+
+// FNV-1a hash of the path
+
+static unsigned long long hash_path(const char* path)
+{
+    unsigned long long h = 1469598103934665603ull;
+    while (*path)
+    {
+        h ^= (unsigned char)*path++;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// Drops one reference, frees the entry if it was the last one
+
+static void release_entry(CacheEntry* entry)
+{
+    if (atomic_add(&entry->refs, -1) == 0)
+    {
+        free(entry->path);
+        delete entry;
+    }
+}
+
+// Finds the stored entry with the specified path, cache must be locked
+
+static CacheEntry* find_entry(CacheState& state, const char* path, unsigned long long hash)
+{
+    if (!state.n_buckets)
+        return nullptr;
+
+    CacheEntry* entry = state.buckets[hash % state.n_buckets];
+    while (entry && (entry->hash != hash || strcmp(entry->path, path)))
+        entry = entry->next;
+
+    return entry;
+}
+
+// Moves the entry to the front of the LRU list, cache must be locked
+
+static void touch_entry(CacheState& state, CacheEntry* entry)
+{
+    if (state.newest == entry)
+        return;
+
+    // Unlink
+    if (entry->newer) entry->newer->older = entry->older;
+    if (entry->older) entry->older->newer = entry->newer;
+    if (state.oldest == entry) state.oldest = entry->newer;
+
+    // Push front
+    entry->newer = nullptr;
+    entry->older = state.newest;
+    if (state.newest) state.newest->newer = entry;
+    state.newest = entry;
+    if (!state.oldest) state.oldest = entry;
+}
+
+// Stores a new entry, growing the table if needed, cache must be locked
+
+static void insert_entry(CacheState& state, CacheEntry* entry)
+{
+    if (state.count >= state.n_buckets)
+    {
+        const unsigned n_buckets = state.n_buckets ? 2u * state.n_buckets : 64u;
+        CacheEntry** buckets = (CacheEntry**)calloc(n_buckets, sizeof(CacheEntry*));
+
+        for (unsigned b = 0; b < state.n_buckets; b++)
+        {
+            CacheEntry* e = state.buckets[b];
+            while (e)
+            {
+                CacheEntry* next = e->next;
+                e->next = buckets[e->hash % n_buckets];
+                buckets[e->hash % n_buckets] = e;
+                e = next;
+            }
+        }
+
+        free(state.buckets);
+        state.buckets = buckets;
+        state.n_buckets = n_buckets;
+    }
+
+    CacheEntry** bucket = &state.buckets[entry->hash % state.n_buckets];
+    entry->next = *bucket;
+    *bucket = entry;
+
+    entry->stored = true;
+    state.count++;
+    touch_entry(state, entry);
+}
+
+// Removes the entry from the cache and drops the cache reference, cache must be locked
+
+static void remove_entry(CacheState& state, CacheEntry* entry)
+{
+    CacheEntry** link = &state.buckets[entry->hash % state.n_buckets];
+    while (*link != entry)
+        link = &(*link)->next;
+    *link = entry->next;
+
+    if (entry->newer) entry->newer->older = entry->older;
+    if (entry->older) entry->older->newer = entry->newer;
+    if (state.newest == entry) state.newest = entry->older;
+    if (state.oldest == entry) state.oldest = entry->newer;
+
+    entry->next = entry->newer = entry->older = nullptr;
+    entry->stored = false;
+
+    state.usage -= entry->bytes;
+    state.count--;
+
+    release_entry(entry);
+}
+
+// Evicts the least recently used entries not held by any handle
+// until the usage fits the budget, cache must be locked
+
+static void evict_entries(CacheState& state, unsigned long long budget)
+{
+    CacheEntry* entry = state.oldest;
+    while (entry && state.usage > budget)
+    {
+        CacheEntry* newer = entry->newer;
+        if (!entry->loading && atomic_load(&entry->refs) == 1)
+            remove_entry(state, entry);
+
+        entry = newer;
+    }
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+CachedImage functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Takes ownership of one reference of the entry
+
+CachedImage::CachedImage(void* entry)
+    :entry_{ entry }
+{
+}
+
+// Shares the other handle image
+
+CachedImage::CachedImage(const CachedImage& other)
+    :entry_{ other.entry_ }
+{
+    if (entry_)
+        atomic_add(&((CacheEntry*)entry_)->refs, 1);
+}
+
+// Shares the other handle image
+
+CachedImage& CachedImage::operator=(const CachedImage& other)
+{
+    if (other.entry_)
+        atomic_add(&((CacheEntry*)other.entry_)->refs, 1);
+
+    if (entry_)
+        release_entry((CacheEntry*)entry_);
+
+    entry_ = other.entry_;
+    return *this;
+}
+
+// Takes the other handle image and leaves it empty
+
+CachedImage::CachedImage(CachedImage&& other) noexcept
+    :entry_{ other.entry_ }
+{
+    other.entry_ = nullptr;
+}
+
+// Takes the other handle image and leaves it empty
+
+CachedImage& CachedImage::operator=(CachedImage&& other) noexcept
+{
+    if (&other == this)
+        return *this;
+
+    if (entry_)
+        release_entry((CacheEntry*)entry_);
+
+    entry_ = other.entry_;
+    other.entry_ = nullptr;
+    return *this;
+}
+
+// Releases the image
+
+CachedImage::~CachedImage()
+{
+    if (entry_)
+        release_entry((CacheEntry*)entry_);
+}
+
+// Returns whether the handle points to an image
+
+bool CachedImage::valid() const
+{
+    return entry_ != nullptr;
+}
+
+// Returns whether the handle points to an image
+
+CachedImage::operator bool() const
+{
+    return entry_ != nullptr;
+}
+
+// Returns a pointer to the image, nullptr if empty
+
+const Image* CachedImage::get() const
+{
+    return entry_ ? &((CacheEntry*)entry_)->image : nullptr;
+}
+
+// Returns a pointer to the image, nullptr if empty
+
+const Image* CachedImage::operator->() const
+{
+    return get();
+}
+
+// Returns a reference to the image, the handle must be valid
+
+const Image& CachedImage::operator*() const
+{
+    return ((CacheEntry*)entry_)->image;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+ImageCache functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Returns a handle to the image stored in the bitmap file, loading it if needed.
+
+CachedImage ImageCache::load(const char* fmt_filename, ...)
+{
+    va_list ap;
+
+    // Unwrap the format, with the same extension handling as Image::load()
+    // so the key matches the file that is read
+    char bmpname[512];
+
+    va_start(ap, fmt_filename);
+    const bool ok_name = bmp_format_filename(bmpname, 512, fmt_filename, ap);
+    va_end(ap);
+
+    if (!ok_name)
+        return CachedImage();
+
+    // Resolve the path and read the modification time
+    char path[CACHE_PATH_SIZE_];
+    long long mtime, size;
+#ifdef _WIN32
+    if (!_fullpath(path, bmpname, CACHE_PATH_SIZE_))
+        return CachedImage();
+
+    struct _stat64 st;
+    if (_stat64(path, &st) != 0)
+        return CachedImage();
+#else
+    if (!realpath(bmpname, path))
+        return CachedImage();
+
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return CachedImage();
+#endif
+    mtime = (long long)st.st_mtime;
+    size = (long long)st.st_size;
+
+    const unsigned long long hash = hash_path(path);
+
+    CacheState& state = cache();
+    state.mutex.lock();
+
+    // Wait if another thread is loading the same file
+    CacheEntry* entry = find_entry(state, path, hash);
+    while (entry && entry->loading)
+    {
+        state.loaded.wait(state.mutex);
+        entry = find_entry(state, path, hash);
+    }
+
+    if (entry && entry->mtime == mtime && entry->size == size)
+    {
+        atomic_add(&entry->refs, 1);
+        touch_entry(state, entry);
+        state.mutex.unlock();
+        return CachedImage(entry);
+    }
+
+    // Outdated version, the handles still holding it keep it alive
+    if (entry)
+        remove_entry(state, entry);
+
+    entry = new CacheEntry;
+    entry->refs = 2;
+    entry->path = (char*)calloc(strlen(path) + 1u, sizeof(char));
+    memcpy(entry->path, path, strlen(path) + 1u);
+    entry->hash = hash;
+    entry->mtime = mtime;
+    entry->size = size;
+    entry->loading = true;
+    insert_entry(state, entry);
+
+    state.mutex.unlock();
+
+    // Load without holding the lock
+    const bool ok = entry->image.load("%s", bmpname);
+
+    state.mutex.lock();
+
+    entry->loading = false;
+    if (ok)
+    {
+        entry->bytes = (unsigned long long)entry->image.width() * entry->image.height() * sizeof(Color);
+        state.usage += entry->bytes;
+        evict_entries(state, state.budget);
+    }
+    else
+        remove_entry(state, entry);
+
+    state.loaded.wake_all();
+    state.mutex.unlock();
+
+    if (!ok)
+    {
+        release_entry(entry);
+        return CachedImage();
+    }
+    return CachedImage(entry);
+}
+
+// Sets the maximum number of bytes of pixels stored, evicts images if needed
+
+void ImageCache::set_budget(unsigned long long bytes)
+{
+    CacheState& state = cache();
+    state.mutex.lock();
+    state.budget = bytes;
+    evict_entries(state, state.budget);
+    state.mutex.unlock();
+}
+
+// Returns the maximum number of bytes of pixels stored
+
+unsigned long long ImageCache::budget()
+{
+    CacheState& state = cache();
+    state.mutex.lock();
+    const unsigned long long budget = state.budget;
+    state.mutex.unlock();
+    return budget;
+}
+
+// Returns the number of bytes of pixels currently stored
+
+unsigned long long ImageCache::usage()
+{
+    CacheState& state = cache();
+    state.mutex.lock();
+    const unsigned long long usage = state.usage;
+    state.mutex.unlock();
+    return usage;
+}
+
+// Returns the number of images currently stored
+
+unsigned ImageCache::count()
+{
+    CacheState& state = cache();
+    state.mutex.lock();
+    const unsigned count = state.count;
+    state.mutex.unlock();
+    return count;
+}
+
+// Evicts every image that is not held by any handle
+
+void ImageCache::clear()
+{
+    CacheState& state = cache();
+    state.mutex.lock();
+
+    CacheEntry* entry = state.oldest;
+    while (entry)
+    {
+        CacheEntry* newer = entry->newer;
+        if (!entry->loading && atomic_load(&entry->refs) == 1)
+            remove_entry(state, entry);
+
+        entry = newer;
+    }
+
+    state.mutex.unlock();
+}
@@ -0,0 +1,172 @@
+#include "Image.h"
+#include "BMP.h"
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+
+/*
+-------------------------------------------------------------------------------------------------------
+Dirty region tracking
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Marks every pixel as dirty if tracked, resizing the region to the image
+
+void Image::mark_all_dirty()
+{
+    if (dirty_)
+        dirty_->reset(width_, height_, true);
+}
+
+// Enables or disables tracking which pixels change, tracking starts clean
+
+void Image::set_dirty_tracking(bool enable)
+{
+    if (!enable)
+    {
+        delete dirty_;
+        dirty_ = nullptr;
+        return;
+    }
+
+    if (!dirty_)
+        dirty_ = new DirtyRegion(width_, height_);
+}
+
+// Returns whether the changed pixels are tracked
+
+bool Image::dirty_tracking() const
+{
+    return dirty_ != nullptr;
+}
+
+// Returns the changed pixels since the last clear_dirty(), nullptr if not tracked
+
+const DirtyRegion* Image::dirty_region() const
+{
+    return dirty_;
+}
+
+// Marks the rectangle as dirty, ignored if not tracked
+
+void Image::mark_dirty(unsigned int row, unsigned int col, unsigned int height, unsigned int width)
+{
+    if (dirty_)
+        dirty_->add(row, col, height, width);
+}
+
+// Marks every pixel as clean
+
+void Image::clear_dirty()
+{
+    if (dirty_)
+        dirty_->clear();
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Incremental export and save
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Converts only the dirty pixels into dst, row by row over their spans.
+// Without a region, or if all is dirty, it is a plain export_pixels().
+
+bool Image::export_dirty(void* dst, PixelFormat format, unsigned long long stride, const DirtyRegion* region) const
+{
+    if (!region)
+        region = dirty_;
+
+    if (!region || region->all())
+        return export_pixels(dst, format, stride);
+
+    if (region->width() != width_ || region->height() != height_)
+        return false;
+
+    const unsigned size = pixel_format_size(format);
+    const unsigned long long row_bytes = (unsigned long long)width_ * size;
+    if (!stride)
+        stride = row_bytes;
+
+    if (stride < row_bytes || (!dst && row_bytes && height_))
+        return false;
+
+    for (unsigned row = region->first_row(); row < region->end_row(); row++)
+    {
+        unsigned first, end;
+        if (region->row_span(row, &first, &end))
+            convert_to_format(pixels_ + (unsigned long long)row * width_ + first, (uint8_t*)dst + row * stride + (unsigned long long)first * size, end - first, format);
+    }
+    return true;
+}
+
+// Writes only the dirty pixels into the existing file saved from this image. The
+// colors are stored BGRA, same as 32-bit bitmaps, so the spans are written straight
+// from the pixels, in file order so that consecutive spans need no seek.
+
+bool Image::save_dirty(const char* fmt_filename, ...) const
+{
+    va_list ap;
+    char filename[512];
+
+    va_start(ap, fmt_filename);
+    const bool formatted = bmp_format_filename(filename, 512u, fmt_filename, ap);
+    va_end(ap);
+
+    if (!formatted)
+        return false;
+
+    if (!dirty_ || dirty_->all())
+        return save("%s", filename);
+
+    FILE* file = fopen(filename, "r+b");
+    if (!file)
+        return save("%s", filename);
+
+    // The file must have the layout save() writes, other than the row order
+    uint8_t data[BMP_HEADER_SIZE_];
+    BMPHeader header;
+    const bool matches = fread(data, 1, BMP_HEADER_SIZE_, file) == BMP_HEADER_SIZE_ && bmp_parse_header(data, &header)
+        && header.planes == 1u && header.bit_count == 32u && header.compression == 0u && header.width == (int32_t)width_
+        && (header.height == (int32_t)height_ || header.height == -(int32_t)height_)
+        && header.file_size >= header.pixel_offset + (unsigned long long)width_ * height_ * 4u;
+
+    if (!matches)
+    {
+        fclose(file);
+        return save("%s", filename);
+    }
+
+    const bool top_down = header.height < 0;
+    const unsigned long long row_bytes = (unsigned long long)width_ * sizeof(Color);
+    const unsigned first_row = dirty_->first_row(), end_row = dirty_->end_row();
+
+    unsigned long long position = ~0ull;
+    for (unsigned i = first_row; i < end_row; i++)
+    {
+        const unsigned row = top_down ? i : first_row + end_row - 1u - i;
+        const unsigned file_row = top_down ? row : height_ - 1u - row;
+
+        unsigned first, end;
+        if (!dirty_->row_span(row, &first, &end))
+            continue;
+
+        const unsigned long long offset = header.pixel_offset + file_row * row_bytes + (unsigned long long)first * sizeof(Color);
+        if (offset != position && !bmp_seek(file, offset))
+        {
+            fclose(file);
+            return false;
+        }
+
+        const size_t bytes = (size_t)(end - first) * sizeof(Color);
+        if (fwrite(pixels_ + (unsigned long long)row * width_ + first, 1, bytes, file) != bytes)
+        {
+            fclose(file);
+            return false;
+        }
+        position = offset + bytes;
+    }
+
+    return fclose(file) == 0;
+}
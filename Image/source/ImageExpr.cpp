@@ -0,0 +1,514 @@
+#include "ImageExpr.h"
+#include "Parallel.h"
+#include "SIMD.h"
+
+#include <cstdint>
+#include <cstring>
+
+#define EXPR_BLOCK_ 128u					// Pixels per block, every operation holds one block
+#define EXPR_BAND_ 16384u					// Pixels per band of a parallel evaluation
+#define EXPR_MIN_BANDS_ 4u					// Minimum bands evaluated by each thread
+
+/*
+-------------------------------------------------------------------------------------------------------
+Operation kernels
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Every kernel processes count pixels and gives exactly what the Color operator does,
+// they read their operands before writing, so the output can be one of them.
+
+#ifdef IMAGE_SSE2_
+// Converts the 16 channels of 4 pixels to floats
+
+static inline void widen_channels(__m128i v, __m128* f)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo = _mm_unpacklo_epi8(v, zero);
+    const __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+    f[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+    f[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+    f[2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+    f[3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+}
+
+// Truncates the floats of 16 channels from 0 to 255 back into 4 pixels
+
+static inline __m128i narrow_channels(const __m128* f)
+{
+    const __m128i lo = _mm_packs_epi32(_mm_cvttps_epi32(f[0]), _mm_cvttps_epi32(f[1]));
+    const __m128i hi = _mm_packs_epi32(_mm_cvttps_epi32(f[2]), _mm_cvttps_epi32(f[3]));
+    return _mm_packus_epi16(lo, hi);
+}
+#endif
+
+// Saturated addition, Color + Color
+
+static void expr_add_scalar(const Color* a, const Color* b, Color* out, unsigned count)
+{
+    for (unsigned i = 0u; i < count; i++)
+        out[i] = a[i] + b[i];
+}
+
+// Saturated subtraction, Color - Color
+
+static void expr_sub_scalar(const Color* a, const Color* b, Color* out, unsigned count)
+{
+    for (unsigned i = 0u; i < count; i++)
+        out[i] = a[i] - b[i];
+}
+
+// Product over 255, Color * Color
+
+static void expr_mul_scalar(const Color* a, const Color* b, Color* out, unsigned count)
+{
+    for (unsigned i = 0u; i < count; i++)
+        out[i] = a[i] * b[i];
+}
+
+// Color inversion keeping the alpha, -Color
+
+static void expr_invert_scalar(const Color* a, Color* out, unsigned count)
+{
+    for (unsigned i = 0u; i < count; i++)
+        out[i] = -a[i];
+}
+
+#ifdef IMAGE_SSE2_
+// Saturated addition of 4 pixels at a time
+
+static void expr_add_sse2(const Color* a, const Color* b, Color* out, unsigned count)
+{
+    unsigned i = 0u;
+    for (; i + 4u <= count; i += 4u)
+        _mm_storeu_si128((__m128i*)(out + i), _mm_adds_epu8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))));
+    expr_add_scalar(a + i, b + i, out + i, count - i);
+}
+
+// Saturated subtraction of 4 pixels at a time
+
+static void expr_sub_sse2(const Color* a, const Color* b, Color* out, unsigned count)
+{
+    unsigned i = 0u;
+    for (; i + 4u <= count; i += 4u)
+        _mm_storeu_si128((__m128i*)(out + i), _mm_subs_epu8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))));
+    expr_sub_scalar(a + i, b + i, out + i, count - i);
+}
+
+// Product over 255 of 4 pixels at a time. The 16-bit products are divided
+// with (t + 1 + (t >> 8)) >> 8, which truncates like t / 255 up to 255^2.
+
+static void expr_mul_sse2(const Color* a, const Color* b, Color* out, unsigned count)
+{
+    unsigned i = 0u;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+
+    for (; i + 4u <= count; i += 4u)
+    {
+        const __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        const __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+
+        __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+        __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+        lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, one), _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, one), _mm_srli_epi16(hi, 8)), 8);
+
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(lo, hi));
+    }
+    expr_mul_scalar(a + i, b + i, out + i, count - i);
+}
+
+// Color inversion of 4 pixels at a time
+
+static void expr_invert_sse2(const Color* a, Color* out, unsigned count)
+{
+    unsigned i = 0u;
+    const __m128i mask = _mm_set1_epi32(0x00FFFFFF);
+    for (; i + 4u <= count; i += 4u)
+        _mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)), mask));
+    expr_invert_scalar(a + i, out + i, count - i);
+}
+#endif
+
+#ifdef IMAGE_DISPATCH_
+// Saturated addition of 8 pixels at a time
+
+IMAGE_TARGET_AVX2_ static void expr_add_avx2(const Color* a, const Color* b, Color* out, unsigned count)
+{
+    unsigned i = 0u;
+    for (; i + 8u <= count; i += 8u)
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_adds_epu8(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i))));
+    _mm256_zeroupper();
+    expr_add_sse2(a + i, b + i, out + i, count - i);
+}
+
+// Saturated subtraction of 8 pixels at a time
+
+IMAGE_TARGET_AVX2_ static void expr_sub_avx2(const Color* a, const Color* b, Color* out, unsigned count)
+{
+    unsigned i = 0u;
+    for (; i + 8u <= count; i += 8u)
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_subs_epu8(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i))));
+    _mm256_zeroupper();
+    expr_sub_sse2(a + i, b + i, out + i, count - i);
+}
+
+// Product over 255 of 8 pixels at a time, unpacking and packing within each half
+
+IMAGE_TARGET_AVX2_ static void expr_mul_avx2(const Color* a, const Color* b, Color* out, unsigned count)
+{
+    unsigned i = 0u;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi16(1);
+
+    for (; i + 8u <= count; i += 8u)
+    {
+        const __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        const __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+
+        __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(va, zero), _mm256_unpacklo_epi8(vb, zero));
+        __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(va, zero), _mm256_unpackhi_epi8(vb, zero));
+        lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(lo, one), _mm256_srli_epi16(lo, 8)), 8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(hi, one), _mm256_srli_epi16(hi, 8)), 8);
+
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_packus_epi16(lo, hi));
+    }
+    _mm256_zeroupper();
+    expr_mul_sse2(a + i, b + i, out + i, count - i);
+}
+
+// Color inversion of 8 pixels at a time
+
+IMAGE_TARGET_AVX2_ static void expr_invert_avx2(const Color* a, Color* out, unsigned count)
+{
+    unsigned i = 0u;
+    const __m256i mask = _mm256_set1_epi32(0x00FFFFFF);
+    for (; i + 8u <= count; i += 8u)
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i)), mask));
+    _mm256_zeroupper();
+    expr_invert_sse2(a + i, out + i, count - i);
+}
+
+// Saturated addition of 16 pixels at a time
+
+IMAGE_TARGET_AVX512_ static void expr_add_avx512(const Color* a, const Color* b, Color* out, unsigned count)
+{
+    unsigned i = 0u;
+    for (; i + 16u <= count; i += 16u)
+        _mm512_storeu_si512((void*)(out + i), _mm512_adds_epu8(_mm512_loadu_si512((const void*)(a + i)), _mm512_loadu_si512((const void*)(b + i))));
+    expr_add_avx2(a + i, b + i, out + i, count - i);
+}
+
+// Saturated subtraction of 16 pixels at a time
+
+IMAGE_TARGET_AVX512_ static void expr_sub_avx512(const Color* a, const Color* b, Color* out, unsigned count)
+{
+    unsigned i = 0u;
+    for (; i + 16u <= count; i += 16u)
+        _mm512_storeu_si512((void*)(out + i), _mm512_subs_epu8(_mm512_loadu_si512((const void*)(a + i)), _mm512_loadu_si512((const void*)(b + i))));
+    expr_sub_avx2(a + i, b + i, out + i, count - i);
+}
+
+// Product over 255 of 16 pixels at a time, unpacking and packing within each quarter
+
+IMAGE_TARGET_AVX512_ static void expr_mul_avx512(const Color* a, const Color* b, Color* out, unsigned count)
+{
+    unsigned i = 0u;
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi16(1);
+
+    for (; i + 16u <= count; i += 16u)
+    {
+        const __m512i va = _mm512_loadu_si512((const void*)(a + i));
+        const __m512i vb = _mm512_loadu_si512((const void*)(b + i));
+
+        __m512i lo = _mm512_mullo_epi16(_mm512_unpacklo_epi8(va, zero), _mm512_unpacklo_epi8(vb, zero));
+        __m512i hi = _mm512_mullo_epi16(_mm512_unpackhi_epi8(va, zero), _mm512_unpackhi_epi8(vb, zero));
+        lo = _mm512_srli_epi16(_mm512_add_epi16(_mm512_add_epi16(lo, one), _mm512_srli_epi16(lo, 8)), 8);
+        hi = _mm512_srli_epi16(_mm512_add_epi16(_mm512_add_epi16(hi, one), _mm512_srli_epi16(hi, 8)), 8);
+
+        _mm512_storeu_si512((void*)(out + i), _mm512_packus_epi16(lo, hi));
+    }
+    expr_mul_avx2(a + i, b + i, out + i, count - i);
+}
+
+// Color inversion of 16 pixels at a time
+
+IMAGE_TARGET_AVX512_ static void expr_invert_avx512(const Color* a, Color* out, unsigned count)
+{
+    unsigned i = 0u;
+    const __m512i mask = _mm512_set1_epi32(0x00FFFFFF);
+    for (; i + 16u <= count; i += 16u)
+        _mm512_storeu_si512((void*)(out + i), _mm512_xor_si512(_mm512_loadu_si512((const void*)(a + i)), mask));
+    expr_invert_avx2(a + i, out + i, count - i);
+}
+#endif
+
+// Quotient times 255, Color / Color, kept in 8 bits as the Color constructor does.
+// The float quotient of two integers below 2^16 truncates to the integer one.
+
+static void expr_div(const Color* a, const Color* b, Color* out, unsigned count)
+{
+    unsigned i = 0u;
+#ifdef IMAGE_SSE2_
+    const __m128 scale = _mm_set1_ps(255.f);
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128i low = _mm_set1_epi32(0xFF);
+
+    for (; i + 4u <= count; i += 4u)
+    {
+        __m128 fa[4], fb[4];
+        widen_channels(_mm_loadu_si128((const __m128i*)(a + i)), fa);
+        widen_channels(_mm_loadu_si128((const __m128i*)(b + i)), fb);
+
+        __m128i q[4];
+        for (unsigned k = 0u; k < 4u; k++)
+            q[k] = _mm_and_si128(_mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(fa[k], scale), _mm_max_ps(fb[k], one))), low);
+
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+    }
+#endif
+    for (; i < count; i++)
+        out[i] = a[i] / b[i];
+}
+
+// Multiplies by a float factor from 0 to infinity, saturated, Color * float
+
+static unsigned expr_mul_factor(const Color* a, Color* out, unsigned count, float factor)
+{
+    unsigned i = 0u;
+#ifdef IMAGE_SSE2_
+    const __m128 scale = _mm_set1_ps(factor);
+    const __m128 top = _mm_set1_ps(255.f);
+
+    for (; i + 4u <= count; i += 4u)
+    {
+        __m128 f[4];
+        widen_channels(_mm_loadu_si128((const __m128i*)(a + i)), f);
+        for (unsigned k = 0u; k < 4u; k++)
+            f[k] = _mm_min_ps(_mm_mul_ps(f[k], scale), top);
+        _mm_storeu_si128((__m128i*)(out + i), narrow_channels(f));
+    }
+#endif
+    return i;
+}
+
+// Divides by a positive float divisor, saturated, Color / float
+
+static unsigned expr_div_factor(const Color* a, Color* out, unsigned count, float divisor)
+{
+    unsigned i = 0u;
+#ifdef IMAGE_SSE2_
+    const __m128 scale = _mm_set1_ps(divisor);
+    const __m128 top = _mm_set1_ps(255.f);
+
+    for (; i + 4u <= count; i += 4u)
+    {
+        __m128 f[4];
+        widen_channels(_mm_loadu_si128((const __m128i*)(a + i)), f);
+        for (unsigned k = 0u; k < 4u; k++)
+            f[k] = _mm_min_ps(_mm_div_ps(f[k], scale), top);
+        _mm_storeu_si128((__m128i*)(out + i), narrow_channels(f));
+    }
+#endif
+    return i;
+}
+
+// Operations with a number. The vector kernels only take the numbers for which the
+// Color operators stay in range, the rest go through the Color operators.
+
+static void expr_number(const ExprInstruction& instruction, const Color* a, Color* out, unsigned count)
+{
+    const float number = (float)instruction.number;
+    const bool finite = number - number == 0.f;
+    unsigned i = 0u;
+
+    switch (instruction.op)
+    {
+    case EXPR_OP_MUL_INT:
+        if (instruction.integer >= 0 && instruction.integer <= 0xFFFF)
+            i = expr_mul_factor(a, out, count, (float)instruction.integer);
+        for (; i < count; i++)
+            out[i] = a[i] * instruction.integer;
+        return;
+
+    case EXPR_OP_DIV_INT:
+        if (!instruction.integer)
+            fill_colors(out, count, Color::White);
+        else
+        {
+            if (instruction.integer > 0)
+                i = expr_div_factor(a, out, count, (float)instruction.integer);
+            for (; i < count; i++)
+                out[i] = a[i] / instruction.integer;
+        }
+        return;
+
+    case EXPR_OP_MUL_FLOAT:
+    case EXPR_OP_MUL_DOUBLE:
+        if (finite && number >= 0.f)
+            i = expr_mul_factor(a, out, count, number);
+        for (; i < count; i++)
+            out[i] = instruction.op == EXPR_OP_MUL_FLOAT ? a[i] * number : a[i] * instruction.number;
+        return;
+
+    case EXPR_OP_DIV_FLOAT:
+    case EXPR_OP_DIV_DOUBLE:
+        if (!instruction.number)
+            fill_colors(out, count, Color::White);
+        else
+        {
+            if (number > 0.f)
+                i = expr_div_factor(a, out, count, number);
+            for (; i < count; i++)
+                out[i] = instruction.op == EXPR_OP_DIV_FLOAT ? a[i] / number : a[i] / instruction.number;
+        }
+        return;
+
+    default:
+        return;
+    }
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Kernel dispatch
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Kernels with versions for several SIMD levels
+
+struct ExprKernels
+{
+    void (*add)(const Color*, const Color*, Color*, unsigned);
+    void (*sub)(const Color*, const Color*, Color*, unsigned);
+    void (*mul)(const Color*, const Color*, Color*, unsigned);
+    void (*invert)(const Color*, Color*, unsigned);
+};
+
+// Picks the best version of every kernel for the active SIMD level
+
+static ExprKernels resolve_expr_kernels()
+{
+    ExprKernels kernels = { expr_add_scalar, expr_sub_scalar, expr_mul_scalar, expr_invert_scalar };
+#ifdef IMAGE_SSE2_
+    const SIMDLevel level = simd_level();
+    if (level >= SIMD_LEVEL_SSE2)
+        kernels = { expr_add_sse2, expr_sub_sse2, expr_mul_sse2, expr_invert_sse2 };
+#endif
+#ifdef IMAGE_DISPATCH_
+    if (level >= SIMD_LEVEL_AVX2)
+        kernels = { expr_add_avx2, expr_sub_avx2, expr_mul_avx2, expr_invert_avx2 };
+    if (level >= SIMD_LEVEL_AVX512)
+        kernels = { expr_add_avx512, expr_sub_avx512, expr_mul_avx512, expr_invert_avx512 };
+#endif
+    return kernels;
+}
+
+// Returns the kernels, resolved the first time
+
+static const ExprKernels& expr_kernels()
+{
+    static const ExprKernels kernels = resolve_expr_kernels();
+    return kernels;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Evaluation
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Resizes the image to the size of the images of the program and stores its result
+// for every pixel. Returns false if they differ in size or could not be allocated.
+
+bool Image::evaluate(const ImageProgram& program)
+{
+    if (!program.size || program.size > MAX_EXPR_OPS_)
+        return false;
+
+    // Pixels of every image operand, taken before the buffer is resized
+    // or leaves a shared one, so this image can be one of them.
+    const Color* sources[MAX_EXPR_OPS_] = {};
+    const Image* first = nullptr;
+
+    for (unsigned i = 0u; i < program.size; i++)
+    {
+        const ExprInstruction& instruction = program.code[i];
+        if (instruction.op != EXPR_OP_IMAGE)
+            continue;
+
+        if (!first)
+            first = instruction.image;
+        else if (instruction.image->width() != first->width() || instruction.image->height() != first->height())
+            return false;
+
+        sources[i] = instruction.image->pixels();
+    }
+
+    if (!first || !allocate_pixels(first->width(), first->height(), false))
+        return false;
+
+    const unsigned long long count = (unsigned long long)width_ * height_;
+    const unsigned bands = (unsigned)((count + EXPR_BAND_ - 1u) / EXPR_BAND_);
+    Color* pixels = pixels_;
+    const ExprKernels& kernels = expr_kernels();
+
+    parallel_for(bands, EXPR_MIN_BANDS_, [&](unsigned begin, unsigned end)
+        {
+            // Block of every operation, colors are filled once
+            alignas(16) uint32_t registers[MAX_EXPR_OPS_][EXPR_BLOCK_];
+            const Color* operands[MAX_EXPR_OPS_] = {};
+
+            for (unsigned i = 0u; i < program.size; i++)
+                if (program.code[i].op == EXPR_OP_COLOR)
+                {
+                    fill_colors((Color*)registers[i], EXPR_BLOCK_, program.code[i].color);
+                    operands[i] = (const Color*)registers[i];
+                }
+
+            const unsigned long long last = (unsigned long long)end * EXPR_BAND_ < count ? (unsigned long long)end * EXPR_BAND_ : count;
+            const unsigned root = program.size - 1u;
+
+            for (unsigned long long offset = (unsigned long long)begin * EXPR_BAND_; offset < last; offset += EXPR_BLOCK_)
+            {
+                const unsigned span = last - offset < EXPR_BLOCK_ ? (unsigned)(last - offset) : EXPR_BLOCK_;
+
+                for (unsigned i = 0u; i < program.size; i++)
+                {
+                    const ExprInstruction& instruction = program.code[i];
+                    if (instruction.op == EXPR_OP_COLOR)
+                        continue;
+                    if (instruction.op == EXPR_OP_IMAGE)
+                    {
+                        operands[i] = sources[i] + offset;
+                        continue;
+                    }
+
+                    // The result goes straight into the pixels
+                    Color* out = i == root ? pixels + offset : (Color*)registers[i];
+                    const Color* a = operands[instruction.left];
+                    const Color* b = operands[instruction.right];
+
+                    switch (instruction.op)
+                    {
+                    case EXPR_OP_ADD:		kernels.add(a, b, out, span);			break;
+                    case EXPR_OP_SUB:		kernels.sub(a, b, out, span);			break;
+                    case EXPR_OP_MUL:		kernels.mul(a, b, out, span);			break;
+                    case EXPR_OP_DIV:		expr_div(a, b, out, span);				break;
+                    case EXPR_OP_INVERT:	kernels.invert(a, out, span);			break;
+                    default:				expr_number(instruction, a, out, span);	break;
+                    }
+                    operands[i] = out;
+                }
+
+                // A single image operand is copied
+                if (program.code[root].op == EXPR_OP_IMAGE && operands[root] != pixels + offset)
+                    memcpy((void*)(pixels + offset), operands[root], span * sizeof(Color));
+            }
+        });
+
+    return true;
+}
@@ -0,0 +1,150 @@
+#include "Image.h"
+#include "Parallel.h"
+#include "SIMD.h"
+
+#include <cstdint>
+#include <cstring>
+
+#define FILL_STREAM_BYTES_ (4ull << 20)	// Spans from this size on use streaming stores
+#define FILL_BLOCK_ 65536u					// Pixels per block of a parallel fill, 256 KB
+#define FILL_MIN_BLOCKS_ 8u					// Minimum blocks filled by each thread
+
+/*
+-------------------------------------------------------------------------------------------------------
+Internal kernels
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Sets count colors to the color, with streaming stores if requested
+
+static void fill_span(Color* pixels, unsigned long long count, Color color, bool stream)
+{
+#ifdef IMAGE_SSE2_
+    // Scalar head until the pointer is 16 byte aligned
+    while (count && ((uintptr_t)pixels & 15u))
+    {
+        *pixels++ = color;
+        count--;
+    }
+
+    int bits;
+    memcpy(&bits, &color, sizeof(bits));
+    const __m128i v = _mm_set1_epi32(bits);
+
+    if (stream)
+    {
+        for (; count >= 16ull; count -= 16ull, pixels += 16)
+        {
+            _mm_stream_si128((__m128i*)pixels, v);
+            _mm_stream_si128((__m128i*)(pixels + 4), v);
+            _mm_stream_si128((__m128i*)(pixels + 8), v);
+            _mm_stream_si128((__m128i*)(pixels + 12), v);
+        }
+        _mm_sfence();
+    }
+    else
+    {
+        for (; count >= 16ull; count -= 16ull, pixels += 16)
+        {
+            _mm_store_si128((__m128i*)pixels, v);
+            _mm_store_si128((__m128i*)(pixels + 4), v);
+            _mm_store_si128((__m128i*)(pixels + 8), v);
+            _mm_store_si128((__m128i*)(pixels + 12), v);
+        }
+    }
+    for (; count >= 4ull; count -= 4ull, pixels += 4)
+        _mm_store_si128((__m128i*)pixels, v);
+#else
+    (void)stream;
+#endif
+    for (unsigned long long i = 0ull; i < count; i++)
+        pixels[i] = color;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Fill functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Sets count colors starting at pixels to the color. Large spans are split across
+// threads and use streaming stores that do not pollute the cache.
+
+void fill_colors(Color* pixels, unsigned long long count, Color color)
+{
+    const bool stream = count * sizeof(Color) >= FILL_STREAM_BYTES_;
+    if (!stream)
+    {
+        fill_span(pixels, count, color, false);
+        return;
+    }
+
+    const unsigned blocks = (unsigned)((count + FILL_BLOCK_ - 1ull) / FILL_BLOCK_);
+    parallel_for(blocks, FILL_MIN_BLOCKS_, [&](unsigned begin, unsigned end)
+        {
+            const unsigned long long first = (unsigned long long)begin * FILL_BLOCK_;
+            const unsigned long long last = (unsigned long long)end * FILL_BLOCK_ < count ? (unsigned long long)end * FILL_BLOCK_ : count;
+            fill_span(pixels + first, last - first, color, true);
+        });
+}
+
+// Sets every pixel to the color. If the pixels are shared with copy-on-write
+// it takes a new buffer without copying them.
+
+void Image::fill(Color color)
+{
+    if (is_shared() && !allocate_pixels(width_, height_, false))
+        throw "Could not allocate image pixels";
+
+    mark_all_dirty();
+    fill_colors(pixels_, (unsigned long long)width_ * height_, color);
+}
+
+// Sets every pixel to transparent, same as fill(Color::Transparent)
+
+void Image::clear()
+{
+    fill(Color::Transparent);
+}
+
+// Sets the pixels of the rectangle starting at the specified pixel coordinates
+// with the specified size to the color, the parts outside the image are ignored
+
+void Image::fill_rect(unsigned int row, unsigned int col, unsigned int height, unsigned int width, Color color)
+{
+    if (row >= height_ || col >= width_ || !height || !width)
+        return;
+
+    if (height > height_ - row) height = height_ - row;
+    if (width > width_ - col) width = width_ - col;
+
+    if (dirty_)
+        dirty_->add(row, col, height, width);
+
+    // Full rows are a single span
+    if (col == 0u && width == width_)
+    {
+        if (height == height_)
+        {
+            fill(color);
+            return;
+        }
+
+        detach();
+        fill_colors(pixels_ + (unsigned long long)row * width_, (unsigned long long)height * width_, color);
+        return;
+    }
+
+    detach();
+
+    // Each thread gets at least as many pixels as a parallel span fill
+    const unsigned min_rows = FILL_BLOCK_ * FILL_MIN_BLOCKS_ / width + 1u;
+
+    Color* first = pixels_ + (unsigned long long)row * width_ + col;
+    const unsigned stride = width_;
+    parallel_for(height, min_rows, [&](unsigned begin, unsigned end)
+        {
+            for (unsigned r = begin; r < end; r++)
+                fill_span(first + (unsigned long long)r * stride, width, color, false);
+        });
+}
@@ -0,0 +1,350 @@
+#include "Image.h"
+#include "Parallel.h"
+#include "SIMD.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#define HASH_SEGMENT_BYTES_ (256u << 10)	// Bytes hashed independently, so that threads can share the work
+#define HASH_BLOCK_STRIPES_ 16u				// Stripes of 64 bytes accumulated between scrambles
+#define HASH_PARALLEL_PIXELS_ 65536u		// Images reduced for the perceptual hashes in parallel from this size on
+#define HASH_GRAY_CHUNK_ 1024u				// Pixels converted to gray at once by the perceptual hashes
+
+#define PRIME32_1_ 0x9E3779B1u
+#define PRIME32_2_ 0x85EBCA77u
+#define PRIME32_3_ 0xC2B2AE3Du
+#define PRIME64_1_ 0x9E3779B185EBCA87ull
+#define PRIME64_2_ 0xC2B2AE3D27D4EB4Full
+#define PRIME64_3_ 0x165667B19E3779F9ull
+#define PRIME64_4_ 0x85EBCA77C2B2AE63ull
+#define PRIME64_5_ 0x27D4EB2F165667C5ull
+
+/*
+-------------------------------------------------------------------------------------------------------
+Exact hash
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Key mixed with the data, stripe s of a block uses the 8 values from s on,
+// and the last 8 scramble the accumulators after every block
+
+static const uint64_t hash_secret[HASH_BLOCK_STRIPES_ + 8u] =
+{
+    0xC0E16B163A85A4DCull, 0x890ACD8DD443C47Cull, 0xB3889D8A6DC47761ull, 0x6A0398E528F0AE6Aull,
+    0x048344ECE48A855Eull, 0xF175CFEA21871330ull, 0x391CEEF02702C2FDull, 0x4BAF8CAC4784CB12ull,
+    0x3547744583A3F88Eull, 0xD9CF2B15C6B6C90Eull, 0x961FACC76D5FE21Cull, 0x0094AB49D50F11F9ull,
+    0xE3211E37BDBEB6DCull, 0x62FE6C274FF3511Aull, 0x5AC30B329FDF0574ull, 0x1450582C6B65B406ull,
+    0x7A30FCC7888EB791ull, 0x5540F5BA6A15576Eull, 0x16CEF0559096D3E9ull, 0x2CF8F14B06874899ull,
+    0xC9C9263B6E2CE103ull, 0xD6FF920B0A9FAA6Dull, 0x53192697DB998DC1ull, 0x73EA9B9BC7CD18D7ull,
+};
+
+// Reads a little endian 64-bit value
+
+static inline uint64_t read_le64(const uint8_t* p)
+{
+    uint64_t v = 0u;
+    for (unsigned k = 0u; k < 8u; k++)
+        v |= (uint64_t)p[k] << (8u * k);
+    return v;
+}
+
+// Adds a stripe of 64 bytes to the eight accumulators. Every lane adds the product
+// of the halves of its data mixed with the key, and the data of its neighbour lane.
+
+static inline void accumulate_stripe(uint64_t* acc, const uint8_t* data, const uint64_t* key)
+{
+#ifdef IMAGE_SSE2_
+    for (unsigned k = 0u; k < 4u; k++)
+    {
+        const __m128i d = _mm_loadu_si128((const __m128i*)(data + 16u * k));
+        const __m128i mixed = _mm_xor_si128(d, _mm_loadu_si128((const __m128i*)(key + 2u * k)));
+        const __m128i product = _mm_mul_epu32(mixed, _mm_shuffle_epi32(mixed, _MM_SHUFFLE(0, 3, 0, 1)));
+        const __m128i swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+
+        __m128i* a = (__m128i*)(acc + 2u * k);
+        _mm_storeu_si128(a, _mm_add_epi64(_mm_loadu_si128(a), _mm_add_epi64(product, swapped)));
+    }
+#else
+    for (unsigned i = 0u; i < 8u; i++)
+    {
+        const uint64_t d = read_le64(data + 8u * i);
+        const uint64_t mixed = d ^ key[i];
+        acc[i ^ 1u] += d;
+        acc[i] += (mixed & 0xFFFFFFFFull) * (mixed >> 32);
+    }
+#endif
+}
+
+// Spreads the high bits of the accumulators into the low ones after every block
+
+static inline void scramble(uint64_t* acc, const uint64_t* key)
+{
+    for (unsigned i = 0u; i < 8u; i++)
+        acc[i] = (acc[i] ^ (acc[i] >> 47) ^ key[i]) * PRIME32_1_;
+}
+
+// Returns the xor of the high and low halves of the 128-bit product
+
+static inline uint64_t fold_multiply(uint64_t a, uint64_t b)
+{
+    const uint64_t a_lo = a & 0xFFFFFFFFull, a_hi = a >> 32;
+    const uint64_t b_lo = b & 0xFFFFFFFFull, b_hi = b >> 32;
+
+    const uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo;
+    const uint64_t lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+
+    const uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFFull) + lo_hi;
+    const uint64_t high = hi_hi + (hi_lo >> 32) + (cross >> 32);
+    const uint64_t low = (cross << 32) | (lo_lo & 0xFFFFFFFFull);
+    return high ^ low;
+}
+
+// Hashes the bytes with 64-byte stripes over eight 64-bit lanes, the structure of
+// XXH3. A last partial stripe is padded with zeros, the length tells them apart.
+
+static uint64_t hash_bytes(const uint8_t* data, size_t size)
+{
+    uint64_t acc[8] = { PRIME32_3_, PRIME64_1_, PRIME64_2_, PRIME64_3_, PRIME64_4_, PRIME32_2_, PRIME64_5_, PRIME32_1_ };
+
+    const size_t stripes = size / 64u;
+    size_t s = 0u;
+    for (; s + HASH_BLOCK_STRIPES_ <= stripes; s += HASH_BLOCK_STRIPES_)
+    {
+        for (unsigned k = 0u; k < HASH_BLOCK_STRIPES_; k++)
+            accumulate_stripe(acc, data + 64u * (s + k), hash_secret + k);
+        scramble(acc, hash_secret + HASH_BLOCK_STRIPES_);
+    }
+
+    unsigned k = 0u;
+    for (; s < stripes; s++, k++)
+        accumulate_stripe(acc, data + 64u * s, hash_secret + k);
+
+    if (size % 64u)
+    {
+        uint8_t last[64] = {};
+        memcpy(last, data + 64u * stripes, size % 64u);
+        accumulate_stripe(acc, last, hash_secret + k);
+    }
+
+    // Merge the lanes in pairs and avalanche
+    uint64_t h = (uint64_t)size * PRIME64_1_;
+    for (unsigned i = 0u; i < 4u; i++)
+        h += fold_multiply(acc[2u * i] ^ hash_secret[2u * i + 3u], acc[2u * i + 1u] ^ hash_secret[2u * i + 4u]);
+
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ull;
+    h ^= h >> 32;
+    return h;
+}
+
+// Hashes fixed segments of the pixels in parallel, then the size together with the
+// hash of every segment, so the result does not depend on the number of threads
+
+unsigned long long Image::hash() const
+{
+    const unsigned long long bytes = (unsigned long long)width_ * height_ * sizeof(Color);
+    const unsigned segments = (unsigned)((bytes + HASH_SEGMENT_BYTES_ - 1u) / HASH_SEGMENT_BYTES_);
+
+    uint64_t local[64];
+    uint64_t* hashes = segments + 1u <= 64u ? local : (uint64_t*)malloc(((size_t)segments + 1u) * sizeof(uint64_t));
+    if (!hashes)
+        throw "Could not allocate image hash";
+
+    hashes[0] = (uint64_t)width_ | ((uint64_t)height_ << 32);
+
+    const uint8_t* data = (const uint8_t*)pixels_;
+    parallel_for(segments, 1u, [&](unsigned begin, unsigned end)
+        {
+            for (unsigned s = begin; s < end; s++)
+            {
+                const unsigned long long first = (unsigned long long)s * HASH_SEGMENT_BYTES_;
+                const unsigned long long size = bytes - first < HASH_SEGMENT_BYTES_ ? bytes - first : HASH_SEGMENT_BYTES_;
+                hashes[s + 1u] = hash_bytes(data + first, (size_t)size);
+            }
+        });
+
+    // Values are hashed as little endian bytes on every platform
+    uint8_t* key = (uint8_t*)hashes;
+    for (unsigned i = 0u; i <= segments; i++)
+    {
+        const uint64_t v = hashes[i];
+        for (unsigned k = 0u; k < 8u; k++)
+            key[8u * i + k] = (uint8_t)(v >> (8u * k));
+    }
+
+    const uint64_t h = hash_bytes(key, ((size_t)segments + 1u) * sizeof(uint64_t));
+    if (hashes != local)
+        free(hashes);
+    return h;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Perceptual hashes
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Stores the first and end pixel of each of the count boxes spread evenly over
+// size pixels. Boxes have at least one pixel, they overlap when count > size.
+
+static void hash_boxes(unsigned* first, unsigned* end, unsigned count, unsigned size)
+{
+    for (unsigned i = 0u; i < count; i++)
+    {
+        first[i] = (unsigned)((unsigned long long)i * size / count);
+        end[i] = (unsigned)((unsigned long long)(i + 1u) * size / count);
+        if (end[i] <= first[i])
+            end[i] = first[i] + 1u;
+    }
+}
+
+// Returns the sum of the bytes
+
+static inline unsigned sum_bytes(const uint8_t* p, unsigned count)
+{
+    unsigned sum = 0u, i = 0u;
+#ifdef IMAGE_SSE2_
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for (; i + 16u <= count; i += 16u)
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(p + i)), zero));
+    sum = (unsigned)_mm_cvtsi128_si32(acc) + (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#endif
+    for (; i < count; i++)
+        sum += p[i];
+    return sum;
+}
+
+// Reduces the image to cols x rows gray averages of the pixels each one covers.
+// Every output row is computed from its own band of image rows, in parallel for
+// large images, converting the rows to gray in chunks. The image must not be empty.
+
+static void gray_grid(const Image& image, unsigned cols, unsigned rows, float* grid)
+{
+    const unsigned width = image.width(), height = image.height();
+
+    unsigned col_first[32], col_end[32], row_first[32], row_end[32];
+    hash_boxes(col_first, col_end, cols, width);
+    hash_boxes(row_first, row_end, rows, height);
+
+    const unsigned long long pixels = (unsigned long long)width * height;
+    const unsigned min_rows = pixels < HASH_PARALLEL_PIXELS_ ? rows : 1u;
+
+    parallel_for(rows, min_rows, [&](unsigned begin, unsigned end)
+        {
+            uint8_t gray[HASH_GRAY_CHUNK_];
+            for (unsigned i = begin; i < end; i++)
+            {
+                unsigned long long sums[32] = {};
+                for (unsigned y = row_first[i]; y < row_end[i]; y++)
+                    for (unsigned x0 = 0u; x0 < width; x0 += HASH_GRAY_CHUNK_)
+                    {
+                        const unsigned x1 = width - x0 < HASH_GRAY_CHUNK_ ? width : x0 + HASH_GRAY_CHUNK_;
+                        convert_to_format(image.pixels() + (unsigned long long)y * width + x0, gray, x1 - x0, PIXEL_FORMAT_GRAY8);
+
+                        // Part of every box inside the chunk
+                        for (unsigned j = 0u; j < cols; j++)
+                        {
+                            const unsigned first = col_first[j] > x0 ? col_first[j] : x0;
+                            const unsigned last = col_end[j] < x1 ? col_end[j] : x1;
+                            if (first < last)
+                                sums[j] += sum_bytes(gray + (first - x0), last - first);
+                        }
+                    }
+
+                const unsigned long long box_rows = row_end[i] - row_first[i];
+                for (unsigned j = 0u; j < cols; j++)
+                    grid[i * cols + j] = (float)((double)sums[j] / (double)(box_rows * (col_end[j] - col_first[j])));
+            }
+        });
+}
+
+// Reduces the image to 9x8 gray averages, every bit tells whether
+// a value is brighter than the one to its right, row after row
+
+unsigned long long Image::dhash() const
+{
+    if (!width_ || !height_)
+        return 0ull;
+
+    float grid[9u * 8u];
+    gray_grid(*this, 9u, 8u, grid);
+
+    unsigned long long h = 0ull;
+    for (unsigned i = 0u; i < 8u; i++)
+        for (unsigned j = 0u; j < 8u; j++)
+            if (grid[9u * i + j] > grid[9u * i + j + 1u])
+                h |= 1ull << (8u * i + j);
+    return h;
+}
+
+// Reduces the image to 32x32 gray averages and computes the lowest 8x8 frequencies
+// of their DCT, every bit tells whether one of them is above their median
+
+unsigned long long Image::phash() const
+{
+    if (!width_ || !height_)
+        return 0ull;
+
+    float grid[32u * 32u];
+    gray_grid(*this, 32u, 32u, grid);
+
+    // DCT basis of the 8 lowest frequencies, the scale does not change the bits
+    double basis[8][32];
+    for (unsigned u = 0u; u < 8u; u++)
+        for (unsigned x = 0u; x < 32u; x++)
+            basis[u][x] = cos((2.0 * x + 1.0) * u * 3.14159265358979323846 / 64.0);
+
+    // Rows first, then columns
+    double rows[32][8];
+    for (unsigned y = 0u; y < 32u; y++)
+        for (unsigned u = 0u; u < 8u; u++)
+        {
+            double sum = 0.0;
+            for (unsigned x = 0u; x < 32u; x++)
+                sum += grid[32u * y + x] * basis[u][x];
+            rows[y][u] = sum;
+        }
+
+    double coefficients[64];
+    for (unsigned v = 0u; v < 8u; v++)
+        for (unsigned u = 0u; u < 8u; u++)
+        {
+            double sum = 0.0;
+            for (unsigned y = 0u; y < 32u; y++)
+                sum += rows[y][u] * basis[v][y];
+            coefficients[8u * v + u] = sum;
+        }
+
+    // Median as the mean of the two middle values, by insertion sort of a copy
+    double sorted[64];
+    memcpy(sorted, coefficients, sizeof(sorted));
+    for (unsigned i = 1u; i < 64u; i++)
+    {
+        const double value = sorted[i];
+        unsigned k = i;
+        for (; k > 0u && sorted[k - 1u] > value; k--)
+            sorted[k] = sorted[k - 1u];
+        sorted[k] = value;
+    }
+    const double median = 0.5 * (sorted[31] + sorted[32]);
+
+    unsigned long long h = 0ull;
+    for (unsigned i = 0u; i < 64u; i++)
+        if (coefficients[i] > median)
+            h |= 1ull << i;
+    return h;
+}
+
+// Returns the number of different bits between both hashes
+
+unsigned Image::hash_distance(unsigned long long a, unsigned long long b)
+{
+    unsigned long long diff = a ^ b;
+    unsigned count = 0u;
+    for (; diff; count++)
+        diff &= diff - 1ull;
+    return count;
+}
@@ -0,0 +1,173 @@
+#include "Image.h"
+#include "BMP.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#define PROBE_READ_SIZE_ 64u // Bytes read from each probed file, enough for both headers
+
+/*
+-------------------------------------------------------------------------------------------------------
+Internal helpers
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Probes the file at the exact path with one unbuffered read of the headers
+
+static bool probe_file(const char* path, ImageInfo* info)
+{
+    *info = ImageInfo();
+
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    // Without buffering stdio reads exactly what we ask for
+    setvbuf(file, nullptr, _IONBF, 0);
+
+    uint8_t data[PROBE_READ_SIZE_];
+    const size_t read = fread(data, 1, PROBE_READ_SIZE_, file);
+    fclose(file);
+
+    BMPHeader header;
+    if (read < BMP_HEADER_SIZE_ || !bmp_parse_header(data, &header))
+        return false;
+
+    info->format = IMAGE_FORMAT_BMP;
+    info->width = (unsigned)(header.width < 0 ? -header.width : header.width);
+    info->height = (unsigned)(header.height < 0 ? -header.height : header.height);
+    info->bit_depth = header.bit_count;
+    info->compression = header.compression;
+    info->top_down = header.height < 0;
+    info->file_size = header.file_size;
+    info->loadable = bmp_loadable(header);
+    return true;
+}
+
+// Checks whether the name ends with ".bmp", case insensitive
+
+static bool has_bmp_extension(const char* name)
+{
+    const size_t len = strlen(name);
+    if (len < 4)
+        return false;
+
+    const char* ext = name + len - 4;
+    return ext[0] == '.' &&
+        (ext[1] == 'b' || ext[1] == 'B') &&
+        (ext[2] == 'm' || ext[2] == 'M') &&
+        (ext[3] == 'p' || ext[3] == 'P');
+}
+
+// Stores the probe of the file if there is room, and counts it
+
+static void probe_entry(ImageProbe* probes, unsigned max_probes, unsigned* count, const char* directory, const char* name)
+{
+    if (*count < max_probes)
+    {
+        ImageProbe& probe = probes[*count];
+        const size_t dir_len = strlen(directory);
+        const bool separator = dir_len && directory[dir_len - 1] != '/' && directory[dir_len - 1] != '\\';
+
+        if (snprintf(probe.path, sizeof(probe.path), separator ? "%s/%s" : "%s%s", directory, name) < (int)sizeof(probe.path))
+            probe_file(probe.path, &probe.info);
+        else
+            probe.info = ImageInfo();
+    }
+    (*count)++;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Probe functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Reads only the header of the specified image file and stores its information.
+
+bool Image::probe(ImageInfo* info, const char* fmt_filename, ...)
+{
+    if (!info)
+        return false;
+
+    *info = ImageInfo();
+
+    va_list ap;
+
+    // Unwrap the format
+    char filename[512];
+
+    va_start(ap, fmt_filename);
+    const bool ok = bmp_format_filename(filename, 512, fmt_filename, ap);
+    va_end(ap);
+
+    if (!ok)
+        return false;
+
+    return probe_file(filename, info);
+}
+
+// Probes every BMP file inside the specified directory, not recursive.
+
+unsigned Image::probe_directory(ImageProbe* probes, unsigned int max_probes, const char* fmt_directory, ...)
+{
+    if (!fmt_directory || !*fmt_directory)
+        return 0u;
+
+    if (!probes)
+        max_probes = 0u;
+
+    va_list ap;
+
+    // Unwrap the format
+    char directory[512];
+
+    va_start(ap, fmt_directory);
+    const int written = vsnprintf(directory, 512, fmt_directory, ap);
+    va_end(ap);
+
+    if (written < 0 || written >= 512)
+        return 0u;
+
+    unsigned count = 0u;
+
+#ifdef _WIN32
+    char pattern[520];
+    snprintf(pattern, sizeof(pattern), "%s\\*", directory);
+
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+    if (find == INVALID_HANDLE_VALUE)
+        return 0u;
+
+    do
+    {
+        if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && has_bmp_extension(data.cFileName))
+            probe_entry(probes, max_probes, &count, directory, data.cFileName);
+
+    } while (FindNextFileA(find, &data));
+
+    FindClose(find);
+#else
+    DIR* dir = opendir(directory);
+    if (!dir)
+        return 0u;
+
+    while (dirent* entry = readdir(dir))
+    {
+        if (entry->d_type != DT_DIR && has_bmp_extension(entry->d_name))
+            probe_entry(probes, max_probes, &count, directory, entry->d_name);
+    }
+
+    closedir(dir);
+#endif
+
+    return count;
+}
@@ -0,0 +1,357 @@
+#include "Image.h"
+#include "BMP.h"
+#include "SIMD.h"
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+/*
+-------------------------------------------------------------------------------------------------------
+Box averaging
+-------------------------------------------------------------------------------------------------------
+*/
+
+#define BOX_CHUNK_ROWS_ 257u		// Rows summed in 16-bit lanes before they are added to the box sums
+#define BOX_CHUNK_COLUMNS_ 65536u	// Column sums added in 32-bit lanes before they are widened
+#define BOX_DIRECT_AREA_ 8192u		// Largest box averaged with float reciprocals, see write_band_direct()
+#define BOX_ROUNDING_ 4e-5f			// Added to the float quotients, more than their error, less than 1 / area
+
+// Adds the row to the 16-bit channel sums of every pixel column
+
+static void add_row(const Color* row, uint16_t* columns, uint32_t width)
+{
+    uint32_t x = 0u;
+#ifdef IMAGE_SSE2_
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 4u <= width; x += 4u)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(row + x));
+        __m128i* c = (__m128i*)(columns + 4u * x);
+        _mm_storeu_si128(c, _mm_add_epi16(_mm_loadu_si128(c), _mm_unpacklo_epi8(v, zero)));
+        _mm_storeu_si128(c + 1, _mm_add_epi16(_mm_loadu_si128(c + 1), _mm_unpackhi_epi8(v, zero)));
+    }
+#endif
+    for (; x < width; x++)
+    {
+        columns[4u * x + 0u] += row[x].B;
+        columns[4u * x + 1u] += row[x].G;
+        columns[4u * x + 2u] += row[x].R;
+        columns[4u * x + 3u] += row[x].A;
+    }
+}
+
+// Adds the column sums of every box to its channel sums and clears them. 
+// Columns of box j span from bounds[j] to bounds[j + 1].
+
+static void reduce_columns(uint16_t* columns, const uint32_t* bounds, uint32_t width, uint64_t* sums)
+{
+    for (uint32_t j = 0u; j < width; j++)
+    {
+        uint32_t x = bounds[j];
+        const uint32_t end = bounds[j + 1u];
+        uint64_t* sum = sums + 4u * j;
+
+#ifdef IMAGE_SSE2_
+        // Two columns at a time, widened to 32-bit lanes
+        const __m128i zero = _mm_setzero_si128();
+        while (end - x >= 2u)
+        {
+            const uint32_t count = end - x < BOX_CHUNK_COLUMNS_ ? (end - x) & ~1u : BOX_CHUNK_COLUMNS_;
+            const uint32_t stop = x + count;
+
+            __m128i acc = zero;
+            for (; x < stop; x += 2u)
+            {
+                __m128i* c = (__m128i*)(columns + 4u * x);
+                const __m128i v = _mm_loadu_si128(c);
+                acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero)));
+                _mm_storeu_si128(c, zero);
+            }
+
+            uint32_t total[4];
+            _mm_storeu_si128((__m128i*)total, acc);
+            for (unsigned k = 0u; k < 4u; k++)
+                sum[k] += total[k];
+        }
+#endif
+        for (; x < end; x++)
+            for (unsigned k = 0u; k < 4u; k++)
+            {
+                sum[k] += columns[4u * x + k];
+                columns[4u * x + k] = 0u;
+            }
+    }
+}
+
+// Returns the rounded quotient. The floating point estimate is off by one at most, 
+// which the integer check fixes, so it is exact and much cheaper than a division.
+
+static inline unsigned char rounded_average(uint64_t sum, uint64_t count, double inverse)
+{
+    const uint64_t n = sum + count / 2u;
+    uint64_t q = (uint64_t)(int64_t)((double)(int64_t)n * inverse);
+
+    if (q * count > n) q--;
+    else if ((q + 1u) * count <= n) q++;
+    return (unsigned char)q;
+}
+
+// Writes the rounded average of every box of a band of the specified rows and clears the sums
+
+static void write_band(uint64_t* sums, const uint32_t* bounds, uint32_t width, uint32_t rows, Color* out)
+{
+    for (uint32_t j = 0u; j < width; j++)
+    {
+        uint64_t* sum = sums + 4u * j;
+        const uint64_t count = (uint64_t)(bounds[j + 1u] - bounds[j]) * rows;
+        const double inverse = 1.0 / (double)count;
+
+        out[j].B = rounded_average(sum[0], count, inverse);
+        out[j].G = rounded_average(sum[1], count, inverse);
+        out[j].R = rounded_average(sum[2], count, inverse);
+        out[j].A = rounded_average(sum[3], count, inverse);
+        sum[0] = sum[1] = sum[2] = sum[3] = 0u;
+    }
+}
+
+// Writes the rounded average of every box of a band straight from the column sums
+// and clears them, four channels at once. The quotients are below 256, so their float
+// estimates are off by less than 2^-15, and unless exact their fraction is at least
+// 1 / area. Adding a margin between both truncates them to the exact result.
+
+static void write_band_direct(uint16_t* columns, const uint32_t* bounds, uint32_t width, uint32_t rows, Color* out)
+{
+#ifdef IMAGE_SSE2_
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t last_count = 0u;
+    __m128 half = _mm_setzero_ps(), inverse = _mm_setzero_ps();
+#endif
+    for (uint32_t j = 0u; j < width; j++)
+    {
+        uint32_t x = bounds[j];
+        const uint32_t end = bounds[j + 1u];
+        const uint32_t count = (end - x) * rows;
+
+#ifdef IMAGE_SSE2_
+        __m128i acc = zero;
+        for (; x + 2u <= end; x += 2u)
+        {
+            __m128i* c = (__m128i*)(columns + 4u * x);
+            const __m128i v = _mm_loadu_si128(c);
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero)));
+            _mm_storeu_si128(c, zero);
+        }
+        if (x < end)
+        {
+            __m128i* c = (__m128i*)(columns + 4u * x);
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(_mm_loadl_epi64(c), zero));
+            _mm_storel_epi64(c, zero);
+        }
+
+        // Boxes only differ at the edges
+        if (count != last_count)
+        {
+            last_count = count;
+            half = _mm_set1_ps((float)(count / 2u));
+            inverse = _mm_set1_ps(1.f / (float)count);
+        }
+
+        const __m128 n = _mm_add_ps(_mm_cvtepi32_ps(acc), half);
+        const __m128i q = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(n, inverse), _mm_set1_ps(BOX_ROUNDING_)));
+
+        const int packed = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(q, q), zero));
+        memcpy((void*)(out + j), &packed, sizeof(Color));
+#else
+        uint32_t sum[4] = {};
+        for (; x < end; x++)
+            for (unsigned k = 0u; k < 4u; k++)
+            {
+                sum[k] += columns[4u * x + k];
+                columns[4u * x + k] = 0u;
+            }
+
+        const double inverse = 1.0 / (double)count;
+        out[j].B = rounded_average(sum[0], count, inverse);
+        out[j].G = rounded_average(sum[1], count, inverse);
+        out[j].R = rounded_average(sum[2], count, inverse);
+        out[j].A = rounded_average(sum[3], count, inverse);
+#endif
+    }
+}
+
+// Stores in bounds the first pixel of each of the count boxes, plus the end. With a
+// factor every box has that many pixels but the last, otherwise they are spread evenly.
+
+static void box_bounds(uint32_t* bounds, uint32_t count, uint32_t size, uint32_t factor)
+{
+    for (uint32_t i = 0u; i <= count; i++)
+    {
+        const uint64_t first = factor ? (uint64_t)i * factor : (uint64_t)i * size / count;
+        bounds[i] = first < size ? (uint32_t)first : size;
+    }
+}
+
+// Decodes every row of the reader averaging it into the width x height pixels. Rows
+// are added to per-column sums, which are reduced into the boxes when their band is
+// complete, or every BOX_CHUNK_ROWS_ rows into 64-bit sums for very large boxes.
+// Only one decoded row and the sums are held besides the result. Returns false if
+// the file ends early or out of memory.
+
+static bool average_rows(BMPReader& reader, Color* pixels, uint32_t width, uint32_t height, uint32_t factor)
+{
+    uint32_t* columns = (uint32_t*)malloc(((size_t)width + 1u) * sizeof(uint32_t));
+    uint32_t* rows = (uint32_t*)malloc(((size_t)height + 1u) * sizeof(uint32_t));
+    uint16_t* column_sums = (uint16_t*)calloc((size_t)reader.width * 4u, sizeof(uint16_t));
+    uint64_t* sums = (uint64_t*)calloc((size_t)width * 4u, sizeof(uint64_t));
+    Color* row = (Color*)malloc((size_t)reader.width * sizeof(Color));
+
+    bool read = columns && rows && column_sums && sums && row;
+    if (read)
+    {
+        box_bounds(columns, width, reader.width, factor);
+        box_bounds(rows, height, reader.height, factor);
+
+        // Rows arrive in file order, bottom-up files fill the bands from the last one
+        const bool top_down = reader.header.height < 0;
+        uint32_t band = top_down ? 0u : height - 1u;
+        uint32_t chunk = 0u;
+
+        // Usual sizes average each band straight from the column sums
+        uint32_t box_columns = 0u, box_rows = 0u;
+        for (uint32_t j = 0u; j < width; j++)
+            if (columns[j + 1u] - columns[j] > box_columns)
+                box_columns = columns[j + 1u] - columns[j];
+        for (uint32_t i = 0u; i < height; i++)
+            if (rows[i + 1u] - rows[i] > box_rows)
+                box_rows = rows[i + 1u] - rows[i];
+
+        const bool direct = box_rows <= BOX_CHUNK_ROWS_ && (uint64_t)box_columns * box_rows <= BOX_DIRECT_AREA_;
+
+        for (uint32_t y = 0u; y < reader.height; y++)
+        {
+            const uint32_t image_row = bmp_next_row(reader);
+            if (!(read = bmp_read_row(&reader, row)))
+                break;
+
+            add_row(row, column_sums, reader.width);
+
+            const bool last = top_down ? image_row + 1u == rows[band + 1u] : image_row == rows[band];
+            if (direct)
+            {
+                if (last)
+                {
+                    write_band_direct(column_sums, columns, width, rows[band + 1u] - rows[band], pixels + (size_t)band * width);
+                    band += top_down ? 1u : -1u;
+                }
+                continue;
+            }
+
+            if (last || ++chunk == BOX_CHUNK_ROWS_)
+            {
+                reduce_columns(column_sums, columns, width, sums);
+                chunk = 0u;
+            }
+
+            if (last)
+            {
+                write_band(sums, columns, width, rows[band + 1u] - rows[band], pixels + (size_t)band * width);
+                band += top_down ? 1u : -1u;
+            }
+        }
+    }
+
+    free(columns);
+    free(rows);
+    free(column_sums);
+    free(sums);
+    free(row);
+    return read;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Scaled loading
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Loads the bitmap file downscaled by the factor, the size rounded up
+
+bool Image::load_scaled(unsigned int factor, const char* fmt_filename, ...)
+{
+    va_list ap;
+    char filename[512];
+
+    va_start(ap, fmt_filename);
+    const bool formatted = bmp_format_filename(filename, 512u, fmt_filename, ap);
+    va_end(ap);
+
+    if (!formatted || !factor)
+        return false;
+
+    if (factor == 1u)
+        return load("%s", filename);
+
+    BMPReader reader;
+    if (!bmp_open(&reader, filename))
+        return false;
+
+    const uint32_t width = (uint32_t)(((uint64_t)reader.width + factor - 1u) / factor);
+    const uint32_t height = (uint32_t)(((uint64_t)reader.height + factor - 1u) / factor);
+
+    // every pixel is written by its band so no need to zero
+    const bool loaded = allocate_pixels(width, height, false) && average_rows(reader, pixels_, width, height, factor);
+
+    bmp_close(&reader);
+    return loaded;
+}
+
+// Loads the bitmap file downscaled to fit in the box keeping its aspect ratio
+
+bool Image::load_thumbnail(unsigned int max_width, unsigned int max_height, const char* fmt_filename, ...)
+{
+    va_list ap;
+    char filename[512];
+
+    va_start(ap, fmt_filename);
+    const bool formatted = bmp_format_filename(filename, 512u, fmt_filename, ap);
+    va_end(ap);
+
+    if (!formatted || !max_width || !max_height)
+        return false;
+
+    BMPReader reader;
+    if (!bmp_open(&reader, filename))
+        return false;
+
+    // The limiting side gets its maximum, the other one is rounded, never upscaling
+    const uint64_t w = reader.width, h = reader.height;
+    uint32_t width, height;
+    if (w * max_height >= h * max_width)
+    {
+        width = w < max_width ? (uint32_t)w : max_width;
+        height = (uint32_t)((h * width + w / 2u) / w);
+    }
+    else
+    {
+        height = h < max_height ? (uint32_t)h : max_height;
+        width = (uint32_t)((w * height + h / 2u) / h);
+    }
+    if (!width) width = 1u;
+    if (!height) height = 1u;
+
+    bool loaded = allocate_pixels(width, height, false);
+    if (loaded)
+    {
+        // Same size is a plain load, straight into the pixels
+        if (width == reader.width && height == reader.height)
+            for (uint32_t y = 0u; y < height && loaded; y++)
+                loaded = bmp_read_row(&reader, pixels_ + (size_t)bmp_next_row(reader) * width);
+        else
+            loaded = average_rows(reader, pixels_, width, height, 0u);
+    }
+
+    bmp_close(&reader);
+    return loaded;
+}
@@ -0,0 +1,408 @@
+#include "Image.h"
+#include "Parallel.h"
+#include "SIMD.h"
+
+#include <cstring>
+
+#define TRANSFORM_TILE_ 64u			// Side of the tiles transposed at once, 16 KB per tile
+#define TRANSFORM_TILES_PER_BAND_ 4u	// Minimum rows of tiles processed by each thread
+#define TRANSFORM_ROWS_PER_BAND_ 64u	// Minimum rows flipped by each thread
+
+/*
+-------------------------------------------------------------------------------------------------------
+Internal kernels
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Transposes a block of rows x cols pixels, dst[c * dst_stride + r] = src[r * src_stride + c].
+// Strides are in pixels and can be negative to flip the source or destination rows.
+
+static void transpose_block(const Color* src, long long src_stride, Color* dst, long long dst_stride, unsigned rows, unsigned cols)
+{
+    unsigned r = 0u;
+#ifdef IMAGE_SSE2_
+    for (; r + 4u <= rows; r += 4u)
+    {
+        const Color* s = src + r * src_stride;
+        unsigned c = 0u;
+        for (; c + 4u <= cols; c += 4u)
+        {
+            const __m128i r0 = _mm_loadu_si128((const __m128i*)(s + c));
+            const __m128i r1 = _mm_loadu_si128((const __m128i*)(s + src_stride + c));
+            const __m128i r2 = _mm_loadu_si128((const __m128i*)(s + 2 * src_stride + c));
+            const __m128i r3 = _mm_loadu_si128((const __m128i*)(s + 3 * src_stride + c));
+
+            // 4x4 transpose of 32-bit pixels
+            const __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+            const __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+            const __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+            const __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+            Color* d = dst + c * dst_stride + r;
+            _mm_storeu_si128((__m128i*)d, _mm_unpacklo_epi64(t0, t1));
+            _mm_storeu_si128((__m128i*)(d + dst_stride), _mm_unpackhi_epi64(t0, t1));
+            _mm_storeu_si128((__m128i*)(d + 2 * dst_stride), _mm_unpacklo_epi64(t2, t3));
+            _mm_storeu_si128((__m128i*)(d + 3 * dst_stride), _mm_unpackhi_epi64(t2, t3));
+        }
+        for (; c < cols; c++)
+            for (unsigned k = 0u; k < 4u; k++)
+                dst[c * dst_stride + r + k] = s[k * src_stride + c];
+    }
+#endif
+    for (; r < rows; r++)
+        for (unsigned c = 0u; c < cols; c++)
+            dst[c * dst_stride + r] = src[r * src_stride + c];
+}
+
+// Transposes the whole height x width source tile by tile, threads take bands of tile rows
+
+static void transpose_tiled(const Color* src, long long src_stride, Color* dst, long long dst_stride, unsigned height, unsigned width)
+{
+    const unsigned tile_rows = (height + TRANSFORM_TILE_ - 1u) / TRANSFORM_TILE_;
+
+    parallel_for(tile_rows, TRANSFORM_TILES_PER_BAND_, [&](unsigned begin, unsigned end)
+        {
+            for (unsigned t = begin; t < end; t++)
+            {
+                const unsigned r = t * TRANSFORM_TILE_;
+                const unsigned rows = height - r < TRANSFORM_TILE_ ? height - r : TRANSFORM_TILE_;
+
+                for (unsigned c = 0u; c < width; c += TRANSFORM_TILE_)
+                {
+                    const unsigned cols = width - c < TRANSFORM_TILE_ ? width - c : TRANSFORM_TILE_;
+                    transpose_block(src + r * src_stride + c, src_stride, dst + c * dst_stride + r, dst_stride, rows, cols);
+                }
+            }
+        });
+}
+
+// Transposes the square image in place, every tile above the diagonal is swapped
+// with its mirror through a local buffer, diagonal tiles are transposed on their own
+
+static void transpose_square(Color* pixels, unsigned size)
+{
+    const unsigned tiles = (size + TRANSFORM_TILE_ - 1u) / TRANSFORM_TILE_;
+
+    parallel_for(tiles, 1u, [&](unsigned begin, unsigned end)
+        {
+            Color buffer[TRANSFORM_TILE_ * TRANSFORM_TILE_];
+
+            for (unsigned ti = begin; ti < end; ti++)
+            {
+                const unsigned r = ti * TRANSFORM_TILE_;
+                const unsigned rows = size - r < TRANSFORM_TILE_ ? size - r : TRANSFORM_TILE_;
+
+                for (unsigned tj = ti; tj < tiles; tj++)
+                {
+                    const unsigned c = tj * TRANSFORM_TILE_;
+                    const unsigned cols = size - c < TRANSFORM_TILE_ ? size - c : TRANSFORM_TILE_;
+
+                    Color* a = pixels + (unsigned long long)r * size + c;
+                    Color* b = pixels + (unsigned long long)c * size + r;
+
+                    // Transposed A goes to the buffer, transposed B goes to A
+                    transpose_block(a, size, buffer, TRANSFORM_TILE_, rows, cols);
+                    if (tj != ti)
+                        transpose_block(b, size, a, size, cols, rows);
+
+                    for (unsigned k = 0u; k < cols; k++)
+                        memcpy((void*)(b + (unsigned long long)k * size), (const void*)(buffer + k * TRANSFORM_TILE_), rows * sizeof(Color));
+                }
+            }
+        });
+}
+
+// Reverses the order of 4 pixels
+
+#ifdef IMAGE_SSE2_
+static inline __m128i reverse_4(__m128i v)
+{
+    return _mm_shuffle_epi32(v, 0x1B);
+}
+#endif
+
+// Copies the span reversed, dst[count - 1 - i] = src[i]
+
+static void reverse_copy(const Color* src, Color* dst, unsigned count)
+{
+    unsigned i = 0u;
+#ifdef IMAGE_SSE2_
+    for (; i + 4u <= count; i += 4u)
+        _mm_storeu_si128((__m128i*)(dst + count - i - 4u), reverse_4(_mm_loadu_si128((const __m128i*)(src + i))));
+#endif
+    for (; i < count; i++)
+        dst[count - 1u - i] = src[i];
+}
+
+// Exchanges two disjoint spans reversing them, a[i] <-> b[count - 1 - i]
+
+static void reverse_swap(Color* a, Color* b, unsigned count)
+{
+    unsigned i = 0u;
+#ifdef IMAGE_SSE2_
+    for (; i + 4u <= count; i += 4u)
+    {
+        const __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        const __m128i vb = _mm_loadu_si128((const __m128i*)(b + count - i - 4u));
+        _mm_storeu_si128((__m128i*)(a + i), reverse_4(vb));
+        _mm_storeu_si128((__m128i*)(b + count - i - 4u), reverse_4(va));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        const Color c = a[i];
+        a[i] = b[count - 1u - i];
+        b[count - 1u - i] = c;
+    }
+}
+
+// Reverses the span in place by exchanging its two halves
+
+static void reverse_in_place(Color* pixels, unsigned count)
+{
+    const unsigned half = count / 2u;
+    reverse_swap(pixels, pixels + count - half, half);
+}
+
+// Exchanges two disjoint spans
+
+static void swap_span(Color* a, Color* b, unsigned count)
+{
+    unsigned i = 0u;
+#ifdef IMAGE_SSE2_
+    for (; i + 4u <= count; i += 4u)
+    {
+        const __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        const __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        _mm_storeu_si128((__m128i*)(a + i), vb);
+        _mm_storeu_si128((__m128i*)(b + i), va);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        const Color c = a[i];
+        a[i] = b[i];
+        b[i] = c;
+    }
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Transform functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Swaps rows and columns in place. Square images are transposed tile by tile,
+// the rest use a new buffer from the allocator.
+
+void Image::transpose()
+{
+    if (width_ == height_)
+    {
+        detach();
+        mark_all_dirty();
+        transpose_square(pixels_, width_);
+        return;
+    }
+
+    Image result;
+    result.allocator_ = allocator();
+    transpose(result);
+
+    const bool cow = copy_on_write_;
+    *this = static_cast<Image&&>(result);
+    set_copy_on_write(cow);
+}
+
+// Stores the image with rows and columns swapped in dst
+
+void Image::transpose(Image& dst) const
+{
+    if (&dst == this)
+    {
+        dst.transpose();
+        return;
+    }
+
+    if (!dst.allocate_pixels(height_, width_, false))
+        throw "Could not allocate image pixels";
+
+    transpose_tiled(pixels_, width_, dst.pixels_, height_, height_, width_);
+}
+
+// Rotates the image in place, 90 and 270 degree turns of non-square 
+// images use a new buffer from the allocator
+
+void Image::rotate(ImageRotation rotation)
+{
+    if (rotation == IMAGE_ROTATION_0)
+        return;
+
+    // Quarter turns of square images are a transpose and a flip
+    if (rotation != IMAGE_ROTATION_180 && width_ == height_)
+    {
+        transpose();
+        if (rotation == IMAGE_ROTATION_90)
+            flip_horizontal();
+        else
+            flip_vertical();
+        return;
+    }
+
+    if (rotation == IMAGE_ROTATION_180)
+    {
+        detach();
+        mark_all_dirty();
+
+        // Row r is exchanged reversed with row height - 1 - r
+        Color* pixels = pixels_;
+        const unsigned width = width_, height = height_;
+        parallel_for(height / 2u, TRANSFORM_ROWS_PER_BAND_, [&](unsigned begin, unsigned end)
+            {
+                for (unsigned r = begin; r < end; r++)
+                    reverse_swap(pixels + (unsigned long long)r * width, pixels + (unsigned long long)(height - 1u - r) * width, width);
+            });
+
+        if (height % 2u)
+            reverse_in_place(pixels + (unsigned long long)(height / 2u) * width, width);
+        return;
+    }
+
+    Image result;
+    result.allocator_ = allocator();
+    rotate(rotation, result);
+
+    const bool cow = copy_on_write_;
+    *this = static_cast<Image&&>(result);
+    set_copy_on_write(cow);
+}
+
+// Stores the rotated image in dst
+
+void Image::rotate(ImageRotation rotation, Image& dst) const
+{
+    if (&dst == this)
+    {
+        dst.rotate(rotation);
+        return;
+    }
+
+    switch (rotation)
+    {
+    case IMAGE_ROTATION_0:
+        dst = *this;
+        return;
+
+    case IMAGE_ROTATION_90:
+        // Transpose of the source read from the bottom row up
+        if (!dst.allocate_pixels(height_, width_, false))
+            throw "Could not allocate image pixels";
+
+        if (pixels_)
+            transpose_tiled(pixels_ + (unsigned long long)(height_ - 1u) * width_, -(long long)width_, dst.pixels_, height_, height_, width_);
+        return;
+
+    case IMAGE_ROTATION_270:
+        // Transpose of the source written from the bottom row up
+        if (!dst.allocate_pixels(height_, width_, false))
+            throw "Could not allocate image pixels";
+
+        if (pixels_)
+            transpose_tiled(pixels_, width_, dst.pixels_ + (unsigned long long)(width_ - 1u) * height_, -(long long)height_, height_, width_);
+        return;
+
+    case IMAGE_ROTATION_180:
+    {
+        if (!dst.allocate_pixels(width_, height_, false))
+            throw "Could not allocate image pixels";
+
+        const Color* src = pixels_;
+        Color* out = dst.pixels_;
+        const unsigned width = width_, height = height_;
+        parallel_for(height, TRANSFORM_ROWS_PER_BAND_, [&](unsigned begin, unsigned end)
+            {
+                for (unsigned r = begin; r < end; r++)
+                    reverse_copy(src + (unsigned long long)(height - 1u - r) * width, out + (unsigned long long)r * width, width);
+            });
+        return;
+    }
+    }
+}
+
+// Reverses the order of the rows in place
+
+void Image::flip_vertical()
+{
+    detach();
+    mark_all_dirty();
+
+    Color* pixels = pixels_;
+    const unsigned width = width_, height = height_;
+    parallel_for(height / 2u, TRANSFORM_ROWS_PER_BAND_, [&](unsigned begin, unsigned end)
+        {
+            for (unsigned r = begin; r < end; r++)
+                swap_span(pixels + (unsigned long long)r * width, pixels + (unsigned long long)(height - 1u - r) * width, width);
+        });
+}
+
+// Stores the image with the order of the rows reversed in dst
+
+void Image::flip_vertical(Image& dst) const
+{
+    if (&dst == this)
+    {
+        dst.flip_vertical();
+        return;
+    }
+
+    if (!dst.allocate_pixels(width_, height_, false))
+        throw "Could not allocate image pixels";
+
+    const Color* src = pixels_;
+    Color* out = dst.pixels_;
+    const unsigned width = width_, height = height_;
+    parallel_for(height, TRANSFORM_ROWS_PER_BAND_, [&](unsigned begin, unsigned end)
+        {
+            for (unsigned r = begin; r < end; r++)
+                memcpy((void*)(out + (unsigned long long)r * width), (const void*)(src + (unsigned long long)(height - 1u - r) * width), width * sizeof(Color));
+        });
+}
+
+// Reverses the order of the columns in place
+
+void Image::flip_horizontal()
+{
+    detach();
+    mark_all_dirty();
+
+    Color* pixels = pixels_;
+    const unsigned width = width_;
+    parallel_for(height_, TRANSFORM_ROWS_PER_BAND_, [&](unsigned begin, unsigned end)
+        {
+            for (unsigned r = begin; r < end; r++)
+                reverse_in_place(pixels + (unsigned long long)r * width, width);
+        });
+}
+
+// Stores the image with the order of the columns reversed in dst
+
+void Image::flip_horizontal(Image& dst) const
+{
+    if (&dst == this)
+    {
+        dst.flip_horizontal();
+        return;
+    }
+
+    if (!dst.allocate_pixels(width_, height_, false))
+        throw "Could not allocate image pixels";
+
+    const Color* src = pixels_;
+    Color* out = dst.pixels_;
+    const unsigned width = width_;
+    parallel_for(height_, TRANSFORM_ROWS_PER_BAND_, [&](unsigned begin, unsigned end)
+        {
+            for (unsigned r = begin; r < end; r++)
+                reverse_copy(src + (unsigned long long)r * width, out + (unsigned long long)r * width, width);
+        });
+}
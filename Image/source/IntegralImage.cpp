@@ -0,0 +1,274 @@
+#include "IntegralImage.h"
+#include "Parallel.h"
+#include "SIMD.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#define INTEGRAL_ROWS_PER_BAND_ 16u		// Minimum rows scanned by each thread
+#define INTEGRAL_COLUMN_BLOCK_ 1024u	// Sums per column block, 4 KB per row
+#define INTEGRAL_BLOCKS_PER_BAND_ 1u	// Minimum column blocks accumulated by each thread
+
+/*
+-------------------------------------------------------------------------------------------------------
+Internal helpers
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Writes the running sums of the row after the zero entry
+
+static void scan_row(const Color* pixels, unsigned int* out, unsigned width)
+{
+    unsigned col = 0u;
+#ifdef IMAGE_SSE2_
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for (; col + 4u <= width; col += 4u)
+    {
+        // Widen 4 pixels to 4 sums each and accumulate them in order
+        const __m128i v = _mm_loadu_si128((const __m128i*)(pixels + col));
+        const __m128i lo = _mm_unpacklo_epi8(v, zero);
+        const __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i*)(out + 4u * col), acc);
+        acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i*)(out + 4u * col + 4u), acc);
+        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i*)(out + 4u * col + 8u), acc);
+        acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(hi, zero));
+        _mm_storeu_si128((__m128i*)(out + 4u * col + 12u), acc);
+    }
+    unsigned int b = (unsigned)_mm_cvtsi128_si32(acc);
+    unsigned int g = (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(acc, 4));
+    unsigned int r = (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+    unsigned int a = (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(acc, 12));
+#else
+    unsigned int b = 0u, g = 0u, r = 0u, a = 0u;
+#endif
+    for (; col < width; col++)
+    {
+        out[4u * col + 0u] = b += pixels[col].B;
+        out[4u * col + 1u] = g += pixels[col].G;
+        out[4u * col + 2u] = r += pixels[col].R;
+        out[4u * col + 3u] = a += pixels[col].A;
+    }
+}
+
+// Adds the previous row to the row over [begin, end)
+
+static void add_row(const unsigned int* above, unsigned int* row, unsigned begin, unsigned end)
+{
+    unsigned i = begin;
+#ifdef IMAGE_SSE2_
+    for (; i + 4u <= end; i += 4u)
+    {
+        const __m128i s = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(row + i)), _mm_loadu_si128((const __m128i*)(above + i)));
+        _mm_storeu_si128((__m128i*)(row + i), s);
+    }
+#endif
+    for (; i < end; i++)
+        row[i] += above[i];
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Constructors / Destructors
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Builds the table of the image
+
+IntegralImage::IntegralImage(const Image& image)
+{
+    if (!build(image))
+        throw "Could not allocate integral image";
+}
+
+// Copies the other table
+
+IntegralImage::IntegralImage(const IntegralImage& other)
+{
+    *this = other;
+}
+
+// Copies the other table
+
+IntegralImage& IntegralImage::operator=(const IntegralImage& other)
+{
+    if (&other == this)
+        return *this;
+
+    free(sums_);
+    sums_ = nullptr;
+    width_ = height_ = 0u;
+
+    if (!other.sums_)
+        return *this;
+
+    const size_t bytes = (size_t)(other.width_ + 1u) * (other.height_ + 1u) * 4u * sizeof(unsigned int);
+    sums_ = (unsigned int*)malloc(bytes);
+    if (!sums_)
+        throw "Could not allocate integral image";
+
+    memcpy(sums_, other.sums_, bytes);
+    width_ = other.width_;
+    height_ = other.height_;
+    return *this;
+}
+
+// Takes the other table and leaves it empty
+
+IntegralImage::IntegralImage(IntegralImage&& other) noexcept
+    :sums_{ other.sums_ }, width_{ other.width_ }, height_{ other.height_ }
+{
+    other.sums_ = nullptr;
+    other.width_ = other.height_ = 0u;
+}
+
+// Takes the other table and leaves it empty
+
+IntegralImage& IntegralImage::operator=(IntegralImage&& other) noexcept
+{
+    if (&other == this)
+        return *this;
+
+    free(sums_);
+    sums_ = other.sums_;
+    width_ = other.width_;
+    height_ = other.height_;
+
+    other.sums_ = nullptr;
+    other.width_ = other.height_ = 0u;
+    return *this;
+}
+
+// Frees the table
+
+IntegralImage::~IntegralImage()
+{
+    free(sums_);
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Builds the table in two passes. First every row is scanned independently in
+// parallel, then the rows are accumulated downwards, splitting the columns in
+// blocks so each thread walks its own narrow strip and keeps it in cache.
+
+bool IntegralImage::build(const Image& image)
+{
+    const unsigned width = image.width();
+    const unsigned height = image.height();
+    const unsigned stride = 4u * (width + 1u);
+
+    if (!sums_ || width != width_ || height != height_)
+    {
+        free(sums_);
+        width_ = height_ = 0u;
+
+        sums_ = (unsigned int*)malloc((size_t)stride * (height + 1u) * sizeof(unsigned int));
+        if (!sums_)
+            return false;
+
+        width_ = width;
+        height_ = height;
+    }
+
+    // Zero first row
+    memset(sums_, 0, stride * sizeof(unsigned int));
+
+    const Color* pixels = image.pixels();
+    unsigned int* sums = sums_;
+
+    // Row scans, zero first column
+    parallel_for(height, INTEGRAL_ROWS_PER_BAND_, [&](unsigned begin, unsigned end)
+        {
+            for (unsigned row = begin; row < end; row++)
+            {
+                unsigned int* out = sums + (size_t)(row + 1u) * stride;
+                out[0] = out[1] = out[2] = out[3] = 0u;
+                scan_row(pixels + (size_t)row * width, out + 4u, width);
+            }
+        });
+
+    // Column accumulation by blocks
+    const unsigned blocks = (stride + INTEGRAL_COLUMN_BLOCK_ - 1u) / INTEGRAL_COLUMN_BLOCK_;
+    parallel_for(blocks, INTEGRAL_BLOCKS_PER_BAND_, [&](unsigned begin, unsigned end)
+        {
+            const unsigned first = begin * INTEGRAL_COLUMN_BLOCK_;
+            const unsigned last = end * INTEGRAL_COLUMN_BLOCK_ < stride ? end * INTEGRAL_COLUMN_BLOCK_ : stride;
+
+            for (unsigned row = 2u; row <= height; row++)
+                add_row(sums + (size_t)(row - 1u) * stride, sums + (size_t)row * stride, first, last);
+        });
+
+    return true;
+}
+
+// Returns the 4 sums of the entry, row and col go up to height and width
+
+const unsigned int* IntegralImage::entry(unsigned int row, unsigned int col) const
+{
+    return sums_ + ((size_t)row * (width_ + 1u) + col) * 4u;
+}
+
+// Returns the sums of the rectangle starting at the specified pixel coordinates
+// with the specified size, which must be inside the image
+
+ColorSum IntegralImage::sum(unsigned int row, unsigned int col, unsigned int height, unsigned int width) const
+{
+    const unsigned int* a = entry(row, col);
+    const unsigned int* b = entry(row, col + width);
+    const unsigned int* c = entry(row + height, col);
+    const unsigned int* d = entry(row + height, col + width);
+
+    // Wrapping arithmetic, exact while the true sum fits in 32 bits
+    ColorSum s;
+    s.B = d[0] - b[0] - c[0] + a[0];
+    s.G = d[1] - b[1] - c[1] + a[1];
+    s.R = d[2] - b[2] - c[2] + a[2];
+    s.A = d[3] - b[3] - c[3] + a[3];
+    return s;
+}
+
+// Returns the mean color of the rectangle, rounded, which must be inside the image and not empty
+
+Color IntegralImage::mean(unsigned int row, unsigned int col, unsigned int height, unsigned int width) const
+{
+    const ColorSum s = sum(row, col, height, width);
+    const unsigned long long n = (unsigned long long)height * width;
+
+    return Color(
+        (unsigned char)((s.R + n / 2ull) / n),
+        (unsigned char)((s.G + n / 2ull) / n),
+        (unsigned char)((s.B + n / 2ull) / n),
+        (unsigned char)((s.A + n / 2ull) / n)
+    );
+}
+
+// Returns the width of the source image
+
+unsigned IntegralImage::width() const
+{
+    return width_;
+}
+
+// Returns the height of the source image
+
+unsigned IntegralImage::height() const
+{
+    return height_;
+}
+
+// Returns the table entries, (height + 1) rows of (width + 1) entries with the
+// B, G, R and A sums each, the first row and column are zero
+
+const unsigned int* IntegralImage::data() const
+{
+    return sums_;
+}
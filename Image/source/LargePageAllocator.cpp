@@ -0,0 +1,263 @@
+#include "PixelAllocator.h"
+#include "Parallel.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include <cstdlib>
+
+#define PAGE_BYTES_ 4096ull					// Size of the regular pages touched on allocation
+#define TOUCH_MIN_PAGES_ 256u				// Minimum pages touched by each thread
+#define MAX_NUMA_NODES_ 1024u				// Maximum NUMA nodes in the interleave mask
+
+#define MPOL_INTERLEAVE_ 3					// Interleave policy of mbind, from numaif.h
+#define MPOL_F_MEMS_ALLOWED_ (1 << 2)		// Flag of get_mempolicy to query the allowed nodes, from numaif.h
+
+/*
+-------------------------------------------------------------------------------------------------------
+System helpers
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Writes a zero into every page of the buffer from parallel threads, split in the same
+// equal bands as the parallel kernels, so every page lands on the node of its thread.
+
+static void touch_pages(void* buffer, unsigned long long bytes)
+{
+    volatile char* first = (volatile char*)buffer;
+    const unsigned pages = (unsigned)((bytes + PAGE_BYTES_ - 1ull) / PAGE_BYTES_);
+
+    parallel_for(pages, TOUCH_MIN_PAGES_, [&](unsigned begin, unsigned end)
+        {
+            for (unsigned i = begin; i < end; i++)
+                first[i * PAGE_BYTES_] = 0;
+        });
+}
+
+#ifdef _WIN32
+// Commits the reserved range in chunks of huge page size alternating between
+// the NUMA nodes. Returns false if there is a single node or it fails.
+
+static bool commit_interleaved(void* buffer, unsigned long long bytes)
+{
+    ULONG highest = 0ul;
+    if (!GetNumaHighestNodeNumber(&highest) || !highest)
+        return false;
+
+    for (unsigned long long offset = 0ull, node = 0ull; offset < bytes; offset += HUGE_PAGE_BYTES_, node++)
+    {
+        const unsigned long long chunk = bytes - offset < HUGE_PAGE_BYTES_ ? bytes - offset : HUGE_PAGE_BYTES_;
+        if (!VirtualAllocExNuma(GetCurrentProcess(), (char*)buffer + offset, (SIZE_T)chunk, MEM_COMMIT, PAGE_READWRITE, (DWORD)(node % (highest + 1ul))))
+            return false;
+    }
+    return true;
+}
+#else
+// Maps bytes aligned to huge pages, mapping one more and unmapping the edges
+
+static void* map_aligned(unsigned long long bytes)
+{
+    const unsigned long long span = bytes + HUGE_PAGE_BYTES_;
+    void* region = mmap(nullptr, (size_t)span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+        return nullptr;
+
+    const unsigned long long start = (unsigned long long)region;
+    const unsigned long long aligned = (start + HUGE_PAGE_BYTES_ - 1ull) & ~(HUGE_PAGE_BYTES_ - 1ull);
+
+    if (aligned > start)
+        munmap(region, (size_t)(aligned - start));
+    if (start + span > aligned + bytes)
+        munmap((void*)(aligned + bytes), (size_t)(start + span - aligned - bytes));
+
+    return (void*)aligned;
+}
+
+// Spreads the pages of the range over every node the process may use.
+// Does nothing outside Linux or with a single node.
+
+static void interleave_pages(void* buffer, unsigned long long bytes)
+{
+#ifdef __linux__
+    unsigned long mask[MAX_NUMA_NODES_ / (8u * sizeof(unsigned long))] = {};
+    const unsigned long max_node = MAX_NUMA_NODES_;
+
+    if (syscall(SYS_get_mempolicy, nullptr, mask, max_node, nullptr, MPOL_F_MEMS_ALLOWED_))
+        return;
+
+    unsigned nodes = 0u;
+    for (unsigned long word : mask)
+        nodes += (unsigned)__builtin_popcountl(word);
+
+    if (nodes > 1u)
+        syscall(SYS_mbind, buffer, (unsigned long)bytes, MPOL_INTERLEAVE_, mask, max_node, 0u);
+#else
+    (void)buffer;
+    (void)bytes;
+#endif
+}
+#endif
+
+/*
+-------------------------------------------------------------------------------------------------------
+LargePageAllocator functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Creates an allocator with the specified huge page use and NUMA placement
+// for the buffers of at least min_bytes.
+
+LargePageAllocator::LargePageAllocator(HugePages huge_pages, NUMAPlacement placement, unsigned long long min_bytes)
+    :huge_pages_{ huge_pages }, placement_{ placement }, min_bytes_{ min_bytes ? min_bytes : 1ull }
+{
+}
+
+// Returns the bytes mapped for a buffer, rounded up to the page size used
+
+unsigned long long LargePageAllocator::mapping_bytes(unsigned long long bytes) const
+{
+    const unsigned long long page = huge_pages_ == HUGE_PAGES_NONE ? PAGE_BYTES_ : HUGE_PAGE_BYTES_;
+    return (bytes + page - 1ull) & ~(page - 1ull);
+}
+
+// Maps a new buffer, or uses malloc if it is smaller than min_bytes.
+
+void* LargePageAllocator::allocate(unsigned long long bytes, bool zero)
+{
+    if (bytes < min_bytes_)
+        return zero ? calloc((size_t)bytes, 1) : malloc((size_t)bytes);
+
+    const unsigned long long size = mapping_bytes(bytes);
+    void* buffer = nullptr;
+
+#ifdef _WIN32
+    if (huge_pages_ == HUGE_PAGES_EXPLICIT)
+    {
+        // Large pages need the lock pages privilege, and are never interleaved
+        const SIZE_T large = GetLargePageMinimum();
+        if (large)
+            buffer = VirtualAlloc(nullptr, (SIZE_T)((size + large - 1ull) / large * large), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+
+        atomic_add(buffer ? &huge_allocations_ : &fallbacks_, 1);
+    }
+
+    if (!buffer && placement_ == NUMA_PLACEMENT_INTERLEAVE)
+    {
+        buffer = VirtualAlloc(nullptr, (SIZE_T)size, MEM_RESERVE, PAGE_READWRITE);
+        if (buffer && !commit_interleaved(buffer, size) && !VirtualAlloc(buffer, (SIZE_T)size, MEM_COMMIT, PAGE_READWRITE))
+        {
+            VirtualFree(buffer, 0, MEM_RELEASE);
+            buffer = nullptr;
+        }
+    }
+    else if (!buffer)
+        buffer = VirtualAlloc(nullptr, (SIZE_T)size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+    if (!buffer)
+        return nullptr;
+#else
+#ifdef MAP_HUGETLB
+    if (huge_pages_ == HUGE_PAGES_EXPLICIT)
+    {
+        buffer = mmap(nullptr, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (buffer == MAP_FAILED)
+            buffer = nullptr;
+
+        atomic_add(buffer ? &huge_allocations_ : &fallbacks_, 1);
+    }
+#endif
+
+    if (!buffer)
+    {
+        if (huge_pages_ == HUGE_PAGES_NONE)
+        {
+            buffer = mmap(nullptr, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (buffer == MAP_FAILED)
+                return nullptr;
+        }
+        else
+        {
+            buffer = map_aligned(size);
+            if (!buffer)
+                return nullptr;
+#ifdef MADV_HUGEPAGE
+            madvise(buffer, (size_t)size, MADV_HUGEPAGE);
+#endif
+        }
+    }
+
+    // The policy applies to the pages not touched yet, so before any write
+    if (placement_ == NUMA_PLACEMENT_INTERLEAVE)
+        interleave_pages(buffer, size);
+#endif
+
+    if (placement_ == NUMA_PLACEMENT_FIRST_TOUCH)
+        touch_pages(buffer, size);
+
+    atomic_add(&mapped_, (long long)size);
+    return buffer;
+}
+
+// Unmaps the buffer, or frees it if it is smaller than min_bytes.
+
+void LargePageAllocator::release(void* buffer, unsigned long long bytes)
+{
+    if (!buffer)
+        return;
+
+    if (bytes < min_bytes_)
+    {
+        free(buffer);
+        return;
+    }
+
+    const unsigned long long size = mapping_bytes(bytes);
+#ifdef _WIN32
+    VirtualFree(buffer, 0, MEM_RELEASE);
+#else
+    munmap(buffer, (size_t)size);
+#endif
+    atomic_add(&mapped_, -(long long)size);
+}
+
+// Returns the huge page use
+
+HugePages LargePageAllocator::huge_pages() const
+{
+    return huge_pages_;
+}
+
+// Returns the NUMA placement
+
+NUMAPlacement LargePageAllocator::placement() const
+{
+    return placement_;
+}
+
+// Returns the bytes currently mapped, rounded up to pages
+
+unsigned long long LargePageAllocator::mapped() const
+{
+    return (unsigned long long)atomic_load(&mapped_);
+}
+
+// Returns the number of buffers mapped with explicit huge pages
+
+unsigned long long LargePageAllocator::huge_allocations() const
+{
+    return (unsigned long long)atomic_load(&huge_allocations_);
+}
+
+// Returns the number of explicit huge page requests that fell back to transparent ones
+
+unsigned long long LargePageAllocator::fallbacks() const
+{
+    return (unsigned long long)atomic_load(&fallbacks_);
+}
@@ -0,0 +1,927 @@
+#include "Palette.h"
+#include "Parallel.h"
+#include "BMP.h"
+#include "SIMD.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define PALETTE_CELL_BITS_ 5u						// Bits per channel of the lookup cells and the histogram
+#define PALETTE_CELLS_ (1u << 3u * PALETTE_CELL_BITS_)	// Number of lookup cells and histogram bins
+#define PALETTE_COARSE_BITS_ 3u					// Bits per channel of the coarse lookup cells
+#define PALETTE_COARSE_PER_BAND_ 16u				// Minimum coarse cells built by each thread
+#define PALETTE_CANDIDATE_GROUP_ 4u					// Candidates of a cell are padded to a multiple of this
+#define PALETTE_BINS_PER_BAND_ 512u					// Minimum histogram bins merged by each thread
+#define PALETTE_PIXELS_PER_BAND_ 65536u				// Minimum pixels counted or mapped by each thread
+#define PALETTE_ROWS_PER_BAND_ 16u					// Minimum rows mapped by each thread
+
+/*
+-------------------------------------------------------------------------------------------------------
+Internal helpers
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Returns the lookup cell or histogram bin of the color
+
+static inline unsigned color_cell(unsigned r, unsigned g, unsigned b)
+{
+    const unsigned shift = 8u - PALETTE_CELL_BITS_;
+    return (r >> shift) << 2u * PALETTE_CELL_BITS_ | (g >> shift) << PALETTE_CELL_BITS_ | (b >> shift);
+}
+
+// Returns the squared distance between two colors
+
+static inline unsigned color_distance(int r0, int g0, int b0, int r1, int g1, int b1)
+{
+    const int dr = r0 - r1, dg = g0 - g1, db = b0 - b1;
+    return (unsigned)(dr * dr + dg * dg + db * db);
+}
+
+// Clamps a channel value to [0, 255]
+
+static inline int clamp_channel(int v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// 8x8 Bayer threshold matrix, values 0 to 63
+
+static const unsigned char bayer8[8][8] =
+{
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+// Histogram bin of the median cut
+
+struct HistogramBin
+{
+    unsigned long long count;
+    unsigned long long r, g, b;
+};
+
+// Box of histogram bins being split by the median cut, [begin, end) of the bin list
+
+struct CutBox
+{
+    unsigned begin, end;
+    unsigned char min[3], max[3];
+    unsigned long long count;
+};
+
+// Computes the channel bounds and pixel count of the box
+
+static void fit_box(CutBox& box, const unsigned short* bins, const HistogramBin* histogram)
+{
+    box.min[0] = box.min[1] = box.min[2] = 255u;
+    box.max[0] = box.max[1] = box.max[2] = 0u;
+    box.count = 0ull;
+
+    for (unsigned i = box.begin; i < box.end; i++)
+    {
+        const unsigned bin = bins[i];
+        const unsigned char c[3] = {
+            (unsigned char)(bin >> 2u * PALETTE_CELL_BITS_),
+            (unsigned char)((bin >> PALETTE_CELL_BITS_) & ((1u << PALETTE_CELL_BITS_) - 1u)),
+            (unsigned char)(bin & ((1u << PALETTE_CELL_BITS_) - 1u)),
+        };
+        for (unsigned k = 0; k < 3u; k++)
+        {
+            if (c[k] < box.min[k]) box.min[k] = c[k];
+            if (c[k] > box.max[k]) box.max[k] = c[k];
+        }
+        box.count += histogram[bin].count;
+    }
+}
+
+// Finds up to max_colors distinct colors of the image, in order of appearance.
+// Returns the number found, or max_colors + 1 if there are more.
+
+static unsigned distinct_colors(const Image& image, unsigned max_colors, Color* colors)
+{
+    // Open addressing set of 24-bit colors, at least 4 times larger than needed
+    unsigned keys[4u * MAX_PALETTE_COLORS_];
+    const unsigned mask = 4u * MAX_PALETTE_COLORS_ - 1u;
+    memset(keys, 0xFF, sizeof(keys));
+
+    const Color* pixels = image.pixels();
+    const unsigned long long count = (unsigned long long)image.width() * image.height();
+
+    unsigned found = 0u, previous = ~0u;
+    for (unsigned long long i = 0ull; i < count; i++)
+    {
+        const unsigned key = (unsigned)pixels[i].R << 16 | (unsigned)pixels[i].G << 8 | pixels[i].B;
+        if (key == previous)
+            continue;
+        previous = key;
+
+        unsigned slot = (key * 2654435761u) >> 22 & mask;
+        while (keys[slot] != key && keys[slot] != ~0u)
+            slot = (slot + 1u) & mask;
+
+        if (keys[slot] == key)
+            continue;
+
+        if (found == max_colors)
+            return max_colors + 1u;
+
+        keys[slot] = key;
+        colors[found++] = Color(pixels[i].R, pixels[i].G, pixels[i].B);
+    }
+    return found;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Constructors / Destructors
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Creates a palette with the specified colors
+
+Palette::Palette(const Color* colors, unsigned int count)
+{
+    if (!set_colors(colors, count))
+        throw "Could not create palette";
+}
+
+// Creates a palette of at most max_colors entries for the image
+
+Palette::Palette(const Image& image, unsigned int max_colors)
+{
+    if (!build(image, max_colors))
+        throw "Could not create palette";
+}
+
+// Copies the other palette
+
+Palette::Palette(const Palette& other)
+{
+    *this = other;
+}
+
+// Copies the other palette, the lookup is built again
+
+Palette& Palette::operator=(const Palette& other)
+{
+    if (&other == this)
+        return *this;
+
+    if (!other.size_)
+    {
+        free_lookup();
+        size_ = 0u;
+        return *this;
+    }
+
+    if (!set_colors(other.colors_, other.size_))
+        throw "Could not create palette";
+
+    return *this;
+}
+
+// Takes the other palette and leaves it empty
+
+Palette::Palette(Palette&& other) noexcept
+    :size_{ other.size_ }, cell_offsets_{ other.cell_offsets_ }, candidates_{ other.candidates_ }
+{
+    memcpy(colors_, other.colors_, sizeof(colors_));
+
+    other.size_ = 0u;
+    other.cell_offsets_ = nullptr;
+    other.candidates_ = nullptr;
+}
+
+// Takes the other palette and leaves it empty
+
+Palette& Palette::operator=(Palette&& other) noexcept
+{
+    if (&other == this)
+        return *this;
+
+    free_lookup();
+    memcpy(colors_, other.colors_, sizeof(colors_));
+    size_ = other.size_;
+    cell_offsets_ = other.cell_offsets_;
+    candidates_ = other.candidates_;
+
+    other.size_ = 0u;
+    other.cell_offsets_ = nullptr;
+    other.candidates_ = nullptr;
+    return *this;
+}
+
+// Frees the lookup
+
+Palette::~Palette()
+{
+    free_lookup();
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Nearest entry lookup
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Frees the lookup
+
+void Palette::free_lookup()
+{
+    free(cell_offsets_);
+    free(candidates_);
+    cell_offsets_ = nullptr;
+    candidates_ = nullptr;
+}
+
+// Distances from a channel value to the nearest and farthest points of [lo, lo + size)
+
+static inline void span_distances(int value, int lo, int size, unsigned* near, unsigned* far)
+{
+    const int hi = lo + size - 1;
+    const int n = value < lo ? lo - value : value > hi ? value - hi : 0;
+    const int f = value - lo > hi - value ? value - lo : hi - value;
+    *near = (unsigned)(n * n);
+    *far = (unsigned)(f * f);
+}
+
+// Builds the nearest-entry lookup. For every cell it finds the smallest distance
+// within which some entry covers the whole cell, then keeps as candidates the
+// entries closer than that to any point of the cell. The nearest entry of every
+// color inside the cell is always one of them.
+// It is done first for 8x8x8 coarse cells over every entry, then for the lookup 
+// cells inside each coarse cell only over the coarse candidates, which contain 
+// all the fine ones. Channel distances come from tables per cell coordinate.
+
+bool Palette::build_lookup()
+{
+    free_lookup();
+
+    const unsigned side = 1u << PALETTE_CELL_BITS_;                 // Lookup cells per channel
+    const unsigned coarse_side = 1u << PALETTE_COARSE_BITS_;        // Coarse cells per channel
+    const unsigned fine_side = side / coarse_side;                  // Lookup cells per coarse cell and channel
+    const int cell_size = 256 / (int)side;
+    const unsigned size = size_;
+
+    // Near and far squared distances of every entry to every cell coordinate, per channel
+    const size_t table_size = 3u * side * MAX_PALETTE_COLORS_;
+    unsigned int* tables = (unsigned int*)malloc(2u * table_size * sizeof(unsigned int));
+    unsigned int* counts = (unsigned int*)malloc(PALETTE_CELLS_ * sizeof(unsigned int));
+    cell_offsets_ = (unsigned int*)malloc((PALETTE_CELLS_ + 1u) * sizeof(unsigned int));
+    if (!tables || !counts || !cell_offsets_)
+    {
+        free(tables);
+        free(counts);
+        free_lookup();
+        return false;
+    }
+
+    unsigned int* near = tables;
+    unsigned int* far = tables + table_size;
+    for (unsigned c = 0; c < side; c++)
+        for (unsigned i = 0; i < size; i++)
+        {
+            const int value[3] = { colors_[i].R, colors_[i].G, colors_[i].B };
+            for (unsigned k = 0; k < 3u; k++)
+            {
+                const size_t at = ((size_t)k * side + c) * MAX_PALETTE_COLORS_ + i;
+                span_distances(value[k], (int)c * cell_size, cell_size, near + at, far + at);
+            }
+        }
+
+    // Fills the candidates of the lookup cells inside the coarse cell, or only counts them if out is nullptr
+    auto coarse_cell = [&](unsigned coarse, Color* out)
+        {
+            const unsigned cr = coarse / (coarse_side * coarse_side), cg = coarse / coarse_side % coarse_side, cb = coarse % coarse_side;
+            const int coarse_size = 256 / (int)coarse_side;
+
+            unsigned char list[MAX_PALETTE_COLORS_];
+            unsigned listed = 0u;
+            {
+                unsigned limit = ~0u;
+                unsigned near_coarse[MAX_PALETTE_COLORS_];
+                for (unsigned i = 0; i < size; i++)
+                {
+                    unsigned nr, ng, nb, fr, fg, fb;
+                    span_distances(colors_[i].R, (int)cr * coarse_size, coarse_size, &nr, &fr);
+                    span_distances(colors_[i].G, (int)cg * coarse_size, coarse_size, &ng, &fg);
+                    span_distances(colors_[i].B, (int)cb * coarse_size, coarse_size, &nb, &fb);
+                    near_coarse[i] = nr + ng + nb;
+                    if (fr + fg + fb < limit)
+                        limit = fr + fg + fb;
+                }
+                for (unsigned i = 0; i < size; i++)
+                    if (near_coarse[i] <= limit)
+                        list[listed++] = (unsigned char)i;
+            }
+
+            for (unsigned r = cr * fine_side; r < (cr + 1u) * fine_side; r++)
+                for (unsigned g = cg * fine_side; g < (cg + 1u) * fine_side; g++)
+                    for (unsigned b = cb * fine_side; b < (cb + 1u) * fine_side; b++)
+                    {
+                        const unsigned int* near_r = near + (0u * side + r) * MAX_PALETTE_COLORS_;
+                        const unsigned int* near_g = near + (1u * side + g) * MAX_PALETTE_COLORS_;
+                        const unsigned int* near_b = near + (2u * side + b) * MAX_PALETTE_COLORS_;
+                        const unsigned int* far_r = far + (0u * side + r) * MAX_PALETTE_COLORS_;
+                        const unsigned int* far_g = far + (1u * side + g) * MAX_PALETTE_COLORS_;
+                        const unsigned int* far_b = far + (2u * side + b) * MAX_PALETTE_COLORS_;
+
+                        unsigned limit = ~0u;
+                        for (unsigned j = 0; j < listed; j++)
+                        {
+                            const unsigned i = list[j];
+                            const unsigned distance = far_r[i] + far_g[i] + far_b[i];
+                            if (distance < limit)
+                                limit = distance;
+                        }
+
+                        const unsigned cell = (r << PALETTE_CELL_BITS_ | g) << PALETTE_CELL_BITS_ | b;
+                        unsigned count = 0u;
+                        Color* cell_out = out ? out + cell_offsets_[cell] : nullptr;
+                        for (unsigned j = 0; j < listed; j++)
+                        {
+                            const unsigned i = list[j];
+                            if (near_r[i] + near_g[i] + near_b[i] > limit)
+                                continue;
+                            if (cell_out)
+                                cell_out[count] = Color(colors_[i].R, colors_[i].G, colors_[i].B, (unsigned char)i);
+                            count++;
+                        }
+
+                        // Padded with copies of the last one to a multiple of PALETTE_CANDIDATE_GROUP_
+                        if (!out)
+                            counts[cell] = (count + PALETTE_CANDIDATE_GROUP_ - 1u) / PALETTE_CANDIDATE_GROUP_ * PALETTE_CANDIDATE_GROUP_;
+                        else
+                            for (unsigned j = count; j < cell_offsets_[cell + 1u] - cell_offsets_[cell]; j++)
+                                cell_out[j] = cell_out[count - 1u];
+                    }
+        };
+
+    const unsigned coarse_cells = coarse_side * coarse_side * coarse_side;
+    parallel_for(coarse_cells, PALETTE_COARSE_PER_BAND_, [&](unsigned begin, unsigned end)
+        {
+            for (unsigned coarse = begin; coarse < end; coarse++)
+                coarse_cell(coarse, nullptr);
+        });
+
+    cell_offsets_[0] = 0u;
+    for (unsigned cell = 0; cell < PALETTE_CELLS_; cell++)
+        cell_offsets_[cell + 1u] = cell_offsets_[cell] + counts[cell];
+
+    candidates_ = (Color*)malloc((size_t)cell_offsets_[PALETTE_CELLS_] * sizeof(Color));
+    if (!candidates_)
+    {
+        free(tables);
+        free(counts);
+        free_lookup();
+        return false;
+    }
+
+    Color* candidates = candidates_;
+    parallel_for(coarse_cells, PALETTE_COARSE_PER_BAND_, [&](unsigned begin, unsigned end)
+        {
+            for (unsigned coarse = begin; coarse < end; coarse++)
+                coarse_cell(coarse, candidates);
+        });
+
+    free(tables);
+    free(counts);
+    return true;
+}
+
+// Returns the index of the entry nearest to the color, checking only the candidates of its cell.
+// The candidates store their index in the alpha, so comparing the distance shifted left by 8 
+// with the index in the low byte picks the nearest one and the lowest index among ties.
+
+unsigned char Palette::nearest(Color color) const
+{
+    const unsigned cell = color_cell(color.R, color.G, color.B);
+    const Color* candidate = candidates_ + cell_offsets_[cell];
+    const Color* end = candidates_ + cell_offsets_[cell + 1u];
+
+#ifdef IMAGE_SSE2_
+    // Lanes B, G, R, 0 of two candidates against the color, the index lane is masked
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rgb_mask = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i target = _mm_set_epi16(0, color.R, color.G, color.B, 0, color.R, color.G, color.B);
+    __m128i best = _mm_set1_epi32(0x7FFFFFFF);
+
+    for (; candidate < end; candidate += PALETTE_CANDIDATE_GROUP_)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i*)candidate);
+        const __m128i index = _mm_srli_epi32(v, 24);
+        const __m128i rgb = _mm_and_si128(v, rgb_mask);
+
+        const __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(rgb, zero), target);
+        const __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(rgb, zero), target);
+        const __m128 pair_lo = _mm_castsi128_ps(_mm_madd_epi16(lo, lo));   // b0²+g0², r0², b1²+g1², r1²
+        const __m128 pair_hi = _mm_castsi128_ps(_mm_madd_epi16(hi, hi));
+
+        const __m128i distance = _mm_add_epi32(
+            _mm_castps_si128(_mm_shuffle_ps(pair_lo, pair_hi, _MM_SHUFFLE(2, 0, 2, 0))),
+            _mm_castps_si128(_mm_shuffle_ps(pair_lo, pair_hi, _MM_SHUFFLE(3, 1, 3, 1)))
+        );
+
+        const __m128i key = _mm_or_si128(_mm_slli_epi32(distance, 8), index);
+        const __m128i less = _mm_cmplt_epi32(key, best);
+        best = _mm_or_si128(_mm_and_si128(less, key), _mm_andnot_si128(less, best));
+    }
+
+    int keys[4];
+    _mm_storeu_si128((__m128i*)keys, best);
+    int key = keys[0];
+    for (unsigned i = 1u; i < 4u; i++)
+        if (keys[i] < key)
+            key = keys[i];
+    return (unsigned char)key;
+#else
+    unsigned best = ~0u;
+    for (; candidate < end; candidate++)
+    {
+        const unsigned key = color_distance(color.R, color.G, color.B, candidate->R, candidate->G, candidate->B) << 8 | candidate->A;
+        if (key < best)
+            best = key;
+    }
+    return (unsigned char)best;
+#endif
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Building
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Sets the palette entries, the alpha is set opaque
+
+bool Palette::set_colors(const Color* colors, unsigned int count)
+{
+    if (!colors || !count || count > MAX_PALETTE_COLORS_)
+        return false;
+
+    for (unsigned i = 0; i < count; i++)
+        colors_[i] = Color(colors[i].R, colors[i].G, colors[i].B);
+    size_ = count;
+
+    if (build_lookup())
+        return true;
+
+    size_ = 0u;
+    return false;
+}
+
+// Builds a palette for the image. Images with few colors keep them, the rest go
+// through median cut: a 15-bit histogram is counted in parallel, then the box with
+// the most pixels times squared length is split at the median of its longest side
+// until there are max_colors boxes, and every entry is the mean color of a box.
+
+bool Palette::build(const Image& image, unsigned int max_colors)
+{
+    if (!image.width() || !image.height() || !max_colors)
+        return false;
+
+    if (max_colors > MAX_PALETTE_COLORS_)
+        max_colors = MAX_PALETTE_COLORS_;
+
+    Color colors[MAX_PALETTE_COLORS_];
+    const unsigned found = distinct_colors(image, max_colors, colors);
+    if (found <= max_colors)
+        return set_colors(colors, found);
+
+    // Histogram, one per band merged into the first
+    const unsigned long long pixels = (unsigned long long)image.width() * image.height();
+    unsigned long long band_count = pixels / PALETTE_PIXELS_PER_BAND_ + 1ull;
+    if (band_count > parallel_threads())
+        band_count = parallel_threads();
+    const unsigned bands = (unsigned)band_count;
+
+    HistogramBin* histograms = (HistogramBin*)calloc((size_t)bands * PALETTE_CELLS_, sizeof(HistogramBin));
+    unsigned short* bins = (unsigned short*)malloc(2u * PALETTE_CELLS_ * sizeof(unsigned short));
+    if (!histograms || !bins)
+    {
+        free(histograms);
+        free(bins);
+        return false;
+    }
+
+    const Color* source = image.pixels();
+    parallel_for(bands, 1u, [&](unsigned begin, unsigned end)
+        {
+            for (unsigned band = begin; band < end; band++)
+            {
+                HistogramBin* histogram = histograms + (size_t)band * PALETTE_CELLS_;
+                const unsigned long long first = pixels * band / bands, last = pixels * (band + 1u) / bands;
+                for (unsigned long long i = first; i < last; i++)
+                {
+                    HistogramBin& bin = histogram[color_cell(source[i].R, source[i].G, source[i].B)];
+                    bin.count++;
+                    bin.r += source[i].R;
+                    bin.g += source[i].G;
+                    bin.b += source[i].B;
+                }
+            }
+        });
+
+    HistogramBin* histogram = histograms;
+    parallel_for(PALETTE_CELLS_, PALETTE_BINS_PER_BAND_, [&](unsigned begin, unsigned end)
+        {
+            for (unsigned band = 1u; band < bands; band++)
+                for (unsigned i = begin; i < end; i++)
+                {
+                    const HistogramBin& other = histograms[(size_t)band * PALETTE_CELLS_ + i];
+                    histogram[i].count += other.count;
+                    histogram[i].r += other.r;
+                    histogram[i].g += other.g;
+                    histogram[i].b += other.b;
+                }
+        });
+
+    // List of used bins, the second half of the array is scratch for sorting
+    unsigned used = 0u;
+    for (unsigned i = 0; i < PALETTE_CELLS_; i++)
+        if (histogram[i].count)
+            bins[used++] = (unsigned short)i;
+
+    CutBox boxes[MAX_PALETTE_COLORS_];
+    unsigned n_boxes = 1u;
+    boxes[0].begin = 0u;
+    boxes[0].end = used;
+    fit_box(boxes[0], bins, histogram);
+
+    while (n_boxes < max_colors)
+    {
+        // Box with the largest error estimate that can still be split
+        unsigned pick = n_boxes, axis = 0u;
+        unsigned long long best = 0ull;
+        for (unsigned i = 0; i < n_boxes; i++)
+        {
+            if (boxes[i].end - boxes[i].begin < 2u)
+                continue;
+
+            unsigned longest = 0u;
+            for (unsigned k = 1u; k < 3u; k++)
+                if (boxes[i].max[k] - boxes[i].min[k] > boxes[i].max[longest] - boxes[i].min[longest])
+                    longest = k;
+
+            const unsigned long long length = boxes[i].max[longest] - boxes[i].min[longest] + 1u;
+            const unsigned long long score = boxes[i].count * length * length;
+            if (score > best)
+            {
+                best = score;
+                pick = i;
+                axis = longest;
+            }
+        }
+        if (pick == n_boxes)
+            break;
+
+        // Counting sort of the box bins along the axis
+        CutBox& box = boxes[pick];
+        const unsigned shift = (2u - axis) * PALETTE_CELL_BITS_;
+        const unsigned mask = (1u << PALETTE_CELL_BITS_) - 1u;
+        unsigned starts[(1u << PALETTE_CELL_BITS_) + 1u] = {};
+
+        for (unsigned i = box.begin; i < box.end; i++)
+            starts[((bins[i] >> shift) & mask) + 1u]++;
+        for (unsigned v = 0; v < (1u << PALETTE_CELL_BITS_); v++)
+            starts[v + 1u] += starts[v];
+
+        unsigned short* sorted = bins + PALETTE_CELLS_;
+        for (unsigned i = box.begin; i < box.end; i++)
+            sorted[starts[(bins[i] >> shift) & mask]++] = bins[i];
+        memcpy(bins + box.begin, sorted, (box.end - box.begin) * sizeof(unsigned short));
+
+        // Median by pixels, leaving at least one bin on each side
+        unsigned split = box.begin + 1u;
+        unsigned long long below = histogram[bins[box.begin]].count;
+        while (split + 1u < box.end && 2ull * (below + histogram[bins[split]].count) <= box.count)
+            below += histogram[bins[split++]].count;
+
+        CutBox& upper = boxes[n_boxes++];
+        upper.begin = split;
+        upper.end = box.end;
+        box.end = split;
+        fit_box(box, bins, histogram);
+        fit_box(upper, bins, histogram);
+    }
+
+    for (unsigned i = 0; i < n_boxes; i++)
+    {
+        unsigned long long r = 0ull, g = 0ull, b = 0ull;
+        for (unsigned j = boxes[i].begin; j < boxes[i].end; j++)
+        {
+            r += histogram[bins[j]].r;
+            g += histogram[bins[j]].g;
+            b += histogram[bins[j]].b;
+        }
+        const unsigned long long n = boxes[i].count;
+        colors[i] = Color((unsigned char)((r + n / 2ull) / n), (unsigned char)((g + n / 2ull) / n), (unsigned char)((b + n / 2ull) / n));
+    }
+
+    free(histograms);
+    free(bins);
+    return set_colors(colors, n_boxes);
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Queries
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Returns the number of entries
+
+unsigned Palette::size() const
+{
+    return size_;
+}
+
+// Returns the palette entries
+
+const Color* Palette::colors() const
+{
+    return colors_;
+}
+
+// Returns the entry at the specified index
+
+const Color& Palette::operator[](unsigned int index) const
+{
+    return colors_[index];
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Mapping
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Stores the palette index of every pixel. Without dithering and with ordered
+// dithering the rows are independent and mapped in parallel, runs of equal
+// colors reuse the previous lookup. Error diffusion walks the image in
+// serpentine order keeping the error of the current and next rows.
+
+bool Palette::map(const Image& image, unsigned char* indices, PaletteDither dither) const
+{
+    if (!size_)
+        return false;
+
+    const unsigned width = image.width(), height = image.height();
+    const Color* pixels = image.pixels();
+    if (!width || !height)
+        return true;
+
+    if (dither == PALETTE_DITHER_NONE)
+    {
+        parallel_for(height, PALETTE_ROWS_PER_BAND_, [&](unsigned begin, unsigned end)
+            {
+                for (unsigned row = begin; row < end; row++)
+                {
+                    const Color* src = pixels + (unsigned long long)row * width;
+                    unsigned char* out = indices + (unsigned long long)row * width;
+
+                    Color previous = src[0];
+                    unsigned char index = nearest(previous);
+                    for (unsigned col = 0; col < width; col++)
+                    {
+                        if (src[col].R != previous.R || src[col].G != previous.G || src[col].B != previous.B)
+                        {
+                            previous = src[col];
+                            index = nearest(previous);
+                        }
+                        out[col] = index;
+                    }
+                }
+            });
+        return true;
+    }
+
+    if (dither == PALETTE_DITHER_ORDERED)
+    {
+        // Threshold spread of about one palette step, as if the entries were a regular grid
+        unsigned steps = 1u;
+        while (steps * steps * steps < size_)
+            steps++;
+        const int spread = 256 / (int)steps;
+
+        parallel_for(height, PALETTE_ROWS_PER_BAND_, [&](unsigned begin, unsigned end)
+            {
+                for (unsigned row = begin; row < end; row++)
+                {
+                    const Color* src = pixels + (unsigned long long)row * width;
+                    unsigned char* out = indices + (unsigned long long)row * width;
+                    const unsigned char* threshold = bayer8[row & 7u];
+
+                    for (unsigned col = 0; col < width; col++)
+                    {
+                        const int offset = (2 * threshold[col & 7u] - 63) * spread / 128;
+                        const Color c(
+                            (unsigned char)clamp_channel(src[col].R + offset),
+                            (unsigned char)clamp_channel(src[col].G + offset),
+                            (unsigned char)clamp_channel(src[col].B + offset)
+                        );
+                        out[col] = nearest(c);
+                    }
+                }
+            });
+        return true;
+    }
+
+    // Floyd-Steinberg, errors in sixteenths with a guard entry on each side
+    int* errors = (int*)calloc(2u * 3u * (width + 2u), sizeof(int));
+    if (!errors)
+        throw "Could not allocate dithering buffer";
+
+    int* current = errors;
+    int* next = errors + 3u * (width + 2u);
+
+    for (unsigned row = 0; row < height; row++)
+    {
+        const Color* src = pixels + (unsigned long long)row * width;
+        unsigned char* out = indices + (unsigned long long)row * width;
+        const bool reverse = row & 1u;
+        const int step = reverse ? -1 : 1;
+
+        for (unsigned i = 0; i < width; i++)
+        {
+            const unsigned col = reverse ? width - 1u - i : i;
+            int* e = current + 3u * (col + 1u);
+            int* below = next + 3u * (col + 1u);
+
+            const int r = clamp_channel(src[col].R + ((e[0] + 8) >> 4));
+            const int g = clamp_channel(src[col].G + ((e[1] + 8) >> 4));
+            const int b = clamp_channel(src[col].B + ((e[2] + 8) >> 4));
+
+            const unsigned char index = nearest(Color((unsigned char)r, (unsigned char)g, (unsigned char)b));
+            out[col] = index;
+
+            const int d[3] = { r - colors_[index].R, g - colors_[index].G, b - colors_[index].B };
+            for (unsigned k = 0; k < 3u; k++)
+            {
+                e[3 * step + (int)k] += 7 * d[k];
+                below[-3 * step + (int)k] += 3 * d[k];
+                below[k] += 5 * d[k];
+                below[3 * step + (int)k] += d[k];
+            }
+        }
+
+        int* swap = current;
+        current = next;
+        next = swap;
+        memset(next, 0, 3u * (width + 2u) * sizeof(int));
+    }
+
+    free(errors);
+    return true;
+}
+
+// Replaces every pixel of the image by its palette color, keeping the alpha
+
+bool Palette::apply(Image& image, PaletteDither dither) const
+{
+    if (!size_)
+        return false;
+
+    const unsigned long long count = (unsigned long long)image.width() * image.height();
+    unsigned char* indices = (unsigned char*)malloc((size_t)count + 1u);
+    if (!indices)
+        throw "Could not allocate palette indices";
+
+    map(image, indices, dither);
+
+    Color* pixels = image.pixels();
+    for (unsigned long long i = 0ull; i < count; i++)
+    {
+        const Color& entry = colors_[indices[i]];
+        pixels[i] = Color(entry.R, entry.G, entry.B, pixels[i].A);
+    }
+
+    free(indices);
+    return true;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Indexed bitmap files
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Writes the image as a bottom-up indexed bitmap with the palette, 4 or 8 bits per
+// pixel. The palette must fit in the bit depth.
+
+static bool write_indexed(const Image& image, const Palette& palette, unsigned bits, PaletteDither dither, const char* filename)
+{
+    if (!palette.size() || palette.size() > (1u << bits))
+        return false;
+
+    const unsigned width = image.width(), height = image.height();
+    const uint32_t row_stride = ((width * bits + 31u) / 32u) * 4u;
+    const uint32_t pixel_data_size = row_stride * height;
+
+    unsigned char* indices = (unsigned char*)malloc((size_t)width * height + 1u);
+    uint8_t* row = (uint8_t*)calloc(row_stride + 1u, 1);
+    if (!indices || !row)
+    {
+        free(indices);
+        free(row);
+        return false;
+    }
+    palette.map(image, indices, dither);
+
+    // Both headers and the color table in a single write
+    uint8_t header[BMP_HEADER_SIZE_ + 4u * MAX_PALETTE_COLORS_] = {};
+    const uint32_t table_size = 4u * palette.size();
+    const uint32_t offset = BMP_HEADER_SIZE_ + table_size;
+
+    header[0] = 'B';
+    header[1] = 'M';
+    put_le32(header + 2, offset + pixel_data_size);     // bfSize
+    put_le32(header + 10, offset);                      // bfOffBits
+    put_le32(header + 14, BMP_INFO_HEADER_SIZE_);       // biSize
+    put_le32(header + 18, width);                       // biWidth
+    put_le32(header + 22, height);                      // biHeight (positive => bottom-up)
+    put_le16(header + 26, 1u);                          // biPlanes
+    put_le16(header + 28, (uint16_t)bits);              // biBitCount
+    put_le32(header + 30, 0u);                          // biCompression (BI_RGB = 0)
+    put_le32(header + 34, pixel_data_size);             // biSizeImage
+    put_le32(header + 38, 2835u);                       // biXPelsPerMeter (~72 DPI)
+    put_le32(header + 42, 2835u);                       // biYPelsPerMeter
+    put_le32(header + 46, palette.size());              // biClrUsed
+    put_le32(header + 50, 0u);                          // biClrImportant
+
+    for (unsigned i = 0; i < palette.size(); i++)
+    {
+        uint8_t* entry = header + BMP_HEADER_SIZE_ + 4u * i;
+        entry[0] = palette[i].B;
+        entry[1] = palette[i].G;
+        entry[2] = palette[i].R;
+        entry[3] = 0u;
+    }
+
+    FILE* file = fopen(filename, "wb");
+    bool ok = file && fwrite(header, 1, offset, file) == offset;
+
+    for (int y = (int)height - 1; ok && y >= 0; --y)
+    {
+        const unsigned char* in = indices + (size_t)y * width;
+        if (bits == 8u)
+            memcpy(row, in, width);
+        else
+            for (unsigned x = 0; x < width; x += 2u)
+                row[x / 2u] = (uint8_t)(in[x] << 4 | (x + 1u < width ? in[x + 1u] : 0u));
+
+        ok = fwrite(row, 1, row_stride, file) == row_stride;
+    }
+
+    if (file && fclose(file) != 0)
+        ok = false;
+
+    free(indices);
+    free(row);
+    return ok;
+}
+
+// Saves the image as an indexed bitmap of 4 or 8 bits per pixel with a palette built for it
+
+bool Image::save_palettized(unsigned int bits, PaletteDither dither, const char* fmt_filename, ...) const
+{
+    if (bits != 4u && bits != 8u)
+        return false;
+
+    char filename[512];
+    va_list ap;
+    va_start(ap, fmt_filename);
+    const bool formatted = bmp_format_filename(filename, 512u, fmt_filename, ap);
+    va_end(ap);
+
+    Palette palette;
+    if (!formatted || !palette.build(*this, 1u << bits))
+        return false;
+
+    // The requested depth is kept even if fewer colors would fit in 4 bits
+    return write_indexed(*this, palette, bits, dither, filename);
+}
+
+// Saves the image as an indexed bitmap with the specified palette
+
+bool Image::save_palettized(const Palette& palette, PaletteDither dither, const char* fmt_filename, ...) const
+{
+    char filename[512];
+    va_list ap;
+    va_start(ap, fmt_filename);
+    const bool formatted = bmp_format_filename(filename, 512u, fmt_filename, ap);
+    va_end(ap);
+
+    if (!formatted)
+        return false;
+
+    return write_indexed(*this, palette, palette.size() <= 16u ? 4u : 8u, dither, filename);
+}
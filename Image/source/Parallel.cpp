@@ -0,0 +1,402 @@
+#include "Parallel.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#endif
+
+#include <cstdlib>
+
+/*
+-------------------------------------------------------------------------------------------------------
+Internal helpers
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Band description sent to each worker thread
+
+struct ParallelBand
+{
+    void (*task)(void*, unsigned, unsigned);
+    void* data;
+    unsigned begin;
+    unsigned end;
+};
+
+// Thread entry, runs the band it receives.
+
+#ifdef _WIN32
+static DWORD WINAPI band_entry(void* pband)
+{
+    ParallelBand* band = (ParallelBand*)pband;
+    band->task(band->data, band->begin, band->end);
+    return 0;
+}
+#else
+static void* band_entry(void* pband)
+{
+    ParallelBand* band = (ParallelBand*)pband;
+    band->task(band->data, band->begin, band->end);
+    return nullptr;
+}
+#endif
+
+/*
+-------------------------------------------------------------------------------------------------------
+Parallel functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Returns the number of logical processors available, at least 1.
+
+unsigned parallel_threads()
+{
+    static unsigned threads = 0u;
+    if (threads)
+        return threads;
+
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long n = (long)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (n < 1) n = 1;
+    if (n > (long)MAX_PARALLEL_THREADS_) n = (long)MAX_PARALLEL_THREADS_;
+
+    threads = (unsigned)n;
+    return threads;
+}
+
+// Splits [0, count) in bands, threads all but the last one and runs the last one
+// in the calling thread. If a thread can not be created its band runs inline.
+
+void parallel_run(void (*task)(void* data, unsigned begin, unsigned end), void* data, unsigned count, unsigned min_per_band)
+{
+    if (!count)
+        return;
+
+    if (!min_per_band)
+        min_per_band = 1u;
+
+    unsigned bands = count / min_per_band;
+    if (bands > parallel_threads()) bands = parallel_threads();
+    if (bands < 2u)
+    {
+        task(data, 0u, count);
+        return;
+    }
+
+    ParallelBand band[MAX_PARALLEL_THREADS_];
+#ifdef _WIN32
+    HANDLE handle[MAX_PARALLEL_THREADS_];
+#else
+    pthread_t handle[MAX_PARALLEL_THREADS_];
+#endif
+    bool started[MAX_PARALLEL_THREADS_];
+
+    for (unsigned i = 0; i < bands; i++)
+    {
+        band[i].task = task;
+        band[i].data = data;
+        band[i].begin = (unsigned)(((unsigned long long)count * i) / bands);
+        band[i].end = (unsigned)(((unsigned long long)count * (i + 1)) / bands);
+    }
+
+    for (unsigned i = 0; i + 1 < bands; i++)
+    {
+#ifdef _WIN32
+        handle[i] = CreateThread(NULL, 0, band_entry, &band[i], 0, NULL);
+        started[i] = handle[i] != NULL;
+#else
+        started[i] = pthread_create(&handle[i], nullptr, band_entry, &band[i]) == 0;
+#endif
+        if (!started[i])
+            band_entry(&band[i]);
+    }
+
+    band_entry(&band[bands - 1]);
+
+    for (unsigned i = 0; i + 1 < bands; i++)
+    {
+        if (!started[i])
+            continue;
+#ifdef _WIN32
+        WaitForSingleObject(handle[i], INFINITE);
+        CloseHandle(handle[i]);
+#else
+        pthread_join(handle[i], nullptr);
+#endif
+    }
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Synchronization objects
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Allocates and initializes the OS lock
+
+ParallelMutex::ParallelMutex()
+{
+#ifdef _WIN32
+    handle_ = calloc(1, sizeof(SRWLOCK));
+    InitializeSRWLock((SRWLOCK*)handle_);
+#else
+    handle_ = calloc(1, sizeof(pthread_mutex_t));
+    pthread_mutex_init((pthread_mutex_t*)handle_, nullptr);
+#endif
+}
+
+// Destroys and frees the OS lock
+
+ParallelMutex::~ParallelMutex()
+{
+#ifndef _WIN32
+    pthread_mutex_destroy((pthread_mutex_t*)handle_);
+#endif
+    free(handle_);
+}
+
+// Blocks until the mutex is acquired
+
+void ParallelMutex::lock()
+{
+#ifdef _WIN32
+    AcquireSRWLockExclusive((SRWLOCK*)handle_);
+#else
+    pthread_mutex_lock((pthread_mutex_t*)handle_);
+#endif
+}
+
+// Releases the mutex
+
+void ParallelMutex::unlock()
+{
+#ifdef _WIN32
+    ReleaseSRWLockExclusive((SRWLOCK*)handle_);
+#else
+    pthread_mutex_unlock((pthread_mutex_t*)handle_);
+#endif
+}
+
+// Allocates and initializes the OS condition
+
+ParallelCondition::ParallelCondition()
+{
+#ifdef _WIN32
+    handle_ = calloc(1, sizeof(CONDITION_VARIABLE));
+    InitializeConditionVariable((CONDITION_VARIABLE*)handle_);
+#else
+    handle_ = calloc(1, sizeof(pthread_cond_t));
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init((pthread_cond_t*)handle_, &attr);
+    pthread_condattr_destroy(&attr);
+#endif
+}
+
+// Destroys and frees the OS condition
+
+ParallelCondition::~ParallelCondition()
+{
+#ifndef _WIN32
+    pthread_cond_destroy((pthread_cond_t*)handle_);
+#endif
+    free(handle_);
+}
+
+// Releases the mutex and waits until woken up, reacquires it before returning.
+
+bool ParallelCondition::wait(ParallelMutex& mutex, unsigned long timeout_ms)
+{
+#ifdef _WIN32
+    return SleepConditionVariableSRW((CONDITION_VARIABLE*)handle_, (SRWLOCK*)mutex.handle_, timeout_ms, 0) != 0;
+#else
+    if (timeout_ms == 0xFFFFFFFFUL)
+        return pthread_cond_wait((pthread_cond_t*)handle_, (pthread_mutex_t*)mutex.handle_) == 0;
+
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += timeout_ms / 1000UL;
+    ts.tv_nsec += (long)(timeout_ms % 1000UL) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return pthread_cond_timedwait((pthread_cond_t*)handle_, (pthread_mutex_t*)mutex.handle_, &ts) != ETIMEDOUT;
+#endif
+}
+
+// Wakes up one of the waiting threads
+
+void ParallelCondition::wake_one()
+{
+#ifdef _WIN32
+    WakeConditionVariable((CONDITION_VARIABLE*)handle_);
+#else
+    pthread_cond_signal((pthread_cond_t*)handle_);
+#endif
+}
+
+// Wakes up all the waiting threads
+
+void ParallelCondition::wake_all()
+{
+#ifdef _WIN32
+    WakeAllConditionVariable((CONDITION_VARIABLE*)handle_);
+#else
+    pthread_cond_broadcast((pthread_cond_t*)handle_);
+#endif
+}
+
+// Atomically adds value to the counter and returns the new value.
+
+long long atomic_add(volatile long long* counter, long long value)
+{
+#ifdef _WIN32
+    return InterlockedAdd64(counter, value);
+#else
+    return __atomic_add_fetch(counter, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+// Atomically reads the counter.
+
+long long atomic_load(const volatile long long* counter)
+{
+#ifdef _WIN32
+    return InterlockedCompareExchange64((volatile long long*)counter, 0, 0);
+#else
+    return __atomic_load_n(counter, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Threads and time
+-------------------------------------------------------------------------------------------------------
+*/
+
+// OS thread together with the function it runs
+
+struct ThreadHandle
+{
+#ifdef _WIN32
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+    void (*entry)(void*);
+    void* data;
+};
+
+// Thread entry, calls the function it was started with.
+
+#ifdef _WIN32
+static DWORD WINAPI thread_entry(void* phandle)
+{
+    ThreadHandle* handle = (ThreadHandle*)phandle;
+    handle->entry(handle->data);
+    return 0;
+}
+#else
+static void* thread_entry(void* phandle)
+{
+    ThreadHandle* handle = (ThreadHandle*)phandle;
+    handle->entry(handle->data);
+    return nullptr;
+}
+#endif
+
+// Waits for the thread if it is still running
+
+ParallelThread::~ParallelThread()
+{
+    join();
+}
+
+// Starts the thread calling entry(data).
+
+bool ParallelThread::start(void (*entry)(void* data), void* data)
+{
+    if (handle_)
+        return false;
+
+    ThreadHandle* handle = (ThreadHandle*)calloc(1, sizeof(ThreadHandle));
+    if (!handle)
+        return false;
+
+    handle->entry = entry;
+    handle->data = data;
+
+#ifdef _WIN32
+    handle->thread = CreateThread(NULL, 0, thread_entry, handle, 0, NULL);
+    const bool created = handle->thread != NULL;
+#else
+    const bool created = pthread_create(&handle->thread, nullptr, thread_entry, handle) == 0;
+#endif
+    if (!created)
+    {
+        free(handle);
+        return false;
+    }
+
+    handle_ = handle;
+    return true;
+}
+
+// Waits until the thread returns, does nothing if not started
+
+void ParallelThread::join()
+{
+    if (!handle_)
+        return;
+
+    ThreadHandle* handle = (ThreadHandle*)handle_;
+#ifdef _WIN32
+    WaitForSingleObject(handle->thread, INFINITE);
+    CloseHandle(handle->thread);
+#else
+    pthread_join(handle->thread, nullptr);
+#endif
+    free(handle);
+    handle_ = nullptr;
+}
+
+// Returns whether the thread was started and not joined yet
+
+bool ParallelThread::started() const
+{
+    return handle_ != nullptr;
+}
+
+// Returns a monotonic timestamp in nanoseconds.
+
+unsigned long long monotonic_ns()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency = {};
+    if (!frequency.QuadPart)
+        QueryPerformanceFrequency(&frequency);
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    // Split to avoid overflowing the multiplication
+    const unsigned long long ticks = (unsigned long long)counter.QuadPart, freq = (unsigned long long)frequency.QuadPart;
+    return ticks / freq * 1000000000ull + ticks % freq * 1000000000ull / freq;
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+#endif
+}
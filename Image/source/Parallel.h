@@ -0,0 +1,107 @@
+#pragma once
+
+/* PARALLEL HELPERS HEADER (PRIVATE)
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Internal helpers used by the image library to split work across threads.
+It uses the Win32 API on Windows and pthreads on other systems, so the
+public headers of the library stay clean of any dependency.
+
+The work is split in contiguous bands of indices, the calling thread
+always processes the last band, so small jobs never create threads.
+
+It also contains the minimal synchronization objects needed by the
+library: a mutex, a condition variable, atomic counters, a long-lived
+thread for background work and a monotonic clock. Their names carry the
+Parallel prefix so they never clash with the classes of other libraries,
+like the Thread one, compiled into the same project.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+#define MAX_PARALLEL_THREADS_ 64u // Maximum number of threads used by a parallel call
+
+// Returns the number of logical processors available, at least 1.
+unsigned parallel_threads();
+
+// Calls task(data, begin, end) over contiguous bands covering [0, count). Each band
+// has at least min_per_band indices, and it is split across at most the logical processors.
+void parallel_run(void (*task)(void* data, unsigned begin, unsigned end), void* data, unsigned count, unsigned min_per_band = 1u);
+
+// Templated version of parallel_run, the body is called as body(begin, end).
+// Any callable works, including lambdas that capture by reference.
+template<typename Body>
+inline void parallel_for(unsigned count, unsigned min_per_band, const Body& body)
+{
+	parallel_run(
+		[](void* data, unsigned begin, unsigned end) { (*(const Body*)data)(begin, end); },
+		(void*)&body, count, min_per_band
+	);
+}
+
+// Simple mutex wrapper, uses an SRW lock on Windows and a pthread mutex otherwise.
+class ParallelMutex
+{
+private:
+	void* handle_ = nullptr; // Pointer to the OS lock object
+
+	friend class ParallelCondition;
+public:
+	ParallelMutex(const ParallelMutex&) = delete;
+	ParallelMutex& operator=(const ParallelMutex&) = delete;
+
+	ParallelMutex();
+	~ParallelMutex();
+
+	void lock();	// Blocks until the mutex is acquired
+	void unlock();	// Releases the mutex
+};
+
+// Condition variable to be used together with a locked ParallelMutex.
+class ParallelCondition
+{
+private:
+	void* handle_ = nullptr; // Pointer to the OS condition object
+public:
+	ParallelCondition(const ParallelCondition&) = delete;
+	ParallelCondition& operator=(const ParallelCondition&) = delete;
+
+	ParallelCondition();
+	~ParallelCondition();
+
+	// Releases the mutex and waits until woken up, reacquires it before returning.
+	// With a timeout it returns false if the time ran out.
+	bool wait(ParallelMutex& mutex, unsigned long timeout_ms = 0xFFFFFFFFUL);
+
+	void wake_one();	// Wakes up one of the waiting threads
+	void wake_all();	// Wakes up all the waiting threads
+};
+
+// Atomically adds value to the counter and returns the new value.
+long long atomic_add(volatile long long* counter, long long value);
+
+// Atomically reads the counter.
+long long atomic_load(const volatile long long* counter);
+
+// Long-lived thread running a single function, for background work.
+class ParallelThread
+{
+private:
+	void* handle_ = nullptr; // Pointer to the OS thread and its entry
+public:
+	ParallelThread(const ParallelThread&) = delete;
+	ParallelThread& operator=(const ParallelThread&) = delete;
+
+	ParallelThread() = default;
+	~ParallelThread();	// Waits for the thread if it is still running
+
+	// Starts the thread calling entry(data). Returns false if it could not be
+	// created or it was already started and not joined.
+	bool start(void (*entry)(void* data), void* data);
+
+	void join();			// Waits until the thread returns, does nothing if not started
+	bool started() const;	// Returns whether the thread was started and not joined yet
+};
+
+// Returns a monotonic timestamp in nanoseconds, only meaningful as a difference.
+unsigned long long monotonic_ns();
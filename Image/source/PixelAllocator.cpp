@@ -0,0 +1,196 @@
+#include "PixelAllocator.h"
+#include "Parallel.h"
+
+#include <cstdlib>
+#include <cstring>
+
+/*
+-------------------------------------------------------------------------------------------------------
+Standard allocator
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Allocator using calloc/malloc and free
+
+class StandardAllocator : public PixelAllocator
+{
+public:
+    void* allocate(unsigned long long bytes, bool zero) override
+    {
+        return zero ? calloc((size_t)bytes, 1) : malloc((size_t)bytes);
+    }
+
+    void release(void* buffer, unsigned long long) override
+    {
+        free(buffer);
+    }
+};
+
+// Returns the standard allocator, it uses calloc/malloc and free.
+
+PixelAllocator* PixelAllocator::standard()
+{
+    static StandardAllocator allocator;
+    return &allocator;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Size class helpers
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Returns the size class of a buffer, sizes up to 64 bytes are class 0, then
+// every power of two is divided in four classes.
+
+static unsigned size_class(unsigned long long bytes, unsigned long long* class_bytes)
+{
+    if (bytes <= 64ull)
+    {
+        *class_bytes = 64ull;
+        return 0u;
+    }
+
+    const unsigned long long n = bytes - 1ull;
+    unsigned k = 63u;
+    while (!(n >> k))
+        k--;
+
+    const unsigned sub = (unsigned)(n >> (k - 2u)) & 3u;
+    *class_bytes = (4ull + sub + 1ull) << (k - 2u);
+    return (k - 6u) * 4u + sub + 1u;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+PoolAllocator functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Creates an empty pool that retains up to max_cached bytes of released buffers.
+
+PoolAllocator::PoolAllocator(unsigned long long max_cached)
+    :mutex_{ new ParallelMutex }, max_cached_{ max_cached }
+{
+}
+
+// Frees all the retained buffers.
+
+PoolAllocator::~PoolAllocator()
+{
+    trim();
+    delete (ParallelMutex*)mutex_;
+}
+
+// Returns a buffer of the size class, reusing a released one if available.
+
+void* PoolAllocator::allocate(unsigned long long bytes, bool zero)
+{
+    unsigned long long class_bytes;
+    const unsigned idx = size_class(bytes, &class_bytes);
+    if (idx >= POOL_SIZE_CLASSES_)
+        return nullptr;
+
+    ParallelMutex& mutex = *(ParallelMutex*)mutex_;
+    mutex.lock();
+
+    void* buffer = free_[idx];
+    if (buffer)
+    {
+        free_[idx] = *(void**)buffer;
+        cached_ -= class_bytes;
+        hits_++;
+    }
+    else misses_++;
+
+    mutex.unlock();
+
+    if (!buffer)
+        return zero ? calloc((size_t)class_bytes, 1) : malloc((size_t)class_bytes);
+
+    if (zero)
+        memset(buffer, 0, (size_t)bytes);
+
+    return buffer;
+}
+
+// Retains the buffer for reuse, or frees it if the pool is full.
+
+void PoolAllocator::release(void* buffer, unsigned long long bytes)
+{
+    if (!buffer)
+        return;
+
+    unsigned long long class_bytes;
+    const unsigned idx = size_class(bytes, &class_bytes);
+
+    ParallelMutex& mutex = *(ParallelMutex*)mutex_;
+    mutex.lock();
+
+    if (cached_ + class_bytes <= max_cached_)
+    {
+        *(void**)buffer = free_[idx];
+        free_[idx] = buffer;
+        cached_ += class_bytes;
+        buffer = nullptr;
+    }
+
+    mutex.unlock();
+
+    if (buffer)
+        free(buffer);
+}
+
+// Frees all the retained buffers.
+
+void PoolAllocator::trim()
+{
+    ParallelMutex& mutex = *(ParallelMutex*)mutex_;
+    mutex.lock();
+
+    for (unsigned i = 0; i < POOL_SIZE_CLASSES_; i++)
+    {
+        while (free_[i])
+        {
+            void* next = *(void**)free_[i];
+            free(free_[i]);
+            free_[i] = next;
+        }
+    }
+    cached_ = 0ull;
+
+    mutex.unlock();
+}
+
+// Returns the bytes currently retained by the pool
+
+unsigned long long PoolAllocator::cached() const
+{
+    ParallelMutex& mutex = *(ParallelMutex*)mutex_;
+    mutex.lock();
+    const unsigned long long cached = cached_;
+    mutex.unlock();
+    return cached;
+}
+
+// Returns the number of allocations served from released buffers
+
+unsigned long long PoolAllocator::hits() const
+{
+    ParallelMutex& mutex = *(ParallelMutex*)mutex_;
+    mutex.lock();
+    const unsigned long long hits = hits_;
+    mutex.unlock();
+    return hits;
+}
+
+// Returns the number of allocations that went to the system
+
+unsigned long long PoolAllocator::misses() const
+{
+    ParallelMutex& mutex = *(ParallelMutex*)mutex_;
+    mutex.lock();
+    const unsigned long long misses = misses_;
+    mutex.unlock();
+    return misses;
+}
@@ -0,0 +1,550 @@
+#include "Image.h"
+#include "SIMD.h"
+
+#include <cstdint>
+#include <cstring>
+
+/*
+-------------------------------------------------------------------------------------------------------
+Scalar helpers
+-------------------------------------------------------------------------------------------------------
+*/
+
+// BT.601 luma with 8-bit weights that add up to 256
+
+static inline uint8_t luma(const Color& c)
+{
+    return (uint8_t)((77u * c.R + 150u * c.G + 29u * c.B + 128u) >> 8);
+}
+
+// Packs a color into RGB565
+
+static inline uint16_t pack_565(const Color& c)
+{
+    return (uint16_t)(((c.R >> 3) << 11) | ((c.G >> 2) << 5) | (c.B >> 3));
+}
+
+// Expands an RGB565 value into an opaque color, replicating the high bits
+
+static inline Color unpack_565(uint16_t v)
+{
+    const unsigned r = (v >> 11) & 0x1Fu;
+    const unsigned g = (v >> 5) & 0x3Fu;
+    const unsigned b = v & 0x1Fu;
+    return Color((uint8_t)((r << 3) | (r >> 2)), (uint8_t)((g << 2) | (g >> 4)), (uint8_t)((b << 3) | (b >> 2)));
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Color to format kernels
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Swaps the red and blue channels, the same kernel goes both ways
+
+static void swap_red_blue_scalar(const Color* src, Color* dst, unsigned long long count)
+{
+    for (unsigned long long i = 0ull; i < count; i++)
+    {
+        const Color c = src[i];
+        dst[i].B = c.R;
+        dst[i].G = c.G;
+        dst[i].R = c.B;
+        dst[i].A = c.A;
+    }
+}
+
+#ifdef IMAGE_SSE2_
+// Swaps the red and blue channels with shifts and masks
+
+static void swap_red_blue_sse2(const Color* src, Color* dst, unsigned long long count)
+{
+    unsigned long long i = 0ull;
+    const __m128i mask_ga = _mm_set1_epi32((int)0xFF00FF00);
+    const __m128i mask_lo = _mm_set1_epi32(0x000000FF);
+    for (; i + 4ull <= count; i += 4ull)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        const __m128i ga = _mm_and_si128(v, mask_ga);
+        const __m128i lo = _mm_and_si128(_mm_srli_epi32(v, 16), mask_lo);
+        const __m128i hi = _mm_slli_epi32(_mm_and_si128(v, mask_lo), 16);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(ga, _mm_or_si128(lo, hi)));
+    }
+    swap_red_blue_scalar(src + i, dst + i, count - i);
+}
+#endif
+
+#ifdef IMAGE_DISPATCH_
+// Swaps the red and blue channels with a byte shuffle
+
+IMAGE_TARGET_SSSE3_ static void swap_red_blue_ssse3(const Color* src, Color* dst, unsigned long long count)
+{
+    unsigned long long i = 0ull;
+    const __m128i order = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    for (; i + 4ull <= count; i += 4ull)
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i)), order));
+    swap_red_blue_scalar(src + i, dst + i, count - i);
+}
+
+// Swaps the red and blue channels of 8 pixels per shuffle
+
+IMAGE_TARGET_AVX2_ static void swap_red_blue_avx2(const Color* src, Color* dst, unsigned long long count)
+{
+    unsigned long long i = 0ull;
+    const __m256i order = _mm256_setr_epi8(
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    for (; i + 8ull <= count; i += 8ull)
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(src + i)), order));
+    _mm256_zeroupper();
+    swap_red_blue_ssse3(src + i, dst + i, count - i);
+}
+
+// Swaps the red and blue channels of 16 pixels per shuffle
+
+IMAGE_TARGET_AVX512_ static void swap_red_blue_avx512(const Color* src, Color* dst, unsigned long long count)
+{
+    unsigned long long i = 0ull;
+    const __m512i order = _mm512_set4_epi32(0x0F0C0D0E, 0x0B08090A, 0x07040506, 0x03000102);
+    for (; i + 16ull <= count; i += 16ull)
+        _mm512_storeu_si512((void*)(dst + i), _mm512_shuffle_epi8(_mm512_loadu_si512((const void*)(src + i)), order));
+    swap_red_blue_avx2(src + i, dst + i, count - i);
+}
+#endif
+
+// Drops the alpha channel, keeping or swapping the channel order
+
+static void to_3_bytes_scalar(const Color* src, uint8_t* dst, unsigned long long count, bool rgb)
+{
+    const unsigned first = rgb ? 2u : 0u;
+    const unsigned last = rgb ? 0u : 2u;
+
+    for (unsigned long long i = 0ull; i < count; i++)
+    {
+        const uint8_t* c = (const uint8_t*)(src + i);
+        dst[3ull * i + 0ull] = c[first];
+        dst[3ull * i + 1ull] = c[1];
+        dst[3ull * i + 2ull] = c[last];
+    }
+}
+
+#ifdef IMAGE_DISPATCH_
+// Drops the alpha channel of 4 pixels per shuffle. Every store writes 16 bytes
+// of which the last 4 are overwritten by the next one, so it stops 6 pixels early.
+
+IMAGE_TARGET_SSSE3_ static void to_3_bytes_ssse3(const Color* src, uint8_t* dst, unsigned long long count, bool rgb)
+{
+    unsigned long long i = 0ull;
+    const __m128i order = rgb ?
+        _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1) :
+        _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    for (; i + 6ull <= count; i += 4ull)
+        _mm_storeu_si128((__m128i*)(dst + 3ull * i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i)), order));
+    to_3_bytes_scalar(src + i, dst + 3ull * i, count - i, rgb);
+}
+#endif
+
+// Computes the luma of every color
+
+static void to_gray(const Color* src, uint8_t* dst, unsigned long long count)
+{
+    unsigned long long i = 0ull;
+#ifdef IMAGE_SSE2_
+    // Weights for B, G, R, A of every pixel, pairs are added by madd
+    const __m128i weights = _mm_setr_epi16(29, 150, 77, 0, 29, 150, 77, 0);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(128);
+    for (; i + 8ull <= count; i += 8ull)
+    {
+        const __m128i v0 = _mm_loadu_si128((const __m128i*)(src + i));
+        const __m128i v1 = _mm_loadu_si128((const __m128i*)(src + i + 4ull));
+
+        // Partial sums B+G and R+A for every pixel
+        const __m128i s0 = _mm_madd_epi16(_mm_unpacklo_epi8(v0, zero), weights);
+        const __m128i s1 = _mm_madd_epi16(_mm_unpackhi_epi8(v0, zero), weights);
+        const __m128i s2 = _mm_madd_epi16(_mm_unpacklo_epi8(v1, zero), weights);
+        const __m128i s3 = _mm_madd_epi16(_mm_unpackhi_epi8(v1, zero), weights);
+
+        // Add the pairs, even lanes hold the full sum
+        __m128i y0 = _mm_add_epi32(_mm_unpacklo_epi64(_mm_shuffle_epi32(s0, 0x88), _mm_shuffle_epi32(s1, 0x88)),
+                                   _mm_unpacklo_epi64(_mm_shuffle_epi32(s0, 0xDD), _mm_shuffle_epi32(s1, 0xDD)));
+        __m128i y1 = _mm_add_epi32(_mm_unpacklo_epi64(_mm_shuffle_epi32(s2, 0x88), _mm_shuffle_epi32(s3, 0x88)),
+                                   _mm_unpacklo_epi64(_mm_shuffle_epi32(s2, 0xDD), _mm_shuffle_epi32(s3, 0xDD)));
+
+        y0 = _mm_srli_epi32(_mm_add_epi32(y0, round), 8);
+        y1 = _mm_srli_epi32(_mm_add_epi32(y1, round), 8);
+
+        const __m128i y = _mm_packus_epi16(_mm_packs_epi32(y0, y1), zero);
+        _mm_storel_epi64((__m128i*)(dst + i), y);
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = luma(src[i]);
+}
+
+// Keeps only the red channel
+
+static void to_red(const Color* src, uint8_t* dst, unsigned long long count)
+{
+    unsigned long long i = 0ull;
+#ifdef IMAGE_SSE2_
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    for (; i + 16ull <= count; i += 16ull)
+    {
+        __m128i r0 = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i*)(src + i)), 16), mask);
+        __m128i r1 = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i*)(src + i + 4ull)), 16), mask);
+        __m128i r2 = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i*)(src + i + 8ull)), 16), mask);
+        __m128i r3 = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i*)(src + i + 12ull)), 16), mask);
+
+        const __m128i r = _mm_packus_epi16(_mm_packs_epi32(r0, r1), _mm_packs_epi32(r2, r3));
+        _mm_storeu_si128((__m128i*)(dst + i), r);
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = src[i].R;
+}
+
+// Packs every color into RGB565
+
+static void to_565(const Color* src, uint16_t* dst, unsigned long long count)
+{
+    unsigned long long i = 0ull;
+#ifdef IMAGE_SSE2_
+    const __m128i mask_r = _mm_set1_epi32(0xF800);
+    const __m128i mask_g = _mm_set1_epi32(0x07E0);
+    const __m128i mask_b = _mm_set1_epi32(0x001F);
+    for (; i + 8ull <= count; i += 8ull)
+    {
+        __m128i p[2];
+        for (unsigned k = 0u; k < 2u; k++)
+        {
+            const __m128i v = _mm_loadu_si128((const __m128i*)(src + i + 4ull * k));
+            const __m128i r = _mm_and_si128(_mm_srli_epi32(v, 8), mask_r);
+            const __m128i g = _mm_and_si128(_mm_srli_epi32(v, 5), mask_g);
+            const __m128i b = _mm_and_si128(_mm_srli_epi32(v, 3), mask_b);
+
+            // Sign extend so the signed saturating pack keeps the 16 bits
+            p[k] = _mm_srai_epi32(_mm_slli_epi32(_mm_or_si128(r, _mm_or_si128(g, b)), 16), 16);
+        }
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(p[0], p[1]));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = pack_565(src[i]);
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Format to color kernels
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Adds full alpha, keeping or swapping the channel order
+
+static void from_3_bytes_scalar(const uint8_t* src, Color* dst, unsigned long long count, bool rgb)
+{
+    const unsigned first = rgb ? 2u : 0u;
+    const unsigned last = rgb ? 0u : 2u;
+
+    for (unsigned long long i = 0ull; i < count; i++)
+    {
+        uint8_t* c = (uint8_t*)(dst + i);
+        c[first] = src[3ull * i + 0ull];
+        c[1] = src[3ull * i + 1ull];
+        c[last] = src[3ull * i + 2ull];
+        c[3] = 255u;
+    }
+}
+
+#ifdef IMAGE_DISPATCH_
+// Adds full alpha to 4 pixels per shuffle. Every load reads 16 bytes of which
+// only 12 are used, so it stops 6 pixels early.
+
+IMAGE_TARGET_SSSE3_ static void from_3_bytes_ssse3(const uint8_t* src, Color* dst, unsigned long long count, bool rgb)
+{
+    unsigned long long i = 0ull;
+    const __m128i order = rgb ?
+        _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1) :
+        _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    for (; i + 6ull <= count; i += 4ull)
+    {
+        const __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 3ull * i)), order);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(v, alpha));
+    }
+    from_3_bytes_scalar(src + 3ull * i, dst + i, count - i, rgb);
+}
+#endif
+
+// Replicates the gray value into every channel, alpha is full
+
+static void from_gray(const uint8_t* src, Color* dst, unsigned long long count)
+{
+    unsigned long long i = 0ull;
+#ifdef IMAGE_SSE2_
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    for (; i + 16ull <= count; i += 16ull)
+    {
+        const __m128i g = _mm_loadu_si128((const __m128i*)(src + i));
+        const __m128i lo = _mm_unpacklo_epi8(g, g);
+        const __m128i hi = _mm_unpackhi_epi8(g, g);
+
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_unpacklo_epi16(lo, lo), alpha));
+        _mm_storeu_si128((__m128i*)(dst + i + 4ull), _mm_or_si128(_mm_unpackhi_epi16(lo, lo), alpha));
+        _mm_storeu_si128((__m128i*)(dst + i + 8ull), _mm_or_si128(_mm_unpacklo_epi16(hi, hi), alpha));
+        _mm_storeu_si128((__m128i*)(dst + i + 12ull), _mm_or_si128(_mm_unpackhi_epi16(hi, hi), alpha));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = Color(src[i], src[i], src[i]);
+}
+
+// Stores the value in the red channel, alpha is full
+
+static void from_red(const uint8_t* src, Color* dst, unsigned long long count)
+{
+    unsigned long long i = 0ull;
+#ifdef IMAGE_SSE2_
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16ull <= count; i += 16ull)
+    {
+        const __m128i r = _mm_loadu_si128((const __m128i*)(src + i));
+
+        // Red into the low byte of the high half of every pixel
+        const __m128i lo = _mm_unpacklo_epi8(r, zero);
+        const __m128i hi = _mm_unpackhi_epi8(r, zero);
+
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_unpacklo_epi16(zero, lo), alpha));
+        _mm_storeu_si128((__m128i*)(dst + i + 4ull), _mm_or_si128(_mm_unpackhi_epi16(zero, lo), alpha));
+        _mm_storeu_si128((__m128i*)(dst + i + 8ull), _mm_or_si128(_mm_unpacklo_epi16(zero, hi), alpha));
+        _mm_storeu_si128((__m128i*)(dst + i + 12ull), _mm_or_si128(_mm_unpackhi_epi16(zero, hi), alpha));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = Color(src[i], 0u, 0u);
+}
+
+// Expands RGB565 values into opaque colors
+
+static void from_565(const uint16_t* src, Color* dst, unsigned long long count)
+{
+    unsigned long long i = 0ull;
+#ifdef IMAGE_SSE2_
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask5 = _mm_set1_epi32(0x1F);
+    const __m128i mask6 = _mm_set1_epi32(0x3F);
+    for (; i + 8ull <= count; i += 8ull)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        const __m128i halves[2] = { _mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero) };
+
+        for (unsigned k = 0u; k < 2u; k++)
+        {
+            const __m128i r5 = _mm_and_si128(_mm_srli_epi32(halves[k], 11), mask5);
+            const __m128i g6 = _mm_and_si128(_mm_srli_epi32(halves[k], 5), mask6);
+            const __m128i b5 = _mm_and_si128(halves[k], mask5);
+
+            const __m128i r = _mm_or_si128(_mm_slli_epi32(r5, 3), _mm_srli_epi32(r5, 2));
+            const __m128i g = _mm_or_si128(_mm_slli_epi32(g6, 2), _mm_srli_epi32(g6, 4));
+            const __m128i b = _mm_or_si128(_mm_slli_epi32(b5, 3), _mm_srli_epi32(b5, 2));
+
+            const __m128i c = _mm_or_si128(_mm_or_si128(b, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(r, 16), alpha));
+            _mm_storeu_si128((__m128i*)(dst + i + 4ull * k), c);
+        }
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = unpack_565(src[i]);
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Kernel dispatch
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Kernels with versions for several SIMD levels
+
+struct FormatKernels
+{
+    void (*swap_red_blue)(const Color*, Color*, unsigned long long);
+    void (*to_3_bytes)(const Color*, uint8_t*, unsigned long long, bool);
+    void (*from_3_bytes)(const uint8_t*, Color*, unsigned long long, bool);
+};
+
+// Picks the best version of every kernel for the active SIMD level
+
+static FormatKernels resolve_format_kernels()
+{
+    FormatKernels kernels = { swap_red_blue_scalar, to_3_bytes_scalar, from_3_bytes_scalar };
+#ifdef IMAGE_SSE2_
+    const SIMDLevel level = simd_level();
+    if (level >= SIMD_LEVEL_SSE2)
+        kernels.swap_red_blue = swap_red_blue_sse2;
+#endif
+#ifdef IMAGE_DISPATCH_
+    if (level >= SIMD_LEVEL_SSSE3)
+        kernels = { swap_red_blue_ssse3, to_3_bytes_ssse3, from_3_bytes_ssse3 };
+    if (level >= SIMD_LEVEL_AVX2)
+        kernels.swap_red_blue = swap_red_blue_avx2;
+    if (level >= SIMD_LEVEL_AVX512)
+        kernels.swap_red_blue = swap_red_blue_avx512;
+#endif
+    return kernels;
+}
+
+// Returns the kernels, resolved the first time
+
+static const FormatKernels& format_kernels()
+{
+    static const FormatKernels kernels = resolve_format_kernels();
+    return kernels;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Pixel format functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Returns the number of bytes per pixel of the format
+
+unsigned pixel_format_size(PixelFormat format)
+{
+    switch (format)
+    {
+    case PIXEL_FORMAT_BGRA8:
+    case PIXEL_FORMAT_RGBA8:
+        return 4u;
+    case PIXEL_FORMAT_BGR8:
+    case PIXEL_FORMAT_RGB8:
+        return 3u;
+    case PIXEL_FORMAT_RGB565:
+        return 2u;
+    case PIXEL_FORMAT_GRAY8:
+    case PIXEL_FORMAT_R8:
+        return 1u;
+    }
+    return 0u;
+}
+
+// Converts count colors into the specified format at dst
+
+void convert_to_format(const Color* src, void* dst, unsigned long long count, PixelFormat format)
+{
+    switch (format)
+    {
+    case PIXEL_FORMAT_BGRA8:
+        memmove(dst, (const void*)src, count * sizeof(Color));
+        break;
+    case PIXEL_FORMAT_RGBA8:
+        format_kernels().swap_red_blue(src, (Color*)dst, count);
+        break;
+    case PIXEL_FORMAT_BGR8:
+        format_kernels().to_3_bytes(src, (uint8_t*)dst, count, false);
+        break;
+    case PIXEL_FORMAT_RGB8:
+        format_kernels().to_3_bytes(src, (uint8_t*)dst, count, true);
+        break;
+    case PIXEL_FORMAT_GRAY8:
+        to_gray(src, (uint8_t*)dst, count);
+        break;
+    case PIXEL_FORMAT_R8:
+        to_red(src, (uint8_t*)dst, count);
+        break;
+    case PIXEL_FORMAT_RGB565:
+        to_565(src, (uint16_t*)dst, count);
+        break;
+    }
+}
+
+// Converts count pixels in the specified format at src into colors
+
+void convert_from_format(const void* src, Color* dst, unsigned long long count, PixelFormat format)
+{
+    switch (format)
+    {
+    case PIXEL_FORMAT_BGRA8:
+        memmove((void*)dst, src, count * sizeof(Color));
+        break;
+    case PIXEL_FORMAT_RGBA8:
+        format_kernels().swap_red_blue((const Color*)src, dst, count);
+        break;
+    case PIXEL_FORMAT_BGR8:
+        format_kernels().from_3_bytes((const uint8_t*)src, dst, count, false);
+        break;
+    case PIXEL_FORMAT_RGB8:
+        format_kernels().from_3_bytes((const uint8_t*)src, dst, count, true);
+        break;
+    case PIXEL_FORMAT_GRAY8:
+        from_gray((const uint8_t*)src, dst, count);
+        break;
+    case PIXEL_FORMAT_R8:
+        from_red((const uint8_t*)src, dst, count);
+        break;
+    case PIXEL_FORMAT_RGB565:
+        from_565((const uint16_t*)src, dst, count);
+        break;
+    }
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Image conversion functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Converts the pixels into the specified format at dst, rows are stride bytes
+// apart, or tightly packed if zero. Returns false if the stride is too small.
+
+bool Image::export_pixels(void* dst, PixelFormat format, unsigned long long stride) const
+{
+    const unsigned long long row_bytes = (unsigned long long)width_ * pixel_format_size(format);
+    if (!stride)
+        stride = row_bytes;
+
+    if (stride < row_bytes || (!dst && row_bytes && height_))
+        return false;
+
+    // Tightly packed rows are converted in one go
+    if (stride == row_bytes)
+    {
+        convert_to_format(pixels_, dst, (unsigned long long)width_ * height_, format);
+        return true;
+    }
+
+    for (unsigned row = 0u; row < height_; row++)
+        convert_to_format(pixels_ + (unsigned long long)row * width_, (uint8_t*)dst + row * stride, width_, format);
+
+    return true;
+}
+
+// Resizes the image to width x height and converts into it the pixels in the specified
+// format at src, rows are stride bytes apart, or tightly packed if zero. 
+// Returns false if the stride is too small or the pixels could not be allocated.
+
+bool Image::import_pixels(const void* src, unsigned int width, unsigned int height, PixelFormat format, unsigned long long stride)
+{
+    const unsigned long long row_bytes = (unsigned long long)width * pixel_format_size(format);
+    if (!stride)
+        stride = row_bytes;
+
+    if (stride < row_bytes || (!src && row_bytes && height))
+        return false;
+
+    if (!allocate_pixels(width, height, false))
+        return false;
+
+    if (stride == row_bytes)
+    {
+        convert_from_format(src, pixels_, (unsigned long long)width * height, format);
+        return true;
+    }
+
+    for (unsigned row = 0u; row < height; row++)
+        convert_from_format((const uint8_t*)src + row * stride, pixels_ + (unsigned long long)row * width, width, format);
+
+    return true;
+}
@@ -0,0 +1,213 @@
+#include "PixelImage.h"
+#include "Parallel.h"
+
+#include <cstdint>
+#include <cstring>
+
+#define CONVERT_BLOCK_ 16384u		// Pixels per block of a parallel conversion
+#define CONVERT_MIN_BLOCKS_ 16u		// Minimum blocks converted by each thread
+
+/*
+-------------------------------------------------------------------------------------------------------
+Half float functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+static inline uint32_t float_bits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static inline float bits_float(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Converts the float, rounding to the nearest half, ties to even.
+// Values too large become infinity and NaNs stay NaNs.
+
+Half::Half(float value)
+{
+    uint32_t f = float_bits(value);
+    const uint32_t sign = f & 0x80000000u;
+    f ^= sign;
+
+    uint32_t h;
+    if (f >= 0x47800000u)
+    {
+        // Too large for a half, or infinity or NaN
+        h = f > 0x7F800000u ? 0x7E00u : 0x7C00u;
+    }
+    else if (f < 0x38800000u)
+    {
+        // Subnormal half, the float addition does the rounding
+        const uint32_t magic = 0x3F000000u;
+        h = float_bits(bits_float(f) + bits_float(magic)) - magic;
+    }
+    else
+    {
+        // Normal half, rebias the exponent and round the mantissa
+        const uint32_t odd = (f >> 13) & 1u;
+        f += 0xC8000FFFu + odd;
+        h = f >> 13;
+    }
+
+    bits = (unsigned short)(h | (sign >> 16));
+}
+
+// Converts back to float, exact
+
+Half::operator float() const
+{
+    const uint32_t exponent_mask = 0x7C00u << 13;
+
+    uint32_t f = (bits & 0x7FFFu) << 13;
+    const uint32_t exponent = f & exponent_mask;
+    f += (127u - 15u) << 23;
+
+    if (exponent == exponent_mask)
+        f += (128u - 16u) << 23;    // Infinity or NaN
+    else if (!exponent)
+    {
+        // Subnormal, renormalize through a float subtraction
+        f += 1u << 23;
+        f = float_bits(bits_float(f) - bits_float(113u << 23));
+    }
+
+    return bits_float(f | ((uint32_t)(bits & 0x8000u) << 16));
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Internal helpers
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Converts the span in blocks split across threads, convert(src, dst) does a single pixel
+
+template<typename Src, typename Dst, typename Convert>
+static void convert_span(const Src* src, Dst* dst, unsigned long long count, const Convert& convert)
+{
+    const unsigned blocks = (unsigned)((count + CONVERT_BLOCK_ - 1ull) / CONVERT_BLOCK_);
+
+    parallel_for(blocks, CONVERT_MIN_BLOCKS_, [&](unsigned begin, unsigned end)
+        {
+            const unsigned long long last = (unsigned long long)end * CONVERT_BLOCK_ < count ? (unsigned long long)end * CONVERT_BLOCK_ : count;
+            for (unsigned long long i = (unsigned long long)begin * CONVERT_BLOCK_; i < last; i++)
+                convert(src[i], dst[i]);
+        });
+}
+
+// Maps an 8-bit value to [0, 1]
+
+static inline float unit_float(unsigned char value)
+{
+    return value * (1.f / 255.f);
+}
+
+// Maps a [0, 1] value to 8 bits, rounding and clamping, NaN becomes 0
+
+static inline unsigned char unit_byte(float value)
+{
+    value = value > 0.f ? (value < 1.f ? value : 1.f) : 0.f;
+    return (unsigned char)(value * 255.f + 0.5f);
+}
+
+// Maps a 16-bit value to 8 bits, rounding to nearest
+
+static inline unsigned char short_byte(unsigned short value)
+{
+    return (unsigned char)((value * 255u + 32767u) / 65535u);
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Pixel conversion functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+void convert_pixels(const Color* src, Color* dst, unsigned long long count)
+{
+    memmove((void*)dst, (const void*)src, (size_t)count * sizeof(Color));
+}
+
+void convert_pixels(const Color* src, PixelR8* dst, unsigned long long count)
+{
+    convert_to_format(src, dst, count, PIXEL_FORMAT_R8);
+}
+
+void convert_pixels(const PixelR8* src, Color* dst, unsigned long long count)
+{
+    convert_from_format(src, dst, count, PIXEL_FORMAT_R8);
+}
+
+void convert_pixels(const Color* src, PixelRG8* dst, unsigned long long count)
+{
+    convert_span(src, dst, count, [](const Color& c, PixelRG8& p) { p.R = c.R; p.G = c.G; });
+}
+
+void convert_pixels(const PixelRG8* src, Color* dst, unsigned long long count)
+{
+    convert_span(src, dst, count, [](const PixelRG8& p, Color& c) { c = Color(p.R, p.G, 0u); });
+}
+
+void convert_pixels(const Color* src, PixelRGBA16* dst, unsigned long long count)
+{
+    convert_span(src, dst, count, [](const Color& c, PixelRGBA16& p)
+        {
+            p.R = (unsigned short)(c.R * 257u);
+            p.G = (unsigned short)(c.G * 257u);
+            p.B = (unsigned short)(c.B * 257u);
+            p.A = (unsigned short)(c.A * 257u);
+        });
+}
+
+void convert_pixels(const PixelRGBA16* src, Color* dst, unsigned long long count)
+{
+    convert_span(src, dst, count, [](const PixelRGBA16& p, Color& c)
+        {
+            c = Color(short_byte(p.R), short_byte(p.G), short_byte(p.B), short_byte(p.A));
+        });
+}
+
+void convert_pixels(const Color* src, PixelRGBA16F* dst, unsigned long long count)
+{
+    convert_span(src, dst, count, [](const Color& c, PixelRGBA16F& p)
+        {
+            p.R = Half(unit_float(c.R));
+            p.G = Half(unit_float(c.G));
+            p.B = Half(unit_float(c.B));
+            p.A = Half(unit_float(c.A));
+        });
+}
+
+void convert_pixels(const PixelRGBA16F* src, Color* dst, unsigned long long count)
+{
+    convert_span(src, dst, count, [](const PixelRGBA16F& p, Color& c)
+        {
+            c = Color(unit_byte(p.R), unit_byte(p.G), unit_byte(p.B), unit_byte(p.A));
+        });
+}
+
+void convert_pixels(const Color* src, PixelRGBA32F* dst, unsigned long long count)
+{
+    convert_span(src, dst, count, [](const Color& c, PixelRGBA32F& p)
+        {
+            p.R = unit_float(c.R);
+            p.G = unit_float(c.G);
+            p.B = unit_float(c.B);
+            p.A = unit_float(c.A);
+        });
+}
+
+void convert_pixels(const PixelRGBA32F* src, Color* dst, unsigned long long count)
+{
+    convert_span(src, dst, count, [](const PixelRGBA32F& p, Color& c)
+        {
+            c = Color(unit_byte(p.R), unit_byte(p.G), unit_byte(p.B), unit_byte(p.A));
+        });
+}
@@ -0,0 +1,769 @@
+#include "Rasterizer.h"
+#include "Parallel.h"
+#include "SIMD.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#define RASTER_MAX_SIZE_ 8192u			// Maximum width and height of the target
+#define RASTER_GUARD_BAND_ 1024.f		// Pixels outside the target where triangles are not clipped
+#define RASTER_SUBPIXEL_BITS_ 4			// Fractional bits of the snapped vertex positions
+#define RASTER_NEAR_W_ 1e-5f			// Minimum w kept by the clipping
+#define RASTER_CLIP_PLANES_ 6u			// Near depth, near w and the four guard band sides
+#define RASTER_SETUP_PER_BAND_ 1024u	// Minimum triangles set up by each thread
+
+#define RASTER_SUBPIXEL_ (1 << RASTER_SUBPIXEL_BITS_)
+#define RASTER_MAX_CLIPPED_ (3u + RASTER_CLIP_PLANES_)	// Maximum vertices of a clipped triangle
+
+/*
+-------------------------------------------------------------------------------------------------------
+Internal types
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Attributes interpolated across the triangles: red, green, blue, alpha, u and v
+#define RASTER_ATTRIBUTES_ 6u
+
+// Vertex during clipping, position in clip space
+struct ClipVertex
+{
+    float p[4];
+    float a[RASTER_ATTRIBUTES_];
+};
+
+// Value of a linear function on screen, value at the first vertex plus its slopes
+struct RasterPlane
+{
+    float value;
+    float dx;
+    float dy;
+};
+
+// Triangle after setup, in screen space with clockwise orientation
+
+struct RasterTriangle
+{
+    bool valid;                 // False if it was culled or it is degenerate
+
+    int X[3], Y[3];             // Snapped vertex positions in subpixels
+    int A[3], B[3];             // Edge k opposite to vertex k: E = A (X - Xi) + B (Y - Yi)
+    int bias[3];                // -1 for edges that are not top or left, so E + bias >= 0 is inside
+
+    int min_x, min_y;           // Pixel bounding box, inclusive and inside the target
+    int max_x, max_y;
+
+    float x0, y0;               // Position of the first vertex in pixels
+
+    RasterPlane z;              // Depth
+    RasterPlane iw;             // 1 / w
+    RasterPlane a[RASTER_ATTRIBUTES_];  // Attributes over w
+};
+
+/*
+-------------------------------------------------------------------------------------------------------
+Setup helpers
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Signed distance of the vertex to the clip plane, negative is outside
+
+static inline float plane_distance(const ClipVertex& v, unsigned plane, float kx, float ky)
+{
+    switch (plane)
+    {
+    case 0: return v.p[2];
+    case 1: return v.p[3] - RASTER_NEAR_W_;
+    case 2: return kx * v.p[3] - v.p[0];
+    case 3: return kx * v.p[3] + v.p[0];
+    case 4: return ky * v.p[3] - v.p[1];
+    default: return ky * v.p[3] + v.p[1];
+    }
+}
+
+// Returns a bit for every plane the vertex is outside of
+
+static inline unsigned outcode(const ClipVertex& v, float kx, float ky)
+{
+    unsigned code = 0u;
+    for (unsigned plane = 0u; plane < RASTER_CLIP_PLANES_; plane++)
+        if (plane_distance(v, plane, kx, ky) < 0.f)
+            code |= 1u << plane;
+    return code;
+}
+
+// Clips the polygon against every plane it crosses, returns the number of vertices left
+
+static unsigned clip_polygon(ClipVertex* poly, unsigned n, unsigned planes, float kx, float ky)
+{
+    ClipVertex buffer[RASTER_MAX_CLIPPED_];
+
+    for (unsigned plane = 0u; plane < RASTER_CLIP_PLANES_ && n >= 3u; plane++)
+    {
+        if (!(planes & (1u << plane)))
+            continue;
+
+        unsigned m = 0u;
+        for (unsigned i = 0u; i < n; i++)
+        {
+            const ClipVertex& cur = poly[i];
+            const ClipVertex& next = poly[(i + 1u) % n];
+            const float dc = plane_distance(cur, plane, kx, ky);
+            const float dn = plane_distance(next, plane, kx, ky);
+
+            if (dc >= 0.f)
+                buffer[m++] = cur;
+
+            if ((dc >= 0.f) != (dn >= 0.f))
+            {
+                const float t = dc / (dc - dn);
+                ClipVertex& v = buffer[m++];
+                for (unsigned k = 0u; k < 4u; k++)
+                    v.p[k] = cur.p[k] + t * (next.p[k] - cur.p[k]);
+                for (unsigned k = 0u; k < RASTER_ATTRIBUTES_; k++)
+                    v.a[k] = cur.a[k] + t * (next.a[k] - cur.a[k]);
+            }
+        }
+
+        memcpy(poly, buffer, m * sizeof(ClipVertex));
+        n = m;
+    }
+    return n >= 3u ? n : 0u;
+}
+
+// Fills the clip vertex from the user vertex
+
+static inline void load_vertex(const RasterVertex& in, ClipVertex& out)
+{
+    out.p[0] = in.x;
+    out.p[1] = in.y;
+    out.p[2] = in.z;
+    out.p[3] = in.w;
+    out.a[0] = in.color.R;
+    out.a[1] = in.color.G;
+    out.a[2] = in.color.B;
+    out.a[3] = in.color.A;
+    out.a[4] = in.u;
+    out.a[5] = in.v;
+}
+
+// Computes the linear function with the values at the three vertices
+
+static inline RasterPlane make_plane(float a0, float a1, float a2, float dx1, float dy1, float dx2, float dy2, float inv_det)
+{
+    RasterPlane plane;
+    plane.value = a0;
+    plane.dx = ((a1 - a0) * dy2 - (a2 - a0) * dy1) * inv_det;
+    plane.dy = ((a2 - a0) * dx1 - (a1 - a0) * dx2) * inv_det;
+    return plane;
+}
+
+// Projects and sets up the clipped triangle, marks it invalid if it is culled or empty
+
+static void setup_triangle(const ClipVertex* v0, const ClipVertex* v1, const ClipVertex* v2, unsigned width, unsigned height, RasterCull cull, RasterTriangle& tri)
+{
+    tri.valid = false;
+
+    const ClipVertex* v[3] = { v0, v1, v2 };
+    float sx[3], sy[3], sz[3], iw[3];
+    int X[3], Y[3];
+
+    for (unsigned k = 0u; k < 3u; k++)
+    {
+        iw[k] = 1.f / v[k]->p[3];
+        sx[k] = (v[k]->p[0] * iw[k] * 0.5f + 0.5f) * width;
+        sy[k] = (0.5f - v[k]->p[1] * iw[k] * 0.5f) * height;
+        sz[k] = v[k]->p[2] * iw[k];
+
+        X[k] = (int)lrintf(sx[k] * RASTER_SUBPIXEL_);
+        Y[k] = (int)lrintf(sy[k] * RASTER_SUBPIXEL_);
+    }
+
+    // Positive area is clockwise on screen, with y pointing down
+    long long area = (long long)(X[1] - X[0]) * (Y[2] - Y[0]) - (long long)(Y[1] - Y[0]) * (X[2] - X[0]);
+    if (!area || (cull == RASTER_CULL_BACK && area < 0) || (cull == RASTER_CULL_FRONT && area > 0))
+        return;
+
+    unsigned order[3] = { 0u, 1u, 2u };
+    if (area < 0)
+    {
+        order[1] = 2u;
+        order[2] = 1u;
+    }
+
+    for (unsigned k = 0u; k < 3u; k++)
+    {
+        tri.X[k] = X[order[k]];
+        tri.Y[k] = Y[order[k]];
+    }
+
+    // Pixel bounding box of the centers inside the triangle
+    const int min_X = tri.X[0] < tri.X[1] ? (tri.X[0] < tri.X[2] ? tri.X[0] : tri.X[2]) : (tri.X[1] < tri.X[2] ? tri.X[1] : tri.X[2]);
+    const int max_X = tri.X[0] > tri.X[1] ? (tri.X[0] > tri.X[2] ? tri.X[0] : tri.X[2]) : (tri.X[1] > tri.X[2] ? tri.X[1] : tri.X[2]);
+    const int min_Y = tri.Y[0] < tri.Y[1] ? (tri.Y[0] < tri.Y[2] ? tri.Y[0] : tri.Y[2]) : (tri.Y[1] < tri.Y[2] ? tri.Y[1] : tri.Y[2]);
+    const int max_Y = tri.Y[0] > tri.Y[1] ? (tri.Y[0] > tri.Y[2] ? tri.Y[0] : tri.Y[2]) : (tri.Y[1] > tri.Y[2] ? tri.Y[1] : tri.Y[2]);
+
+    const int half = RASTER_SUBPIXEL_ / 2;
+    tri.min_x = (min_X - half + RASTER_SUBPIXEL_ - 1) >> RASTER_SUBPIXEL_BITS_;
+    tri.max_x = (max_X - half) >> RASTER_SUBPIXEL_BITS_;
+    tri.min_y = (min_Y - half + RASTER_SUBPIXEL_ - 1) >> RASTER_SUBPIXEL_BITS_;
+    tri.max_y = (max_Y - half) >> RASTER_SUBPIXEL_BITS_;
+
+    if (tri.min_x < 0) tri.min_x = 0;
+    if (tri.min_y < 0) tri.min_y = 0;
+    if (tri.max_x > (int)width - 1) tri.max_x = (int)width - 1;
+    if (tri.max_y > (int)height - 1) tri.max_y = (int)height - 1;
+
+    if (tri.min_x > tri.max_x || tri.min_y > tri.max_y)
+        return;
+
+    // Edge functions with the top-left fill rule
+    for (unsigned k = 0u; k < 3u; k++)
+    {
+        const unsigned i = (k + 1u) % 3u, j = (k + 2u) % 3u;
+        tri.A[k] = tri.Y[i] - tri.Y[j];
+        tri.B[k] = tri.X[j] - tri.X[i];
+
+        const bool top_left = tri.A[k] > 0 || (tri.A[k] == 0 && tri.B[k] > 0);
+        tri.bias[k] = top_left ? 0 : -1;
+    }
+
+    // Interpolation planes, relative to the first vertex
+    const unsigned o0 = order[0], o1 = order[1], o2 = order[2];
+    const float x0 = tri.X[0] * (1.f / RASTER_SUBPIXEL_), y0 = tri.Y[0] * (1.f / RASTER_SUBPIXEL_);
+    const float dx1 = tri.X[1] * (1.f / RASTER_SUBPIXEL_) - x0, dy1 = tri.Y[1] * (1.f / RASTER_SUBPIXEL_) - y0;
+    const float dx2 = tri.X[2] * (1.f / RASTER_SUBPIXEL_) - x0, dy2 = tri.Y[2] * (1.f / RASTER_SUBPIXEL_) - y0;
+    const float inv_det = 1.f / (dx1 * dy2 - dx2 * dy1);
+
+    tri.x0 = x0;
+    tri.y0 = y0;
+    tri.z = make_plane(sz[o0], sz[o1], sz[o2], dx1, dy1, dx2, dy2, inv_det);
+    tri.iw = make_plane(iw[o0], iw[o1], iw[o2], dx1, dy1, dx2, dy2, inv_det);
+    for (unsigned k = 0u; k < RASTER_ATTRIBUTES_; k++)
+        tri.a[k] = make_plane(v[o0]->a[k] * iw[o0], v[o1]->a[k] * iw[o1], v[o2]->a[k] * iw[o2], dx1, dy1, dx2, dy2, inv_det);
+
+    tri.valid = true;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Rasterization helpers
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Everything the tile workers need to shade pixels
+
+struct RasterContext
+{
+    const RasterTriangle* triangles;
+    const unsigned* bin_offsets;
+    const unsigned* bins;
+
+    Color* pixels;
+    float* depth;
+    unsigned width;
+    unsigned height;
+    unsigned tiles_x;
+
+    const Color* texture;
+    unsigned texture_width;
+    unsigned texture_height;
+};
+
+// Evaluates the linear function at the pixel offset from the first vertex
+
+static inline float eval_plane(const RasterPlane& plane, float fx, float fy)
+{
+    return plane.value + plane.dx * fx + plane.dy * fy;
+}
+
+// Clamps a color channel value and converts it
+
+static inline unsigned char channel(float value)
+{
+    return (unsigned char)(value > 0.f ? (value < 255.f ? value + 0.5f : 255.f) : 0.f);
+}
+
+// Shades the pixel if it passes the depth test
+
+static inline void shade_pixel(const RasterContext& ctx, const RasterTriangle& tri, int x, int y)
+{
+    const float fx = x + 0.5f - tri.x0;
+    const float fy = y + 0.5f - tri.y0;
+    const unsigned long long index = (unsigned long long)y * ctx.width + x;
+
+    const float z = eval_plane(tri.z, fx, fy);
+    if (z < 0.f || z > 1.f)
+        return;
+
+    if (ctx.depth)
+    {
+        if (!(z < ctx.depth[index]))
+            return;
+        ctx.depth[index] = z;
+    }
+
+    // Perspective correction
+    const float w = 1.f / eval_plane(tri.iw, fx, fy);
+
+    float r = eval_plane(tri.a[0], fx, fy) * w;
+    float g = eval_plane(tri.a[1], fx, fy) * w;
+    float b = eval_plane(tri.a[2], fx, fy) * w;
+    float a = eval_plane(tri.a[3], fx, fy) * w;
+
+    if (ctx.texture)
+    {
+        float u = eval_plane(tri.a[4], fx, fy) * w;
+        float v = eval_plane(tri.a[5], fx, fy) * w;
+        u -= floorf(u);
+        v -= floorf(v);
+
+        unsigned tx = (unsigned)(u * ctx.texture_width);
+        unsigned ty = (unsigned)(v * ctx.texture_height);
+        if (tx >= ctx.texture_width) tx = ctx.texture_width - 1u;
+        if (ty >= ctx.texture_height) ty = ctx.texture_height - 1u;
+
+        const Color texel = ctx.texture[(unsigned long long)ty * ctx.texture_width + tx];
+        r *= texel.R * (1.f / 255.f);
+        g *= texel.G * (1.f / 255.f);
+        b *= texel.B * (1.f / 255.f);
+        a *= texel.A * (1.f / 255.f);
+    }
+
+    ctx.pixels[index] = Color(channel(r), channel(g), channel(b), channel(a));
+}
+
+// Rasterizes the triangle inside the rectangle of pixels
+
+static void raster_rect(const RasterContext& ctx, const RasterTriangle& tri, int x0, int y0, int x1, int y1)
+{
+    int row_e[3], step_x[3], step_y[3];
+
+    for (unsigned k = 0u; k < 3u; k++)
+    {
+        const unsigned i = (k + 1u) % 3u;
+        const long long A = tri.A[k], B = tri.B[k];
+
+        // Edge function at the centers of the rectangle corners
+        const long long cx0 = (long long)x0 * RASTER_SUBPIXEL_ + RASTER_SUBPIXEL_ / 2 - tri.X[i];
+        const long long cx1 = (long long)x1 * RASTER_SUBPIXEL_ + RASTER_SUBPIXEL_ / 2 - tri.X[i];
+        const long long cy0 = (long long)y0 * RASTER_SUBPIXEL_ + RASTER_SUBPIXEL_ / 2 - tri.Y[i];
+        const long long cy1 = (long long)y1 * RASTER_SUBPIXEL_ + RASTER_SUBPIXEL_ / 2 - tri.Y[i];
+
+        const long long e00 = A * cx0 + B * cy0 + tri.bias[k];
+        const long long e10 = A * cx1 + B * cy0 + tri.bias[k];
+        const long long e01 = A * cx0 + B * cy1 + tri.bias[k];
+        const long long e11 = A * cx1 + B * cy1 + tri.bias[k];
+
+        const long long lo = e00 < e10 ? (e00 < e01 ? (e00 < e11 ? e00 : e11) : (e01 < e11 ? e01 : e11)) : (e10 < e01 ? (e10 < e11 ? e10 : e11) : (e01 < e11 ? e01 : e11));
+        const long long hi = e00 > e10 ? (e00 > e01 ? (e00 > e11 ? e00 : e11) : (e01 > e11 ? e01 : e11)) : (e10 > e01 ? (e10 > e11 ? e10 : e11) : (e01 > e11 ? e01 : e11));
+
+        // Completely outside this edge
+        if (hi < 0)
+            return;
+
+        // Completely inside this edge, it does not need testing
+        if (lo >= 0)
+        {
+            row_e[k] = step_x[k] = step_y[k] = 0;
+            continue;
+        }
+
+        // The edge crosses the rectangle so the values fit in 32 bits
+        row_e[k] = (int)e00;
+        step_x[k] = (int)(A * RASTER_SUBPIXEL_);
+        step_y[k] = (int)(B * RASTER_SUBPIXEL_);
+    }
+
+#ifdef IMAGE_SSE2_
+    // Edge values of 4 consecutive pixels and their step
+    __m128i step4[3], offset[3];
+    for (unsigned k = 0u; k < 3u; k++)
+    {
+        step4[k] = _mm_set1_epi32(4 * step_x[k]);
+        offset[k] = _mm_setr_epi32(0, step_x[k], 2 * step_x[k], 3 * step_x[k]);
+    }
+#endif
+
+    for (int y = y0; y <= y1; y++)
+    {
+#ifdef IMAGE_SSE2_
+        __m128i e0 = _mm_add_epi32(_mm_set1_epi32(row_e[0]), offset[0]);
+        __m128i e1 = _mm_add_epi32(_mm_set1_epi32(row_e[1]), offset[1]);
+        __m128i e2 = _mm_add_epi32(_mm_set1_epi32(row_e[2]), offset[2]);
+
+        for (int x = x0; x <= x1; x += 4)
+        {
+            // Sign bit set in any edge means outside
+            const __m128i outside = _mm_or_si128(_mm_or_si128(e0, e1), e2);
+            unsigned mask = ~(unsigned)_mm_movemask_ps(_mm_castsi128_ps(outside)) & 0xFu;
+
+            if (x1 - x < 3)
+                mask &= (1u << (x1 - x + 1)) - 1u;
+
+            if (mask)
+                for (unsigned lane = 0u; lane < 4u; lane++)
+                    if (mask & (1u << lane))
+                        shade_pixel(ctx, tri, x + (int)lane, y);
+
+            e0 = _mm_add_epi32(e0, step4[0]);
+            e1 = _mm_add_epi32(e1, step4[1]);
+            e2 = _mm_add_epi32(e2, step4[2]);
+        }
+#else
+        int e0 = row_e[0], e1 = row_e[1], e2 = row_e[2];
+        for (int x = x0; x <= x1; x++)
+        {
+            if ((e0 | e1 | e2) >= 0)
+                shade_pixel(ctx, tri, x, y);
+
+            e0 += step_x[0];
+            e1 += step_x[1];
+            e2 += step_x[2];
+        }
+#endif
+        row_e[0] += step_y[0];
+        row_e[1] += step_y[1];
+        row_e[2] += step_y[2];
+    }
+}
+
+// Rasterizes every triangle binned to the tile, in draw order
+
+static void raster_tile(const RasterContext& ctx, unsigned tile)
+{
+    const int tx0 = (int)((tile % ctx.tiles_x) * RASTER_TILE_SIZE_);
+    const int ty0 = (int)((tile / ctx.tiles_x) * RASTER_TILE_SIZE_);
+    const int tx1 = tx0 + (int)RASTER_TILE_SIZE_ - 1 < (int)ctx.width - 1 ? tx0 + (int)RASTER_TILE_SIZE_ - 1 : (int)ctx.width - 1;
+    const int ty1 = ty0 + (int)RASTER_TILE_SIZE_ - 1 < (int)ctx.height - 1 ? ty0 + (int)RASTER_TILE_SIZE_ - 1 : (int)ctx.height - 1;
+
+    for (unsigned b = ctx.bin_offsets[tile]; b < ctx.bin_offsets[tile + 1u]; b++)
+    {
+        const RasterTriangle& tri = ctx.triangles[ctx.bins[b]];
+
+        const int x0 = tri.min_x > tx0 ? tri.min_x : tx0;
+        const int y0 = tri.min_y > ty0 ? tri.min_y : ty0;
+        const int x1 = tri.max_x < tx1 ? tri.max_x : tx1;
+        const int y1 = tri.max_y < ty1 ? tri.max_y : ty1;
+
+        if (x0 <= x1 && y0 <= y1)
+            raster_rect(ctx, tri, x0, y0, x1, y1);
+    }
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Constructors / Destructors
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Creates a rasterizer drawing into the target
+
+Rasterizer::Rasterizer(Image* target, bool depth)
+{
+    if (!set_target(target, depth))
+        throw "Could not set the rasterizer target";
+}
+
+// Frees the depth buffer and the internal arrays
+
+Rasterizer::~Rasterizer()
+{
+    free(depth_);
+    free(triangles_);
+    free(bin_offsets_);
+    free(bins_);
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Settings
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Sets the image drawn into and allocates a depth buffer of its size if requested.
+// It must be called again if the target is resized. Returns false if out of memory.
+
+bool Rasterizer::set_target(Image* target, bool depth)
+{
+    free(depth_);
+    depth_ = nullptr;
+    target_ = nullptr;
+    width_ = height_ = 0u;
+
+    if (!target)
+        return true;
+
+    if (target->width() > RASTER_MAX_SIZE_ || target->height() > RASTER_MAX_SIZE_)
+        return false;
+
+    const unsigned long long size = (unsigned long long)target->width() * target->height();
+    if (depth && size)
+    {
+        depth_ = (float*)malloc((size_t)size * sizeof(float));
+        if (!depth_)
+            return false;
+
+        for (unsigned long long i = 0ull; i < size; i++)
+            depth_[i] = 1.f;
+    }
+
+    target_ = target;
+    width_ = target->width();
+    height_ = target->height();
+    return true;
+}
+
+// Enables or disables the depth test, only works if there is a depth buffer
+
+void Rasterizer::set_depth_test(bool enable)
+{
+    depth_test_ = enable;
+}
+
+// Sets the texture modulating the vertex colors, nullptr for none
+
+void Rasterizer::set_texture(const Image* texture)
+{
+    texture_ = texture;
+}
+
+// Sets which triangles are discarded by their orientation on screen
+
+void Rasterizer::set_cull(RasterCull cull)
+{
+    cull_ = cull;
+}
+
+// Returns the depth buffer, nullptr if there is none
+
+const float* Rasterizer::depth() const
+{
+    return depth_;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Drawing
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Fills the target with the color and the depth buffer with the depth
+
+void Rasterizer::clear(Color color, float depth)
+{
+    if (!target_)
+        return;
+
+    target_->fill(color);
+
+    if (depth_)
+    {
+        const unsigned long long size = (unsigned long long)width_ * height_;
+        for (unsigned long long i = 0ull; i < size; i++)
+            depth_[i] = depth;
+    }
+}
+
+// Draws a list of triangles, every 3 consecutive vertices form a triangle
+
+void Rasterizer::draw(const RasterVertex* vertices, unsigned int vertex_count)
+{
+    draw_triangles(vertices, nullptr, vertex_count / 3u);
+}
+
+// Draws a list of triangles, every 3 consecutive indices form a triangle
+
+void Rasterizer::draw_indexed(const RasterVertex* vertices, const unsigned int* indices, unsigned int index_count)
+{
+    draw_triangles(vertices, indices, index_count / 3u);
+}
+
+// Sets up, bins and rasterizes the triangles given by the indices, or by consecutive vertices if nullptr
+
+void Rasterizer::draw_triangles(const RasterVertex* vertices, const unsigned int* indices, unsigned int triangle_count)
+{
+    if (!target_ || !triangle_count)
+        return;
+
+    // Follow the target if it was resized
+    if (target_->width() != width_ || target_->height() != height_)
+        if (!set_target(target_, depth_ != nullptr))
+            return;
+
+    if (!width_ || !height_)
+        return;
+
+    const float kx = 1.f + 2.f * RASTER_GUARD_BAND_ / width_;
+    const float ky = 1.f + 2.f * RASTER_GUARD_BAND_ / height_;
+
+    // First pass, count the triangles left after clipping
+    unsigned* counts = (unsigned*)malloc(((size_t)triangle_count + 1u) * sizeof(unsigned));
+    if (!counts)
+        throw "Could not allocate rasterizer memory";
+
+    parallel_for(triangle_count, RASTER_SETUP_PER_BAND_, [&](unsigned begin, unsigned end)
+        {
+            ClipVertex poly[RASTER_MAX_CLIPPED_];
+            for (unsigned t = begin; t < end; t++)
+            {
+                unsigned codes[3];
+                for (unsigned k = 0u; k < 3u; k++)
+                {
+                    load_vertex(vertices[indices ? indices[3u * t + k] : 3u * t + k], poly[k]);
+                    codes[k] = outcode(poly[k], kx, ky);
+                }
+
+                if (codes[0] & codes[1] & codes[2])
+                    counts[t] = 0u;
+                else if (!(codes[0] | codes[1] | codes[2]))
+                    counts[t] = 1u;
+                else
+                {
+                    const unsigned n = clip_polygon(poly, 3u, codes[0] | codes[1] | codes[2], kx, ky);
+                    counts[t] = n ? n - 2u : 0u;
+                }
+            }
+        });
+
+    // Offsets of the set up triangles of every input triangle
+    unsigned total = 0u;
+    for (unsigned t = 0u; t < triangle_count; t++)
+    {
+        const unsigned count = counts[t];
+        counts[t] = total;
+        total += count;
+    }
+    counts[triangle_count] = total;
+
+    if (total > triangle_capacity_)
+    {
+        free(triangles_);
+        triangles_ = (RasterTriangle*)malloc((size_t)total * sizeof(RasterTriangle));
+        triangle_capacity_ = triangles_ ? total : 0u;
+        if (!triangles_)
+        {
+            free(counts);
+            throw "Could not allocate rasterizer memory";
+        }
+    }
+
+    // Second pass, clip again where needed and set up the triangles
+    RasterTriangle* triangles = triangles_;
+    const unsigned width = width_, height = height_;
+    const RasterCull cull = cull_;
+    parallel_for(triangle_count, RASTER_SETUP_PER_BAND_, [&](unsigned begin, unsigned end)
+        {
+            ClipVertex poly[RASTER_MAX_CLIPPED_];
+            for (unsigned t = begin; t < end; t++)
+            {
+                const unsigned first = counts[t], n_triangles = counts[t + 1u] - first;
+                if (!n_triangles)
+                    continue;
+
+                unsigned codes = 0u;
+                for (unsigned k = 0u; k < 3u; k++)
+                {
+                    load_vertex(vertices[indices ? indices[3u * t + k] : 3u * t + k], poly[k]);
+                    codes |= outcode(poly[k], kx, ky);
+                }
+
+                if (codes)
+                    clip_polygon(poly, 3u, codes, kx, ky);
+
+                // Triangle fan over the clipped polygon
+                for (unsigned k = 0u; k < n_triangles; k++)
+                    setup_triangle(&poly[0], &poly[k + 1u], &poly[k + 2u], width, height, cull, triangles[first + k]);
+            }
+        });
+
+    free(counts);
+
+    // Binning, count the triangles of every tile and then store their indices in order
+    const unsigned tiles_x = (width_ + RASTER_TILE_SIZE_ - 1u) / RASTER_TILE_SIZE_;
+    const unsigned tiles_y = (height_ + RASTER_TILE_SIZE_ - 1u) / RASTER_TILE_SIZE_;
+    const unsigned n_tiles = tiles_x * tiles_y;
+
+    if (!bin_offsets_)
+    {
+        bin_offsets_ = (unsigned*)malloc(((size_t)RASTER_MAX_SIZE_ / RASTER_TILE_SIZE_) * (RASTER_MAX_SIZE_ / RASTER_TILE_SIZE_) * sizeof(unsigned) + sizeof(unsigned));
+        if (!bin_offsets_)
+            throw "Could not allocate rasterizer memory";
+    }
+    memset(bin_offsets_, 0, ((size_t)n_tiles + 1u) * sizeof(unsigned));
+
+    unsigned long long n_entries = 0ull;
+    for (unsigned t = 0u; t < total; t++)
+    {
+        const RasterTriangle& tri = triangles_[t];
+        if (!tri.valid)
+            continue;
+
+        for (int ty = tri.min_y / (int)RASTER_TILE_SIZE_; ty <= tri.max_y / (int)RASTER_TILE_SIZE_; ty++)
+            for (int tx = tri.min_x / (int)RASTER_TILE_SIZE_; tx <= tri.max_x / (int)RASTER_TILE_SIZE_; tx++)
+                bin_offsets_[ty * tiles_x + tx + 1u]++;
+
+        n_entries += (unsigned long long)(tri.max_y / RASTER_TILE_SIZE_ - tri.min_y / RASTER_TILE_SIZE_ + 1) * (tri.max_x / RASTER_TILE_SIZE_ - tri.min_x / RASTER_TILE_SIZE_ + 1);
+    }
+
+    if (n_entries > 0xFFFFFFFFull)
+        throw "Too many triangles in a single draw call";
+
+    if (n_entries > bin_capacity_)
+    {
+        free(bins_);
+        bins_ = (unsigned*)malloc((size_t)n_entries * sizeof(unsigned));
+        bin_capacity_ = bins_ ? (unsigned)n_entries : 0u;
+        if (!bins_)
+            throw "Could not allocate rasterizer memory";
+    }
+
+    for (unsigned tile = 0u; tile < n_tiles; tile++)
+        bin_offsets_[tile + 1u] += bin_offsets_[tile];
+
+    // Write positions start at the tile offsets and end at the next ones
+    unsigned* cursor = (unsigned*)malloc((size_t)n_tiles * sizeof(unsigned));
+    if (!cursor)
+        throw "Could not allocate rasterizer memory";
+    memcpy(cursor, bin_offsets_, (size_t)n_tiles * sizeof(unsigned));
+
+    for (unsigned t = 0u; t < total; t++)
+    {
+        const RasterTriangle& tri = triangles_[t];
+        if (!tri.valid)
+            continue;
+
+        for (int ty = tri.min_y / (int)RASTER_TILE_SIZE_; ty <= tri.max_y / (int)RASTER_TILE_SIZE_; ty++)
+            for (int tx = tri.min_x / (int)RASTER_TILE_SIZE_; tx <= tri.max_x / (int)RASTER_TILE_SIZE_; tx++)
+                bins_[cursor[ty * tiles_x + tx]++] = t;
+    }
+    free(cursor);
+
+    // Rasterization, every worker takes the next tile until none are left
+    RasterContext ctx;
+    ctx.triangles = triangles_;
+    ctx.bin_offsets = bin_offsets_;
+    ctx.bins = bins_;
+    ctx.pixels = target_->pixels();
+    ctx.depth = depth_test_ ? depth_ : nullptr;
+    ctx.width = width_;
+    ctx.height = height_;
+    ctx.tiles_x = tiles_x;
+    ctx.texture = texture_ && texture_->width() && texture_->height() ? texture_->pixels() : nullptr;
+    ctx.texture_width = ctx.texture ? texture_->width() : 0u;
+    ctx.texture_height = ctx.texture ? texture_->height() : 0u;
+
+    volatile long long next_tile = 0;
+    parallel_for(parallel_threads(), 1u, [&](unsigned, unsigned)
+        {
+            for (;;)
+            {
+                const long long tile = atomic_add(&next_tile, 1) - 1;
+                if (tile >= (long long)n_tiles)
+                    break;
+
+                if (ctx.bin_offsets[tile] != ctx.bin_offsets[tile + 1])
+                    raster_tile(ctx, (unsigned)tile);
+            }
+        });
+}
@@ -0,0 +1,154 @@
+#include "SIMD.h"
+
+#ifdef IMAGE_DISPATCH_
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#include <cstdlib>
+
+/*
+-------------------------------------------------------------------------------------------------------
+Processor detection
+-------------------------------------------------------------------------------------------------------
+*/
+
+#ifdef IMAGE_DISPATCH_
+// Runs the cpuid instruction, registers in EAX, EBX, ECX, EDX order
+
+static void cpuid(unsigned leaf, unsigned subleaf, unsigned* regs)
+{
+#ifdef _MSC_VER
+    int values[4];
+    __cpuidex(values, (int)leaf, (int)subleaf);
+    for (unsigned i = 0u; i < 4u; i++)
+        regs[i] = (unsigned)values[i];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Returns the register states the operating system saves, XCR0
+
+static unsigned long long xgetbv0()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (unsigned long long)hi << 32 | lo;
+#endif
+}
+#endif
+
+// Finds the highest level supported by the processor and the operating system.
+// The wider registers are only usable if the system saves them on context switches.
+
+static SIMDLevel detect_level()
+{
+#ifdef IMAGE_DISPATCH_
+    unsigned regs[4];
+    cpuid(0u, 0u, regs);
+    const unsigned max_leaf = regs[0];
+
+    cpuid(1u, 0u, regs);
+    if (!(regs[3] & 1u << 26))
+        return SIMD_LEVEL_SCALAR;
+    if (!(regs[2] & 1u << 9))
+        return SIMD_LEVEL_SSE2;
+
+    // AVX, and the system saving XMM and YMM registers
+    const bool osxsave = regs[2] & 1u << 27 && regs[2] & 1u << 28;
+    const unsigned long long xcr0 = osxsave ? xgetbv0() : 0ull;
+    if (max_leaf < 7u || (xcr0 & 0x6ull) != 0x6ull)
+        return SIMD_LEVEL_SSSE3;
+
+    cpuid(7u, 0u, regs);
+    if (!(regs[1] & 1u << 5))
+        return SIMD_LEVEL_SSSE3;
+
+    // AVX-512F and BW, and the system saving the mask and ZMM registers
+    if (!(regs[1] & 1u << 16) || !(regs[1] & 1u << 30) || (xcr0 & 0xE6ull) != 0xE6ull)
+        return SIMD_LEVEL_AVX2;
+
+    return SIMD_LEVEL_AVX512;
+#elif defined(IMAGE_SSE2_)
+    return SIMD_LEVEL_SSE2;
+#else
+    return SIMD_LEVEL_SCALAR;
+#endif
+}
+
+// Compares the names ignoring case
+
+static bool same_name(const char* a, const char* b)
+{
+    for (; *a && *b; a++, b++)
+    {
+        const char ca = *a >= 'A' && *a <= 'Z' ? *a - 'A' + 'a' : *a;
+        if (ca != *b)
+            return false;
+    }
+    return *a == *b;
+}
+
+// Lowers the supported level to the one in IMAGE_SIMD_LEVEL, if set and valid
+
+static SIMDLevel requested_level(SIMDLevel supported)
+{
+    const char* name = getenv("IMAGE_SIMD_LEVEL");
+    if (!name)
+        return supported;
+
+    for (unsigned level = SIMD_LEVEL_SCALAR; level <= SIMD_LEVEL_AVX512; level++)
+        if (same_name(name, simd_level_name((SIMDLevel)level)))
+            return level < supported ? (SIMDLevel)level : supported;
+
+    return supported;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+SIMD level functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Returns the level used by the kernels, the supported one unless lowered by IMAGE_SIMD_LEVEL
+
+SIMDLevel simd_level()
+{
+    static const SIMDLevel level = requested_level(simd_supported_level());
+    return level;
+}
+
+// Returns the highest level supported by both the processor and the build
+
+SIMDLevel simd_supported_level()
+{
+    static const SIMDLevel level = detect_level();
+    return level;
+}
+
+// Returns the lowercase name of the level, as accepted by IMAGE_SIMD_LEVEL
+
+const char* simd_level_name(SIMDLevel level)
+{
+    switch (level)
+    {
+    case SIMD_LEVEL_SCALAR:
+        return "scalar";
+    case SIMD_LEVEL_SSE2:
+        return "sse2";
+    case SIMD_LEVEL_SSSE3:
+        return "ssse3";
+    case SIMD_LEVEL_AVX2:
+        return "avx2";
+    case SIMD_LEVEL_AVX512:
+        return "avx512";
+    }
+    return "unknown";
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "SIMDLevel.h"
+
+/* SIMD HELPERS HEADER (PRIVATE)
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+Internal header that detects at compile time which vector instructions
+can be used by the image kernels, and includes their intrinsics.
+
+SSE2 is part of every x86-64 processor, so it is always enabled there.
+Every kernel also has a scalar version for other architectures.
+
+SSSE3, AVX2 and AVX-512 kernels are compiled into their own functions,
+marked with the target macros below, so the rest of the library does not
+require them. They must only be called when simd_level() allows them,
+through function pointers resolved once, see SIMDLevel.h. AVX kernels
+clear the upper halves of the registers with _mm256_zeroupper() before
+handing their last pixels to an SSE version, mixing them is slow otherwise.
+-------------------------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------------------
+*/
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGE_SSE2_ 1
+#include <emmintrin.h>
+#endif
+
+#if defined(IMAGE_SSE2_) && (defined(_MSC_VER) || defined(__GNUC__))
+#define IMAGE_DISPATCH_ 1 // Whether the wider kernels are compiled
+#include <immintrin.h>
+#endif
+
+// MSVC accepts every intrinsic anywhere, GCC and Clang need the target of the function
+#if defined(IMAGE_DISPATCH_) && defined(__GNUC__)
+#define IMAGE_TARGET_SSSE3_ __attribute__((target("ssse3")))
+#define IMAGE_TARGET_AVX2_ __attribute__((target("avx2")))
+#define IMAGE_TARGET_AVX512_ __attribute__((target("avx512f,avx512bw")))
+#else
+#define IMAGE_TARGET_SSSE3_
+#define IMAGE_TARGET_AVX2_
+#define IMAGE_TARGET_AVX512_
+#endif
@@ -0,0 +1,671 @@
+#include "Image.h"
+#include "Parallel.h"
+#include "SIMD.h"
+
+#include <cstdint>
+#include <cstring>
+
+#define YUV_BAND_PIXELS_ 65536u		// Minimum pixels converted by each thread
+#define YUV_CHUNK_ 1024u			// Pixels of a row converted at once through the stack buffers
+
+#define YUV_ENCODE_BITS_ 14			// Fraction bits of the export weights
+#define YUV_DECODE_BITS_ 17			// Fraction bits of the import products, 13 of the weights and 4 of the samples
+
+/*
+-------------------------------------------------------------------------------------------------------
+Coefficients
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Fixed point weights of a matrix and range. The export weights go in B, G, R, 0
+// order to match the colors, the chroma ones apply to sums of four pixels.
+
+struct YUVCoefficients
+{
+    int16_t luma[4];        // Luma weights, the G one makes them add up exactly
+    int16_t cb[4];          // U weights, adding up to zero so grays stay neutral
+    int16_t cr[4];          // V weights, adding up to zero so grays stay neutral
+    int32_t luma_offset;    // Luma of black, 16 or 0
+
+    int16_t scale;          // Weight of the luma on import
+    int16_t b_cb;           // Weight of U in the blue channel
+    int16_t g_cb;           // Weight of U in the green channel, negative
+    int16_t g_cr;           // Weight of V in the green channel, negative
+    int16_t r_cr;           // Weight of V in the red channel
+};
+
+// Rounds to the nearest integer, halves away from zero
+
+static inline int16_t round_weight(double value)
+{
+    return (int16_t)(value < 0.0 ? value - 0.5 : value + 0.5);
+}
+
+// Computes the weights of the matrix and range
+
+static YUVCoefficients yuv_coefficients(YUVMatrix matrix, YUVRange range)
+{
+    const double kr = matrix == YUV_MATRIX_BT601 ? 0.299 : 0.2126;
+    const double kb = matrix == YUV_MATRIX_BT601 ? 0.114 : 0.0722;
+    const double kg = 1.0 - kr - kb;
+
+    const bool limited = range == YUV_RANGE_LIMITED;
+    const double luma_range = limited ? 219.0 / 255.0 : 1.0;
+    const double chroma_range = limited ? 224.0 / 255.0 : 1.0;
+
+    YUVCoefficients k;
+    const double one = (double)(1 << YUV_ENCODE_BITS_);
+
+    k.luma[0] = round_weight(kb * luma_range * one);
+    k.luma[2] = round_weight(kr * luma_range * one);
+    k.luma[1] = (int16_t)(round_weight(luma_range * one) - k.luma[0] - k.luma[2]);
+    k.luma[3] = 0;
+
+    // Chroma from sums of four pixels, the quarter goes in the final shift
+    k.cb[0] = round_weight(0.5 * chroma_range * one);
+    k.cb[2] = round_weight(-0.5 * kr / (1.0 - kb) * chroma_range * one);
+    k.cb[1] = (int16_t)(-k.cb[0] - k.cb[2]);
+    k.cb[3] = 0;
+
+    k.cr[2] = round_weight(0.5 * chroma_range * one);
+    k.cr[0] = round_weight(-0.5 * kb / (1.0 - kr) * chroma_range * one);
+    k.cr[1] = (int16_t)(-k.cr[0] - k.cr[2]);
+    k.cr[3] = 0;
+
+    k.luma_offset = limited ? 16 : 0;
+
+    const double unit = (double)(1 << (YUV_DECODE_BITS_ - 4));
+    k.scale = round_weight(unit / luma_range);
+    k.b_cb = round_weight(2.0 * (1.0 - kb) / chroma_range * unit);
+    k.g_cb = round_weight(-2.0 * kb * (1.0 - kb) / kg / chroma_range * unit);
+    k.g_cr = round_weight(-2.0 * kr * (1.0 - kr) / kg / chroma_range * unit);
+    k.r_cr = round_weight(2.0 * (1.0 - kr) / chroma_range * unit);
+    return k;
+}
+
+// Clamps the value to a byte
+
+static inline uint8_t clamp_byte(int32_t value)
+{
+    return (uint8_t)(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Export kernels
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Computes the luma of every color
+
+static void encode_luma(const Color* src, uint8_t* dst, unsigned count, const YUVCoefficients& k)
+{
+    const int32_t round = (k.luma_offset << YUV_ENCODE_BITS_) + (1 << (YUV_ENCODE_BITS_ - 1));
+
+    unsigned i = 0u;
+#ifdef IMAGE_SSE2_
+    const __m128i weights = _mm_setr_epi16(k.luma[0], k.luma[1], k.luma[2], 0, k.luma[0], k.luma[1], k.luma[2], 0);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rounding = _mm_set1_epi32(round);
+    for (; i + 8u <= count; i += 8u)
+    {
+        const __m128i v0 = _mm_loadu_si128((const __m128i*)(src + i));
+        const __m128i v1 = _mm_loadu_si128((const __m128i*)(src + i + 4u));
+
+        // Partial sums B+G and R+A for every pixel
+        const __m128i s0 = _mm_madd_epi16(_mm_unpacklo_epi8(v0, zero), weights);
+        const __m128i s1 = _mm_madd_epi16(_mm_unpackhi_epi8(v0, zero), weights);
+        const __m128i s2 = _mm_madd_epi16(_mm_unpacklo_epi8(v1, zero), weights);
+        const __m128i s3 = _mm_madd_epi16(_mm_unpackhi_epi8(v1, zero), weights);
+
+        __m128i y0 = _mm_add_epi32(_mm_unpacklo_epi64(_mm_shuffle_epi32(s0, 0x88), _mm_shuffle_epi32(s1, 0x88)),
+                                   _mm_unpacklo_epi64(_mm_shuffle_epi32(s0, 0xDD), _mm_shuffle_epi32(s1, 0xDD)));
+        __m128i y1 = _mm_add_epi32(_mm_unpacklo_epi64(_mm_shuffle_epi32(s2, 0x88), _mm_shuffle_epi32(s3, 0x88)),
+                                   _mm_unpacklo_epi64(_mm_shuffle_epi32(s2, 0xDD), _mm_shuffle_epi32(s3, 0xDD)));
+
+        y0 = _mm_srai_epi32(_mm_add_epi32(y0, rounding), YUV_ENCODE_BITS_);
+        y1 = _mm_srai_epi32(_mm_add_epi32(y1, rounding), YUV_ENCODE_BITS_);
+
+        _mm_storel_epi64((__m128i*)(dst + i), _mm_packus_epi16(_mm_packs_epi32(y0, y1), zero));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = clamp_byte((k.luma[0] * src[i].B + k.luma[1] * src[i].G + k.luma[2] * src[i].R + round) >> YUV_ENCODE_BITS_);
+}
+
+// Computes the chroma of every pair of columns of both rows, averaging their
+// four colors. An odd last column is paired with itself, and so are the rows.
+
+static void encode_chroma(const Color* row0, const Color* row1, uint8_t* u, uint8_t* v, unsigned width, const YUVCoefficients& k)
+{
+    const int32_t round = (128 << (YUV_ENCODE_BITS_ + 2)) + (1 << (YUV_ENCODE_BITS_ + 1));
+
+    unsigned j = 0u;
+#ifdef IMAGE_SSE2_
+    const __m128i weights_u = _mm_setr_epi16(k.cb[0], k.cb[1], k.cb[2], 0, k.cb[0], k.cb[1], k.cb[2], 0);
+    const __m128i weights_v = _mm_setr_epi16(k.cr[0], k.cr[1], k.cr[2], 0, k.cr[0], k.cr[1], k.cr[2], 0);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rounding = _mm_set1_epi32(round);
+    for (; j + 8u <= width / 2u; j += 8u)
+    {
+        // Channel sums of two blocks per vector
+        __m128i sums[4];
+        for (unsigned q = 0u; q < 4u; q++)
+        {
+            const __m128i a = _mm_loadu_si128((const __m128i*)(row0 + 2u * j + 4u * q));
+            const __m128i b = _mm_loadu_si128((const __m128i*)(row1 + 2u * j + 4u * q));
+            const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+            const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+            sums[q] = _mm_unpacklo_epi64(_mm_add_epi16(lo, _mm_srli_si128(lo, 8)), _mm_add_epi16(hi, _mm_srli_si128(hi, 8)));
+        }
+
+        // Weighted like the luma, four blocks per vector
+        __m128i c[4];
+        for (unsigned h = 0u; h < 2u; h++)
+        {
+            const __m128i u0 = _mm_madd_epi16(sums[2u * h], weights_u);
+            const __m128i u1 = _mm_madd_epi16(sums[2u * h + 1u], weights_u);
+            const __m128i v0 = _mm_madd_epi16(sums[2u * h], weights_v);
+            const __m128i v1 = _mm_madd_epi16(sums[2u * h + 1u], weights_v);
+
+            c[h] = _mm_add_epi32(_mm_unpacklo_epi64(_mm_shuffle_epi32(u0, 0x88), _mm_shuffle_epi32(u1, 0x88)),
+                                 _mm_unpacklo_epi64(_mm_shuffle_epi32(u0, 0xDD), _mm_shuffle_epi32(u1, 0xDD)));
+            c[h + 2u] = _mm_add_epi32(_mm_unpacklo_epi64(_mm_shuffle_epi32(v0, 0x88), _mm_shuffle_epi32(v1, 0x88)),
+                                      _mm_unpacklo_epi64(_mm_shuffle_epi32(v0, 0xDD), _mm_shuffle_epi32(v1, 0xDD)));
+        }
+        for (unsigned q = 0u; q < 4u; q++)
+            c[q] = _mm_srai_epi32(_mm_add_epi32(c[q], rounding), YUV_ENCODE_BITS_ + 2);
+
+        _mm_storel_epi64((__m128i*)(u + j), _mm_packus_epi16(_mm_packs_epi32(c[0], c[1]), zero));
+        _mm_storel_epi64((__m128i*)(v + j), _mm_packus_epi16(_mm_packs_epi32(c[2], c[3]), zero));
+    }
+#endif
+    for (; j < (width + 1u) / 2u; j++)
+    {
+        const unsigned x0 = 2u * j;
+        const unsigned x1 = x0 + 1u < width ? x0 + 1u : x0;
+
+        const int32_t b = row0[x0].B + row0[x1].B + row1[x0].B + row1[x1].B;
+        const int32_t g = row0[x0].G + row0[x1].G + row1[x0].G + row1[x1].G;
+        const int32_t r = row0[x0].R + row0[x1].R + row1[x0].R + row1[x1].R;
+
+        u[j] = clamp_byte((k.cb[0] * b + k.cb[1] * g + k.cb[2] * r + round) >> (YUV_ENCODE_BITS_ + 2));
+        v[j] = clamp_byte((k.cr[0] * b + k.cr[1] * g + k.cr[2] * r + round) >> (YUV_ENCODE_BITS_ + 2));
+    }
+}
+
+// Interleaves the U and V samples into pairs, for NV12
+
+static void interleave_chroma(const uint8_t* u, const uint8_t* v, uint8_t* dst, unsigned count)
+{
+    unsigned j = 0u;
+#ifdef IMAGE_SSE2_
+    for (; j + 16u <= count; j += 16u)
+    {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(u + j));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(v + j));
+        _mm_storeu_si128((__m128i*)(dst + 2u * j), _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128((__m128i*)(dst + 2u * j + 16u), _mm_unpackhi_epi8(a, b));
+    }
+#endif
+    for (; j < count; j++)
+    {
+        dst[2u * j] = u[j];
+        dst[2u * j + 1u] = v[j];
+    }
+}
+
+// Packs the luma and chroma into Y0 U Y1 V quads, for YUY2. The luma has
+// an even count, an odd last column is duplicated by the caller.
+
+static void pack_quads(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, unsigned count)
+{
+    unsigned j = 0u;
+#ifdef IMAGE_SSE2_
+    for (; j + 8u <= count; j += 8u)
+    {
+        const __m128i l = _mm_loadu_si128((const __m128i*)(y + 2u * j));
+        const __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(u + j)), _mm_loadl_epi64((const __m128i*)(v + j)));
+        _mm_storeu_si128((__m128i*)(dst + 4u * j), _mm_unpacklo_epi8(l, c));
+        _mm_storeu_si128((__m128i*)(dst + 4u * j + 16u), _mm_unpackhi_epi8(l, c));
+    }
+#endif
+    for (; j < count; j++)
+    {
+        dst[4u * j + 0u] = y[2u * j];
+        dst[4u * j + 1u] = u[j];
+        dst[4u * j + 2u] = y[2u * j + 1u];
+        dst[4u * j + 3u] = v[j];
+    }
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Import kernels
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Weights a chroma row with its vertical neighbor 3:1, or takes it four times, for I420
+
+static void vertical_planar(const uint8_t* a, const uint8_t* b, uint16_t* dst, unsigned count, bool blend)
+{
+    unsigned j = 0u;
+#ifdef IMAGE_SSE2_
+    const __m128i zero = _mm_setzero_si128();
+    for (; j + 8u <= count; j += 8u)
+    {
+        const __m128i va = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(a + j)), zero);
+        const __m128i vb = blend ? _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(b + j)), zero) : va;
+        _mm_storeu_si128((__m128i*)(dst + j), _mm_add_epi16(_mm_add_epi16(va, _mm_add_epi16(va, va)), vb));
+    }
+#endif
+    for (; j < count; j++)
+        dst[j] = (uint16_t)(3u * a[j] + (blend ? b[j] : a[j]));
+}
+
+// Same as vertical_planar() for rows of U V pairs, for NV12
+
+static void vertical_pairs(const uint8_t* a, const uint8_t* b, uint16_t* u, uint16_t* v, unsigned count, bool blend)
+{
+    unsigned j = 0u;
+#ifdef IMAGE_SSE2_
+    const __m128i mask = _mm_set1_epi16(0xFF);
+    for (; j + 8u <= count; j += 8u)
+    {
+        const __m128i va = _mm_loadu_si128((const __m128i*)(a + 2u * j));
+        const __m128i vb = blend ? _mm_loadu_si128((const __m128i*)(b + 2u * j)) : va;
+
+        const __m128i ua = _mm_and_si128(va, mask), ub = _mm_and_si128(vb, mask);
+        const __m128i wa = _mm_srli_epi16(va, 8), wb = _mm_srli_epi16(vb, 8);
+        _mm_storeu_si128((__m128i*)(u + j), _mm_add_epi16(_mm_add_epi16(ua, _mm_add_epi16(ua, ua)), ub));
+        _mm_storeu_si128((__m128i*)(v + j), _mm_add_epi16(_mm_add_epi16(wa, _mm_add_epi16(wa, wa)), wb));
+    }
+#endif
+    for (; j < count; j++)
+    {
+        u[j] = (uint16_t)(3u * a[2u * j] + (blend ? b[2u * j] : a[2u * j]));
+        v[j] = (uint16_t)(3u * a[2u * j + 1u] + (blend ? b[2u * j + 1u] : a[2u * j + 1u]));
+    }
+}
+
+// Takes the chroma of the Y0 U Y1 V quads four times, for YUY2
+
+static void chroma_quads(const uint8_t* src, uint16_t* u, uint16_t* v, unsigned count)
+{
+    unsigned j = 0u;
+#ifdef IMAGE_SSE2_
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    for (; j + 8u <= count; j += 8u)
+    {
+        const __m128i q0 = _mm_loadu_si128((const __m128i*)(src + 4u * j));
+        const __m128i q1 = _mm_loadu_si128((const __m128i*)(src + 4u * j + 16u));
+
+        const __m128i cu = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(q0, 8), mask), _mm_and_si128(_mm_srli_epi32(q1, 8), mask));
+        const __m128i cv = _mm_packs_epi32(_mm_srli_epi32(q0, 24), _mm_srli_epi32(q1, 24));
+        _mm_storeu_si128((__m128i*)(u + j), _mm_slli_epi16(cu, 2));
+        _mm_storeu_si128((__m128i*)(v + j), _mm_slli_epi16(cv, 2));
+    }
+#endif
+    for (; j < count; j++)
+    {
+        u[j] = (uint16_t)(4u * src[4u * j + 1u]);
+        v[j] = (uint16_t)(4u * src[4u * j + 3u]);
+    }
+}
+
+// Extracts the luma of the Y0 U Y1 V quads, for YUY2
+
+static void luma_quads(const uint8_t* src, uint8_t* dst, unsigned count)
+{
+    unsigned i = 0u;
+#ifdef IMAGE_SSE2_
+    const __m128i mask = _mm_set1_epi16(0xFF);
+    for (; i + 16u <= count; i += 16u)
+    {
+        const __m128i l0 = _mm_and_si128(_mm_loadu_si128((const __m128i*)(src + 2u * i)), mask);
+        const __m128i l1 = _mm_and_si128(_mm_loadu_si128((const __m128i*)(src + 2u * i + 16u)), mask);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(l0, l1));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = src[2u * i];
+}
+
+// Upsamples the vertically weighted chroma to every pixel, weighting every sample
+// 3:1 with its horizontal neighbor on that side, or taking it four times. The
+// samples from src[-1] to src[(count + 1) / 2] must be valid. The results are
+// sixteen times the chroma, centered at zero.
+
+static void horizontal_chroma(const uint16_t* src, int16_t* dst, unsigned count, bool blend)
+{
+    unsigned j = 0u;
+#ifdef IMAGE_SSE2_
+    const __m128i center = _mm_set1_epi16(16 * 128);
+    for (; j + 8u <= count / 2u; j += 8u)
+    {
+        const __m128i c = _mm_loadu_si128((const __m128i*)(src + j));
+        const __m128i l = blend ? _mm_loadu_si128((const __m128i*)(src + j - 1u)) : c;
+        const __m128i r = blend ? _mm_loadu_si128((const __m128i*)(src + j + 1u)) : c;
+
+        const __m128i c3 = _mm_sub_epi16(_mm_add_epi16(c, _mm_add_epi16(c, c)), center);
+        const __m128i even = _mm_add_epi16(c3, l);
+        const __m128i odd = _mm_add_epi16(c3, r);
+        _mm_storeu_si128((__m128i*)(dst + 2u * j), _mm_unpacklo_epi16(even, odd));
+        _mm_storeu_si128((__m128i*)(dst + 2u * j + 8u), _mm_unpackhi_epi16(even, odd));
+    }
+#endif
+    for (; 2u * j < count; j++)
+    {
+        const uint16_t* s = src + j;
+        const int32_t c3 = 3 * s[0] - 16 * 128;
+        dst[2u * j] = (int16_t)(c3 + (blend ? s[-1] : s[0]));
+        if (2u * j + 1u < count)
+            dst[2u * j + 1u] = (int16_t)(c3 + (blend ? s[1] : s[0]));
+    }
+}
+
+// Converts the luma and upsampled chroma of every pixel into an opaque color
+
+static void decode_pixels(const uint8_t* y, const int16_t* u, const int16_t* v, Color* dst, unsigned count, const YUVCoefficients& k)
+{
+    const int32_t round = 1 << (YUV_DECODE_BITS_ - 1);
+    const int32_t offset = k.luma_offset;
+
+    unsigned i = 0u;
+#ifdef IMAGE_SSE2_
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi8((char)0xFF);
+    const __m128i rounding = _mm_set1_epi32(round);
+    const __m128i luma_offset = _mm_set1_epi16((short)(16 * offset));
+    const __m128i weights_b = _mm_setr_epi16(k.scale, k.b_cb, k.scale, k.b_cb, k.scale, k.b_cb, k.scale, k.b_cb);
+    const __m128i weights_g = _mm_setr_epi16(k.scale, k.g_cb, k.scale, k.g_cb, k.scale, k.g_cb, k.scale, k.g_cb);
+    const __m128i weights_gv = _mm_setr_epi16(0, k.g_cr, 0, k.g_cr, 0, k.g_cr, 0, k.g_cr);
+    const __m128i weights_r = _mm_setr_epi16(k.scale, k.r_cr, k.scale, k.r_cr, k.scale, k.r_cr, k.scale, k.r_cr);
+    for (; i + 8u <= count; i += 8u)
+    {
+        const __m128i l = _mm_sub_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(y + i)), zero), 4), luma_offset);
+        const __m128i cu = _mm_loadu_si128((const __m128i*)(u + i));
+        const __m128i cv = _mm_loadu_si128((const __m128i*)(v + i));
+
+        // Luma paired with each chroma, every madd gives a full product sum
+        const __m128i lu[2] = { _mm_unpacklo_epi16(l, cu), _mm_unpackhi_epi16(l, cu) };
+        const __m128i lv[2] = { _mm_unpacklo_epi16(l, cv), _mm_unpackhi_epi16(l, cv) };
+
+        __m128i b[2], g[2], r[2];
+        for (unsigned h = 0u; h < 2u; h++)
+        {
+            b[h] = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lu[h], weights_b), rounding), YUV_DECODE_BITS_);
+            r[h] = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lv[h], weights_r), rounding), YUV_DECODE_BITS_);
+            g[h] = _mm_add_epi32(_mm_madd_epi16(lu[h], weights_g), _mm_madd_epi16(lv[h], weights_gv));
+            g[h] = _mm_srai_epi32(_mm_add_epi32(g[h], rounding), YUV_DECODE_BITS_);
+        }
+
+        const __m128i bb = _mm_packus_epi16(_mm_packs_epi32(b[0], b[1]), zero);
+        const __m128i gg = _mm_packus_epi16(_mm_packs_epi32(g[0], g[1]), zero);
+        const __m128i rr = _mm_packus_epi16(_mm_packs_epi32(r[0], r[1]), zero);
+
+        const __m128i bg = _mm_unpacklo_epi8(bb, gg);
+        const __m128i ra = _mm_unpacklo_epi8(rr, alpha);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128((__m128i*)(dst + i + 4u), _mm_unpackhi_epi16(bg, ra));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        const int32_t l = 16 * ((int32_t)y[i] - offset);
+        dst[i].B = clamp_byte((k.scale * l + k.b_cb * u[i] + round) >> YUV_DECODE_BITS_);
+        dst[i].G = clamp_byte((k.scale * l + k.g_cb * u[i] + k.g_cr * v[i] + round) >> YUV_DECODE_BITS_);
+        dst[i].R = clamp_byte((k.scale * l + k.r_cr * v[i] + round) >> YUV_DECODE_BITS_);
+        dst[i].A = 255u;
+    }
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Frame functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Stores the size of the rows of every plane used by the layout, zero for the
+// unused ones, and returns the number of rows of the chroma planes.
+
+static unsigned plane_rows(YUVLayout layout, unsigned width, unsigned height, unsigned long long* row_bytes)
+{
+    const unsigned long long chroma_width = ((unsigned long long)width + 1ull) / 2ull;
+
+    switch (layout)
+    {
+    case YUV_LAYOUT_I420:
+        row_bytes[0] = width;
+        row_bytes[1] = row_bytes[2] = chroma_width;
+        return (height + 1u) / 2u;
+    case YUV_LAYOUT_NV12:
+        row_bytes[0] = width;
+        row_bytes[1] = 2ull * chroma_width;
+        row_bytes[2] = 0ull;
+        return (height + 1u) / 2u;
+    case YUV_LAYOUT_YUY2:
+        row_bytes[0] = 4ull * chroma_width;
+        row_bytes[1] = row_bytes[2] = 0ull;
+        return 0u;
+    }
+    row_bytes[0] = row_bytes[1] = row_bytes[2] = 0ull;
+    return 0u;
+}
+
+// Returns the number of bytes of a tightly packed frame of the specified layout and size
+
+unsigned long long yuv_frame_size(YUVLayout layout, unsigned int width, unsigned int height)
+{
+    unsigned long long row_bytes[3];
+    const unsigned chroma_rows = plane_rows(layout, width, height, row_bytes);
+    return row_bytes[0] * height + (row_bytes[1] + row_bytes[2]) * chroma_rows;
+}
+
+// Sets the frame up over a tightly packed buffer of yuv_frame_size() bytes,
+// with the planes one after the other, as most encoders expect them.
+
+void yuv_frame_wrap(YUVFrame* frame, void* buffer, YUVLayout layout, unsigned int width, unsigned int height, YUVMatrix matrix, YUVRange range)
+{
+    unsigned long long row_bytes[3];
+    const unsigned chroma_rows = plane_rows(layout, width, height, row_bytes);
+
+    *frame = YUVFrame();
+    frame->width = width;
+    frame->height = height;
+    frame->layout = layout;
+    frame->matrix = matrix;
+    frame->range = range;
+
+    unsigned char* plane = (unsigned char*)buffer;
+    for (unsigned p = 0u; p < 3u && row_bytes[p]; p++)
+    {
+        frame->planes[p] = plane;
+        frame->strides[p] = row_bytes[p];
+        plane += row_bytes[p] * (p ? chroma_rows : height);
+    }
+}
+
+// Stores the strides of the planes used by the frame, the row size if zero.
+// Returns false if a plane is missing or a stride is too small.
+
+static bool frame_strides(const YUVFrame& frame, unsigned long long* strides)
+{
+    if (frame.layout > YUV_LAYOUT_YUY2)
+        return false;
+
+    unsigned long long row_bytes[3];
+    plane_rows(frame.layout, frame.width, frame.height, row_bytes);
+
+    for (unsigned p = 0u; p < 3u; p++)
+    {
+        strides[p] = frame.strides[p] ? frame.strides[p] : row_bytes[p];
+        if (row_bytes[p] && frame.width && frame.height && (!frame.planes[p] || strides[p] < row_bytes[p]))
+            return false;
+    }
+    return true;
+}
+
+/*
+-------------------------------------------------------------------------------------------------------
+Image conversion functions
+-------------------------------------------------------------------------------------------------------
+*/
+
+// Converts the pixels into the YUV frame, which must have the same size, averaging
+// the chroma of the pixels every sample covers. Returns false if the size differs,
+// a plane is missing or a stride is too small.
+
+bool Image::export_yuv(const YUVFrame& frame) const
+{
+    unsigned long long strides[3];
+    if (frame.width != width_ || frame.height != height_ || !frame_strides(frame, strides))
+        return false;
+
+    const unsigned width = width_;
+    const Color* pixels = pixels_;
+    const YUVCoefficients k = yuv_coefficients(frame.matrix, frame.range);
+
+    // Every band row is a chroma row, two image rows for the subsampled layouts
+    const bool packed = frame.layout == YUV_LAYOUT_YUY2;
+    const unsigned rows = packed ? height_ : (height_ + 1u) / 2u;
+    const unsigned min_rows = YUV_BAND_PIXELS_ / (packed ? width + 1u : 2u * width + 1u) + 1u;
+
+    parallel_for(rows, min_rows, [&](unsigned begin, unsigned end)
+        {
+            uint8_t luma[YUV_CHUNK_ + 1u], u[YUV_CHUNK_ / 2u], v[YUV_CHUNK_ / 2u];
+
+            for (unsigned c = begin; c < end; c++)
+            {
+                const unsigned y0 = packed ? c : 2u * c;
+                const unsigned y1 = !packed && y0 + 1u < height_ ? y0 + 1u : y0;
+                const Color* row0 = pixels + (unsigned long long)y0 * width;
+                const Color* row1 = pixels + (unsigned long long)y1 * width;
+
+                if (frame.layout == YUV_LAYOUT_I420)
+                {
+                    encode_luma(row0, frame.planes[0] + y0 * strides[0], width, k);
+                    if (y1 != y0)
+                        encode_luma(row1, frame.planes[0] + y1 * strides[0], width, k);
+                    encode_chroma(row0, row1, frame.planes[1] + c * strides[1], frame.planes[2] + c * strides[2], width, k);
+                    continue;
+                }
+
+                if (frame.layout == YUV_LAYOUT_NV12)
+                {
+                    encode_luma(row0, frame.planes[0] + y0 * strides[0], width, k);
+                    if (y1 != y0)
+                        encode_luma(row1, frame.planes[0] + y1 * strides[0], width, k);
+                }
+
+                // Chroma through the stack buffers, in chunks of an even number of columns
+                for (unsigned x = 0u; x < width; x += YUV_CHUNK_)
+                {
+                    const unsigned count = width - x < YUV_CHUNK_ ? width - x : YUV_CHUNK_;
+                    const unsigned samples = (count + 1u) / 2u;
+                    encode_chroma(row0 + x, row1 + x, u, v, count, k);
+
+                    if (!packed)
+                        interleave_chroma(u, v, frame.planes[1] + c * strides[1] + x, samples);
+                    else
+                    {
+                        encode_luma(row0 + x, luma, count, k);
+                        luma[count] = luma[count - 1u];
+                        pack_quads(luma, u, v, frame.planes[0] + c * strides[0] + 2ull * x, samples);
+                    }
+                }
+            }
+        });
+
+    return true;
+}
+
+// Resizes the image to the size of the YUV frame and converts it into the pixels,
+// with full alpha. Returns false if a plane is missing, a stride is too small or
+// the pixels could not be allocated.
+
+bool Image::import_yuv(const YUVFrame& frame, YUVUpsampling upsampling)
+{
+    unsigned long long strides[3];
+    if (!frame_strides(frame, strides) || !allocate_pixels(frame.width, frame.height, false))
+        return false;
+
+    const unsigned width = frame.width;
+    const unsigned height = frame.height;
+    const unsigned chroma_width = (width + 1u) / 2u;
+    const unsigned chroma_height = (height + 1u) / 2u;
+    Color* pixels = pixels_;
+    const YUVCoefficients k = yuv_coefficients(frame.matrix, frame.range);
+
+    const bool packed = frame.layout == YUV_LAYOUT_YUY2;
+    const bool blend = upsampling == YUV_UPSAMPLING_BILINEAR;
+    const unsigned min_rows = YUV_BAND_PIXELS_ / (width + 1u) + 1u;
+
+    parallel_for(height, min_rows, [&](unsigned begin, unsigned end)
+        {
+            // Vertically weighted chroma with one sample of margin on each side
+            uint16_t vu[YUV_CHUNK_ / 2u + 2u], vv[YUV_CHUNK_ / 2u + 2u];
+            int16_t hu[YUV_CHUNK_], hv[YUV_CHUNK_];
+            uint8_t luma[YUV_CHUNK_];
+
+            for (unsigned y = begin; y < end; y++)
+            {
+                // Every image row sits between its chroma row and the nearest other one
+                const unsigned c = packed ? y : y / 2u;
+                const unsigned n = packed || !blend ? c : y % 2u ? (c + 1u < chroma_height ? c + 1u : c) : (c ? c - 1u : c);
+                const bool mix = blend && !packed;
+
+                for (unsigned x = 0u; x < width; x += YUV_CHUNK_)
+                {
+                    const unsigned count = width - x < YUV_CHUNK_ ? width - x : YUV_CHUNK_;
+                    const unsigned first = x / 2u;
+                    const unsigned last = (x + count - 1u) / 2u;
+
+                    // Samples from first - 1 to last + 1, clamped to the row
+                    const unsigned from = first ? first - 1u : 0u;
+                    const unsigned to = last + 1u < chroma_width ? last + 1u : last;
+                    uint16_t* pu = vu + (first ? 0u : 1u);
+                    uint16_t* pv = vv + (first ? 0u : 1u);
+
+                    switch (frame.layout)
+                    {
+                    case YUV_LAYOUT_I420:
+                        vertical_planar(frame.planes[1] + c * strides[1] + from, frame.planes[1] + n * strides[1] + from, pu, to - from + 1u, mix);
+                        vertical_planar(frame.planes[2] + c * strides[2] + from, frame.planes[2] + n * strides[2] + from, pv, to - from + 1u, mix);
+                        break;
+                    case YUV_LAYOUT_NV12:
+                        vertical_pairs(frame.planes[1] + c * strides[1] + 2ull * from, frame.planes[1] + n * strides[1] + 2ull * from, pu, pv, to - from + 1u, mix);
+                        break;
+                    case YUV_LAYOUT_YUY2:
+                        chroma_quads(frame.planes[0] + c * strides[0] + 4ull * from, pu, pv, to - from + 1u);
+                        break;
+                    }
+
+                    const unsigned samples = last - first + 1u;
+                    if (!first)
+                    {
+                        vu[0] = vu[1];
+                        vv[0] = vv[1];
+                    }
+                    if (to == last)
+                    {
+                        vu[samples + 1u] = vu[samples];
+                        vv[samples + 1u] = vv[samples];
+                    }
+
+                    horizontal_chroma(vu + 1u, hu, count, blend);
+                    horizontal_chroma(vv + 1u, hv, count, blend);
+
+                    const uint8_t* row = frame.planes[0] + y * strides[0] + x;
+                    if (packed)
+                    {
+                        luma_quads(frame.planes[0] + y * strides[0] + 2ull * x, luma, count);
+                        row = luma;
+                    }
+                    decode_pixels(row, hu, hv, pixels + (unsigned long long)y * width + x, count, k);
+                }
+            }
+        });
+
+    return true;
+}